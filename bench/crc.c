@@ -1,6 +1,7 @@
 #include "siphon/siphon.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
@@ -62,6 +63,76 @@ bench (int iter_count, int silent)
 	return crc == 4053652342 ? 0 : 1;
 }
 
+static void
+bench_size (const char *name, uint32_t (*fn) (uint32_t, const void *, size_t),
+		const uint8_t *buf, size_t size)
+{
+	struct timeval start;
+	struct timeval end;
+	size_t total = 0;
+	uint32_t crc = 0;
+	int err;
+
+	err = gettimeofday (&start, NULL);
+	assert (err == 0);
+
+	// run each size class over roughly 1GiB of input
+	while (total < (1UL << 30)) {
+		crc = fn (crc, buf, size);
+		total += size;
+	}
+
+	err = gettimeofday (&end, NULL);
+	assert (err == 0);
+
+	double sec = (double) (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) * 1e-6;
+	fprintf (stdout, "%-8s %8zu bytes %8.2f GB/s (%08x)\n",
+			name, size, (double)total / sec / 1e9, crc);
+}
+
+static int
+bench_throughput (void)
+{
+	static const size_t sizes[] = { 64, 256, 1024, 4096, 65536, 1048576 };
+	static const struct {
+		const char *name;
+		unsigned features;
+	} tiers[] = {
+		{ "portable", 0 },
+		{ "sse4.2", SP_CPU_SSE42 },
+		{ "pclmul", SP_CPU_SSE42|SP_CPU_PCLMUL },
+		{ "avx512", ~0U },
+	};
+
+	uint8_t *buf = malloc (sizes[sp_len (sizes) - 1]);
+	assert (buf != NULL);
+	for (size_t i = 0; i < sizes[sp_len (sizes) - 1]; i++) {
+		buf[i] = (uint8_t)data[i % (sizeof data - 1)];
+	}
+
+	unsigned active = sp_cpu_active (), last = ~0U;
+	for (size_t t = 0; t < sp_len (tiers); t++) {
+		// skip tiers the host cannot run
+		unsigned f = sp_cpu_restrict (tiers[t].features);
+		if (f == last) {
+			continue;
+		}
+		last = f;
+		fprintf (stdout, "%s:\n", tiers[t].name);
+		for (size_t i = 0; i < sp_len (sizes); i++) {
+			bench_size ("crc32", sp_crc32, buf, sizes[i]);
+		}
+		for (size_t i = 0; i < sp_len (sizes); i++) {
+			bench_size ("crc32c", sp_crc32c, buf, sizes[i]);
+		}
+	}
+	sp_cpu_restrict (active);
+
+	free (buf);
+	return 0;
+}
+
 int
 main (int argc, char** argv)
 {
@@ -69,8 +140,9 @@ main (int argc, char** argv)
 		for (;;)
 			bench(5000000, 1);
 		return 0;
+	} else if (argc == 2 && strcmp(argv[1], "sizes") == 0) {
+		return bench_throughput ();
 	} else {
 		return bench(5000000, 0);
 	}
 }
-
@@ -0,0 +1,43 @@
+#ifndef SIPHON_ARENA_H
+#define SIPHON_ARENA_H
+
+#include "common.h"
+#include "type.h"
+
+#define SP_ARENA_BLOCK 16384
+#define SP_ARENA_ALIGN 16
+
+typedef struct SpArenaBlock SpArenaBlock;
+
+typedef struct {
+	SpArenaBlock *head;    // current bump block
+	SpArenaBlock *large;   // dedicated blocks for oversized allocations
+	uint8_t *last;         // most recent allocation in the bump block
+	size_t block_size;     // size of each bump block
+	size_t used;           // bytes handed out since the last reset
+	SpAllocator allocator; // container hooks backed by this arena
+} SpArena;
+
+SP_EXPORT void
+sp_arena_init (SpArena *a, size_t block_size);
+
+SP_EXPORT void
+sp_arena_final (SpArena *a);
+
+SP_EXPORT void
+sp_arena_reset (SpArena *a);
+
+SP_EXPORT void *
+sp_arena_alloc (SpArena *a, size_t size);
+
+SP_EXPORT void *
+sp_arena_realloc (SpArena *a, void *ptr, size_t oldsz, size_t newsz);
+
+SP_EXPORT void
+sp_arena_free (SpArena *a, void *ptr, size_t size);
+
+SP_EXPORT const SpAllocator *
+sp_arena_allocator (SpArena *a);
+
+#endif
+
@@ -0,0 +1,24 @@
+#ifndef SIPHON_CPU_H
+#define SIPHON_CPU_H
+
+#include "common.h"
+
+typedef enum {
+	SP_CPU_SSE42    = 1 << 0, // crc32 and string compare instructions
+	SP_CPU_AVX2     = 1 << 1, // 256-bit integer vectors
+	SP_CPU_AVX512BW = 1 << 2, // 512-bit byte and word vectors
+	SP_CPU_PCLMUL   = 1 << 3, // 128-bit carry-less multiply
+	SP_CPU_VPCLMUL  = 1 << 4  // 512-bit carry-less multiply
+} SpCpuFeature;
+
+SP_EXPORT unsigned
+sp_cpu_features (void);
+
+SP_EXPORT unsigned
+sp_cpu_active (void);
+
+SP_EXPORT unsigned
+sp_cpu_restrict (unsigned mask);
+
+#endif
+
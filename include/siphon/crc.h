@@ -9,5 +9,23 @@ sp_crc32 (uint32_t crc, const void *bytes, size_t len);
 SP_EXPORT uint32_t
 sp_crc32c (uint32_t crc, const void *bytes, size_t len);
 
+SP_EXPORT uint32_t
+sp_crc32_combine (uint32_t crc1, uint32_t crc2, size_t len2);
+
+SP_EXPORT uint32_t
+sp_crc32c_combine (uint32_t crc1, uint32_t crc2, size_t len2);
+
+/**
+ * Splits the buffer across up to `nthreads` threads created for the call.
+ * At most 16 threads are used, each part is at least 1 MiB, and smaller
+ * buffers are computed on the calling thread. Static consumers must also
+ * link the platform thread library.
+ */
+SP_EXPORT uint32_t
+sp_crc32_parallel (uint32_t crc, const void *bytes, size_t len, unsigned nthreads);
+
+SP_EXPORT uint32_t
+sp_crc32c_parallel (uint32_t crc, const void *bytes, size_t len, unsigned nthreads);
+
 #endif
 
@@ -38,9 +38,13 @@
 #define SP_JSON_ESTATE      (-1023)
 #define SP_JSON_EESCAPE     (-1024)
 #define SP_JSON_EBYTE       (-1025)
+#define SP_JSON_EPATH       (-1026)
 
 #define SP_MSGPACK_ESYNTAX  (-1030)
+#define SP_MSGPACK_ESTATE   (-1031)
 #define SP_MSGPACK_ESTACK   (-1032)
+#define SP_MSGPACK_EKEY     (-1033)
+#define SP_MSGPACK_ESIZE    (-1034)
 
 #define SP_LINE_ESYNTAX     (-1040)
 #define SP_LINE_ESIZE       (-1041)
@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include "range.h"
+#include "type.h"
+#include "utf8.h"
 
 #include <sys/socket.h>
 
@@ -11,6 +13,89 @@
 #define SP_HTTP_MAX_REASON 256
 #define SP_HTTP_MAX_FIELD 256
 #define SP_HTTP_MAX_VALUE 1024
+#define SP_HTTP_INDEX_MAX 128
+
+#define SP_HTTP_HEADERS(XX) \
+	XX(ACCEPT,                           "accept") \
+	XX(ACCEPT_CHARSET,                   "accept-charset") \
+	XX(ACCEPT_ENCODING,                  "accept-encoding") \
+	XX(ACCEPT_LANGUAGE,                  "accept-language") \
+	XX(ACCEPT_RANGES,                    "accept-ranges") \
+	XX(ACCESS_CONTROL_ALLOW_CREDENTIALS, "access-control-allow-credentials") \
+	XX(ACCESS_CONTROL_ALLOW_HEADERS,     "access-control-allow-headers") \
+	XX(ACCESS_CONTROL_ALLOW_METHODS,     "access-control-allow-methods") \
+	XX(ACCESS_CONTROL_ALLOW_ORIGIN,      "access-control-allow-origin") \
+	XX(ACCESS_CONTROL_EXPOSE_HEADERS,    "access-control-expose-headers") \
+	XX(ACCESS_CONTROL_MAX_AGE,           "access-control-max-age") \
+	XX(ACCESS_CONTROL_REQUEST_HEADERS,   "access-control-request-headers") \
+	XX(ACCESS_CONTROL_REQUEST_METHOD,    "access-control-request-method") \
+	XX(AGE,                              "age") \
+	XX(ALLOW,                            "allow") \
+	XX(AUTHORIZATION,                    "authorization") \
+	XX(CACHE_CONTROL,                    "cache-control") \
+	XX(CONNECTION,                       "connection") \
+	XX(CONTENT_DISPOSITION,              "content-disposition") \
+	XX(CONTENT_ENCODING,                 "content-encoding") \
+	XX(CONTENT_LANGUAGE,                 "content-language") \
+	XX(CONTENT_LENGTH,                   "content-length") \
+	XX(CONTENT_LOCATION,                 "content-location") \
+	XX(CONTENT_RANGE,                    "content-range") \
+	XX(CONTENT_SECURITY_POLICY,          "content-security-policy") \
+	XX(CONTENT_TYPE,                     "content-type") \
+	XX(COOKIE,                           "cookie") \
+	XX(DATE,                             "date") \
+	XX(DNT,                              "dnt") \
+	XX(ETAG,                             "etag") \
+	XX(EXPECT,                           "expect") \
+	XX(EXPIRES,                          "expires") \
+	XX(FORWARDED,                        "forwarded") \
+	XX(FROM,                             "from") \
+	XX(HOST,                             "host") \
+	XX(IF_MATCH,                         "if-match") \
+	XX(IF_MODIFIED_SINCE,                "if-modified-since") \
+	XX(IF_NONE_MATCH,                    "if-none-match") \
+	XX(IF_RANGE,                         "if-range") \
+	XX(IF_UNMODIFIED_SINCE,              "if-unmodified-since") \
+	XX(KEEP_ALIVE,                       "keep-alive") \
+	XX(LAST_MODIFIED,                    "last-modified") \
+	XX(LINK,                             "link") \
+	XX(LOCATION,                         "location") \
+	XX(MAX_FORWARDS,                     "max-forwards") \
+	XX(ORIGIN,                           "origin") \
+	XX(PRAGMA,                           "pragma") \
+	XX(PROXY_AUTHENTICATE,               "proxy-authenticate") \
+	XX(PROXY_AUTHORIZATION,              "proxy-authorization") \
+	XX(RANGE,                            "range") \
+	XX(REFERER,                          "referer") \
+	XX(REFRESH,                          "refresh") \
+	XX(RETRY_AFTER,                      "retry-after") \
+	XX(SERVER,                           "server") \
+	XX(SET_COOKIE,                       "set-cookie") \
+	XX(STRICT_TRANSPORT_SECURITY,        "strict-transport-security") \
+	XX(TE,                               "te") \
+	XX(TRAILER,                          "trailer") \
+	XX(TRANSFER_ENCODING,                "transfer-encoding") \
+	XX(UPGRADE,                          "upgrade") \
+	XX(UPGRADE_INSECURE_REQUESTS,        "upgrade-insecure-requests") \
+	XX(USER_AGENT,                       "user-agent") \
+	XX(VARY,                             "vary") \
+	XX(VIA,                              "via") \
+	XX(WARNING,                          "warning") \
+	XX(WWW_AUTHENTICATE,                 "www-authenticate") \
+	XX(X_FORWARDED_FOR,                  "x-forwarded-for") \
+	XX(X_FORWARDED_HOST,                 "x-forwarded-host") \
+	XX(X_FORWARDED_PROTO,                "x-forwarded-proto") \
+	XX(X_REAL_IP,                        "x-real-ip") \
+	XX(X_REQUEST_ID,                     "x-request-id") \
+	XX(X_REQUESTED_WITH,                 "x-requested-with")
+
+typedef enum {
+	SP_HTTP_HEADER_NONE = 0,
+#define XX(id, name) SP_HTTP_HEADER_##id,
+	SP_HTTP_HEADERS(XX)
+#undef XX
+	SP_HTTP_HEADER_COUNT
+} SpHttpHeader;
 
 typedef union {
 	// request line values
@@ -31,6 +116,7 @@ typedef union {
 	struct {
 		SpRange16 name;
 		SpRange16 value;
+		SpHttpHeader id;  // well-known name or SP_HTTP_HEADER_NONE
 	} field;
 
 	// beginning of body
@@ -43,6 +129,16 @@ typedef union {
 	struct {
 		size_t length;
 	} body_chunk;
+
+	// body bytes consumed by a pipelined parser
+	struct {
+		size_t length;
+	} body;
+
+	// complete request or response in a pipelined parser
+	struct {
+		size_t length;
+	} message;
 } SpHttpValue;
 
 typedef enum {
@@ -53,12 +149,105 @@ typedef enum {
 	SP_HTTP_BODY_START,  // start of the body
 	SP_HTTP_BODY_CHUNK,  // size for chunked body
 	SP_HTTP_BODY_END,    // end of the body chunks
-	SP_HTTP_TRAILER_END  // complete request or response
+	SP_HTTP_TRAILER_END, // complete request or response
+	SP_HTTP_BODY,        // body bytes when pipelining
+	SP_HTTP_MESSAGE_END  // end of a pipelined request or response
 } SpHttpType;
 
+typedef struct {
+	SpHttpType type;     // type of the captured value
+	SpHttpValue as;      // captured value relative to `off`
+	size_t off;          // offset of the token within the batch buffer
+	size_t len;          // number of bytes consumed by the token
+} SpHttpToken;
+
 typedef struct SpHttpMap SpHttpMap;
 typedef struct SpHttpEntry SpHttpEntry;
 
+typedef struct {
+	SpRange16 name;      // field name relative to the index base
+	SpRange16 value;     // field value relative to the index base
+	uint32_t hash;       // case-insensitive hash of the name
+	uint8_t next;        // position + 1 of the next field with the same name
+} SpHttpIndexField;
+
+typedef struct {
+	const uint8_t *base; // buffer the field ranges are relative to
+	uint8_t *owned;      // copy of the field bytes once owned
+	uint16_t owned_len;  // size of the owned copy
+	uint16_t count;      // number of indexed fields
+	uint8_t slots[SP_HTTP_INDEX_MAX*2];
+	SpHttpIndexField fields[SP_HTTP_INDEX_MAX];
+} SpHttpIndex;
+
+typedef struct {
+	size_t remain;       // payload bytes left in the current chunk
+	size_t total;        // payload bytes decoded so far
+	SpHttpMap *trailers; // map reference to capture trailers
+	unsigned cs;         // current decoder state
+} SpHttpChunked;
+
+#define SP_HTTP_WRITER_SCRATCH 256
+
+typedef struct {
+	struct iovec *iov;   // caller supplied output entries
+	size_t max;          // number of entries available
+	size_t count;        // number of entries used
+	size_t len;          // total bytes referenced by the entries
+	size_t used;         // scratch bytes used
+	uint8_t scratch[SP_HTTP_WRITER_SCRATCH]; // formatted lines and numbers
+} SpHttpWriter;
+
+#define SP_HPACK_TABLE_SIZE 4096
+#define SP_HPACK_MAX_VALUE 65536
+
+typedef enum {
+	SP_HPACK_INDEXED,         // field taken from the static or dynamic table
+	SP_HPACK_LITERAL_INDEXED, // literal field added to the dynamic table
+	SP_HPACK_LITERAL,         // literal field without indexing
+	SP_HPACK_LITERAL_NEVER,   // literal field that must never be indexed
+	SP_HPACK_SIZE_UPDATE      // dynamic table size update
+} SpHpackType;
+
+typedef struct {
+	SpHpackType type;     // representation of the field
+	const uint8_t *name;  // field name, NULL for a size update
+	const uint8_t *value; // field value
+	size_t nlen, vlen;    // name and value lengths
+	size_t size;          // new table size for a size update
+} SpHpackField;
+
+typedef struct {
+	uint32_t off;         // offset of the name in the table bytes
+	uint32_t nlen;        // name length
+	uint32_t vlen;        // value length, stored after the name
+} SpHpackEntry;
+
+typedef struct {
+	uint8_t *bytes;        // name and value storage, twice the limit
+	SpHpackEntry *entries; // ring of entries, newest before head
+	size_t limit;          // largest size allowed by the settings
+	size_t max;            // current size limit
+	size_t size;           // current size including entry overhead
+	size_t pos;            // offset for the next entry bytes
+	uint32_t head;         // ring position for the next entry
+	uint32_t count;        // number of entries
+	uint32_t mask;         // ring size minus one
+} SpHpackTable;
+
+typedef struct {
+	SpHpackTable table;    // dynamic table
+	SpUtf8 name;           // huffman decoded name
+	SpUtf8 value;          // huffman decoded value
+} SpHpackDecoder;
+
+typedef struct {
+	SpHpackTable table;    // dynamic table
+	size_t update_min;     // smallest size set since the last field
+	size_t update;         // size update owed to the decoder, or SIZE_MAX
+	bool huffman;          // huffman encode strings unless longer
+} SpHpackEncoder;
+
 typedef struct {
 	// public
 	uint16_t max_method; // max size for a request method
@@ -73,12 +262,16 @@ typedef struct {
 	bool response;       // true if response, false if request
 	bool chunked;        // set by field scanner
 	bool trailers;       // parsing trailers
+	bool pipeline;       // continue with the next message when complete
 	SpHttpValue as;      // captured value
 	SpHttpType type;     // type of the captured value
 	unsigned cs;         // current scanner state
+	int err;             // error held back by a batch with tokens
 	size_t off;          // internal offset mark
 	size_t body_len;     // content length or current chunk size
+	size_t pos;          // bytes consumed since the start of the message
 	SpHttpMap *headers;  // map reference to capture headers
+	SpHttpIndex *index;  // zero-copy index to capture headers
 } SpHttp;
 
 typedef enum {
@@ -122,15 +315,134 @@ sp_http_reset (SpHttp *p);
 SP_EXPORT ssize_t
 sp_http_next (SpHttp *p, const void *restrict buf, size_t len);
 
+SP_EXPORT ssize_t
+sp_http_next_batch (SpHttp *p, const void *restrict buf, size_t len,
+		SpHttpToken *out, size_t max);
+
 SP_EXPORT bool
 sp_http_is_done (const SpHttp *p);
 
 SP_EXPORT SpHttpMap *
 sp_http_steal_headers (SpHttp *p);
 
+SP_EXPORT void
+sp_http_use_index (SpHttp *p, SpHttpIndex *idx);
+
+SP_EXPORT void
+sp_http_use_pipeline (SpHttp *p, bool pipeline);
+
 SP_EXPORT void
 sp_http_print (const SpHttp *p, const void *restrict buf, FILE *out);
 
+SP_EXPORT void
+sp_http_chunked_init (SpHttpChunked *c);
+
+SP_EXPORT void
+sp_http_chunked_use_trailers (SpHttpChunked *c, SpHttpMap *trailers);
+
+SP_EXPORT ssize_t
+sp_http_chunked_decode (SpHttpChunked *c, void *buf, size_t len, size_t *out);
+
+SP_EXPORT ssize_t
+sp_http_chunked_scatter (SpHttpChunked *c, const void *buf, size_t len,
+		struct iovec *iov, size_t *iovcnt);
+
+SP_EXPORT bool
+sp_http_chunked_is_done (const SpHttpChunked *c);
+
+SP_EXPORT void
+sp_http_writer_init (SpHttpWriter *w, struct iovec *iov, size_t max);
+
+SP_EXPORT void
+sp_http_writer_reset (SpHttpWriter *w);
+
+SP_EXPORT int
+sp_http_writer_request (SpHttpWriter *w,
+		const void *method, size_t mlen,
+		const void *uri, size_t ulen,
+		uint8_t version);
+
+SP_EXPORT int
+sp_http_writer_response (SpHttpWriter *w, uint8_t version, uint16_t status,
+		const void *reason, size_t len);
+
+SP_EXPORT int
+sp_http_writer_field (SpHttpWriter *w,
+		const void *name, size_t nlen,
+		const void *value, size_t vlen);
+
+SP_EXPORT int
+sp_http_writer_header (SpHttpWriter *w, SpHttpHeader id,
+		const void *value, size_t vlen);
+
+SP_EXPORT int
+sp_http_writer_map (SpHttpWriter *w, const SpHttpMap *m);
+
+SP_EXPORT int
+sp_http_writer_content_length (SpHttpWriter *w, uint64_t len);
+
+SP_EXPORT int
+sp_http_writer_chunked (SpHttpWriter *w);
+
+SP_EXPORT int
+sp_http_writer_end_headers (SpHttpWriter *w);
+
+SP_EXPORT int
+sp_http_writer_body (SpHttpWriter *w, const void *body, size_t len);
+
+SP_EXPORT int
+sp_http_writer_chunk (SpHttpWriter *w, const void *data, size_t len);
+
+SP_EXPORT int
+sp_http_writer_chunk_end (SpHttpWriter *w, const SpHttpMap *trailers);
+
+SP_EXPORT size_t
+sp_http_writer_count (const SpHttpWriter *w);
+
+SP_EXPORT size_t
+sp_http_writer_length (const SpHttpWriter *w);
+
+SP_EXPORT int
+sp_hpack_decoder_init (SpHpackDecoder *d, size_t limit);
+
+SP_EXPORT void
+sp_hpack_decoder_final (SpHpackDecoder *d);
+
+SP_EXPORT ssize_t
+sp_hpack_decode_next (SpHpackDecoder *d, const void *restrict buf, size_t len,
+		SpHpackField *f);
+
+SP_EXPORT ssize_t
+sp_hpack_decode_map (SpHpackDecoder *d, const void *restrict buf, size_t len,
+		SpHttpMap *m);
+
+SP_EXPORT int
+sp_hpack_encoder_init (SpHpackEncoder *e, size_t limit);
+
+SP_EXPORT void
+sp_hpack_encoder_final (SpHpackEncoder *e);
+
+SP_EXPORT void
+sp_hpack_encoder_use_huffman (SpHpackEncoder *e, bool huffman);
+
+SP_EXPORT int
+sp_hpack_encoder_set_size (SpHpackEncoder *e, size_t size);
+
+SP_EXPORT int
+sp_hpack_encode_field (SpHpackEncoder *e, SpUtf8 *out,
+		const void *name, size_t nlen,
+		const void *value, size_t vlen,
+		SpHpackType type);
+
+SP_EXPORT int
+sp_hpack_encode_map (SpHpackEncoder *e, SpUtf8 *out, const SpHttpMap *m);
+
+SP_EXPORT SpHttpHeader
+sp_http_header_id (const void *name, size_t len);
+
+SP_EXPORT const char *
+sp_http_header_name (SpHttpHeader id);
+
 
 
 SP_EXPORT SpHttpMap *
@@ -139,6 +451,9 @@ sp_http_map_new (void);
 SP_EXPORT void
 sp_http_map_free (SpHttpMap *m);
 
+SP_EXPORT int
+sp_http_map_use_allocator (SpHttpMap *m, const SpAllocator *alloc);
+
 SP_EXPORT int
 sp_http_map_put (SpHttpMap *m,
 		const void *name, size_t nlen,
@@ -179,6 +494,36 @@ sp_http_map_print (const SpHttpMap *m, FILE *out);
 
 
 
+SP_EXPORT void
+sp_http_index_init (SpHttpIndex *idx);
+
+SP_EXPORT void
+sp_http_index_final (SpHttpIndex *idx);
+
+SP_EXPORT void
+sp_http_index_clear (SpHttpIndex *idx);
+
+SP_EXPORT int
+sp_http_index_add (SpHttpIndex *idx, const void *buf,
+		SpRange16 name, SpRange16 value);
+
+SP_EXPORT const SpHttpIndexField *
+sp_http_index_get (const SpHttpIndex *idx, const void *name, size_t nlen);
+
+SP_EXPORT const SpHttpIndexField *
+sp_http_index_next (const SpHttpIndex *idx, const SpHttpIndexField *f);
+
+SP_EXPORT void
+sp_http_index_rebase (SpHttpIndex *idx, const void *buf);
+
+SP_EXPORT int
+sp_http_index_own (SpHttpIndex *idx);
+
+SP_EXPORT void
+sp_http_index_print (const SpHttpIndex *idx, FILE *out);
+
+
+
 SP_EXPORT ssize_t
 sp_cache_control_parse (SpCacheControl *cc, const char *buf, size_t len);
 
@@ -2,9 +2,19 @@
 #define SIPHON_JSON_H
 
 #include "common.h"
+#include "range.h"
+#include "arena.h"
 #include "utf8.h"
 
 #define SP_JSON_MAX_STRING 262144
+#define SP_JSON_QUERY_MAX 64
+#define SP_JSON_QUERY_DEPTH 16
+#define SP_JSON_DOM_HASH_MIN 16
+#define SP_JSON_DOM_INDEX_MIN 8
+#define SP_JSON_DOUBLE_MAX 32
+#define SP_JSON_DEPTH_MAX UINT16_MAX
+
+#define SP_JSON_STACK_SIZE(depth) (((size_t)(depth) + 8) / 8)
 
 typedef enum {
 	SP_JSON_NONE       = -1,
@@ -22,14 +32,111 @@ typedef enum {
 typedef struct {
 	SpUtf8 utf8;        // stores the unescaped string
 	double number;      // parsed number value
+	union {
+		int64_t i64;    // exact value of negative or small integers
+		uint64_t u64;   // exact value of non-negative integers
+	} integer;          // exact integer value when `integral` is set
+	bool integral;      // number literal is an integer within 64 bits
 	SpJsonType type;    // type of the captured value
+	SpRange32 raw;      // undecoded string relative to the input buffer
+	bool escaped;       // undecoded string contains escape sequences
+	bool lazy;          // yield undecoded strings
 	unsigned cs;        // current scanner state
 	size_t off;         // internal offset mark
 	size_t mark;        // mark position for scanning doubles
+	uint32_t skip;      // brackets left open while skipping a value
 	uint16_t depth;     // stack entry size
+	uint16_t deep_max;  // depth limit of the external stack
 	uint8_t stack[64];  // object/array bit stack
+	uint8_t *deep;      // external bit stack used in place of `stack`
+	SpArena *deep_arena; // arena used to grow the external stack
+	struct {
+		const uint8_t *base; // document covered by the index
+		size_t len;          // length of the document
+		uint32_t *pos;       // offsets of structural characters
+		size_t count;        // number of structural offsets
+		size_t cur;          // next structural offset to visit
+		size_t cap;          // allocated offset capacity
+	} index;            // structural index for complete documents
 } SpJson;
 
+typedef struct {
+	uint8_t *key;       // owned member name for key steps
+	uint32_t keylen;    // length of the member name
+	uint32_t index;     // element position for index steps
+	uint64_t mask;      // paths that end at this step
+	uint16_t child;     // first child node or 0
+	uint16_t sibling;   // next node with the same parent or 0
+	uint8_t kind;       // step type
+} SpJsonQueryNode;
+
+typedef struct {
+	size_t first;       // first state of the container
+	uint32_t index;     // position of the next array element
+	uint16_t count;     // number of states
+	uint16_t depth;     // parser depth of the container
+	bool object;        // container is an object
+} SpJsonQueryFrame;
+
+typedef struct {
+	SpJsonQueryNode *nodes; // path trie where node 0 is the root
+	uint16_t nnodes;        // number of nodes in use
+	uint16_t ncap;          // allocated node capacity
+	uint16_t *states;       // active nodes for each tracked container
+	size_t nstates;         // number of states in use
+	size_t scap;            // allocated state capacity
+	SpJsonQueryFrame frames[SP_JSON_QUERY_DEPTH]; // tracked containers
+	uint16_t nframes;       // number of tracked containers
+	uint16_t pending;       // states matched by the last object key
+	uint16_t emit[SP_JSON_QUERY_DEPTH + 1];      // parser depth of each matched container
+	uint64_t emit_mask[SP_JSON_QUERY_DEPTH + 1]; // paths matched by it and its ancestors
+	uint16_t nemit;         // number of open matched containers
+	bool skipping;          // an unmatched value is being skipped
+	unsigned paths;         // number of compiled paths
+	uint64_t match;         // paths matched by the yielded token
+} SpJsonQuery;
+
+/**
+ * Documents are stored as a flat tape of nodes in document order. A container
+ * is followed directly by its children, and `next` holds the position after
+ * the container and everything within it, so siblings are reached without
+ * visiting descendants. Object members are stored as a key node followed by
+ * the value. Large objects get a hash table and large arrays a table of
+ * element positions, so members and elements are found in constant time.
+ */
+typedef struct {
+	uint32_t next;      // tape position following the value and its children
+	uint32_t len;       // string length or number of members or elements
+	uint8_t type;       // SpJsonType of the value
+	bool integral;      // number is stored as an exact integer
+	bool negative;      // exact integer is stored in `i64`
+	union {
+		const uint8_t *str;  // string bytes, not nul terminated
+		double number;       // value of non-integral numbers
+		int64_t i64;         // value of negative integers
+		uint64_t u64;        // value of non-negative integers
+		uint32_t *table;     // member hash table of large objects, element
+		                     // positions of large arrays, or NULL
+	} as;
+} SpJsonNode;
+
+typedef struct {
+	SpJsonNode *tape;   // nodes of the document, the root is at 0
+	size_t count;       // number of nodes in use
+	size_t cap;         // allocated node capacity
+	SpArena arena;      // decoded strings and object tables
+	SpJson parser;      // parser reused for each document
+} SpJsonDom;
+
+typedef struct {
+	SpUtf8 out;         // encoded output
+	uint16_t depth;     // number of open containers
+	uint8_t stack[64];  // object/array bit stack
+	bool comma;         // a separator precedes the next key or element
+	bool key;           // a key has been written without its value
+	bool done;          // the root value is complete
+} SpJsonWriter;
+
 SP_EXPORT void
 sp_json_init (SpJson *p);
 
@@ -39,9 +146,27 @@ sp_json_reset (SpJson *p);
 SP_EXPORT void
 sp_json_final (SpJson *p);
 
+SP_EXPORT void
+sp_json_use_lazy_strings (SpJson *p, bool lazy);
+
+SP_EXPORT void
+sp_json_use_stack (SpJson *p, void *buf, size_t len);
+
+SP_EXPORT void
+sp_json_use_stack_arena (SpJson *p, SpArena *arena);
+
+SP_EXPORT ssize_t
+sp_json_decode_string (SpJson *p, const void *buf);
+
+SP_EXPORT int
+sp_json_index (SpJson *p, const void *buf, size_t len);
+
 SP_EXPORT ssize_t
 sp_json_next (SpJson *p, const void *restrict buf, size_t len, bool eof);
 
+SP_EXPORT ssize_t
+sp_json_skip (SpJson *p, const void *restrict buf, size_t len, bool eof);
+
 SP_EXPORT bool
 sp_json_is_done (const SpJson *p);
 
@@ -57,5 +182,90 @@ sp_json_in_array (const SpJson *p);
 SP_EXPORT uint8_t *
 sp_json_steal_string (SpJson *p, size_t *len, size_t *cap);
 
+SP_EXPORT void
+sp_json_query_init (SpJsonQuery *q);
+
+SP_EXPORT void
+sp_json_query_reset (SpJsonQuery *q);
+
+SP_EXPORT void
+sp_json_query_final (SpJsonQuery *q);
+
+SP_EXPORT int
+sp_json_query_add (SpJsonQuery *q, const char *path, size_t len);
+
+SP_EXPORT ssize_t
+sp_json_query_next (SpJsonQuery *q, SpJson *p,
+		const void *restrict buf, size_t len, bool eof);
+
+SP_EXPORT void
+sp_json_dom_init (SpJsonDom *d);
+
+SP_EXPORT void
+sp_json_dom_final (SpJsonDom *d);
+
+SP_EXPORT int
+sp_json_dom_parse (SpJsonDom *d, const void *buf, size_t len);
+
+SP_EXPORT uint32_t
+sp_json_dom_get (const SpJsonDom *d, uint32_t obj, const void *key, size_t len);
+
+SP_EXPORT uint32_t
+sp_json_dom_at (const SpJsonDom *d, uint32_t arr, uint32_t idx);
+
+SP_EXPORT double
+sp_json_dom_number (const SpJsonDom *d, uint32_t pos);
+
+SP_EXPORT size_t
+sp_json_format_double (double val, char *buf);
+
+SP_EXPORT void
+sp_json_writer_init (SpJsonWriter *w);
+
+SP_EXPORT void
+sp_json_writer_init_fixed (SpJsonWriter *w, void *buf, size_t len);
+
+SP_EXPORT void
+sp_json_writer_reset (SpJsonWriter *w);
+
+SP_EXPORT void
+sp_json_writer_final (SpJsonWriter *w);
+
+SP_EXPORT bool
+sp_json_writer_is_done (const SpJsonWriter *w);
+
+SP_EXPORT ssize_t
+sp_json_write_object (SpJsonWriter *w);
+
+SP_EXPORT ssize_t
+sp_json_write_object_end (SpJsonWriter *w);
+
+SP_EXPORT ssize_t
+sp_json_write_array (SpJsonWriter *w);
+
+SP_EXPORT ssize_t
+sp_json_write_array_end (SpJsonWriter *w);
+
+SP_EXPORT ssize_t
+sp_json_write_key (SpJsonWriter *w, const void *key, size_t len);
+
+SP_EXPORT ssize_t
+sp_json_write_string (SpJsonWriter *w, const void *str, size_t len);
+
+SP_EXPORT ssize_t
+sp_json_write_int (SpJsonWriter *w, int64_t val);
+
+SP_EXPORT ssize_t
+sp_json_write_uint (SpJsonWriter *w, uint64_t val);
+
+SP_EXPORT ssize_t
+sp_json_write_double (SpJsonWriter *w, double val);
+
+SP_EXPORT ssize_t
+sp_json_write_bool (SpJsonWriter *w, bool val);
+
+SP_EXPORT ssize_t
+sp_json_write_null (SpJsonWriter *w);
+
 #endif
 
@@ -19,6 +19,7 @@ struct SpMap {
 	SpMapEntry *entries;
 	double loadf;
 	SpBloom *bloom;
+	const SpAllocator *alloc;
 	size_t size, max, count, mask, mod;
 };
 
@@ -27,6 +28,7 @@ struct SpMap {
 	.entries = NULL,               \
 	.loadf = 0.85,                 \
 	.bloom = NULL,                 \
+	.alloc = NULL,                 \
 	.size = 0,                     \
 	.max = 0,                      \
 	.count = 0,                    \
@@ -67,6 +69,9 @@ sp_map_resize (SpMap *self, size_t hint);
 SP_EXPORT int
 sp_map_use_bloom (SpMap *self, size_t hint, double fpp);
 
+SP_EXPORT int
+sp_map_use_allocator (SpMap *self, const SpAllocator *alloc);
+
 SP_EXPORT bool
 sp_map_has_key (const SpMap *self, const void *restrict key, size_t len);
 
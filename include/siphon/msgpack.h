@@ -2,8 +2,18 @@
 #define SIPHON_MSGPACK_H
 
 #include "common.h"
+#include "arena.h"
+#include "clock.h"
+#include "range.h"
+#include "utf8.h"
 
 #define SP_MSGPACK_TAG_MAX 9
+#define SP_MSGPACK_TIMESTAMP_MAX 15
+#define SP_MSGPACK_EXT_TIMESTAMP -1
+#define SP_MSGPACK_DEPTH_MAX UINT16_MAX
+
+#define SP_MSGPACK_STACK_SIZE(depth) \
+	((size_t)(depth) * sizeof (uint32_t) + ((size_t)(depth) + 8) / 8)
 
 typedef enum {
 	SP_MSGPACK_NONE = -1,
@@ -20,7 +30,9 @@ typedef enum {
 	SP_MSGPACK_DOUBLE,
 	SP_MSGPACK_STRING,
 	SP_MSGPACK_BINARY,
-	SP_MSGPACK_EXT
+	SP_MSGPACK_EXT,
+	SP_MSGPACK_TIMESTAMP,
+	SP_MSGPACK_EXT_VALUE
 } SpMsgpackType;
 
 typedef union {
@@ -33,17 +45,59 @@ typedef union {
 		uint32_t len;
 		int8_t type;
 	} ext;
+	SpClock ts;
 } SpMsgpackTag;
 
+/**
+ * Decodes a complete extension body into the tag. The return value is the
+ * type to yield: a scalar type or SP_MSGPACK_TIMESTAMP with the matching tag
+ * field set, or SP_MSGPACK_EXT_VALUE when the decoded value was stored
+ * through `data` and `tag.ext` is left as is. Errors are negative.
+ */
+typedef int (*SpMsgpackExtDecode) (SpMsgpackTag *tag,
+		const void *body, uint32_t len, void *data);
+
+typedef struct {
+	SpMsgpackExtDecode fn; // decoder, or NULL to yield the raw extension
+	void *data;            // user data passed to the decoder
+} SpMsgpackExtEntry;
+
+typedef struct {
+	SpMsgpackExtEntry entry[256]; // decoders indexed by the unsigned ext type
+} SpMsgpackExtRegistry;
+
 typedef struct {
 	SpMsgpackTag tag;    // value enum
 	SpMsgpackType type;  // type of the current parsed value
 	unsigned cs;         // current scanner state
 	uint32_t counts[24]; // map/array entry remaining counts
-	uint8_t depth;       // stack entry size
+	uint16_t depth;      // stack entry size
+	uint16_t deep_max;   // depth limit of the external stack
 	uint8_t stack[3];    // map/array bit stack
+	uint8_t *deep;       // external bit stack used in place of `stack`
+	uint32_t *deep_counts; // external counts used in place of `counts`
+	SpArena *deep_arena; // arena used to grow the external stack
+	uint64_t skip;       // values left to skip
+	uint32_t skip_bytes; // payload bytes left to skip
+	SpMsgpackType skip_type; // type of the value being skipped
+	const SpMsgpackExtRegistry *ext; // extension decoders
 } SpMsgpack;
 
+typedef struct {
+	const uint8_t *base; // indexed document
+	uint32_t len;        // length of the document
+	uint32_t count;      // number of root entries
+	SpMsgpackType type;  // type of the root value
+	uint32_t *pos;       // entry offsets, key and value pairs for maps
+	size_t npos;         // allocated offset capacity
+	uint32_t *table;     // string key hash table for maps
+	size_t ntable;       // allocated table slots
+} SpMsgpackIndex;
+
+typedef struct {
+	SpUtf8 out;          // encoded output
+} SpMsgpackWriter;
+
 SP_EXPORT void
 sp_msgpack_init (SpMsgpack *p);
 
@@ -53,9 +107,21 @@ sp_msgpack_reset (SpMsgpack *p);
 SP_EXPORT void
 sp_msgpack_final (SpMsgpack *p);
 
+SP_EXPORT void
+sp_msgpack_use_stack (SpMsgpack *p, void *buf, size_t len);
+
+SP_EXPORT void
+sp_msgpack_use_stack_arena (SpMsgpack *p, SpArena *arena);
+
+SP_EXPORT void
+sp_msgpack_use_ext (SpMsgpack *p, const SpMsgpackExtRegistry *ext);
+
 SP_EXPORT ssize_t
 sp_msgpack_next (SpMsgpack *p, const void *restrict buf, size_t len, bool eof);
 
+SP_EXPORT ssize_t
+sp_msgpack_skip (SpMsgpack *p, const void *restrict buf, size_t len, bool eof);
+
 SP_EXPORT bool
 sp_msgpack_in_map (const SpMsgpack *p);
 
@@ -68,6 +134,36 @@ sp_msgpack_in_array (const SpMsgpack *p);
 SP_EXPORT bool
 sp_msgpack_is_done (const SpMsgpack *p);
 
+SP_EXPORT void
+sp_msgpack_ext_init (SpMsgpackExtRegistry *ext);
+
+SP_EXPORT void
+sp_msgpack_ext_register (SpMsgpackExtRegistry *ext, int8_t type,
+		SpMsgpackExtDecode fn, void *data);
+
+SP_EXPORT int
+sp_msgpack_ext_timestamp (SpMsgpackTag *tag,
+		const void *body, uint32_t len, void *data);
+
+SP_EXPORT int
+sp_msgpack_dec_timestamp (const void *body, uint32_t len, SpClock *ts);
+
+SP_EXPORT void
+sp_msgpack_index_init (SpMsgpackIndex *idx);
+
+SP_EXPORT void
+sp_msgpack_index_final (SpMsgpackIndex *idx);
+
+SP_EXPORT int
+sp_msgpack_index_parse (SpMsgpackIndex *idx, const void *buf, size_t len);
+
+SP_EXPORT bool
+sp_msgpack_index_at (const SpMsgpackIndex *idx, uint32_t n, SpRange32 *val);
+
+SP_EXPORT bool
+sp_msgpack_index_get (const SpMsgpackIndex *idx,
+		const void *key, size_t len, SpRange32 *val);
+
 SP_EXPORT size_t
 sp_msgpack_enc (SpMsgpackType type, const SpMsgpackTag *tag, void *buf);
 
@@ -107,5 +203,66 @@ sp_msgpack_enc_map (void *buf, uint32_t count);
 SP_EXPORT size_t
 sp_msgpack_enc_ext (void *buf, int8_t type, uint32_t len);
 
+SP_EXPORT size_t
+sp_msgpack_enc_timestamp (void *buf, const SpClock *ts);
+
+SP_EXPORT void
+sp_msgpack_writer_init (SpMsgpackWriter *w);
+
+SP_EXPORT void
+sp_msgpack_writer_init_fixed (SpMsgpackWriter *w, void *buf, size_t len);
+
+SP_EXPORT void
+sp_msgpack_writer_reset (SpMsgpackWriter *w);
+
+SP_EXPORT void
+sp_msgpack_writer_final (SpMsgpackWriter *w);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_nil (SpMsgpackWriter *w);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_bool (SpMsgpackWriter *w, bool val);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_int (SpMsgpackWriter *w, int64_t val);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_uint (SpMsgpackWriter *w, uint64_t val);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_float (SpMsgpackWriter *w, float val);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_double (SpMsgpackWriter *w, double val);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_string (SpMsgpackWriter *w, const void *str, size_t len);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_binary (SpMsgpackWriter *w, const void *bin, size_t len);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_ext (SpMsgpackWriter *w, int8_t type,
+		const void *body, size_t len);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_timestamp (SpMsgpackWriter *w, const SpClock *ts);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_array (SpMsgpackWriter *w, uint32_t count);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_map (SpMsgpackWriter *w, uint32_t count);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_int_array (SpMsgpackWriter *w, const int64_t *vals, size_t n);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_uint32_array (SpMsgpackWriter *w, const uint32_t *vals, size_t n);
+
+SP_EXPORT ssize_t
+sp_msgpack_write_double_array (SpMsgpackWriter *w, const double *vals, size_t n);
+
 #endif
 
@@ -9,6 +9,10 @@ typedef struct {
 	uint16_t off, len;
 } SpRange16;
 
+typedef struct {
+	uint32_t off, len;
+} SpRange32;
+
 #define SP_RANGE_EQ_MEM(r, rbuf, buf, blen) \
 	((r).len == (blen) && \
 	 memcmp ((rbuf)+(r).off, (buf), (blen)) == 0)
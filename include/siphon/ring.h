@@ -30,6 +30,9 @@ sp_ring_init (SpRing *self, SpHash fn);
 SP_EXPORT void
 sp_ring_final (SpRing *self);
 
+SP_EXPORT int
+sp_ring_use_allocator (SpRing *self, const SpAllocator *alloc);
+
 SP_EXPORT int
 sp_ring_put (SpRing *self,
 		const void *restrict key, size_t len,
@@ -8,9 +8,11 @@
 #include "path.h"
 #include "uri.h"
 #include "crc.h"
+#include "cpu.h"
 #include "hash.h"
 #include "line.h"
 #include "msgpack.h"
+#include "transcode.h"
 
 #endif
 
@@ -0,0 +1,74 @@
+#ifndef SIPHON_TRANSCODE_H
+#define SIPHON_TRANSCODE_H
+
+#include "common.h"
+#include "json.h"
+#include "msgpack.h"
+
+#define SP_TRANSCODE_PATCH_MAX 4096
+
+typedef struct {
+	size_t off;         // output offset of the reserved header
+	uint32_t count;     // entries written so far, pairs for maps
+	bool map;           // container is a map
+} SpTranscodeFrame;
+
+typedef struct {
+	SpJson json;             // json input parser
+	SpUtf8 out;              // msgpack output
+	SpTranscodeFrame *open;  // containers waiting for their counts
+	uint16_t nopen;          // number of open containers
+	uint16_t cap;            // allocated frame capacity
+} SpJsonToMsgpack;
+
+typedef struct {
+	SpMsgpack msgpack;       // msgpack input parser
+	SpJsonWriter writer;     // json output
+	SpUtf8 payload;          // payload split across inputs
+	uint32_t need;           // payload bytes still missing
+	bool key;                // current value is a map key
+} SpMsgpackToJson;
+
+SP_EXPORT void
+sp_json_to_msgpack_init (SpJsonToMsgpack *t);
+
+SP_EXPORT void
+sp_json_to_msgpack_reset (SpJsonToMsgpack *t);
+
+SP_EXPORT void
+sp_json_to_msgpack_final (SpJsonToMsgpack *t);
+
+SP_EXPORT ssize_t
+sp_json_to_msgpack (SpJsonToMsgpack *t,
+		const void *restrict buf, size_t len, bool eof);
+
+SP_EXPORT size_t
+sp_json_to_msgpack_ready (const SpJsonToMsgpack *t);
+
+SP_EXPORT void
+sp_json_to_msgpack_consume (SpJsonToMsgpack *t, size_t len);
+
+SP_EXPORT bool
+sp_json_to_msgpack_is_done (const SpJsonToMsgpack *t);
+
+SP_EXPORT void
+sp_msgpack_to_json_init (SpMsgpackToJson *t);
+
+SP_EXPORT void
+sp_msgpack_to_json_reset (SpMsgpackToJson *t);
+
+SP_EXPORT void
+sp_msgpack_to_json_final (SpMsgpackToJson *t);
+
+SP_EXPORT ssize_t
+sp_msgpack_to_json (SpMsgpackToJson *t,
+		const void *restrict buf, size_t len, bool eof);
+
+SP_EXPORT void
+sp_msgpack_to_json_consume (SpMsgpackToJson *t, size_t len);
+
+SP_EXPORT bool
+sp_msgpack_to_json_is_done (const SpMsgpackToJson *t);
+
+#endif
+
@@ -10,12 +10,14 @@ typedef struct SpTrieNode SpTrieNode;
 struct SpTrie {
 	const SpType *type;
 	SpTrieNode *root;
+	const SpAllocator *alloc;
 	size_t count, depth;
 };
 
 #define SP_TRIE_MAKE(typ) ((SpTrie){ \
 	.type = (typ),                   \
 	.root = NULL,                    \
+	.alloc = NULL,                   \
 	.count = 0,                      \
 	.depth = 0                       \
 })
@@ -42,6 +44,9 @@ sp_trie_final (SpTrie *self);
 SP_EXPORT void
 sp_trie_clear (SpTrie *self);
 
+SP_EXPORT int
+sp_trie_use_allocator (SpTrie *self, const SpAllocator *alloc);
+
 SP_EXPORT size_t
 sp_trie_count (const SpTrie *self);
 
@@ -18,5 +18,17 @@ typedef struct {
 	SpPrint print;
 } SpType;
 
+/**
+ * Allocation hooks for containers. A NULL allocator selects the default
+ * `sp_malloc` family of functions. The `size` passed when resizing or
+ * freeing is always the size originally requested.
+ */
+typedef struct {
+	void *(*alloc)(void *ctx, size_t size);
+	void *(*realloc)(void *ctx, void *ptr, size_t oldsz, size_t newsz);
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+} SpAllocator;
+
 #endif
 
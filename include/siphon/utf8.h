@@ -2,12 +2,14 @@
 #define SIPHON_UTF8_H
 
 #include "common.h"
+#include "type.h"
 
 typedef struct {
 	uint8_t *buf;
 	size_t len;
 	size_t cap;
 	bool fixed;
+	const SpAllocator *alloc;
 } SpUtf8;
 
 typedef enum {
@@ -18,9 +20,9 @@ typedef enum {
 	SP_UTF8_SPACE_PLUS    = 1 << 3, // treat plus as a space character
 } SpUtf8Flags;
 
-#define SP_UTF8_MAKE() ((SpUtf8){ NULL, 0, 0, false })
+#define SP_UTF8_MAKE() ((SpUtf8){ NULL, 0, 0, false, NULL })
 
-#define SP_UTF8_MAKE_FIXED(buf, len) ((SpUtf8){ buf, 0, len, true })
+#define SP_UTF8_MAKE_FIXED(buf, len) ((SpUtf8){ buf, 0, len, true, NULL })
 
 SP_EXPORT void
 sp_utf8_init (SpUtf8 *u);
@@ -28,6 +30,9 @@ sp_utf8_init (SpUtf8 *u);
 SP_EXPORT void
 sp_utf8_init_fixed (SpUtf8 *u, void *buf, size_t len);
 
+SP_EXPORT int
+sp_utf8_use_allocator (SpUtf8 *u, const SpAllocator *alloc);
+
 SP_EXPORT void
 sp_utf8_reset (SpUtf8 *u);
 
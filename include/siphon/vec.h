@@ -2,6 +2,7 @@
 #define SIPHON_VEC_H
 
 #include "common.h"
+#include "type.h"
 #include <stdlib.h>
 
 #define sp_vec_count(v) \
@@ -16,6 +17,9 @@
 #define sp_vec_free(v) \
 	sp_vecp_free ((void **)&(v), sizeof *(v))
 
+#define sp_vec_use_allocator(v, a) \
+	sp_vecp_use_allocator ((void **)&(v), sizeof *(v), a)
+
 #define sp_vec_ensure(v, n) \
 	sp_vecp_ensure ((void **)&(v), sizeof *(v), n)
 
@@ -124,6 +128,9 @@ sp_vecp_clear (void **vec);
 SP_EXPORT void
 sp_vecp_free (void **vec, size_t size);
 
+SP_EXPORT int
+sp_vecp_use_allocator (void **vec, size_t size, const SpAllocator *alloc);
+
 SP_EXPORT int
 sp_vecp_ensure (void **vec, size_t size, size_t nitems);
 
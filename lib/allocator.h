@@ -0,0 +1,51 @@
+#ifndef SIPHON_ALLOCATOR_H
+#define SIPHON_ALLOCATOR_H
+
+#include "../include/siphon/type.h"
+#include "../include/siphon/alloc.h"
+
+#include <string.h>
+
+/**
+ * Counterparts to the `sp_malloc` family that go through an optional
+ * container allocator.
+ */
+
+static inline void *
+sp_amalloc (const SpAllocator *a, size_t size)
+{
+	return a ? a->alloc (a->ctx, size) : sp_malloc (size);
+}
+
+static inline void *
+sp_acalloc (const SpAllocator *a, size_t count, size_t size)
+{
+	if (a == NULL) {
+		return sp_calloc (count, size);
+	}
+	void *ptr = a->alloc (a->ctx, count * size);
+	if (ptr != NULL) {
+		memset (ptr, 0, count * size);
+	}
+	return ptr;
+}
+
+static inline void *
+sp_arealloc (const SpAllocator *a, void *ptr, size_t oldsz, size_t newsz)
+{
+	return a ? a->realloc (a->ctx, ptr, oldsz, newsz) : sp_realloc (ptr, oldsz, newsz);
+}
+
+static inline void
+sp_afree (const SpAllocator *a, void *ptr, size_t size)
+{
+	if (a == NULL) {
+		sp_free (ptr, size);
+	}
+	else if (ptr != NULL) {
+		a->free (a->ctx, ptr, size);
+	}
+}
+
+#endif
+
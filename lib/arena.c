@@ -0,0 +1,189 @@
+#include "../include/siphon/arena.h"
+#include "../include/siphon/alloc.h"
+
+#include <assert.h>
+
+struct SpArenaBlock {
+	SpArenaBlock *next;
+	size_t size, used;
+	uint8_t data[] __attribute__((aligned (SP_ARENA_ALIGN)));
+};
+
+#define ALIGN(n) sp_next_quantum ((n), SP_ARENA_ALIGN)
+
+static SpArenaBlock *
+block_new (size_t size)
+{
+	SpArenaBlock *b = sp_malloc (sizeof *b + size);
+	if (b != NULL) {
+		b->next = NULL;
+		b->size = size;
+		b->used = 0;
+	}
+	return b;
+}
+
+static void
+block_free_all (SpArenaBlock *b)
+{
+	while (b != NULL) {
+		SpArenaBlock *next = b->next;
+		sp_free (b, sizeof *b + b->size);
+		b = next;
+	}
+}
+
+static void *
+hook_alloc (void *ctx, size_t size)
+{
+	return sp_arena_alloc (ctx, size);
+}
+
+static void *
+hook_realloc (void *ctx, void *ptr, size_t oldsz, size_t newsz)
+{
+	return sp_arena_realloc (ctx, ptr, oldsz, newsz);
+}
+
+static void
+hook_free (void *ctx, void *ptr, size_t size)
+{
+	sp_arena_free (ctx, ptr, size);
+}
+
+void
+sp_arena_init (SpArena *a, size_t block_size)
+{
+	assert (a != NULL);
+
+	a->head = NULL;
+	a->large = NULL;
+	a->last = NULL;
+	a->block_size = ALIGN (block_size ? block_size : SP_ARENA_BLOCK);
+	a->used = 0;
+	a->allocator = (SpAllocator){ hook_alloc, hook_realloc, hook_free, a };
+}
+
+void
+sp_arena_final (SpArena *a)
+{
+	assert (a != NULL);
+
+	block_free_all (a->head);
+	block_free_all (a->large);
+	a->head = NULL;
+	a->large = NULL;
+	a->last = NULL;
+	a->used = 0;
+}
+
+void
+sp_arena_reset (SpArena *a)
+{
+	assert (a != NULL);
+
+	// keep the current block so steady-state use never touches the heap
+	if (a->head != NULL) {
+		block_free_all (a->head->next);
+		a->head->next = NULL;
+		a->head->used = 0;
+	}
+	block_free_all (a->large);
+	a->large = NULL;
+	a->last = NULL;
+	a->used = 0;
+}
+
+void *
+sp_arena_alloc (SpArena *a, size_t size)
+{
+	assert (a != NULL);
+
+	size_t need = ALIGN (size ? size : 1);
+
+	// oversized requests get a dedicated block so the bump block is kept
+	if (need > a->block_size / 4) {
+		SpArenaBlock *b = block_new (need);
+		if (b == NULL) {
+			return NULL;
+		}
+		b->used = need;
+		b->next = a->large;
+		a->large = b;
+		a->used += need;
+		return b->data;
+	}
+
+	SpArenaBlock *b = a->head;
+	if (b == NULL || b->size - b->used < need) {
+		b = block_new (a->block_size);
+		if (b == NULL) {
+			return NULL;
+		}
+		b->next = a->head;
+		a->head = b;
+	}
+
+	uint8_t *ptr = b->data + b->used;
+	b->used += need;
+	a->used += need;
+	a->last = ptr;
+	return ptr;
+}
+
+void *
+sp_arena_realloc (SpArena *a, void *ptr, size_t oldsz, size_t newsz)
+{
+	assert (a != NULL);
+
+	if (ptr == NULL) {
+		return sp_arena_alloc (a, newsz);
+	}
+
+	// the most recent allocation can be resized in place
+	if (ptr == a->last) {
+		SpArenaBlock *b = a->head;
+		size_t off = (uint8_t *)ptr - b->data;
+		size_t need = ALIGN (newsz ? newsz : 1);
+		if (need <= a->block_size / 4 && off + need <= b->size) {
+			a->used = a->used - (b->used - off) + need;
+			b->used = off + need;
+			return ptr;
+		}
+	}
+	else if (newsz <= oldsz) {
+		return ptr;
+	}
+
+	void *copy = sp_arena_alloc (a, newsz);
+	if (copy != NULL) {
+		memcpy (copy, ptr, oldsz < newsz ? oldsz : newsz);
+	}
+	return copy;
+}
+
+void
+sp_arena_free (SpArena *a, void *ptr, size_t size)
+{
+	assert (a != NULL);
+
+	(void)size;
+
+	// only the most recent allocation is reclaimed, the rest is released on reset
+	if (ptr != NULL && ptr == a->last) {
+		SpArenaBlock *b = a->head;
+		size_t off = (uint8_t *)ptr - b->data;
+		a->used -= b->used - off;
+		b->used = off;
+		a->last = NULL;
+	}
+}
+
+const SpAllocator *
+sp_arena_allocator (SpArena *a)
+{
+	assert (a != NULL);
+
+	return &a->allocator;
+}
+
@@ -0,0 +1,128 @@
+#include "cpu.h"
+
+#if SP_CPU_X86
+# include <cpuid.h>
+#endif
+
+static unsigned detected = 0;
+static unsigned active = 0;
+
+// 0 before the probe, 1 while one caller probes, 2 when kernels are selected
+static int state = 0;
+
+#if SP_CPU_X86
+
+static uint64_t
+xgetbv (void)
+{
+	uint32_t eax, edx;
+	__asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return ((uint64_t)edx << 32) | eax;
+}
+
+static unsigned
+probe (void)
+{
+	unsigned eax, ebx, ecx, edx, max, f = 0;
+	uint64_t xcr0;
+
+	max = __get_cpuid_max (0, NULL);
+	if (max < 1) {
+		return 0;
+	}
+
+	__cpuid (1, eax, ebx, ecx, edx);
+	if (ecx & (1U << 20)) f |= SP_CPU_SSE42;
+	if (ecx & (1U << 1)) f |= SP_CPU_PCLMUL;
+
+	// the os must save the vector registers before any avx kernel is usable
+	if (!(ecx & (1U << 27)) || !(ecx & (1U << 28)) || max < 7) {
+		return f;
+	}
+	xcr0 = xgetbv ();
+	if ((xcr0 & 0x06) != 0x06) {
+		return f;
+	}
+
+	__cpuid_count (7, 0, eax, ebx, ecx, edx);
+	if (ebx & (1U << 5)) f |= SP_CPU_AVX2;
+	if ((xcr0 & 0xe0) == 0xe0 && (ebx & (1U << 16))) {
+		if (ebx & (1U << 30)) f |= SP_CPU_AVX512BW;
+		if (ecx & (1U << 10)) f |= SP_CPU_VPCLMUL;
+	}
+
+	return f;
+}
+
+#else
+
+static unsigned
+probe (void)
+{
+	return 0;
+}
+
+#endif
+
+static void
+select_all (unsigned features)
+{
+	active = features;
+	sp_scan_select (features);
+	sp_crc_select (features);
+	sp_json_select (features);
+	sp_msgpack_select (features);
+}
+
+void
+sp_cpu_init (void)
+{
+	if (__atomic_load_n (&state, __ATOMIC_ACQUIRE) == 2) {
+		return;
+	}
+
+	int expect = 0;
+	if (__atomic_compare_exchange_n (&state, &expect, 1, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		detected = probe ();
+		select_all (detected);
+		__atomic_store_n (&state, 2, __ATOMIC_RELEASE);
+		return;
+	}
+
+	// another thread is probing; its selection is only a few stores away
+	while (__atomic_load_n (&state, __ATOMIC_ACQUIRE) != 2) {
+#if SP_CPU_X86
+		_mm_pause ();
+#endif
+	}
+}
+
+static void __attribute__((constructor(101)))
+init (void)
+{
+	sp_cpu_init ();
+}
+
+unsigned
+sp_cpu_features (void)
+{
+	sp_cpu_init ();
+	return detected;
+}
+
+unsigned
+sp_cpu_active (void)
+{
+	sp_cpu_init ();
+	return active;
+}
+
+unsigned
+sp_cpu_restrict (unsigned mask)
+{
+	sp_cpu_init ();
+	select_all (detected & mask);
+	return active;
+}
+
@@ -0,0 +1,35 @@
+#ifndef SIPHON_LIB_CPU_H
+#define SIPHON_LIB_CPU_H
+
+#include "../include/siphon/cpu.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+# define SP_CPU_X86 1
+# include <immintrin.h>
+# define SP_TARGET_SSE42 __attribute__ ((target ("sse4.2")))
+# define SP_TARGET_AVX2 __attribute__ ((target ("avx2")))
+# define SP_TARGET_AVX512 __attribute__ ((target ("avx512f,avx512bw")))
+# define SP_TARGET_CLMUL __attribute__ ((target ("pclmul,sse4.1")))
+# define SP_TARGET_VPCLMUL __attribute__ ((target ("avx512f,vpclmulqdq,pclmul,sse4.1")))
+#endif
+
+// probes the cpu and selects every module's kernels, once
+SP_LOCAL void
+sp_cpu_init (void);
+
+// each module selects its kernels from the active feature set; the kernel
+// pointers start at stubs that call sp_cpu_init, so static links that never
+// reference the sp_cpu functions are still dispatched
+SP_LOCAL void
+sp_scan_select (unsigned features);
+
+SP_LOCAL void
+sp_crc_select (unsigned features);
+
+SP_LOCAL void
+sp_json_select (unsigned features);
+
+SP_LOCAL void
+sp_msgpack_select (unsigned features);
+
+#endif
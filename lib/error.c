@@ -126,10 +126,14 @@
 	XX(ESTATE,             "parser state is invalid") \
 	XX(EESCAPE,            "invalid escape sequence") \
 	XX(EBYTE,              "invalid byte value") \
+	XX(EPATH,              "invalid query path") \
 
 #define SP_MSGPACK_ERRORS(XX) \
 	XX(ESYNTAX,            "invalid syntax") \
+	XX(ESTATE,             "parser state is invalid") \
 	XX(ESTACK,             "stack size exceeded") \
+	XX(EKEY,               "map key cannot be converted") \
+	XX(ESIZE,              "size of value exceeded maximum allowed") \
 
 #define SP_LINE_ERRORS(XX) \
 	XX(ESYNTAX,            "invalid syntax") \
@@ -1,2 +1,7 @@
+#include "http/header.c"
+#include "http/index.c"
 #include "http/parser.c"
 #include "http/map.c"
+#include "http/chunked.c"
+#include "http/writer.c"
+#include "http/hpack.c"
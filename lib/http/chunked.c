@@ -0,0 +1,275 @@
+#include "../../include/siphon/http.h"
+#include "../../include/siphon/error.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+
+/**
+ * The chunked decoder removes the framing of a chunked body without going
+ * through the token parser for every chunk. Size and trailer lines are only
+ * handled once the whole line is available, while payload bytes are passed
+ * on as soon as they arrive. Each payload run is handed to an emit callback
+ * that either compacts it towards the front of the buffer or records it in
+ * an iovec, so both forms share the same framing rules.
+ */
+
+#define CHUNKED_SIZE     1
+#define CHUNKED_DATA     2
+#define CHUNKED_DATA_EOL 3
+#define CHUNKED_TRAILER  4
+#define CHUNKED_DONE     5
+#define CHUNKED_ERROR    6
+
+// longest chunk size line, including any extensions
+#define CHUNKED_MAX_LINE SP_HTTP_MAX_VALUE
+
+typedef bool (*ChunkedEmit) (void *ctx, const uint8_t *data, size_t len);
+
+static int
+chunked_size (SpHttpChunked *c, const uint8_t *line, size_t len)
+{
+	static const uint8_t hex[] = {
+		['0'] = 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+		['A'] = 10, 11, 12, 13, 14, 15,
+		['a'] = 10, 11, 12, 13, 14, 15
+	};
+
+	size_t i = 0, size = 0;
+	for (; i < len && isxdigit (line[i]); i++) {
+		if (size > (SIZE_MAX >> 4)) {
+			return SP_HTTP_ESIZE;
+		}
+		size = (size << 4) | hex[line[i]];
+	}
+	if (i == 0) {
+		return SP_HTTP_ESYNTAX;
+	}
+
+	// extensions follow optional whitespace and are ignored
+	while (i < len && (line[i] == ' ' || line[i] == '\t')) {
+		i++;
+	}
+	if (i < len && line[i] != ';') {
+		return SP_HTTP_ESYNTAX;
+	}
+
+	c->remain = size;
+	c->cs = size > 0 ? CHUNKED_DATA : CHUNKED_TRAILER;
+	return 0;
+}
+
+static int
+chunked_trailer (SpHttpChunked *c, const uint8_t *line, size_t len)
+{
+	const uint8_t *sep = memchr (line, ':', len);
+	if (sep == NULL || sep == line) {
+		return SP_HTTP_ESYNTAX;
+	}
+
+	size_t nlen = sep - line;
+	if (nlen > SP_HTTP_MAX_FIELD) {
+		return SP_HTTP_ESIZE;
+	}
+
+	const uint8_t *val = sep + 1, *end = line + len;
+	while (val < end && (*val == ' ' || *val == '\t')) {
+		val++;
+	}
+	while (end > val && (end[-1] == ' ' || end[-1] == '\t')) {
+		end--;
+	}
+	if ((size_t)(end - val) > SP_HTTP_MAX_VALUE) {
+		return SP_HTTP_ESIZE;
+	}
+
+	if (c->trailers == NULL) {
+		return 0;
+	}
+	return sp_http_map_put (c->trailers, line, nlen, val, end - val);
+}
+
+static ssize_t
+chunked_run (SpHttpChunked *c, const uint8_t *m, size_t len,
+		ChunkedEmit emit, void *ctx)
+{
+	size_t off = 0;
+
+	// a failed decoder stays failed, even for empty input
+	if (c->cs == CHUNKED_ERROR) {
+		return SP_HTTP_ESTATE;
+	}
+
+	while (off < len) {
+		switch (c->cs) {
+
+		case CHUNKED_DATA: {
+			size_t n = len - off;
+			if (n > c->remain) {
+				n = c->remain;
+			}
+			if (!emit (ctx, m + off, n)) {
+				return off;
+			}
+			c->remain -= n;
+			c->total += n;
+			off += n;
+			if (c->remain == 0) {
+				c->cs = CHUNKED_DATA_EOL;
+			}
+			break;
+		}
+
+		case CHUNKED_DATA_EOL:
+			if (len - off < 2) {
+				return off;
+			}
+			if (m[off] != '\r' || m[off+1] != '\n') {
+				return SP_HTTP_ESYNTAX;
+			}
+			off += 2;
+			c->cs = CHUNKED_SIZE;
+			break;
+
+		case CHUNKED_SIZE:
+		case CHUNKED_TRAILER: {
+			const uint8_t *line = m + off;
+			const uint8_t *lf = memchr (line, '\n', len - off);
+			size_t max = c->cs == CHUNKED_SIZE ?
+				CHUNKED_MAX_LINE : SP_HTTP_MAX_FIELD + SP_HTTP_MAX_VALUE + 1;
+			if (lf == NULL) {
+				if (len - off > max) {
+					return SP_HTTP_ESIZE;
+				}
+				return off;
+			}
+			size_t n = lf - line;
+			if (n == 0 || line[n-1] != '\r') {
+				return SP_HTTP_ESYNTAX;
+			}
+			if (n - 1 > max) {
+				return SP_HTTP_ESIZE;
+			}
+			int rc;
+			if (c->cs == CHUNKED_SIZE) {
+				rc = chunked_size (c, line, n - 1);
+			}
+			else if (n == 1) {
+				c->cs = CHUNKED_DONE;
+				rc = 0;
+			}
+			else {
+				rc = chunked_trailer (c, line, n - 1);
+			}
+			if (rc < 0) {
+				return rc;
+			}
+			off += n + 1;
+			break;
+		}
+
+		case CHUNKED_DONE:
+			return off;
+
+		default:
+			return SP_HTTP_ESTATE;
+		}
+	}
+
+	return off;
+}
+
+typedef struct {
+	uint8_t *out;
+} ChunkedCompact;
+
+static bool
+emit_compact (void *ctx, const uint8_t *data, size_t len)
+{
+	ChunkedCompact *cc = ctx;
+	if (cc->out != data) {
+		memmove (cc->out, data, len);
+	}
+	cc->out += len;
+	return true;
+}
+
+typedef struct {
+	struct iovec *iov;
+	size_t count, max;
+} ChunkedScatter;
+
+static bool
+emit_scatter (void *ctx, const uint8_t *data, size_t len)
+{
+	ChunkedScatter *cs = ctx;
+	if (cs->count == cs->max) {
+		return false;
+	}
+	cs->iov[cs->count].iov_base = (void *)data;
+	cs->iov[cs->count].iov_len = len;
+	cs->count++;
+	return true;
+}
+
+void
+sp_http_chunked_init (SpHttpChunked *c)
+{
+	assert (c != NULL);
+
+	memset (c, 0, sizeof *c);
+	c->cs = CHUNKED_SIZE;
+}
+
+void
+sp_http_chunked_use_trailers (SpHttpChunked *c, SpHttpMap *trailers)
+{
+	assert (c != NULL);
+
+	c->trailers = trailers;
+}
+
+ssize_t
+sp_http_chunked_decode (SpHttpChunked *c, void *buf, size_t len, size_t *out)
+{
+	assert (c != NULL);
+	assert (buf != NULL || len == 0);
+	assert (out != NULL);
+
+	ChunkedCompact cc = { buf };
+	ssize_t rc = chunked_run (c, buf, len, emit_compact, &cc);
+	if (rc < 0) {
+		c->cs = CHUNKED_ERROR;
+		return rc;
+	}
+	*out = cc.out - (uint8_t *)buf;
+	return rc;
+}
+
+ssize_t
+sp_http_chunked_scatter (SpHttpChunked *c, const void *buf, size_t len,
+		struct iovec *iov, size_t *iovcnt)
+{
+	assert (c != NULL);
+	assert (buf != NULL || len == 0);
+	assert (iovcnt != NULL);
+	assert (iov != NULL || *iovcnt == 0);
+
+	ChunkedScatter cs = { iov, 0, *iovcnt };
+	ssize_t rc = chunked_run (c, buf, len, emit_scatter, &cs);
+	if (rc < 0) {
+		c->cs = CHUNKED_ERROR;
+		return rc;
+	}
+	*iovcnt = cs.count;
+	return rc;
+}
+
+bool
+sp_http_chunked_is_done (const SpHttpChunked *c)
+{
+	assert (c != NULL);
+
+	return c->cs == CHUNKED_DONE;
+}
+
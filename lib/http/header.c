@@ -0,0 +1,190 @@
+#include "../../include/siphon/http.h"
+#include <assert.h>
+#include <string.h>
+
+/**
+ * Well-known field names are classified with a perfect hash. Four folded
+ * bytes of the name and its length are mixed into one word, the top bits
+ * pick a displacement and the displaced middle bits pick the slot, so each
+ * known name owns a distinct slot. A single compare against the name in
+ * that slot then tells a known field from any other name.
+ *
+ * The displacements were searched offline for the SP_HTTP_HEADERS list, and
+ * must be searched again when a name is added. The header tests check that
+ * every listed name resolves to its own identifier.
+ */
+
+#define HEADER_NAME_MIN 2
+#define HEADER_NAME_MAX 32
+
+static const uint8_t header_names[SP_HTTP_HEADER_COUNT][HEADER_NAME_MAX + 1] = {
+#define XX(id, name) [SP_HTTP_HEADER_##id] = name,
+	SP_HTTP_HEADERS(XX)
+#undef XX
+};
+
+static const uint8_t header_lens[SP_HTTP_HEADER_COUNT] = {
+#define XX(id, name) [SP_HTTP_HEADER_##id] = sizeof name - 1,
+	SP_HTTP_HEADERS(XX)
+#undef XX
+};
+
+static const uint8_t header_disp[32] = {
+	0, 2, 0, 0, 2, 0, 6, 0,
+	4, 3, 4, 4, 1, 0, 1, 0,
+	4, 2, 9, 0, 1, 1, 0, 4,
+	0, 0, 1, 1, 1, 4, 0, 0,
+};
+
+static const uint8_t header_slots[128] = {
+	[2] = SP_HTTP_HEADER_VARY,
+	[4] = SP_HTTP_HEADER_DNT,
+	[5] = SP_HTTP_HEADER_IF_UNMODIFIED_SINCE,
+	[6] = SP_HTTP_HEADER_UPGRADE,
+	[8] = SP_HTTP_HEADER_ACCESS_CONTROL_ALLOW_HEADERS,
+	[9] = SP_HTTP_HEADER_CONTENT_SECURITY_POLICY,
+	[10] = SP_HTTP_HEADER_ACCESS_CONTROL_ALLOW_METHODS,
+	[12] = SP_HTTP_HEADER_X_FORWARDED_PROTO,
+	[13] = SP_HTTP_HEADER_ACCESS_CONTROL_REQUEST_METHOD,
+	[14] = SP_HTTP_HEADER_ACCESS_CONTROL_EXPOSE_HEADERS,
+	[17] = SP_HTTP_HEADER_ACCESS_CONTROL_ALLOW_CREDENTIALS,
+	[18] = SP_HTTP_HEADER_X_FORWARDED_HOST,
+	[27] = SP_HTTP_HEADER_ACCEPT_ENCODING,
+	[30] = SP_HTTP_HEADER_TRANSFER_ENCODING,
+	[31] = SP_HTTP_HEADER_RANGE,
+	[32] = SP_HTTP_HEADER_ORIGIN,
+	[34] = SP_HTTP_HEADER_X_REQUESTED_WITH,
+	[35] = SP_HTTP_HEADER_IF_MODIFIED_SINCE,
+	[37] = SP_HTTP_HEADER_RETRY_AFTER,
+	[41] = SP_HTTP_HEADER_IF_MATCH,
+	[42] = SP_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN,
+	[44] = SP_HTTP_HEADER_KEEP_ALIVE,
+	[45] = SP_HTTP_HEADER_IF_RANGE,
+	[46] = SP_HTTP_HEADER_ETAG,
+	[47] = SP_HTTP_HEADER_EXPIRES,
+	[49] = SP_HTTP_HEADER_ACCESS_CONTROL_REQUEST_HEADERS,
+	[50] = SP_HTTP_HEADER_ACCEPT_CHARSET,
+	[51] = SP_HTTP_HEADER_SERVER,
+	[52] = SP_HTTP_HEADER_VIA,
+	[53] = SP_HTTP_HEADER_ALLOW,
+	[60] = SP_HTTP_HEADER_CACHE_CONTROL,
+	[61] = SP_HTTP_HEADER_LOCATION,
+	[66] = SP_HTTP_HEADER_TRAILER,
+	[72] = SP_HTTP_HEADER_UPGRADE_INSECURE_REQUESTS,
+	[73] = SP_HTTP_HEADER_WARNING,
+	[74] = SP_HTTP_HEADER_SET_COOKIE,
+	[75] = SP_HTTP_HEADER_ACCEPT,
+	[76] = SP_HTTP_HEADER_PRAGMA,
+	[77] = SP_HTTP_HEADER_AGE,
+	[78] = SP_HTTP_HEADER_X_REAL_IP,
+	[79] = SP_HTTP_HEADER_WWW_AUTHENTICATE,
+	[80] = SP_HTTP_HEADER_FROM,
+	[82] = SP_HTTP_HEADER_CONTENT_LANGUAGE,
+	[84] = SP_HTTP_HEADER_FORWARDED,
+	[85] = SP_HTTP_HEADER_CONTENT_LOCATION,
+	[86] = SP_HTTP_HEADER_CONTENT_DISPOSITION,
+	[87] = SP_HTTP_HEADER_DATE,
+	[89] = SP_HTTP_HEADER_LAST_MODIFIED,
+	[90] = SP_HTTP_HEADER_STRICT_TRANSPORT_SECURITY,
+	[91] = SP_HTTP_HEADER_HOST,
+	[92] = SP_HTTP_HEADER_CONNECTION,
+	[95] = SP_HTTP_HEADER_IF_NONE_MATCH,
+	[96] = SP_HTTP_HEADER_EXPECT,
+	[97] = SP_HTTP_HEADER_ACCESS_CONTROL_MAX_AGE,
+	[98] = SP_HTTP_HEADER_X_FORWARDED_FOR,
+	[102] = SP_HTTP_HEADER_REFRESH,
+	[107] = SP_HTTP_HEADER_AUTHORIZATION,
+	[108] = SP_HTTP_HEADER_TE,
+	[109] = SP_HTTP_HEADER_CONTENT_LENGTH,
+	[110] = SP_HTTP_HEADER_MAX_FORWARDS,
+	[111] = SP_HTTP_HEADER_USER_AGENT,
+	[114] = SP_HTTP_HEADER_REFERER,
+	[115] = SP_HTTP_HEADER_ACCEPT_RANGES,
+	[117] = SP_HTTP_HEADER_PROXY_AUTHORIZATION,
+	[118] = SP_HTTP_HEADER_ACCEPT_LANGUAGE,
+	[119] = SP_HTTP_HEADER_CONTENT_TYPE,
+	[120] = SP_HTTP_HEADER_X_REQUEST_ID,
+	[121] = SP_HTTP_HEADER_COOKIE,
+	[122] = SP_HTTP_HEADER_CONTENT_RANGE,
+	[124] = SP_HTTP_HEADER_LINK,
+	[125] = SP_HTTP_HEADER_PROXY_AUTHENTICATE,
+	[126] = SP_HTTP_HEADER_CONTENT_ENCODING,
+};
+
+/**
+ * Lowers the ascii upper case letters in each byte of a word. Bytes with the
+ * high bit set are left alone.
+ */
+static inline uint64_t
+fold8 (uint64_t v)
+{
+	uint64_t low = v & 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t ge_a = low + 0x3f3f3f3f3f3f3f3fULL;
+	uint64_t gt_z = low + 0x2525252525252525ULL;
+	uint64_t upper = ge_a & ~gt_z & ~v & 0x8080808080808080ULL;
+	return v | (upper >> 2);
+}
+
+/**
+ * Compares a mixed case name to a lower case name a word at a time. The
+ * final partial word is copied so neither string is read past `len`.
+ */
+static inline bool
+name_eq (const uint8_t *name, const uint8_t *lower, size_t len)
+{
+	uint64_t a, b;
+	for (; len >= 8; name += 8, lower += 8, len -= 8) {
+		memcpy (&a, name, 8);
+		memcpy (&b, lower, 8);
+		if (fold8 (a) != b) {
+			return false;
+		}
+	}
+	if (len > 0) {
+		a = b = 0;
+		memcpy (&a, name, len);
+		memcpy (&b, lower, len);
+		if (fold8 (a) != b) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline SpHttpHeader
+header_id (const uint8_t *name, size_t len)
+{
+	if (len < HEADER_NAME_MIN || len > HEADER_NAME_MAX) {
+		return SP_HTTP_HEADER_NONE;
+	}
+
+	uint32_t h = (uint32_t)(name[0] | 0x20)
+		| (uint32_t)(name[len/2] | 0x20) << 8
+		| (uint32_t)(name[len-2] | 0x20) << 16
+		| (uint32_t)(name[len-1] | 0x20) << 24;
+	h = (h ^ (uint32_t)len) * 0x9e3779b1;
+
+	SpHttpHeader id = header_slots[((h >> 8) ^ header_disp[h >> 27]) & 127];
+	if (header_lens[id] == len && name_eq (name, header_names[id], len)) {
+		return id;
+	}
+	return SP_HTTP_HEADER_NONE;
+}
+
+SpHttpHeader
+sp_http_header_id (const void *name, size_t len)
+{
+	assert (name != NULL || len == 0);
+
+	return header_id (name, len);
+}
+
+const char *
+sp_http_header_name (SpHttpHeader id)
+{
+	if (id <= SP_HTTP_HEADER_NONE || id >= SP_HTTP_HEADER_COUNT) {
+		return NULL;
+	}
+	return (const char *)header_names[id];
+}
+
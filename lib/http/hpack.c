@@ -0,0 +1,984 @@
+#include "../../include/siphon/http.h"
+#include "../../include/siphon/alloc.h"
+#include "../../include/siphon/error.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+
+/**
+ * HPACK header compression for HTTP/2 (RFC 7541).
+ *
+ * The dynamic table keeps entry bytes in a buffer twice the size of the
+ * table limit, written in order and wrapping to the start when an entry
+ * does not fit at the end. Because every entry counts at least 32 bytes of
+ * overhead against the table size, the live bytes and the single gap left by
+ * a wrap can never collide with a new entry. Evicting an entry therefore only
+ * advances the tail of the entry ring, and nothing is ever moved.
+ *
+ * Huffman strings are decoded from a 64-bit accumulator one whole code at a
+ * time. Codes of up to 8 bits, which include all the common characters, are
+ * resolved with a single lookup on the next byte of input. Longer codes use
+ * the canonical ordering of the code to find the length by comparing against
+ * the upper bound for each length, and then index the sorted symbol table.
+ */
+
+// size counted against the table for each entry in addition to its bytes
+#define ENTRY_OVERHEAD 32
+
+#define STATIC_COUNT 61
+
+// largest encoded integer for a 64-bit value
+#define INT_MAX_BYTES 11
+
+typedef struct {
+	const char *name, *value;
+	uint8_t nlen, vlen;
+} StaticEntry;
+
+#define STATIC(n, v) { n, v, sizeof n - 1, sizeof v - 1 }
+
+static const StaticEntry static_table[STATIC_COUNT + 1] = {
+	{ NULL, NULL, 0, 0 },
+	STATIC (":authority", ""),
+	STATIC (":method", "GET"),
+	STATIC (":method", "POST"),
+	STATIC (":path", "/"),
+	STATIC (":path", "/index.html"),
+	STATIC (":scheme", "http"),
+	STATIC (":scheme", "https"),
+	STATIC (":status", "200"),
+	STATIC (":status", "204"),
+	STATIC (":status", "206"),
+	STATIC (":status", "304"),
+	STATIC (":status", "400"),
+	STATIC (":status", "404"),
+	STATIC (":status", "500"),
+	STATIC ("accept-charset", ""),
+	STATIC ("accept-encoding", "gzip, deflate"),
+	STATIC ("accept-language", ""),
+	STATIC ("accept-ranges", ""),
+	STATIC ("accept", ""),
+	STATIC ("access-control-allow-origin", ""),
+	STATIC ("age", ""),
+	STATIC ("allow", ""),
+	STATIC ("authorization", ""),
+	STATIC ("cache-control", ""),
+	STATIC ("content-disposition", ""),
+	STATIC ("content-encoding", ""),
+	STATIC ("content-language", ""),
+	STATIC ("content-length", ""),
+	STATIC ("content-location", ""),
+	STATIC ("content-range", ""),
+	STATIC ("content-type", ""),
+	STATIC ("cookie", ""),
+	STATIC ("date", ""),
+	STATIC ("etag", ""),
+	STATIC ("expect", ""),
+	STATIC ("expires", ""),
+	STATIC ("from", ""),
+	STATIC ("host", ""),
+	STATIC ("if-match", ""),
+	STATIC ("if-modified-since", ""),
+	STATIC ("if-none-match", ""),
+	STATIC ("if-range", ""),
+	STATIC ("if-unmodified-since", ""),
+	STATIC ("last-modified", ""),
+	STATIC ("link", ""),
+	STATIC ("location", ""),
+	STATIC ("max-forwards", ""),
+	STATIC ("proxy-authenticate", ""),
+	STATIC ("proxy-authorization", ""),
+	STATIC ("range", ""),
+	STATIC ("referer", ""),
+	STATIC ("refresh", ""),
+	STATIC ("retry-after", ""),
+	STATIC ("server", ""),
+	STATIC ("set-cookie", ""),
+	STATIC ("strict-transport-security", ""),
+	STATIC ("transfer-encoding", ""),
+	STATIC ("user-agent", ""),
+	STATIC ("vary", ""),
+	STATIC ("via", ""),
+	STATIC ("www-authenticate", ""),
+};
+
+#undef STATIC
+
+static const uint32_t huff_codes[257] = {
+	0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5,
+	0x0fffffe6, 0x0fffffe7, 0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9,
+	0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec, 0x0fffffed, 0x0fffffee,
+	0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+	0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9,
+	0x0ffffffa, 0x0ffffffb, 0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa,
+	0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa, 0x000003fa, 0x000003fb,
+	0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+	0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b,
+	0x0000001c, 0x0000001d, 0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb,
+	0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc, 0x00001ffa, 0x00000021,
+	0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+	0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068,
+	0x00000069, 0x0000006a, 0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e,
+	0x0000006f, 0x00000070, 0x00000071, 0x00000072, 0x000000fc, 0x00000073,
+	0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+	0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005,
+	0x00000025, 0x00000026, 0x00000027, 0x00000006, 0x00000074, 0x00000075,
+	0x00000028, 0x00000029, 0x0000002a, 0x00000007, 0x0000002b, 0x00000076,
+	0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+	0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd,
+	0x00001ffd, 0x0ffffffc, 0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8,
+	0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9, 0x003fffd6, 0x007fffda,
+	0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+	0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1,
+	0x007fffe2, 0x007fffe3, 0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5,
+	0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef, 0x003fffda, 0x001fffdd,
+	0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+	0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf,
+	0x007fffeb, 0x007fffec, 0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2,
+	0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef, 0x000fffea, 0x003fffe2,
+	0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+	0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2,
+	0x003fffe8, 0x01ffffec, 0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde,
+	0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed, 0x0007fff2, 0x001fffe3,
+	0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+	0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3,
+	0x07ffffe4, 0x07ffffe5, 0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6,
+	0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3, 0x003fffea, 0x003fffeb,
+	0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+	0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8,
+	0x07ffffe9, 0x07ffffea, 0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed,
+	0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee, 0x3fffffff,
+};
+
+static const uint8_t huff_lens[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+
+static const uint16_t huff_primary[256] = {
+	0x0a30, 0x0a30, 0x0a30, 0x0a30, 0x0a30, 0x0a30, 0x0a30, 0x0a30,
+	0x0a31, 0x0a31, 0x0a31, 0x0a31, 0x0a31, 0x0a31, 0x0a31, 0x0a31,
+	0x0a32, 0x0a32, 0x0a32, 0x0a32, 0x0a32, 0x0a32, 0x0a32, 0x0a32,
+	0x0a61, 0x0a61, 0x0a61, 0x0a61, 0x0a61, 0x0a61, 0x0a61, 0x0a61,
+	0x0a63, 0x0a63, 0x0a63, 0x0a63, 0x0a63, 0x0a63, 0x0a63, 0x0a63,
+	0x0a65, 0x0a65, 0x0a65, 0x0a65, 0x0a65, 0x0a65, 0x0a65, 0x0a65,
+	0x0a69, 0x0a69, 0x0a69, 0x0a69, 0x0a69, 0x0a69, 0x0a69, 0x0a69,
+	0x0a6f, 0x0a6f, 0x0a6f, 0x0a6f, 0x0a6f, 0x0a6f, 0x0a6f, 0x0a6f,
+	0x0a73, 0x0a73, 0x0a73, 0x0a73, 0x0a73, 0x0a73, 0x0a73, 0x0a73,
+	0x0a74, 0x0a74, 0x0a74, 0x0a74, 0x0a74, 0x0a74, 0x0a74, 0x0a74,
+	0x0c20, 0x0c20, 0x0c20, 0x0c20, 0x0c25, 0x0c25, 0x0c25, 0x0c25,
+	0x0c2d, 0x0c2d, 0x0c2d, 0x0c2d, 0x0c2e, 0x0c2e, 0x0c2e, 0x0c2e,
+	0x0c2f, 0x0c2f, 0x0c2f, 0x0c2f, 0x0c33, 0x0c33, 0x0c33, 0x0c33,
+	0x0c34, 0x0c34, 0x0c34, 0x0c34, 0x0c35, 0x0c35, 0x0c35, 0x0c35,
+	0x0c36, 0x0c36, 0x0c36, 0x0c36, 0x0c37, 0x0c37, 0x0c37, 0x0c37,
+	0x0c38, 0x0c38, 0x0c38, 0x0c38, 0x0c39, 0x0c39, 0x0c39, 0x0c39,
+	0x0c3d, 0x0c3d, 0x0c3d, 0x0c3d, 0x0c41, 0x0c41, 0x0c41, 0x0c41,
+	0x0c5f, 0x0c5f, 0x0c5f, 0x0c5f, 0x0c62, 0x0c62, 0x0c62, 0x0c62,
+	0x0c64, 0x0c64, 0x0c64, 0x0c64, 0x0c66, 0x0c66, 0x0c66, 0x0c66,
+	0x0c67, 0x0c67, 0x0c67, 0x0c67, 0x0c68, 0x0c68, 0x0c68, 0x0c68,
+	0x0c6c, 0x0c6c, 0x0c6c, 0x0c6c, 0x0c6d, 0x0c6d, 0x0c6d, 0x0c6d,
+	0x0c6e, 0x0c6e, 0x0c6e, 0x0c6e, 0x0c70, 0x0c70, 0x0c70, 0x0c70,
+	0x0c72, 0x0c72, 0x0c72, 0x0c72, 0x0c75, 0x0c75, 0x0c75, 0x0c75,
+	0x0e3a, 0x0e3a, 0x0e42, 0x0e42, 0x0e43, 0x0e43, 0x0e44, 0x0e44,
+	0x0e45, 0x0e45, 0x0e46, 0x0e46, 0x0e47, 0x0e47, 0x0e48, 0x0e48,
+	0x0e49, 0x0e49, 0x0e4a, 0x0e4a, 0x0e4b, 0x0e4b, 0x0e4c, 0x0e4c,
+	0x0e4d, 0x0e4d, 0x0e4e, 0x0e4e, 0x0e4f, 0x0e4f, 0x0e50, 0x0e50,
+	0x0e51, 0x0e51, 0x0e52, 0x0e52, 0x0e53, 0x0e53, 0x0e54, 0x0e54,
+	0x0e55, 0x0e55, 0x0e56, 0x0e56, 0x0e57, 0x0e57, 0x0e59, 0x0e59,
+	0x0e6a, 0x0e6a, 0x0e6b, 0x0e6b, 0x0e71, 0x0e71, 0x0e76, 0x0e76,
+	0x0e77, 0x0e77, 0x0e78, 0x0e78, 0x0e79, 0x0e79, 0x0e7a, 0x0e7a,
+	0x1026, 0x102a, 0x102c, 0x103b, 0x1058, 0x105a, 0x0000, 0x0000,
+};
+
+// exclusive upper bounds of codes with 9 to 30 bits, left aligned to 32 bits
+static const uint64_t huff_limit[22] = {
+	0x0fe000000, 0x0ff400000, 0x0ffa00000, 0x0ffc00000,
+	0x0fff00000, 0x0fff80000, 0x0fffe0000, 0x0fffe0000,
+	0x0fffe0000, 0x0fffe0000, 0x0fffe6000, 0x0fffee000,
+	0x0ffff4800, 0x0ffffb000, 0x0ffffea00, 0x0fffff600,
+	0x0fffff800, 0x0fffffbc0, 0x0fffffe20, 0x0fffffff0,
+	0x0fffffff0, 0x100000000,
+};
+
+static const uint32_t huff_first[22] = {
+	0x00000000, 0x000003f8, 0x000007fa, 0x00000ffa, 0x00001ff8, 0x00003ffc,
+	0x00007ffc, 0x00000000, 0x00000000, 0x00000000, 0x0007fff0, 0x000fffe6,
+	0x001fffdc, 0x003fffd2, 0x007fffd8, 0x00ffffea, 0x01ffffec, 0x03ffffe0,
+	0x07ffffde, 0x0fffffe2, 0x00000000, 0x3ffffffc,
+};
+
+static const uint16_t huff_offset[22] = {
+	0, 74, 79, 82, 84, 90, 92, 0, 0, 0, 95,
+	98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+};
+
+// symbols in canonical order
+static const uint16_t huff_symbols[257] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+	45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+	95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+	58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+	77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+	106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+	88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+	0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+	167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+	132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+	173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+	151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+	183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+	171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+	255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+	246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+	6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+	21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+	249, 10, 13, 22, 256,
+};
+
+static ssize_t
+huff_decode (const uint8_t *p, size_t len, uint8_t *out, size_t max)
+{
+	const uint8_t *end = p + len;
+	uint64_t acc = 0;
+	unsigned bits = 0;
+	size_t n = 0;
+
+	for (;;) {
+		// top up the left aligned accumulator with whole bytes
+		while (bits <= 56 && p < end) {
+			acc |= (uint64_t)*p++ << (56 - bits);
+			bits += 8;
+		}
+		if (bits == 0) {
+			break;
+		}
+
+		unsigned sym, clen;
+		uint16_t e = huff_primary[acc >> 56];
+		if (sp_likely (e != 0)) {
+			sym = e & 0x1ff;
+			clen = e >> 9;
+		}
+		else {
+			uint64_t code = acc >> 32;
+			unsigned i = 0;
+			while (code >= huff_limit[i]) {
+				i++;
+			}
+			clen = i + 9;
+			sym = huff_symbols[huff_offset[i] + (code >> (32 - clen)) - huff_first[i]];
+		}
+
+		if (clen > bits) {
+			// the remainder must be a prefix of EOS used as padding
+			if (bits > 7 || (acc >> (64 - bits)) != (1u << bits) - 1) {
+				return SP_HTTP_ESYNTAX;
+			}
+			break;
+		}
+		if (sym == 256) {
+			return SP_HTTP_ESYNTAX;
+		}
+		if (n == max) {
+			return SP_HTTP_ESIZE;
+		}
+		out[n++] = (uint8_t)sym;
+		acc <<= clen;
+		bits -= clen;
+	}
+
+	return n;
+}
+
+static size_t
+huff_length (const uint8_t *s, size_t len)
+{
+	size_t bits = 0;
+	for (size_t i = 0; i < len; i++) {
+		bits += huff_lens[s[i]];
+	}
+	return (bits + 7) / 8;
+}
+
+static size_t
+huff_encode (const uint8_t *s, size_t len, uint8_t *out)
+{
+	uint8_t *p = out;
+	uint64_t acc = 0;
+	unsigned bits = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		acc = (acc << huff_lens[s[i]]) | huff_codes[s[i]];
+		bits += huff_lens[s[i]];
+		while (bits >= 8) {
+			bits -= 8;
+			*p++ = (uint8_t)(acc >> bits);
+		}
+	}
+	if (bits > 0) {
+		// pad with the most significant bits of EOS
+		*p++ = (uint8_t)((acc << (8 - bits)) | (0xff >> bits));
+	}
+	return p - out;
+}
+
+static ssize_t
+decode_int (const uint8_t *p, const uint8_t *end, unsigned prefix, size_t *out)
+{
+	const uint8_t *start = p;
+	size_t max = (1u << prefix) - 1;
+	size_t val = *p++ & max;
+
+	if (val == max) {
+		unsigned shift = 0;
+		uint8_t b;
+		do {
+			if (p == end) {
+				return 0;
+			}
+			if (shift > 28) {
+				return SP_HTTP_ESIZE;
+			}
+			b = *p++;
+			val += (size_t)(b & 0x7f) << shift;
+			shift += 7;
+		} while (b & 0x80);
+	}
+
+	*out = val;
+	return p - start;
+}
+
+static size_t
+encode_int (uint8_t *p, uint8_t flags, unsigned prefix, size_t val)
+{
+	uint8_t *start = p;
+	size_t max = (1u << prefix) - 1;
+
+	if (val < max) {
+		*p++ = flags | (uint8_t)val;
+	}
+	else {
+		*p++ = flags | (uint8_t)max;
+		for (val -= max; val >= 0x80; val >>= 7) {
+			*p++ = (uint8_t)(val | 0x80);
+		}
+		*p++ = (uint8_t)val;
+	}
+	return p - start;
+}
+
+static int
+table_init (SpHpackTable *t, size_t limit)
+{
+	if (limit > (UINT32_MAX >> 2)) {
+		return SP_HTTP_ESIZE;
+	}
+
+	// every entry is at least the overhead so this bounds the entry count
+	size_t n = sp_power_of_2 (limit / ENTRY_OVERHEAD + 1);
+
+	memset (t, 0, sizeof *t);
+	t->entries = sp_malloc (n * sizeof *t->entries);
+	if (t->entries == NULL) {
+		return SP_ESYSTEM (errno);
+	}
+	if (limit > 0) {
+		t->bytes = sp_malloc (2 * limit);
+		if (t->bytes == NULL) {
+			int err = SP_ESYSTEM (errno);
+			sp_free (t->entries, n * sizeof *t->entries);
+			return err;
+		}
+	}
+	t->limit = limit;
+	t->max = limit;
+	t->mask = (uint32_t)n - 1;
+	return 0;
+}
+
+static void
+table_final (SpHpackTable *t)
+{
+	sp_free (t->entries, (t->mask + 1) * sizeof *t->entries);
+	if (t->bytes != NULL) {
+		sp_free (t->bytes, 2 * t->limit);
+	}
+	memset (t, 0, sizeof *t);
+}
+
+static void
+table_evict (SpHpackTable *t, size_t size)
+{
+	while (t->size > size) {
+		const SpHpackEntry *e = &t->entries[(t->head - t->count) & t->mask];
+		t->size -= e->nlen + e->vlen + ENTRY_OVERHEAD;
+		t->count--;
+	}
+	if (t->count == 0) {
+		t->pos = 0;
+	}
+}
+
+static void
+table_resize (SpHpackTable *t, size_t max)
+{
+	assert (max <= t->limit);
+
+	table_evict (t, max);
+	t->max = max;
+}
+
+static const SpHpackEntry *
+table_add (SpHpackTable *t,
+		const uint8_t *name, size_t nlen,
+		const uint8_t *value, size_t vlen)
+{
+	size_t len = nlen + vlen;
+	if (len + ENTRY_OVERHEAD > t->max) {
+		table_evict (t, 0);
+		return NULL;
+	}
+
+	table_evict (t, t->max - len - ENTRY_OVERHEAD);
+	if (t->pos + len > 2 * t->limit) {
+		t->pos = 0;
+	}
+
+	// the name may refer to the bytes of an entry that was just evicted
+	uint8_t *dst = t->bytes + t->pos;
+	memmove (dst, name, nlen);
+	memcpy (dst + nlen, value, vlen);
+
+	SpHpackEntry *e = &t->entries[t->head & t->mask];
+	e->off = (uint32_t)t->pos;
+	e->nlen = (uint32_t)nlen;
+	e->vlen = (uint32_t)vlen;
+	t->head++;
+	t->count++;
+	t->size += len + ENTRY_OVERHEAD;
+	t->pos += len;
+	return e;
+}
+
+static int
+table_get (const SpHpackTable *t, size_t idx, SpHpackField *f)
+{
+	if (idx == 0) {
+		return SP_HTTP_ESYNTAX;
+	}
+	if (idx <= STATIC_COUNT) {
+		const StaticEntry *s = &static_table[idx];
+		f->name = (const uint8_t *)s->name;
+		f->nlen = s->nlen;
+		f->value = (const uint8_t *)s->value;
+		f->vlen = s->vlen;
+		return 0;
+	}
+	idx -= STATIC_COUNT + 1;
+	if (idx >= t->count) {
+		return SP_HTTP_ESYNTAX;
+	}
+	const SpHpackEntry *e = &t->entries[(t->head - 1 - idx) & t->mask];
+	f->name = t->bytes + e->off;
+	f->nlen = e->nlen;
+	f->value = f->name + e->nlen;
+	f->vlen = e->vlen;
+	return 0;
+}
+
+static size_t
+table_find (const SpHpackTable *t,
+		const uint8_t *name, size_t nlen,
+		const uint8_t *value, size_t vlen,
+		size_t *name_idx)
+{
+	*name_idx = 0;
+
+	for (size_t i = 1; i <= STATIC_COUNT; i++) {
+		const StaticEntry *s = &static_table[i];
+		if (s->nlen == nlen && memcmp (s->name, name, nlen) == 0) {
+			if (*name_idx == 0) {
+				*name_idx = i;
+			}
+			if (s->vlen == vlen && memcmp (s->value, value, vlen) == 0) {
+				return i;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < t->count; i++) {
+		const SpHpackEntry *e = &t->entries[(t->head - 1 - i) & t->mask];
+		const uint8_t *ename = t->bytes + e->off;
+		if (e->nlen == nlen && memcmp (ename, name, nlen) == 0) {
+			if (*name_idx == 0) {
+				*name_idx = i + STATIC_COUNT + 1;
+			}
+			if (e->vlen == vlen && memcmp (ename + nlen, value, vlen) == 0) {
+				return i + STATIC_COUNT + 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static ssize_t
+decode_string (const uint8_t *p, const uint8_t *end,
+		SpUtf8 *scratch, size_t max,
+		const uint8_t **out, size_t *outlen)
+{
+	if (p == end) {
+		return 0;
+	}
+
+	size_t len;
+	ssize_t n = decode_int (p, end, 7, &len);
+	if (n <= 0) {
+		return n;
+	}
+
+	bool huff = *p & 0x80;
+	if (!huff && len > max) {
+		return SP_HTTP_ESIZE;
+	}
+	if (len > (size_t)(end - p) - n) {
+		return 0;
+	}
+
+	const uint8_t *s = p + n;
+	if (huff) {
+		// the shortest code is 5 bits which bounds the decoded length
+		size_t dmax = len / 5 * 8 + (len % 5) * 8 / 5;
+		if (dmax > max) {
+			dmax = max;
+		}
+		sp_utf8_reset (scratch);
+		int rc = sp_utf8_ensure (scratch, dmax);
+		if (rc < 0) {
+			return rc;
+		}
+		ssize_t dlen = huff_decode (s, len, scratch->buf, dmax);
+		if (dlen < 0) {
+			return dlen;
+		}
+		scratch->len = dlen;
+		*out = scratch->buf;
+		*outlen = dlen;
+	}
+	else {
+		*out = s;
+		*outlen = len;
+	}
+	return n + len;
+}
+
+int
+sp_hpack_decoder_init (SpHpackDecoder *d, size_t limit)
+{
+	assert (d != NULL);
+
+	sp_utf8_init (&d->name);
+	sp_utf8_init (&d->value);
+	return table_init (&d->table, limit);
+}
+
+void
+sp_hpack_decoder_final (SpHpackDecoder *d)
+{
+	assert (d != NULL);
+
+	table_final (&d->table);
+	sp_utf8_final (&d->name);
+	sp_utf8_final (&d->value);
+}
+
+ssize_t
+sp_hpack_decode_next (SpHpackDecoder *d, const void *restrict buf, size_t len,
+		SpHpackField *f)
+{
+	assert (d != NULL);
+	assert (buf != NULL || len == 0);
+	assert (f != NULL);
+
+	if (len == 0) {
+		return 0;
+	}
+
+	const uint8_t *p = buf, *end = p + len;
+	uint8_t b = *p;
+	size_t idx;
+	ssize_t n, off;
+	int rc;
+
+	if (b & 0x80) {
+		n = decode_int (p, end, 7, &idx);
+		if (n <= 0) {
+			return n;
+		}
+		rc = table_get (&d->table, idx, f);
+		if (rc < 0) {
+			return rc;
+		}
+		f->type = SP_HPACK_INDEXED;
+		return n;
+	}
+
+	if ((b & 0xe0) == 0x20) {
+		n = decode_int (p, end, 5, &idx);
+		if (n <= 0) {
+			return n;
+		}
+		if (idx > d->table.limit) {
+			return SP_HTTP_ESIZE;
+		}
+		table_resize (&d->table, idx);
+		f->type = SP_HPACK_SIZE_UPDATE;
+		f->name = f->value = NULL;
+		f->nlen = f->vlen = 0;
+		f->size = idx;
+		return n;
+	}
+
+	SpHpackType type;
+	unsigned prefix;
+	if (b & 0x40) {
+		type = SP_HPACK_LITERAL_INDEXED;
+		prefix = 6;
+	}
+	else {
+		type = (b & 0x10) ? SP_HPACK_LITERAL_NEVER : SP_HPACK_LITERAL;
+		prefix = 4;
+	}
+
+	off = decode_int (p, end, prefix, &idx);
+	if (off <= 0) {
+		return off;
+	}
+	if (idx > 0) {
+		rc = table_get (&d->table, idx, f);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+	else {
+		n = decode_string (p + off, end, &d->name, SP_HTTP_MAX_FIELD,
+				&f->name, &f->nlen);
+		if (n <= 0) {
+			return n;
+		}
+		off += n;
+	}
+
+	n = decode_string (p + off, end, &d->value, SP_HPACK_MAX_VALUE,
+			&f->value, &f->vlen);
+	if (n <= 0) {
+		return n;
+	}
+	off += n;
+
+	if (type == SP_HPACK_LITERAL_INDEXED) {
+		const SpHpackEntry *e = table_add (&d->table, f->name, f->nlen, f->value, f->vlen);
+		if (e != NULL) {
+			f->name = d->table.bytes + e->off;
+			f->value = f->name + e->nlen;
+		}
+	}
+
+	f->type = type;
+	f->size = 0;
+	return off;
+}
+
+ssize_t
+sp_hpack_decode_map (SpHpackDecoder *d, const void *restrict buf, size_t len,
+		SpHttpMap *m)
+{
+	assert (d != NULL);
+	assert (buf != NULL || len == 0);
+	assert (m != NULL);
+
+	const uint8_t *p = buf;
+	size_t off = 0;
+	bool fields = false;
+
+	while (off < len) {
+		SpHpackField f;
+		ssize_t n = sp_hpack_decode_next (d, p + off, len - off, &f);
+		if (n <= 0) {
+			// the block is complete so a partial representation is invalid
+			return n < 0 ? n : SP_HTTP_ESYNTAX;
+		}
+		off += n;
+
+		if (f.type == SP_HPACK_SIZE_UPDATE) {
+			// size updates are only allowed at the start of a block
+			if (fields) {
+				return SP_HTTP_ESYNTAX;
+			}
+			continue;
+		}
+		fields = true;
+
+		int rc = sp_http_map_put (m, f.name, f.nlen, f.value, f.vlen);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+
+	return off;
+}
+
+int
+sp_hpack_encoder_init (SpHpackEncoder *e, size_t limit)
+{
+	assert (e != NULL);
+
+	int rc = table_init (&e->table, limit);
+	if (rc < 0) {
+		return rc;
+	}
+	e->update_min = SIZE_MAX;
+	e->update = SIZE_MAX;
+	e->huffman = true;
+	return 0;
+}
+
+void
+sp_hpack_encoder_final (SpHpackEncoder *e)
+{
+	assert (e != NULL);
+
+	table_final (&e->table);
+}
+
+void
+sp_hpack_encoder_use_huffman (SpHpackEncoder *e, bool huffman)
+{
+	assert (e != NULL);
+
+	e->huffman = huffman;
+}
+
+int
+sp_hpack_encoder_set_size (SpHpackEncoder *e, size_t size)
+{
+	assert (e != NULL);
+
+	if (size > e->table.limit) {
+		return SP_HTTP_ESIZE;
+	}
+
+	table_resize (&e->table, size);
+	if (size < e->update_min) {
+		e->update_min = size;
+	}
+	e->update = size;
+	return 0;
+}
+
+static int
+encode_update (SpHpackEncoder *e, SpUtf8 *out)
+{
+	int rc = sp_utf8_ensure (out, 2 * INT_MAX_BYTES);
+	if (rc < 0) {
+		return rc;
+	}
+
+	// a reduction followed by an increase must signal both sizes
+	uint8_t *p = out->buf + out->len;
+	if (e->update_min < e->update) {
+		p += encode_int (p, 0x20, 5, e->update_min);
+	}
+	p += encode_int (p, 0x20, 5, e->update);
+	out->len = p - out->buf;
+
+	e->update_min = SIZE_MAX;
+	e->update = SIZE_MAX;
+	return 0;
+}
+
+static int
+encode_string (SpHpackEncoder *e, SpUtf8 *out, const uint8_t *s, size_t len)
+{
+	size_t hlen = e->huffman ? huff_length (s, len) : SIZE_MAX;
+	bool huff = len > 0 && hlen <= len;
+	size_t n = huff ? hlen : len;
+
+	int rc = sp_utf8_ensure (out, INT_MAX_BYTES + n);
+	if (rc < 0) {
+		return rc;
+	}
+
+	uint8_t *p = out->buf + out->len;
+	p += encode_int (p, huff ? 0x80 : 0, 7, n);
+	if (huff) {
+		p += huff_encode (s, len, p);
+	}
+	else {
+		memcpy (p, s, len);
+		p += len;
+	}
+	out->len = p - out->buf;
+	return 0;
+}
+
+int
+sp_hpack_encode_field (SpHpackEncoder *e, SpUtf8 *out,
+		const void *name, size_t nlen,
+		const void *value, size_t vlen,
+		SpHpackType type)
+{
+	assert (e != NULL);
+	assert (out != NULL);
+	assert (name != NULL);
+	assert (value != NULL || vlen == 0);
+	assert (type == SP_HPACK_LITERAL_INDEXED ||
+			type == SP_HPACK_LITERAL ||
+			type == SP_HPACK_LITERAL_NEVER);
+
+	// the same limits as the decoder so the tables cannot diverge
+	if (nlen > SP_HTTP_MAX_FIELD || vlen > SP_HPACK_MAX_VALUE) {
+		return SP_HTTP_ESIZE;
+	}
+
+	// field names are always sent in lower case
+	uint8_t lower[SP_HTTP_MAX_FIELD];
+	for (size_t i = 0; i < nlen; i++) {
+		lower[i] = (uint8_t)tolower (((const uint8_t *)name)[i]);
+	}
+
+	int rc;
+	if (e->update != SIZE_MAX) {
+		rc = encode_update (e, out);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+
+	size_t name_idx;
+	size_t idx = table_find (&e->table, lower, nlen, value, vlen, &name_idx);
+
+	rc = sp_utf8_ensure (out, INT_MAX_BYTES);
+	if (rc < 0) {
+		return rc;
+	}
+	uint8_t *p = out->buf + out->len;
+
+	// sensitive values are not taken from the table either
+	if (idx > 0 && type != SP_HPACK_LITERAL_NEVER) {
+		out->len += encode_int (p, 0x80, 7, idx);
+		return 0;
+	}
+
+	switch (type) {
+	case SP_HPACK_LITERAL_INDEXED:
+		out->len += encode_int (p, 0x40, 6, name_idx);
+		break;
+	case SP_HPACK_LITERAL_NEVER:
+		out->len += encode_int (p, 0x10, 4, name_idx);
+		break;
+	default:
+		out->len += encode_int (p, 0x00, 4, name_idx);
+		break;
+	}
+
+	if (name_idx == 0) {
+		rc = encode_string (e, out, lower, nlen);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+	rc = encode_string (e, out, value, vlen);
+	if (rc < 0) {
+		return rc;
+	}
+
+	if (type == SP_HPACK_LITERAL_INDEXED) {
+		table_add (&e->table, lower, nlen, value, vlen);
+	}
+	return 0;
+}
+
+static int
+encode_entry (SpHpackEncoder *e, SpUtf8 *out, const SpHttpEntry *ent)
+{
+	SpHpackType type = SP_HPACK_LITERAL_INDEXED;
+
+	switch (sp_http_header_id (ent->data, ent->len)) {
+	// connection-specific fields are not allowed in HTTP/2
+	case SP_HTTP_HEADER_CONNECTION:
+	case SP_HTTP_HEADER_KEEP_ALIVE:
+	case SP_HTTP_HEADER_TRANSFER_ENCODING:
+	case SP_HTTP_HEADER_UPGRADE:
+		return 0;
+	case SP_HTTP_HEADER_AUTHORIZATION:
+	case SP_HTTP_HEADER_PROXY_AUTHORIZATION:
+		type = SP_HPACK_LITERAL_NEVER;
+		break;
+	default:
+		break;
+	}
+
+	size_t i;
+	sp_vec_each (ent->values, i) {
+		const size_t *s = ent->values[i];
+		int rc = sp_hpack_encode_field (e, out, ent->data, ent->len, s+1, *s, type);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+	return 0;
+}
+
+int
+sp_hpack_encode_map (SpHpackEncoder *e, SpUtf8 *out, const SpHttpMap *m)
+{
+	assert (e != NULL);
+	assert (out != NULL);
+	assert (m != NULL);
+
+	const SpMapEntry *me;
+	int rc;
+
+	// pseudo-header fields must precede all regular fields
+	sp_map_each (&m->map, me) {
+		const SpHttpEntry *ent = me->value;
+		if (ent->len > 0 && ent->data[0] == ':') {
+			rc = encode_entry (e, out, ent);
+			if (rc < 0) {
+				return rc;
+			}
+		}
+	}
+	sp_map_each (&m->map, me) {
+		const SpHttpEntry *ent = me->value;
+		if (ent->len == 0 || ent->data[0] != ':') {
+			rc = encode_entry (e, out, ent);
+			if (rc < 0) {
+				return rc;
+			}
+		}
+	}
+	return 0;
+}
+
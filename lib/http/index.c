@@ -0,0 +1,224 @@
+#include "../../include/siphon/http.h"
+#include "../../include/siphon/error.h"
+#include "../../include/siphon/alloc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+
+#define INDEX_SLOTS (SP_HTTP_INDEX_MAX*2)
+
+/**
+ * FNV-1a over the lower-cased name. Folding with 0x20 only lower-cases
+ * letters correctly, but any collisions it causes for other token characters
+ * are resolved by the name comparison.
+ */
+static inline uint32_t
+index_hash (const uint8_t *name, size_t len)
+{
+	uint32_t h = 0x811c9dc5;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (name[i] | 0x20)) * 0x01000193;
+	}
+	return h;
+}
+
+static inline bool
+index_eq (const SpHttpIndex *idx, const SpHttpIndexField *f,
+		const void *name, size_t nlen, uint32_t h)
+{
+	return f->hash == h && f->name.len == nlen &&
+		strncasecmp ((const char *)idx->base + f->name.off, name, nlen) == 0;
+}
+
+static int
+index_put (SpHttpIndex *restrict idx, const uint8_t *restrict name,
+		SpRange16 nr, SpRange16 vr)
+{
+	if (idx->count == SP_HTTP_INDEX_MAX) {
+		return SP_HTTP_ESIZE;
+	}
+	// both ranges must end within the 16-bit offsets they are stored as
+	if ((size_t)nr.off + nr.len > UINT16_MAX ||
+			(size_t)vr.off + vr.len > UINT16_MAX) {
+		return SP_HTTP_ESIZE;
+	}
+
+	uint32_t h = index_hash (name, nr.len);
+	uint8_t pos = (uint8_t)idx->count;
+	SpHttpIndexField *f = &idx->fields[pos];
+	f->name = nr;
+	f->value = vr;
+	f->hash = h;
+	f->next = 0;
+	idx->count++;
+
+	// the load factor never exceeds 0.5 so an empty slot always exists
+	for (size_t s = h & (INDEX_SLOTS - 1); ; s = (s + 1) & (INDEX_SLOTS - 1)) {
+		if (idx->slots[s] == 0) {
+			idx->slots[s] = pos + 1;
+			return 0;
+		}
+		SpHttpIndexField *e = &idx->fields[idx->slots[s] - 1];
+		if (e->hash == h && e->name.len == nr.len &&
+				strncasecmp ((const char *)name - nr.off + e->name.off,
+					(const char *)name, nr.len) == 0) {
+			// repeated names are chained in arrival order
+			while (e->next) {
+				e = &idx->fields[e->next - 1];
+			}
+			e->next = pos + 1;
+			return 0;
+		}
+	}
+}
+
+void
+sp_http_index_init (SpHttpIndex *idx)
+{
+	assert (idx != NULL);
+
+	idx->base = NULL;
+	idx->owned = NULL;
+	idx->owned_len = 0;
+	idx->count = 0;
+	memset (idx->slots, 0, sizeof idx->slots);
+}
+
+void
+sp_http_index_final (SpHttpIndex *idx)
+{
+	assert (idx != NULL);
+
+	if (idx->owned != NULL) {
+		sp_free (idx->owned, idx->owned_len);
+		idx->owned = NULL;
+		idx->owned_len = 0;
+	}
+}
+
+void
+sp_http_index_clear (SpHttpIndex *idx)
+{
+	assert (idx != NULL);
+
+	sp_http_index_final (idx);
+	sp_http_index_init (idx);
+}
+
+int
+sp_http_index_add (SpHttpIndex *idx, const void *buf,
+		SpRange16 name, SpRange16 value)
+{
+	assert (idx != NULL);
+	assert (buf != NULL);
+
+	return index_put (idx, (const uint8_t *)buf + name.off, name, value);
+}
+
+const SpHttpIndexField *
+sp_http_index_get (const SpHttpIndex *idx, const void *name, size_t nlen)
+{
+	assert (idx != NULL);
+	assert (idx->base != NULL || idx->count == 0);
+
+	if (idx->count == 0) {
+		return NULL;
+	}
+
+	uint32_t h = index_hash (name, nlen);
+	for (size_t s = h & (INDEX_SLOTS - 1); ; s = (s + 1) & (INDEX_SLOTS - 1)) {
+		if (idx->slots[s] == 0) {
+			return NULL;
+		}
+		const SpHttpIndexField *f = &idx->fields[idx->slots[s] - 1];
+		if (index_eq (idx, f, name, nlen, h)) {
+			return f;
+		}
+	}
+}
+
+const SpHttpIndexField *
+sp_http_index_next (const SpHttpIndex *idx, const SpHttpIndexField *f)
+{
+	assert (idx != NULL);
+	assert (f != NULL);
+
+	return f->next ? &idx->fields[f->next - 1] : NULL;
+}
+
+void
+sp_http_index_rebase (SpHttpIndex *idx, const void *buf)
+{
+	assert (idx != NULL);
+
+	idx->base = buf;
+}
+
+int
+sp_http_index_own (SpHttpIndex *idx)
+{
+	assert (idx != NULL);
+	assert (idx->base != NULL || idx->count == 0);
+
+	size_t len = 0;
+	for (uint16_t i = 0; i < idx->count; i++) {
+		len += idx->fields[i].name.len + idx->fields[i].value.len;
+	}
+
+	// ranges may overlap, so the packed copy can outgrow the 16-bit offsets
+	if (len > UINT16_MAX) {
+		return SP_HTTP_ESIZE;
+	}
+
+	uint8_t *owned = sp_malloc (len ? len : 1);
+	if (owned == NULL) {
+		return SP_ESYSTEM (errno);
+	}
+
+	uint16_t off = 0;
+	for (uint16_t i = 0; i < idx->count; i++) {
+		SpHttpIndexField *f = &idx->fields[i];
+		memcpy (owned + off, idx->base + f->name.off, f->name.len);
+		f->name.off = off;
+		off += f->name.len;
+		memcpy (owned + off, idx->base + f->value.off, f->value.len);
+		f->value.off = off;
+		off += f->value.len;
+	}
+
+	sp_http_index_final (idx);
+	idx->owned = owned;
+	idx->owned_len = len ? (uint16_t)len : 1;
+	idx->base = owned;
+	return 0;
+}
+
+void
+sp_http_index_print (const SpHttpIndex *idx, FILE *out)
+{
+	if (out == NULL) {
+		out = stderr;
+	}
+
+	if (idx == NULL) {
+		fprintf (out, "#<SpHttpIndex:(null)>\n");
+	}
+	else {
+		fprintf (out, "#<SpHttpIndex:%p> {\n", (void *)idx);
+		for (uint16_t i = 0; i < idx->count; i++) {
+			const SpHttpIndexField *f = &idx->fields[i];
+			if (idx->base == NULL) {
+				fprintf (out, "    [%u,%u]: [%u,%u]\n",
+					f->name.off, f->name.len, f->value.off, f->value.len);
+			}
+			else {
+				fprintf (out, "    %.*s: %.*s\n",
+					(int)f->name.len, (char *)idx->base + f->name.off,
+					(int)f->value.len, (char *)idx->base + f->value.off);
+			}
+		}
+		fprintf (out, "}\n");
+	}
+}
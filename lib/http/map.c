@@ -1,15 +1,17 @@
 #include "../../include/siphon/vec.h"
 #include "../../include/siphon/map.h"
 #include "../../include/siphon/hash.h"
-#include "../../include/siphon/alloc.h"
+#include "../allocator.h"
 
 struct SpHttpMap {
 	SpMap map;
+	const SpAllocator *alloc;
 	size_t encode_size;
 	size_t scatter_count;
 };
 
 struct SpHttpEntry {
+	const SpAllocator *alloc;
 	size_t **values;
 	size_t len;
 	char data[];
@@ -25,9 +27,9 @@ pstr_assign (size_t *s, const void *val, size_t len)
 }
 
 static size_t *
-pstr_new (const void *val, size_t len)
+pstr_new (const SpAllocator *a, const void *val, size_t len)
 {
-	size_t *s = sp_malloc (sizeof *s + len + 1);
+	size_t *s = sp_amalloc (a, sizeof *s + len + 1);
 	if (s != NULL) {
 		pstr_assign (s, val, len);
 	}
@@ -35,10 +37,10 @@ pstr_new (const void *val, size_t len)
 }
 
 static void
-pstr_free (size_t *s)
+pstr_free (const SpAllocator *a, size_t *s)
 {
 	if (s != NULL) {
-		sp_free (s, sizeof *s + *s + 1);
+		sp_afree (a, s, sizeof *s + *s + 1);
 	}
 }
 
@@ -69,12 +71,17 @@ entry_iskey (const void *val, const void *key, size_t len)
 }
 
 static SpHttpEntry *
-entry_new (const void *name, size_t len)
+entry_new (const SpAllocator *a, const void *name, size_t len)
 {
-	SpHttpEntry *e = sp_malloc (sizeof *e + len + 1);
+	SpHttpEntry *e = sp_amalloc (a, sizeof *e + len + 1);
 	if (e != NULL) {
+		e->alloc = a;
 		e->values = NULL;
 		pstr_assign (&e->len, name, len);
+		if (sp_vec_use_allocator (e->values, a) < 0) {
+			sp_afree (a, e, sizeof *e + len + 1);
+			return NULL;
+		}
 	}
 	return e;
 }
@@ -86,10 +93,10 @@ entry_free (void *val)
 
 	size_t i;
 	sp_vec_each (e->values, i) {
-		pstr_free (e->values[i]);
+		pstr_free (e->alloc, e->values[i]);
 	}
 	sp_vec_free (e->values);
-	sp_free (e, sizeof *e + e->len + 1);
+	sp_afree (e->alloc, e, sizeof *e + e->len + 1);
 }
 
 static const SpType map_type = {
@@ -104,6 +111,7 @@ sp_http_map_new (void)
 	SpHttpMap *m = sp_malloc (sizeof *m);
 	if (m != NULL) {
 		sp_map_init (&m->map, 0, 0.0, &map_type);
+		m->alloc = NULL;
 		m->encode_size = 0;
 		m->scatter_count = 0;
 	}
@@ -128,7 +136,7 @@ sp_http_map_put (SpHttpMap *m,
 	assert (name != NULL);
 	assert (value != NULL);
 
-	size_t *s = pstr_new (value, vlen);
+	size_t *s = pstr_new (m->alloc, value, vlen);
 	bool new = false;
 	SpHttpEntry *e = NULL;
 	void **loc;
@@ -144,7 +152,7 @@ sp_http_map_put (SpHttpMap *m,
 	}
 
 	if (new) {
-		e = entry_new (name, nlen);
+		e = entry_new (m->alloc, name, nlen);
 		if (e == NULL) {
 			goto err;
 		}
@@ -173,10 +181,24 @@ err:
 	if (new && e != NULL) {
 		entry_free (e);
 	}
-	pstr_free (s);
+	pstr_free (m->alloc, s);
 	return SP_ESYSTEM (err);
 }
 
+int
+sp_http_map_use_allocator (SpHttpMap *m, const SpAllocator *alloc)
+{
+	assert (m != NULL);
+
+	// entries keep the allocator they were created with
+	if (sp_map_count (&m->map) > 0) {
+		return SP_ESYSTEM (EBUSY);
+	}
+	// the table stays on the heap so the map may outlive an arena reset
+	m->alloc = alloc;
+	return 0;
+}
+
 bool
 sp_http_map_del (SpHttpMap *m, const void *name, size_t nlen)
 {
@@ -34,6 +34,17 @@ static const uint8_t crlf[] = "\r\n";
 #define CHK_EOL1 0x002000
 #define CHK_EOL2 0x003000
 
+#define BDY      0x0F0000
+#define BDY_LEN  0x010000
+#define BDY_CHK  0x020000
+
+#define MSG      0xF00000
+#define MSG_END  0x100000
+#define MSG_NEXT 0x200000
+
+// state following the last token of a message
+#define COMPLETE(p) ((p)->pipeline ? MSG_END : DONE)
+
 static int
 scrape_field (SpHttp *restrict p, const uint8_t *restrict m)
 {
@@ -46,11 +57,30 @@ scrape_field (SpHttp *restrict p, const uint8_t *restrict m)
 		}
 	}
 
+	if (p->index != NULL && !p->trailers) {
+		// ranges are kept relative to the start of the message
+		size_t off = p->pos + p->as.field.name.off;
+		size_t end = p->pos + p->as.field.value.off + p->as.field.value.len;
+		if (end > UINT16_MAX) {
+			return SP_HTTP_ESIZE;
+		}
+		SpRange16 name = { (uint16_t)off, p->as.field.name.len };
+		SpRange16 value = {
+			(uint16_t)(p->pos + p->as.field.value.off),
+			p->as.field.value.len
+		};
+		int rc = index_put (p->index, m + p->as.field.name.off, name, value);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+
 	if (p->trailers || p->body_len) {
 		return 0;
 	}
 
-	if (LEQ16 ("content-length", m + p->as.field.name.off, p->as.field.name.len)) {
+	switch (p->as.field.id) {
+	case SP_HTTP_HEADER_CONTENT_LENGTH: {
 		if (p->as.field.value.len == 0) {
 			YIELD_ERROR (SP_HTTP_ESYNTAX);
 		}
@@ -68,13 +98,15 @@ scrape_field (SpHttp *restrict p, const uint8_t *restrict m)
 		return 0;
 	}
 
-	if (LEQ ("transfer-encoding", m + p->as.field.name.off, p->as.field.name.len) &&
-			LEQ16 ("chunked", m + p->as.field.value.off, p->as.field.value.len)) {
-		p->chunked = true;
+	case SP_HTTP_HEADER_TRANSFER_ENCODING:
+		if (LEQ ("chunked", m + p->as.field.value.off, p->as.field.value.len)) {
+			p->chunked = true;
+		}
 		return 0;
-	}
 
-	return 0;
+	default:
+		return 0;
+	}
 }
 
 static ssize_t
@@ -204,10 +236,14 @@ again:
 			p->as.body_start.chunked = p->chunked;
 			p->as.body_start.content_length = p->body_len;
 			if (p->trailers) {
-				YIELD (SP_HTTP_TRAILER_END, DONE);
+				YIELD (SP_HTTP_TRAILER_END, COMPLETE (p));
+			}
+			else if (p->chunked) {
+				YIELD (SP_HTTP_BODY_START, CHK);
 			}
 			else {
-				YIELD (SP_HTTP_BODY_START, p->chunked ? CHK : DONE);
+				YIELD (SP_HTTP_BODY_START,
+						p->pipeline && p->body_len ? BDY_LEN : COMPLETE (p));
 			}
 		}
 		p->cs = FLD_KEY;
@@ -231,8 +267,9 @@ again:
 		p->as.field.name.off = SCAN;
 		p->as.field.value.off += SCAN;
 		p->as.field.value.len = (uint16_t)(p->off + SCAN - p->as.field.value.off - (sizeof crlf - 1));
+		p->as.field.id = header_id (m + p->as.field.name.off, p->as.field.name.len);
 		CHECK_ERROR (scrape_field (p, m));
-		if (p->headers == NULL) {
+		if (p->headers == NULL && (p->index == NULL || p->trailers)) {
 			YIELD (SP_HTTP_FIELD, FLD);
 		}
 		else {
@@ -292,6 +329,10 @@ again:
 		}
 		else {
 			p->as.body_chunk.length = p->body_len;
+			if (p->pipeline) {
+				// the remaining length is counted down by the body state
+				YIELD (SP_HTTP_BODY_CHUNK, BDY_CHK);
+			}
 			p->body_len = 0;
 			YIELD (SP_HTTP_BODY_CHUNK, CHK_EOL2);
 		}
@@ -306,6 +347,39 @@ again:
 	}
 }
 
+static ssize_t
+parse_body (SpHttp *restrict p, const uint8_t *const restrict m, const size_t len)
+{
+	(void)m;
+
+	size_t n = len < p->body_len ? len : p->body_len;
+
+	p->as.body.length = n;
+	p->body_len -= n;
+	p->type = SP_HTTP_BODY;
+	if (p->body_len == 0) {
+		p->cs = p->cs == BDY_CHK ? CHK_EOL2 : MSG_END;
+	}
+	return (ssize_t)n;
+}
+
+static ssize_t
+parse_message (SpHttp *restrict p, const uint8_t *const restrict m, const size_t len)
+{
+	(void)m;
+	(void)len;
+
+	if (p->cs != MSG_END) {
+		YIELD_ERROR (SP_HTTP_ESTATE);
+	}
+
+	// the token consumes nothing so the message length is already known
+	p->as.message.length = p->pos;
+	p->type = SP_HTTP_MESSAGE_END;
+	p->cs = MSG_NEXT;
+	return 0;
+}
+
 static void
 init_sizes (SpHttp *p)
 {
@@ -371,6 +445,8 @@ sp_http_reset (SpHttp *p)
 	uint16_t max_field = p->max_field;
 	uint16_t max_value = p->max_value;
 	SpHttpMap *headers = p->headers;
+	SpHttpIndex *index = p->index;
+	bool pipeline = p->pipeline;
 
 	if (p->response) {
 		sp_http_init_response (p, false);
@@ -384,23 +460,42 @@ sp_http_reset (SpHttp *p)
 	p->max_reason = max_reason;
 	p->max_field = max_field;
 	p->max_value = max_value;
+	p->pipeline = pipeline;
 
 	if (headers) {
 		sp_http_map_clear (headers);
 		p->headers = headers;
 	}
+
+	if (index) {
+		sp_http_index_clear (index);
+		p->index = index;
+	}
 }
 
-ssize_t
-sp_http_next (SpHttp *p, const void *restrict buf, size_t len)
+static inline ssize_t
+account (SpHttp *p, ssize_t rc)
 {
-	assert (p != NULL);
-
-	if (len == 0) {
-		return 0;
+	if (rc > 0 || (rc == 0 && p->type == SP_HTTP_MESSAGE_END)) {
+		p->cscans = 0;
+		p->pos += (size_t)rc;
 	}
+	else if (rc == 0 && p->cscans > 64) {
+		YIELD_ERROR (SP_HTTP_ETOOSHORT);
+	}
+	return rc;
+}
 
+static inline ssize_t
+next (SpHttp *restrict p, const uint8_t *restrict buf, size_t len)
+{
 	ssize_t rc;
+
+	// captured values of the last message are kept until the next one starts
+	if (p->cs == MSG_NEXT) {
+		sp_http_reset (p);
+	}
+
 	p->scans++;
 	p->cscans++;
 
@@ -408,14 +503,109 @@ sp_http_next (SpHttp *p, const void *restrict buf, size_t len)
 	else if (p->cs & RES) rc = parse_response_line (p, buf, len);
 	else if (p->cs & FLD) rc = parse_field (p, buf, len);
 	else if (p->cs & CHK) rc = parse_chunk (p, buf, len);
+	else if (p->cs & BDY) rc = parse_body (p, buf, len);
+	else if (p->cs & MSG) rc = parse_message (p, buf, len);
 	else { YIELD_ERROR (SP_HTTP_ESTATE); }
-	if (rc > 0) {
-		p->cscans = 0;
+	return account (p, rc);
+}
+
+ssize_t
+sp_http_next (SpHttp *p, const void *restrict buf, size_t len)
+{
+	assert (p != NULL);
+
+	// an error held back by sp_http_next_batch is reported first
+	if (p->err < 0) {
+		ssize_t rc = p->err;
+		p->err = 0;
+		return rc;
 	}
-	else if (rc == 0 && p->cscans > 64) {
-		YIELD_ERROR (SP_HTTP_ETOOSHORT);
+
+	// the end of a pipelined message needs no input
+	if (len == 0 && p->cs != MSG_END) {
+		p->type = SP_HTTP_NONE;
+		return 0;
 	}
-	return rc;
+
+	return next (p, buf, len);
+}
+
+ssize_t
+sp_http_next_batch (SpHttp *p, const void *restrict buf, size_t len,
+		SpHttpToken *out, size_t max)
+{
+	assert (p != NULL);
+	assert (out != NULL || max == 0);
+
+	// an error after some tokens were written is reported by the next call
+	if (p->err < 0) {
+		ssize_t rc = p->err;
+		p->err = 0;
+		return rc;
+	}
+
+	const uint8_t *m = buf;
+	size_t off = 0, n = 0;
+	ssize_t rc;
+
+#define ADD_TOKEN() do {     \
+	out[n].type = p->type;   \
+	out[n].as = p->as;       \
+	out[n].off = off;        \
+	out[n].len = (size_t)rc; \
+	off += (size_t)rc;       \
+	n++;                     \
+} while (0)
+
+	while (n < max && (off < len || p->cs == MSG_END) && !IS_DONE (p->cs)) {
+		if (p->cs == FLD) {
+			// fields make up most of a message, so scan them back to back
+			// without the per-token dispatch in next
+			do {
+				p->scans++;
+				p->cscans++;
+				rc = account (p, parse_field (p, m + off, len - off));
+				if (rc <= 0) {
+					break;
+				}
+				ADD_TOKEN ();
+			} while (p->type == SP_HTTP_FIELD && n < max && off < len);
+		}
+		else {
+			rc = next (p, m + off, len - off);
+			if (rc > 0 || (rc == 0 && p->type == SP_HTTP_MESSAGE_END)) {
+				ADD_TOKEN ();
+			}
+		}
+
+		if (rc < 0) {
+			if (n == 0) {
+				return rc;
+			}
+			p->err = (int)rc;
+			break;
+		}
+		if (rc == 0 && p->type != SP_HTTP_MESSAGE_END) {
+			break;
+		}
+
+		// stop when more input is needed or body bytes must be consumed
+		if (p->type == SP_HTTP_NONE ||
+				(p->type == SP_HTTP_BODY_CHUNK && !p->pipeline) ||
+				(p->type == SP_HTTP_TRAILER_END && !p->pipeline)) {
+			break;
+		}
+
+		// captured fields only hold the current message
+		if (p->type == SP_HTTP_MESSAGE_END &&
+				(p->headers != NULL || p->index != NULL)) {
+			break;
+		}
+	}
+
+#undef ADD_TOKEN
+
+	return (ssize_t)n;
 }
 
 bool
@@ -438,6 +628,25 @@ sp_http_steal_headers (SpHttp *p)
 	return headers;
 }
 
+void
+sp_http_use_index (SpHttp *p, SpHttpIndex *idx)
+{
+	assert (p != NULL);
+
+	if (idx != NULL) {
+		sp_http_index_clear (idx);
+	}
+	p->index = idx;
+}
+
+void
+sp_http_use_pipeline (SpHttp *p, bool pipeline)
+{
+	assert (p != NULL);
+
+	p->pipeline = pipeline;
+}
+
 void
 sp_http_print (const SpHttp *p, const void *restrict buf, FILE *out)
 {
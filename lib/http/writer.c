@@ -0,0 +1,380 @@
+#include "../../include/siphon/http.h"
+#include "../../include/siphon/error.h"
+
+#include <assert.h>
+#include <string.h>
+
+/**
+ * The writer only records iovec entries. Caller values such as names,
+ * values and bodies are referenced where they are, fixed strings come from
+ * literals, and the few formatted numbers are placed in the writer's own
+ * scratch space. This keeps the writer from being moved until the entries
+ * have been written, but no body byte is ever copied. The separators are
+ * shared with the parser.
+ */
+
+#define STATUS_LINES(XX) \
+	XX(100, "Continue") \
+	XX(101, "Switching Protocols") \
+	XX(200, "OK") \
+	XX(201, "Created") \
+	XX(202, "Accepted") \
+	XX(203, "Non-Authoritative Information") \
+	XX(204, "No Content") \
+	XX(205, "Reset Content") \
+	XX(206, "Partial Content") \
+	XX(300, "Multiple Choices") \
+	XX(301, "Moved Permanently") \
+	XX(302, "Found") \
+	XX(303, "See Other") \
+	XX(304, "Not Modified") \
+	XX(305, "Use Proxy") \
+	XX(307, "Temporary Redirect") \
+	XX(308, "Permanent Redirect") \
+	XX(400, "Bad Request") \
+	XX(401, "Unauthorized") \
+	XX(402, "Payment Required") \
+	XX(403, "Forbidden") \
+	XX(404, "Not Found") \
+	XX(405, "Method Not Allowed") \
+	XX(406, "Not Acceptable") \
+	XX(407, "Proxy Authentication Required") \
+	XX(408, "Request Timeout") \
+	XX(409, "Conflict") \
+	XX(410, "Gone") \
+	XX(411, "Length Required") \
+	XX(412, "Precondition Failed") \
+	XX(413, "Payload Too Large") \
+	XX(414, "URI Too Long") \
+	XX(415, "Unsupported Media Type") \
+	XX(416, "Range Not Satisfiable") \
+	XX(417, "Expectation Failed") \
+	XX(421, "Misdirected Request") \
+	XX(422, "Unprocessable Entity") \
+	XX(426, "Upgrade Required") \
+	XX(428, "Precondition Required") \
+	XX(429, "Too Many Requests") \
+	XX(431, "Request Header Fields Too Large") \
+	XX(451, "Unavailable For Legal Reasons") \
+	XX(500, "Internal Server Error") \
+	XX(501, "Not Implemented") \
+	XX(502, "Bad Gateway") \
+	XX(503, "Service Unavailable") \
+	XX(504, "Gateway Timeout") \
+	XX(505, "HTTP Version Not Supported") \
+	XX(511, "Network Authentication Required")
+
+// length of the "HTTP/1.1 200 " prefix of a status line
+#define STATUS_PREFIX 13
+
+static const char content_length[] = "content-length: ";
+static const char chunked_field[] = "transfer-encoding: chunked\r\n";
+static const char last_chunk[] = "0\r\n";
+static const char last_chunk_end[] = "0\r\n\r\n";
+
+static const char *
+status_line (uint16_t status, size_t *len)
+{
+	switch (status) {
+#define XX(code, reason) \
+	case code: \
+		*len = sizeof "HTTP/1.1 " #code " " reason "\r\n" - 1; \
+		return "HTTP/1.1 " #code " " reason "\r\n";
+	STATUS_LINES(XX)
+#undef XX
+	default:
+		return NULL;
+	}
+}
+
+static size_t
+fmt_uint (uint8_t *buf, uint64_t val, unsigned base)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	uint8_t tmp[20];
+	size_t n = 0;
+	do {
+		tmp[n++] = (uint8_t)digits[val % base];
+		val /= base;
+	} while (val > 0);
+	for (size_t i = 0; i < n; i++) {
+		buf[i] = tmp[n - i - 1];
+	}
+	return n;
+}
+
+static inline void
+writer_add (SpHttpWriter *w, const void *base, size_t len)
+{
+	w->iov[w->count].iov_base = (void *)base;
+	w->iov[w->count].iov_len = len;
+	w->count++;
+	w->len += len;
+}
+
+#define add_lit(w, lit) writer_add (w, lit, sizeof lit - 1)
+
+#define EXPECT_ENTRIES(w, n) do {       \
+	if ((w)->count + (n) > (w)->max) {  \
+		return SP_HTTP_ESIZE;           \
+	}                                   \
+} while (0)
+
+#define EXPECT_SCRATCH(w, n) do {                                \
+	if ((w)->used + (size_t)(n) > sizeof (w)->scratch) {         \
+		return SP_HTTP_ESIZE;                                    \
+	}                                                            \
+} while (0)
+
+void
+sp_http_writer_init (SpHttpWriter *w, struct iovec *iov, size_t max)
+{
+	assert (w != NULL);
+	assert (iov != NULL || max == 0);
+
+	w->iov = iov;
+	w->max = max;
+	sp_http_writer_reset (w);
+}
+
+void
+sp_http_writer_reset (SpHttpWriter *w)
+{
+	assert (w != NULL);
+
+	w->count = 0;
+	w->len = 0;
+	w->used = 0;
+}
+
+int
+sp_http_writer_request (SpHttpWriter *w,
+		const void *method, size_t mlen,
+		const void *uri, size_t ulen,
+		uint8_t version)
+{
+	assert (w != NULL);
+	assert (method != NULL);
+	assert (uri != NULL);
+	assert (version <= 9);
+
+	EXPECT_ENTRIES (w, 4);
+	writer_add (w, method, mlen);
+	add_lit (w, " ");
+	writer_add (w, uri, ulen);
+	if (version == 1) {
+		add_lit (w, " HTTP/1.1\r\n");
+	}
+	else if (version == 0) {
+		add_lit (w, " HTTP/1.0\r\n");
+	}
+	else {
+		EXPECT_SCRATCH (w, 11);
+		uint8_t *s = w->scratch + w->used;
+		memcpy (s, " HTTP/1.0\r\n", 11);
+		s[8] = (uint8_t)('0' + version);
+		w->used += 11;
+		writer_add (w, s, 11);
+	}
+	return 0;
+}
+
+int
+sp_http_writer_response (SpHttpWriter *w, uint8_t version, uint16_t status,
+		const void *reason, size_t len)
+{
+	assert (w != NULL);
+	assert (reason != NULL || len == 0);
+	assert (version <= 9);
+	assert (status <= 999);
+
+	size_t llen = 0;
+	const char *line = reason == NULL ? status_line (status, &llen) : NULL;
+
+	if (line != NULL && version == 1) {
+		EXPECT_ENTRIES (w, 1);
+		writer_add (w, line, llen);
+		return 0;
+	}
+
+	EXPECT_ENTRIES (w, line != NULL ? 2 : 3);
+	EXPECT_SCRATCH (w, STATUS_PREFIX);
+
+	uint8_t *s = w->scratch + w->used;
+	memcpy (s, "HTTP/1.1 ", 9);
+	s[7] = (uint8_t)('0' + version);
+	s[9] = (uint8_t)('0' + status / 100);
+	s[10] = (uint8_t)('0' + status / 10 % 10);
+	s[11] = (uint8_t)('0' + status % 10);
+	s[12] = ' ';
+	w->used += STATUS_PREFIX;
+	writer_add (w, s, STATUS_PREFIX);
+
+	if (line != NULL) {
+		// the precomputed line supplies the reason and line ending
+		writer_add (w, line + STATUS_PREFIX, llen - STATUS_PREFIX);
+	}
+	else {
+		writer_add (w, reason, len);
+		add_lit (w, crlf);
+	}
+	return 0;
+}
+
+int
+sp_http_writer_field (SpHttpWriter *w,
+		const void *name, size_t nlen,
+		const void *value, size_t vlen)
+{
+	assert (w != NULL);
+	assert (name != NULL);
+	assert (value != NULL || vlen == 0);
+
+	EXPECT_ENTRIES (w, 4);
+	writer_add (w, name, nlen);
+	add_lit (w, sep);
+	writer_add (w, value, vlen);
+	add_lit (w, crlf);
+	return 0;
+}
+
+int
+sp_http_writer_header (SpHttpWriter *w, SpHttpHeader id,
+		const void *value, size_t vlen)
+{
+	assert (w != NULL);
+
+	const char *name = sp_http_header_name (id);
+	if (name == NULL) {
+		return SP_HTTP_ESYNTAX;
+	}
+	return sp_http_writer_field (w, name, header_lens[id], value, vlen);
+}
+
+int
+sp_http_writer_map (SpHttpWriter *w, const SpHttpMap *m)
+{
+	assert (w != NULL);
+	assert (m != NULL);
+
+	size_t n = sp_http_map_scatter_count (m);
+	EXPECT_ENTRIES (w, n);
+	sp_http_map_scatter (m, w->iov + w->count);
+	w->count += n;
+	w->len += sp_http_map_encode_size (m);
+	return 0;
+}
+
+int
+sp_http_writer_content_length (SpHttpWriter *w, uint64_t len)
+{
+	assert (w != NULL);
+
+	EXPECT_ENTRIES (w, 2);
+	EXPECT_SCRATCH (w, 20 + sizeof crlf - 1);
+
+	uint8_t *s = w->scratch + w->used;
+	size_t n = fmt_uint (s, len, 10);
+	memcpy (s + n, crlf, sizeof crlf - 1);
+	n += sizeof crlf - 1;
+	w->used += n;
+
+	add_lit (w, content_length);
+	writer_add (w, s, n);
+	return 0;
+}
+
+int
+sp_http_writer_chunked (SpHttpWriter *w)
+{
+	assert (w != NULL);
+
+	EXPECT_ENTRIES (w, 1);
+	add_lit (w, chunked_field);
+	return 0;
+}
+
+int
+sp_http_writer_end_headers (SpHttpWriter *w)
+{
+	assert (w != NULL);
+
+	EXPECT_ENTRIES (w, 1);
+	add_lit (w, crlf);
+	return 0;
+}
+
+int
+sp_http_writer_body (SpHttpWriter *w, const void *body, size_t len)
+{
+	assert (w != NULL);
+	assert (body != NULL || len == 0);
+
+	if (len > 0) {
+		EXPECT_ENTRIES (w, 1);
+		writer_add (w, body, len);
+	}
+	return 0;
+}
+
+int
+sp_http_writer_chunk (SpHttpWriter *w, const void *data, size_t len)
+{
+	assert (w != NULL);
+	assert (data != NULL || len == 0);
+
+	// an empty chunk would end the body
+	if (len == 0) {
+		return 0;
+	}
+
+	EXPECT_ENTRIES (w, 3);
+	EXPECT_SCRATCH (w, 16 + sizeof crlf - 1);
+
+	uint8_t *s = w->scratch + w->used;
+	size_t n = fmt_uint (s, len, 16);
+	memcpy (s + n, crlf, sizeof crlf - 1);
+	n += sizeof crlf - 1;
+	w->used += n;
+
+	writer_add (w, s, n);
+	writer_add (w, data, len);
+	add_lit (w, crlf);
+	return 0;
+}
+
+int
+sp_http_writer_chunk_end (SpHttpWriter *w, const SpHttpMap *trailers)
+{
+	assert (w != NULL);
+
+	if (trailers == NULL || sp_http_map_scatter_count (trailers) == 0) {
+		EXPECT_ENTRIES (w, 1);
+		add_lit (w, last_chunk_end);
+		return 0;
+	}
+
+	EXPECT_ENTRIES (w, 2 + sp_http_map_scatter_count (trailers));
+	add_lit (w, last_chunk);
+	sp_http_writer_map (w, trailers);
+	add_lit (w, crlf);
+	return 0;
+}
+
+size_t
+sp_http_writer_count (const SpHttpWriter *w)
+{
+	assert (w != NULL);
+
+	return w->count;
+}
+
+size_t
+sp_http_writer_length (const SpHttpWriter *w)
+{
+	assert (w != NULL);
+
+	return w->len;
+}
+
@@ -1,9 +1,19 @@
 #include "../include/siphon/json.h"
+#include "../include/siphon/endian.h"
 #include "parser.h"
+#include "pow5.h"
 
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <locale.h>
+#ifdef __APPLE__
+# include <xlocale.h>
+#endif
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 
 
 static const uint8_t rng_non_ws[] = "\x00\x08\x0b\x0c\x0e\x1f\x21\xff";
@@ -23,6 +33,39 @@ static const uint8_t rng_non_ws[] = "\x00\x08\x0b\x0c\x0e\x1f\x21\xff";
 #define STACK_POP_ARR(p) STACK_POP(p, STACK_ARR)
 #define STACK_POP_OBJ(p) STACK_POP(p, STACK_OBJ)
 
+#define STACK_GROW(p) stack_grow (p)
+
+/**
+ * Doubles the external stack from the arena, starting from the inline one.
+ */
+static bool
+stack_grow (SpJson *p)
+{
+	if (p->deep_arena == NULL || p->depth == SP_JSON_DEPTH_MAX) {
+		return false;
+	}
+
+	size_t old = p->deep ? SP_JSON_STACK_SIZE (p->deep_max) : sizeof p->stack;
+	size_t len = old * 2;
+	if (len > SP_JSON_STACK_SIZE (SP_JSON_DEPTH_MAX)) {
+		len = SP_JSON_STACK_SIZE (SP_JSON_DEPTH_MAX);
+	}
+
+	uint8_t *deep;
+	if (p->deep) {
+		deep = sp_arena_realloc (p->deep_arena, p->deep, old, len);
+	}
+	else if ((deep = sp_arena_alloc (p->deep_arena, len)) != NULL) {
+		memcpy (deep, p->stack, old);
+	}
+	if (deep == NULL) {
+		return false;
+	}
+	p->deep = deep;
+	p->deep_max = (uint16_t)(len*8 - 1);
+	return true;
+}
+
 
 #define KIND_MASK    0x00000F
 #define KIND_ANY     0x000000
@@ -32,6 +75,16 @@ static const uint8_t rng_non_ws[] = "\x00\x08\x0b\x0c\x0e\x1f\x21\xff";
 #define KIND_TRUE    0x000004
 #define KIND_FALSE   0x000005
 #define KIND_NULL    0x000006
+#define KIND_SKIP    0x000007
+#define KIND_SKIP_STR 0x000008
+#define KIND_SKIP_ESC 0x000009
+#define KIND_SKIP_SEP 0x00000A
+#define KIND_SKIP_ANY 0x00000B
+#define KIND_SKIP_LIT 0x00000C
+#define KIND_SKIP_NEXT 0x00000D
+
+// marks a skip that started at a value rather than within a container
+#define SKIP_VALUE   0x80000000U
  
 #define ARRAY_MASK   0x0000F0
 #define ARRAY_FIRST  0x000010
@@ -68,20 +121,166 @@ static const uint8_t rng_non_ws[] = "\x00\x08\x0b\x0c\x0e\x1f\x21\xff";
 	}                                      \
 } while (0)
 
-#define SKIP_WHITESPACE(done) do {                                           \
-	end = pcmp_range16 (end, len-p->off, rng_non_ws, sizeof rng_non_ws - 1); \
-	if (pcmp_unlikely (end == NULL)) {                                       \
-		if (pcmp_unlikely (done)) {                                          \
-			YIELD_ERROR (SP_JSON_ESYNTAX);                                        \
-		}                                                                    \
-		p->off = 0;                                                          \
-		return len;                                                          \
-	}                                                                        \
-	p->off = end - m;                                                        \
+#define SKIP_WHITESPACE(done) do {                                            \
+	end = sp_scan_range (end, len-p->off, rng_non_ws, sizeof rng_non_ws - 1); \
+	if (pcmp_unlikely (end == NULL)) {                                        \
+		if (pcmp_unlikely (done)) {                                           \
+			YIELD_ERROR (SP_JSON_ESYNTAX);                                    \
+		}                                                                     \
+		p->off = 0;                                                           \
+		return len;                                                           \
+	}                                                                         \
+	p->off = end - m;                                                         \
 } while (0)
 
 
 
+/**
+ * Finds the first backslash, control or delete character. Most strings have
+ * none, so 8 bytes are checked at a time before handing off to the scanner.
+ */
+static inline const uint8_t *
+string_special (const uint8_t *s, const uint8_t *e)
+{
+	static const uint64_t ones = 0x0101010101010101ULL;
+	static const uint64_t high = 0x8080808080808080ULL;
+
+	for (; e - s >= 8; s += 8) {
+		uint64_t v;
+		memcpy (&v, s, sizeof v);
+		uint64_t bs = v ^ (ones * '\\');
+		uint64_t del = v ^ (ones * 0x7F);
+		uint64_t hit = (((v - ones * 0x20) & ~v) | ((bs - ones) & ~bs) |
+			((del - ones) & ~del)) & high;
+		if (hit) {
+			break;
+		}
+	}
+	for (; s < e; s++) {
+		if (*s < 0x20 || *s == '\\' || *s == 0x7F) {
+			return s;
+		}
+	}
+	return e;
+}
+
+static ssize_t
+string_decode (SpJson *restrict p, const uint8_t *s, const uint8_t *e)
+{
+#ifdef SP_JSON_STRICT
+	static const uint8_t rng_check[] = SP_UTF8_JSON_RANGE;
+#endif
+
+	if (e - s > SP_JSON_MAX_STRING) {
+		return SP_JSON_ESIZE;
+	}
+
+	sp_utf8_reset (&p->utf8);
+	while (s < e) {
+#ifdef SP_JSON_STRICT
+		const uint8_t *x = sp_scan_range (s, e - s, rng_check, sizeof rng_check - 1);
+		if (x == NULL) {
+			x = e;
+		}
+#else
+		const uint8_t *x = string_special (s, e);
+#endif
+		ssize_t n = sp_utf8_add_raw (&p->utf8, s, x - s);
+		if (n < 0) {
+			return n;
+		}
+		if (x == e) {
+			break;
+		}
+		n = sp_utf8_json_decode (&p->utf8, x, e - x, 0);
+		if (n == SP_UTF8_ETOOSHORT) {
+			return SP_JSON_EESCAPE;
+		}
+		if (n < 0) {
+			return n;
+		}
+		s = x + n;
+	}
+	return 0;
+}
+
+/**
+ * Validates an undecoded string and notes whether it has escape sequences.
+ * The escapes themselves are checked when the string is decoded.
+ */
+static ssize_t
+string_check (const uint8_t *s, const uint8_t *e, bool *escaped)
+{
+	if (e - s > SP_JSON_MAX_STRING) {
+		return SP_JSON_ESIZE;
+	}
+
+	*escaped = false;
+	for (;;) {
+		s = string_special (s, e);
+		if (s == e) {
+			return 0;
+		}
+		if (*s == '\\') {
+			*escaped = true;
+			s += 2;
+			if (s > e) {
+				return SP_JSON_EESCAPE;
+			}
+		}
+		else if (*s < 0x20 || *s == 0x7F) {
+			return SP_JSON_EBYTE;
+		}
+		else {
+			s++;
+		}
+	}
+}
+
+static ssize_t
+parse_lazy_string (SpJson *restrict p, const uint8_t *restrict m, size_t len, bool eof)
+{
+	static const uint8_t rng_check[] = "\\\\\x00\x1F\"\"\x7F\x7F";
+
+	const uint8_t *end = m + p->off;
+
+	for (;;) {
+		end = sp_scan_range (end, len - p->off, rng_check, sizeof rng_check - 1);
+		if (end == NULL) {
+			end = m + len;
+		}
+		p->off = end - m;
+		if (p->off - p->mark > SP_JSON_MAX_STRING) {
+			YIELD_ERROR (SP_JSON_ESIZE);
+		}
+		// a trailing backslash is rescanned once its escaped byte arrives
+		if (end == m + len || (*end == '\\' && end + 1 == m + len)) {
+			if (eof) {
+				YIELD_ERROR (SP_JSON_ESYNTAX);
+			}
+			return 0;
+		}
+
+		if (*end == '"') {
+			p->raw.off = p->mark;
+			p->raw.len = p->off - p->mark;
+			end++;
+			YIELD (SP_JSON_STRING, p->cs == KIND_KEY ? OBJECT_SEP : YIELD_CS (p));
+		}
+		if (*end == '\\') {
+			p->escaped = true;
+			end += 2;
+		}
+		else if (*end < 0x20 || *end == 0x7F) {
+			YIELD_ERROR (SP_JSON_EBYTE);
+		}
+		else {
+			end++;
+		}
+		p->off = end - m;
+	}
+}
+
 static ssize_t
 parse_string (SpJson *restrict p, const uint8_t *restrict m, size_t len, bool eof)
 {
@@ -92,13 +291,17 @@ parse_string (SpJson *restrict p, const uint8_t *restrict m, size_t len, bool eo
 	static const uint8_t rng_check[] = "\\\\\x00\x1F\"\"\x7F\x7F";
 #endif
 
+	if (p->lazy) {
+		return parse_lazy_string (p, m, len, eof);
+	}
+
 	const uint8_t *start = m + p->mark;
 	const uint8_t *end = m + p->off;
 	ssize_t n;
 
 again:
 	EXPECT_RANGE (rng_check, SP_JSON_MAX_STRING, eof, SP_JSON_ESYNTAX, SP_JSON_ESIZE);
-	end = pcmp_range16 (end, len-p->off, rng_check, sizeof rng_check - 1);
+	end = sp_scan_range (end, len-p->off, rng_check, sizeof rng_check - 1);
 	if (end == NULL) {
 		end = m + len;
 	}
@@ -139,28 +342,416 @@ again:
 	goto again;
 }
 
-static ssize_t
-parse_number (SpJson *restrict p, const uint8_t *restrict m, size_t len, bool eof)
+static const double pow10_exact[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 uint128;
+#endif
+
+static inline void
+mul128 (uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
 {
-	// TODO: use better number parser
+#ifdef __SIZEOF_INT128__
+	uint128 r = (uint128)a * b;
+	*hi = (uint64_t)(r >> 64);
+	*lo = (uint64_t)r;
+#else
+	uint64_t al = (uint32_t)a, ah = a >> 32;
+	uint64_t bl = (uint32_t)b, bh = b >> 32;
+	uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+	uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+	*hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+	*lo = (mid << 32) | (uint32_t)ll;
+#endif
+}
+
+/**
+ * Eisel-Lemire conversion of w * 10^q into a biased binary exponent and
+ * an explicit 52-bit mantissa. This is exact for all w of up to 19 digits.
+ */
+static void
+eisel_lemire (int64_t q, uint64_t w, uint64_t *mantissa, int *power2)
+{
+	if (w == 0 || q < POW5_MIN) {
+		*mantissa = 0;
+		*power2 = 0;
+		return;
+	}
+	if (q > POW5_MAX) {
+		*mantissa = 0;
+		*power2 = 0x7FF;
+		return;
+	}
 
-	static const uint8_t rng_non_num[] = "\x00\x2a\x2c\x2c\x2f\x2f\x3a\x44\x46\x64\x66\xff";
+	int lz = __builtin_clzll (w);
+	w <<= lz;
+
+	// the second product only matters when the first leaves ambiguous low bits
+	const uint64_t *p5 = &pow5_128[2 * (q - POW5_MIN)];
+	uint64_t hi, lo, hi2, lo2;
+	mul128 (w, p5[0], &hi, &lo);
+	if ((hi & 0x1FF) == 0x1FF) {
+		mul128 (w, p5[1], &hi2, &lo2);
+		lo += hi2;
+		if (hi2 > lo) {
+			hi++;
+		}
+	}
 
-	const uint8_t *end = m + p->off;
+	int upper = (int)(hi >> 63);
+	uint64_t m = hi >> (upper + 9);
+	int e = (int)((((152170 + 65536) * q) >> 16) + 63) + upper - lz + 1023;
+
+	if (e <= 0) {
+		// subnormal result
+		if (-e + 1 >= 64) {
+			*mantissa = 0;
+			*power2 = 0;
+			return;
+		}
+		m >>= -e + 1;
+		m += m & 1;
+		m >>= 1;
+		*mantissa = m & ((1ULL << 52) - 1);
+		*power2 = m < (1ULL << 52) ? 0 : 1;
+		return;
+	}
+
+	// break ties to even when the product is exact
+	if (lo <= 1 && q >= -4 && q <= 23 && (m & 3) == 1 &&
+			(m << (upper + 9)) == hi) {
+		m &= ~1ULL;
+	}
 
-	EXPECT_RANGE (rng_non_num, 511, eof, SP_JSON_ESYNTAX, SP_JSON_ESIZE);
+	m += m & 1;
+	m >>= 1;
+	if (m >= (2ULL << 52)) {
+		m = 1ULL << 52;
+		e++;
+	}
+	if (e >= 0x7FF) {
+		*mantissa = 0;
+		*power2 = 0x7FF;
+		return;
+	}
+	*mantissa = m & ((1ULL << 52) - 1);
+	*power2 = e;
+}
 
-	size_t n = p->off - p->mark;
+// the "C" locale keeps the radix a '.' whatever the process locale is
+static locale_t c_locale;
 
+static void __attribute__((constructor))
+init_locale (void)
+{
+	c_locale = newlocale (LC_NUMERIC_MASK, "C", (locale_t)0);
+}
+
+static void __attribute__((destructor))
+fini_locale (void)
+{
+	if (c_locale != (locale_t)0) {
+		freelocale (c_locale);
+	}
+}
+
+/**
+ * Correctly rounded fallback for the rare inputs that the fast paths cannot
+ * decide. The conversion uses the cached "C" locale, so it is thread-safe
+ * and independent of setlocale.
+ */
+static int
+number_slow (const uint8_t *s, size_t n, double *out)
+{
 	char buf[512];
-	memcpy (buf, m+p->mark, n);
+	if (n >= sizeof buf) {
+		return SP_JSON_ESIZE;
+	}
+	if (c_locale == (locale_t)0) {
+		return SP_ESYSTEM (ENOMEM);
+	}
+	memcpy (buf, s, n);
 	buf[n] = '\0';
 
 	char *e;
-	p->number = strtod (buf, &e);
-	if (*e) {
-		YIELD_ERROR (SP_JSON_ESYNTAX);
+	*out = strtod_l (buf, &e, c_locale);
+	return *e ? SP_JSON_ESYNTAX : 0;
+}
+
+static inline uint64_t
+load8 (const uint8_t *s)
+{
+	uint64_t v;
+	memcpy (&v, s, sizeof v);
+	return sp_le64toh (v);
+}
+
+/**
+ * Sets the high bit of each byte that is not an ascii digit. Masking off the
+ * high bits before the add keeps carries from crossing into the next byte.
+ */
+static inline uint64_t
+nondigit_mask (uint64_t v)
+{
+	uint64_t t = v ^ 0x3030303030303030ULL;
+	return (((t & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | t) &
+		0x8080808080808080ULL;
+}
+
+/**
+ * Converts 8 ascii digits in memory order to their value by combining pairs,
+ * then quads, then the two halves with three multiplies.
+ */
+static inline uint32_t
+eight_digits (uint64_t v)
+{
+	v -= 0x3030303030303030ULL;
+	v = (v * 10) + (v >> 8);
+	v = (((v & 0x000000FF000000FFULL) * 0x000F424000000064ULL) +
+		(((v >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+	return (uint32_t)v;
+}
+
+/**
+ * Finds the end of the run of digits starting at `s`.
+ */
+static inline const uint8_t *
+digit_run (const uint8_t *s, const uint8_t *e)
+{
+#ifdef __SSE2__
+	const __m128i bias = _mm_set1_epi8 ((char)0xB0);
+	const __m128i lim = _mm_set1_epi8 (-118);
+	for (; e - s >= 16; s += 16) {
+		// rebias so '0'..'9' become the 10 smallest signed bytes
+		__m128i v = _mm_sub_epi8 (_mm_loadu_si128 ((const __m128i *)s), bias);
+		int mask = ~_mm_movemask_epi8 (_mm_cmplt_epi8 (v, lim)) & 0xFFFF;
+		if (mask) {
+			return s + __builtin_ctz (mask);
+		}
 	}
+#endif
+	for (; e - s >= 8; s += 8) {
+		uint64_t mask = nondigit_mask (load8 (s));
+		if (mask) {
+			return s + (__builtin_ctzll (mask) >> 3);
+		}
+	}
+	while (s < e && (unsigned)(*s - '0') < 10) {
+		s++;
+	}
+	return s;
+}
+
+static inline uint64_t
+digits_value (const uint8_t *s, const uint8_t *e, uint64_t w)
+{
+	for (; e - s >= 8; s += 8) {
+		w = w * 100000000 + eight_digits (load8 (s));
+	}
+	for (; s < e; s++) {
+		w = w * 10 + (*s - '0');
+	}
+	return w;
+}
+
+static inline bool
+digits_nonzero (const uint8_t *s, const uint8_t *e)
+{
+	for (; e - s >= 8; s += 8) {
+		if (load8 (s) != 0x3030303030303030ULL) {
+			return true;
+		}
+	}
+	for (; s < e; s++) {
+		if (*s != '0') {
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline bool
+is_number_char (uint8_t c)
+{
+	return (unsigned)(c - '0') < 10 || c == '.' || c == '-' || c == '+' ||
+		(c | 0x20) == 'e';
+}
+
+/**
+ * Parses and converts a number directly from the input.
+ *
+ * @return  length of the number, 0 if the input ends within the number,
+ *          or an error code
+ */
+static ssize_t
+number_convert (SpJson *restrict p, const uint8_t *restrict s, size_t n)
+{
+	const uint8_t *start = s, *e = s + n;
+	bool neg = false;
+
+	if (*s == '-') {
+		neg = true;
+		s++;
+	}
+
+	// locate the integer and fraction digit runs
+	const uint8_t *ia = s, *ib = digit_run (s, e);
+	const uint8_t *fa = ib, *fb = ib;
+	if (ib == e) {
+		return 0;
+	}
+	if (*ib == '.') {
+		fa = ib + 1;
+		fb = digit_run (fa, e);
+		if (fb == e) {
+			return 0;
+		}
+	}
+	if (ib == ia && fb == fa) {
+		return SP_JSON_ESYNTAX;
+	}
+
+	const uint8_t *x = fb;
+	bool integral = fa == ib;
+	int64_t ev = 0;
+	if ((*x | 0x20) == 'e') {
+		integral = false;
+		bool eneg = false;
+		if (++x == e) {
+			return 0;
+		}
+		if (*x == '-' || *x == '+') {
+			eneg = *x++ == '-';
+			if (x == e) {
+				return 0;
+			}
+		}
+		const uint8_t *ee = digit_run (x, e);
+		if (ee == x) {
+			return SP_JSON_ESYNTAX;
+		}
+		if (ee == e) {
+			return 0;
+		}
+		// saturating well past the table range keeps the sum from overflowing
+		for (; x < ee && ev < 100000; x++) {
+			ev = ev * 10 + (*x - '0');
+		}
+		if (eneg) {
+			ev = -ev;
+		}
+		x = ee;
+	}
+
+	if (is_number_char (*x)) {
+		return SP_JSON_ESYNTAX;
+	}
+
+	// leading zeros carry no significance
+	while (ia < ib && *ia == '0') {
+		ia++;
+	}
+	const uint8_t *fs = fa;
+	if (ia == ib) {
+		while (fs < fb && *fs == '0') {
+			fs++;
+		}
+	}
+
+	size_t ni = ib - ia, nd = ni + (fb - fs);
+	uint64_t w;
+	int64_t q;
+	bool truncated = false;
+	if (nd <= 19) {
+		w = digits_value (fs, fb, digits_value (ia, ib, 0));
+		q = -(fb - fa);
+	}
+	else if (ni >= 19) {
+		w = digits_value (ia, ia + 19, 0);
+		q = (int64_t)ni - 19;
+		truncated = digits_nonzero (ia + 19, ib) || digits_nonzero (fs, fb);
+	}
+	else {
+		const uint8_t *fe = fs + (19 - ni);
+		w = digits_value (fs, fe, digits_value (ia, ib, 0));
+		q = -(fe - fa);
+		truncated = digits_nonzero (fe, fb);
+	}
+	q += ev;
+
+	p->integral = false;
+	if (integral && nd <= 20) {
+		uint64_t iv = w;
+		bool exact = true;
+		if (nd == 20) {
+			unsigned d = ib[-1] - '0';
+			exact = w <= (UINT64_MAX - d) / 10;
+			iv = w * 10 + d;
+		}
+		if (exact && (!neg || iv <= (1ULL << 63))) {
+			p->integral = true;
+			p->integer.u64 = neg ? (uint64_t)0 - iv : iv;
+		}
+	}
+
+	double d;
+	if (w == 0) {
+		d = 0.0;
+	}
+	else if (!truncated && q >= -22 && q <= 22 && w <= (1ULL << 53)) {
+		// both operands are exact so a single rounding gives the right result
+		d = (double)w;
+		d = q < 0 ? d / pow10_exact[-q] : d * pow10_exact[q];
+	}
+	else {
+		uint64_t m;
+		int e2;
+		eisel_lemire (q, w, &m, &e2);
+		if (truncated) {
+			uint64_t m1;
+			int e21;
+			eisel_lemire (q, w + 1, &m1, &e21);
+			if (m != m1 || e2 != e21) {
+				int rc = number_slow (start, x - start, &p->number);
+				return rc < 0 ? rc : x - start;
+			}
+		}
+		uint64_t bits = m | ((uint64_t)e2 << 52);
+		memcpy (&d, &bits, sizeof d);
+	}
+
+	p->number = neg ? -d : d;
+	return x - start;
+}
+
+static ssize_t
+parse_number (SpJson *restrict p, const uint8_t *restrict m, size_t len, bool eof)
+{
+	// a number and its delimiter are bounded so the scan never grows
+	size_t n = len - p->mark;
+	if (n > 512) {
+		n = 512;
+	}
+
+	ssize_t rc = number_convert (p, m + p->mark, n);
+	if (rc < 0) {
+		YIELD_ERROR (rc);
+	}
+	if (rc == 0) {
+		if (n == 512) {
+			YIELD_ERROR (SP_JSON_ESIZE);
+		}
+		if (eof) {
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		}
+		p->off = len;
+		return 0;
+	}
+
+	const uint8_t *end = m + p->mark + rc;
 	YIELD_STACK (SP_JSON_NUMBER);
 }
 
@@ -217,6 +808,7 @@ parse_any (SpJson *restrict p, const uint8_t *restrict m, size_t len, bool eof)
 
 	case '"':
 		sp_utf8_reset (&p->utf8);
+		p->escaped = false;
 		p->mark = ++p->off;
 		p->cs = KIND_STRING;
 		return parse_string (p, m, len, eof);
@@ -298,6 +890,7 @@ again:
 				break;
 			case '"':
 				sp_utf8_reset (&p->utf8);
+				p->escaped = false;
 				p->mark = ++p->off;
 				p->cs = KIND_KEY;
 				return parse_string (p, m, len, eof);
@@ -307,6 +900,7 @@ again:
 	case OBJECT_KEY:
 		EXPECT_CHAR ('"', eof, SP_JSON_ESYNTAX);
 		sp_utf8_reset (&p->utf8);
+		p->escaped = false;
 		p->mark = p->off;
 		p->cs = KIND_KEY;
 		return parse_string (p, m, len, eof);
@@ -334,17 +928,194 @@ again:
 	YIELD_ERROR (SP_JSON_ESYNTAX);
 }
 
+static const uint8_t *
+skip_whitespace (const uint8_t *s, const uint8_t *e)
+{
+	s = sp_scan_range (s, e - s, rng_non_ws, sizeof rng_non_ws - 1);
+	return s ? s : e;
+}
+
+/**
+ * Balances brackets and quotes without decoding anything. Only the outermost
+ * bracket of a skipped container is checked against the stack.
+ */
+static ssize_t
+parse_skip (SpJson *restrict p, const uint8_t *restrict m, size_t len, bool eof)
+{
+	static const uint8_t set_nest[] = "\"{}[]";
+	static const uint8_t set_str[] = "\"\\";
+	static const uint8_t set_lit[] = ",}] \t\r\n";
+
+	const uint8_t *end = m + p->off, *e = m + len, *lit = m;
+
+again:
+	switch (p->cs) {
+	case KIND_SKIP_NEXT:
+		end = skip_whitespace (end, e);
+		if (end == e) {
+			goto more;
+		}
+		if (*end == ']') {
+			if (!STACK_POP_ARR (p)) {
+				YIELD_ERROR (SP_JSON_ESYNTAX);
+			}
+			end++;
+			YIELD_STACK (SP_JSON_ARRAY_END);
+		}
+		if (*end != ',') {
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		}
+		end++;
+		p->cs = KIND_SKIP_ANY;
+		goto again;
+
+	case KIND_SKIP_SEP:
+		end = skip_whitespace (end, e);
+		if (end == e) {
+			goto more;
+		}
+		if (*end != ':') {
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		}
+		end++;
+		p->cs = KIND_SKIP_ANY;
+		// fallthrough
+
+	case KIND_SKIP_ANY:
+		end = skip_whitespace (end, e);
+		if (end == e) {
+			goto more;
+		}
+		switch (*end) {
+		case '{': case '[':
+			end++;
+			p->skip = SKIP_VALUE | 1;
+			p->cs = KIND_SKIP;
+			goto again;
+		case '"':
+			end++;
+			p->skip = SKIP_VALUE;
+			p->cs = KIND_SKIP_STR;
+			goto again;
+		case '}': case ']': case ',': case ':':
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		case 't': p->mark = SP_JSON_TRUE; break;
+		case 'f': p->mark = SP_JSON_FALSE; break;
+		case 'n': p->mark = SP_JSON_NULL; break;
+		default: p->mark = SP_JSON_NUMBER; break;
+		}
+		lit = end;
+		p->cs = KIND_SKIP_LIT;
+		// fallthrough
+
+	case KIND_SKIP_LIT:
+		// like numbers, a partial literal is left in the input to be rescanned
+		end = sp_scan_set (end, e - end, set_lit, sizeof set_lit - 1);
+		if (end == NULL) {
+			if (eof) {
+				// only a root literal may run to the end of the input
+				if (p->depth > 0) {
+					YIELD_ERROR (SP_JSON_ESYNTAX);
+				}
+				end = e;
+				YIELD_STACK ((SpJsonType)p->mark);
+			}
+			if (lit > m) {
+				p->off = 0;
+				return lit - m;
+			}
+			p->off = len;
+			return 0;
+		}
+		YIELD_STACK ((SpJsonType)p->mark);
+
+	case KIND_SKIP:
+		for (;;) {
+			end = sp_scan_set (end, e - end, set_nest, sizeof set_nest - 1);
+			if (end == NULL) {
+				end = e;
+				goto more;
+			}
+			uint8_t c = *end++;
+			if (c == '"') {
+				p->cs = KIND_SKIP_STR;
+				goto again;
+			}
+			if (c == '{' || c == '[') {
+				p->skip++;
+				continue;
+			}
+			if (p->skip == 0) {
+				if (c == '}' ? !STACK_POP_OBJ (p) : !STACK_POP_ARR (p)) {
+					YIELD_ERROR (SP_JSON_ESYNTAX);
+				}
+				YIELD_STACK (c == '}' ? SP_JSON_OBJECT_END : SP_JSON_ARRAY_END);
+			}
+			if (--p->skip == SKIP_VALUE) {
+				YIELD_STACK (c == '}' ? SP_JSON_OBJECT : SP_JSON_ARRAY);
+			}
+		}
+
+	case KIND_SKIP_ESC:
+		if (end == e) {
+			goto more;
+		}
+		end++;
+		p->cs = KIND_SKIP_STR;
+		// fallthrough
+
+	case KIND_SKIP_STR:
+		for (;;) {
+			end = sp_scan_set (end, e - end, set_str, sizeof set_str - 1);
+			if (end == NULL) {
+				end = e;
+				goto more;
+			}
+			if (*end++ == '\\') {
+				if (end == e) {
+					p->cs = KIND_SKIP_ESC;
+					goto more;
+				}
+				end++;
+				continue;
+			}
+			if (p->skip == SKIP_VALUE) {
+				YIELD_STACK (SP_JSON_STRING);
+			}
+			p->cs = KIND_SKIP;
+			goto again;
+		}
+	}
+	YIELD_ERROR (SP_JSON_ESTATE);
+
+more:
+	// all skip state is held in the parser so the whole input is consumed
+	if (eof) {
+		YIELD_ERROR (SP_JSON_ESYNTAX);
+	}
+	p->off = 0;
+	return len;
+}
+
 static inline void
 init_values (SpJson *p)
 {
 	p->number = 0.0;
+	p->integer.u64 = 0;
+	p->integral = false;
 	p->type = SP_JSON_NONE;
+	p->raw.off = 0;
+	p->raw.len = 0;
+	p->escaped = false;
 	p->cs = 0;
 	p->off = 0;
 	p->mark = 0;
+	p->skip = 0;
 	p->depth = 0;
 }
 
+#include "json/index.c"
+
 void
 sp_json_init (SpJson *p)
 {
@@ -352,6 +1123,16 @@ sp_json_init (SpJson *p)
 
 	sp_utf8_init (&p->utf8);
 	init_values (p);
+	p->lazy = false;
+	p->deep = NULL;
+	p->deep_max = 0;
+	p->deep_arena = NULL;
+	p->index.base = NULL;
+	p->index.len = 0;
+	p->index.pos = NULL;
+	p->index.count = 0;
+	p->index.cur = 0;
+	p->index.cap = 0;
 }
 
 void
@@ -361,6 +1142,14 @@ sp_json_reset (SpJson *p)
 
 	sp_utf8_reset (&p->utf8);
 	init_values (p);
+	// a grown stack belongs to the arena and is rebuilt on demand
+	if (p->deep_arena != NULL) {
+		p->deep = NULL;
+		p->deep_max = 0;
+	}
+	p->index.base = NULL;
+	p->index.count = 0;
+	p->index.cur = 0;
 }
 
 void
@@ -369,6 +1158,16 @@ sp_json_final (SpJson *p)
 	assert (p != NULL);
 
 	sp_utf8_final (&p->utf8);
+	if (p->index.pos != NULL) {
+		sp_free (p->index.pos, p->index.cap * sizeof *p->index.pos);
+		p->index.pos = NULL;
+		p->index.cap = 0;
+	}
+	p->index.base = NULL;
+	p->index.count = 0;
+	p->deep = NULL;
+	p->deep_max = 0;
+	p->deep_arena = NULL;
 }
 
 ssize_t
@@ -377,6 +1176,9 @@ sp_json_next (SpJson *p, const void *restrict buf, size_t len, bool eof)
 	assert (p != NULL);
 
 	p->type = SP_JSON_NONE;
+	if (p->index.base != NULL) {
+		return parse_indexed (p, buf, len);
+	}
 	EXPECT_SIZE (1, eof, SP_JSON_ESYNTAX);
 
 	if (p->cs & ARRAY_MASK) {
@@ -393,10 +1195,101 @@ sp_json_next (SpJson *p, const void *restrict buf, size_t len, bool eof)
 	case KIND_TRUE:   return parse_true (p, buf, len, eof);
 	case KIND_FALSE:  return parse_false (p, buf, len, eof);
 	case KIND_NULL:   return parse_null (p, buf, len, eof);
+	case KIND_SKIP:
+	case KIND_SKIP_STR:
+	case KIND_SKIP_ESC:
+	case KIND_SKIP_SEP:
+	case KIND_SKIP_ANY:
+	case KIND_SKIP_LIT:
+	case KIND_SKIP_NEXT: return parse_skip (p, buf, len, eof);
 	}
 	YIELD_ERROR (SP_JSON_ESTATE);
 }
 
+void
+sp_json_use_lazy_strings (SpJson *p, bool lazy)
+{
+	assert (p != NULL);
+
+	p->lazy = lazy;
+}
+
+void
+sp_json_use_stack (SpJson *p, void *buf, size_t len)
+{
+	assert (p != NULL);
+	assert (p->depth == 0);
+	assert (buf != NULL || len == 0);
+
+	if (len > SP_JSON_STACK_SIZE (SP_JSON_DEPTH_MAX)) {
+		len = SP_JSON_STACK_SIZE (SP_JSON_DEPTH_MAX);
+	}
+	p->deep = len > 0 ? buf : NULL;
+	p->deep_max = len > 0 ? (uint16_t)(len*8 - 1) : 0;
+	p->deep_arena = NULL;
+}
+
+void
+sp_json_use_stack_arena (SpJson *p, SpArena *arena)
+{
+	assert (p != NULL);
+	assert (p->depth == 0);
+
+	p->deep = NULL;
+	p->deep_max = 0;
+	p->deep_arena = arena;
+}
+
+ssize_t
+sp_json_decode_string (SpJson *p, const void *buf)
+{
+	assert (p != NULL);
+	assert (buf != NULL || p->raw.len == 0);
+
+	const uint8_t *s = (const uint8_t *)buf + p->raw.off;
+	ssize_t rc = string_decode (p, s, s + p->raw.len);
+	return rc < 0 ? rc : (ssize_t)p->utf8.len;
+}
+
+ssize_t
+sp_json_skip (SpJson *p, const void *restrict buf, size_t len, bool eof)
+{
+	assert (p != NULL);
+
+	switch (p->cs) {
+	case OBJECT_FIRST:
+	case ARRAY_FIRST:
+		p->skip = 0;
+		p->cs = KIND_SKIP;
+		break;
+	case OBJECT_SEP:
+		p->cs = KIND_SKIP_SEP;
+		break;
+	case ARRAY_NEXT:
+		p->cs = KIND_SKIP_NEXT;
+		break;
+	case KIND_ANY:
+		p->cs = KIND_SKIP_ANY;
+		break;
+	case KIND_SKIP:
+	case KIND_SKIP_STR:
+	case KIND_SKIP_ESC:
+	case KIND_SKIP_SEP:
+	case KIND_SKIP_ANY:
+	case KIND_SKIP_LIT:
+	case KIND_SKIP_NEXT:
+		break;
+	default:
+		return SP_JSON_ESTATE;
+	}
+
+	if (p->index.base != NULL) {
+		p->type = SP_JSON_NONE;
+		return index_skip (p, buf, len);
+	}
+	return sp_json_next (p, buf, len, eof);
+}
+
 bool
 sp_json_is_done (const SpJson *p)
 {
@@ -437,3 +1330,10 @@ sp_json_steal_string (SpJson *p, size_t *len, size_t *cap)
 	return sp_utf8_steal (&p->utf8, len, cap);
 }
 
+#include "json/query.c"
+
+#include "json/dom.c"
+
+#include "json/writer.c"
+
+#include "json/transcode.c"
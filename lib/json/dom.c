@@ -0,0 +1,321 @@
+#include "../../include/siphon/error.h"
+#include "../../include/siphon/alloc.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+/**
+ * The tape is built from the indexed parser in a single pass. While a
+ * container is open its `next` field links to the enclosing container, so
+ * no separate stack is needed; the link is replaced by the end position once
+ * the container closes. Unescaped strings point into the input, and only
+ * strings with escapes are decoded into the arena.
+ */
+
+#define DOM_NONE UINT32_MAX
+
+static inline uint32_t
+dom_hash (const uint8_t *key, size_t len)
+{
+	uint32_t h = 0x811c9dc5;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ key[i]) * 0x01000193;
+	}
+	return h;
+}
+
+static inline bool
+dom_key_eq (const SpJsonNode *key, const void *name, size_t len)
+{
+	return key->len == len && memcmp (key->as.str, name, len) == 0;
+}
+
+static SpJsonNode *
+dom_push (SpJsonDom *d)
+{
+	if (d->count == d->cap) {
+		size_t cap = d->cap ? d->cap * 2 : 64;
+		SpJsonNode *tape = sp_realloc (d->tape,
+				d->cap * sizeof *tape, cap * sizeof *tape);
+		if (tape == NULL) {
+			return NULL;
+		}
+		d->tape = tape;
+		d->cap = cap;
+	}
+	return &d->tape[d->count++];
+}
+
+static int
+dom_table (SpJsonDom *d, uint32_t obj)
+{
+	SpJsonNode *o = &d->tape[obj];
+	size_t size = sp_power_of_2 ((size_t)o->len * 2);
+	uint32_t *t = sp_arena_alloc (&d->arena, size * sizeof *t);
+	if (t == NULL) {
+		return SP_ESYSTEM (errno);
+	}
+	memset (t, 0, size * sizeof *t);
+
+	// keys are inserted in document order so lookups find the first duplicate
+	uint32_t k = obj + 1;
+	for (uint32_t i = 0; i < o->len; i++, k = d->tape[k + 1].next) {
+		const SpJsonNode *key = &d->tape[k];
+		size_t s = dom_hash (key->as.str, key->len) & (size - 1);
+		while (t[s]) {
+			s = (s + 1) & (size - 1);
+		}
+		t[s] = k;
+	}
+	o->as.table = t;
+	return 0;
+}
+
+static int
+dom_elements (SpJsonDom *d, uint32_t arr)
+{
+	SpJsonNode *a = &d->tape[arr];
+	uint32_t *t = sp_arena_alloc (&d->arena, (size_t)a->len * sizeof *t);
+	if (t == NULL) {
+		return SP_ESYSTEM (errno);
+	}
+
+	uint32_t pos = arr + 1;
+	for (uint32_t i = 0; i < a->len; i++, pos = d->tape[pos].next) {
+		t[i] = pos;
+	}
+	a->as.table = t;
+	return 0;
+}
+
+static int
+dom_string (SpJsonDom *d, SpJsonNode *n, const uint8_t *m)
+{
+	SpJson *p = &d->parser;
+
+	if (!p->escaped) {
+		n->as.str = m + p->raw.off;
+		n->len = p->raw.len;
+		return 0;
+	}
+
+	ssize_t rc = sp_json_decode_string (p, m);
+	if (rc < 0) {
+		return (int)rc;
+	}
+	uint8_t *copy = sp_arena_alloc (&d->arena, rc);
+	if (copy == NULL) {
+		return SP_ESYSTEM (errno);
+	}
+	memcpy (copy, p->utf8.buf, rc);
+	n->as.str = copy;
+	n->len = (uint32_t)rc;
+	return 0;
+}
+
+void
+sp_json_dom_init (SpJsonDom *d)
+{
+	assert (d != NULL);
+
+	d->tape = NULL;
+	d->count = 0;
+	d->cap = 0;
+	sp_arena_init (&d->arena, 0);
+	sp_json_init (&d->parser);
+	sp_json_use_lazy_strings (&d->parser, true);
+}
+
+void
+sp_json_dom_final (SpJsonDom *d)
+{
+	assert (d != NULL);
+
+	if (d->tape != NULL) {
+		sp_free (d->tape, d->cap * sizeof *d->tape);
+		d->tape = NULL;
+	}
+	d->count = 0;
+	d->cap = 0;
+	sp_arena_final (&d->arena);
+	sp_json_final (&d->parser);
+}
+
+int
+sp_json_dom_parse (SpJsonDom *d, const void *buf, size_t len)
+{
+	assert (d != NULL);
+	assert (buf != NULL);
+
+	if (len > UINT32_MAX) {
+		return SP_JSON_ESIZE;
+	}
+
+	SpJson *p = &d->parser;
+	sp_json_reset (p);
+	sp_arena_reset (&d->arena);
+	d->count = 0;
+
+	int rc = sp_json_index (p, buf, len);
+	if (rc < 0) {
+		return rc;
+	}
+
+	const uint8_t *m = buf;
+	size_t off = 0;
+	uint32_t open = DOM_NONE;
+
+	while (!sp_json_is_done (p)) {
+		ssize_t n = sp_json_next (p, m + off, len - off, true);
+		if (n <= 0) {
+			return n < 0 ? (int)n : SP_JSON_ESYNTAX;
+		}
+		const uint8_t *start = m + off;
+		off += n;
+
+		if (p->type == SP_JSON_NONE) {
+			continue;
+		}
+		if (p->type == SP_JSON_OBJECT_END || p->type == SP_JSON_ARRAY_END) {
+			SpJsonNode *c = &d->tape[open];
+			uint32_t parent = c->next;
+			c->next = (uint32_t)d->count;
+			if (c->type == SP_JSON_OBJECT && c->len >= SP_JSON_DOM_HASH_MIN) {
+				rc = dom_table (d, open);
+				if (rc < 0) {
+					return rc;
+				}
+			}
+			else if (c->type == SP_JSON_ARRAY && c->len >= SP_JSON_DOM_INDEX_MIN) {
+				rc = dom_elements (d, open);
+				if (rc < 0) {
+					return rc;
+				}
+			}
+			open = parent;
+			continue;
+		}
+
+		// elements and keys are counted, object values are not
+		if (open != DOM_NONE &&
+				(d->tape[open].type == SP_JSON_ARRAY || sp_json_is_key (p))) {
+			d->tape[open].len++;
+		}
+
+		SpJsonNode *node = dom_push (d);
+		if (node == NULL) {
+			return SP_ESYSTEM (errno);
+		}
+		uint32_t pos = (uint32_t)(d->count - 1);
+		node->next = pos + 1;
+		node->len = 0;
+		node->type = (uint8_t)p->type;
+		node->integral = false;
+		node->negative = false;
+		node->as.u64 = 0;
+
+		switch (p->type) {
+		case SP_JSON_OBJECT:
+		case SP_JSON_ARRAY:
+			node->next = open;
+			node->as.table = NULL;
+			open = pos;
+			break;
+		case SP_JSON_STRING:
+			rc = dom_string (d, node, start);
+			if (rc < 0) {
+				return rc;
+			}
+			break;
+		case SP_JSON_NUMBER:
+			// -0 is kept as a double to preserve the sign
+			if (p->integral && !(p->integer.u64 == 0 && signbit (p->number))) {
+				node->integral = true;
+				node->negative = p->number < 0;
+				node->as.u64 = p->integer.u64;
+			}
+			else {
+				node->as.number = p->number;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	// only whitespace may follow the root value
+	if (p->index.cur != p->index.count ||
+			skip_whitespace (m + off, m + len) != m + len) {
+		return SP_JSON_ESYNTAX;
+	}
+	return 0;
+}
+
+uint32_t
+sp_json_dom_get (const SpJsonDom *d, uint32_t obj, const void *key, size_t len)
+{
+	assert (d != NULL);
+	assert (obj < d->count);
+
+	const SpJsonNode *o = &d->tape[obj];
+	if (o->type != SP_JSON_OBJECT) {
+		return 0;
+	}
+
+	if (o->as.table != NULL) {
+		size_t mask = sp_power_of_2 ((size_t)o->len * 2) - 1;
+		for (size_t s = dom_hash (key, len) & mask; o->as.table[s];
+				s = (s + 1) & mask) {
+			uint32_t k = o->as.table[s];
+			if (dom_key_eq (&d->tape[k], key, len)) {
+				return k + 1;
+			}
+		}
+		return 0;
+	}
+
+	uint32_t k = obj + 1;
+	for (uint32_t i = 0; i < o->len; i++, k = d->tape[k + 1].next) {
+		if (dom_key_eq (&d->tape[k], key, len)) {
+			return k + 1;
+		}
+	}
+	return 0;
+}
+
+uint32_t
+sp_json_dom_at (const SpJsonDom *d, uint32_t arr, uint32_t idx)
+{
+	assert (d != NULL);
+	assert (arr < d->count);
+
+	const SpJsonNode *a = &d->tape[arr];
+	if (a->type != SP_JSON_ARRAY || idx >= a->len) {
+		return 0;
+	}
+
+	if (a->as.table != NULL) {
+		return a->as.table[idx];
+	}
+
+	// small arrays are walked, which is bounded by SP_JSON_DOM_INDEX_MIN
+	uint32_t pos = arr + 1;
+	for (; idx > 0; idx--) {
+		pos = d->tape[pos].next;
+	}
+	return pos;
+}
+
+double
+sp_json_dom_number (const SpJsonDom *d, uint32_t pos)
+{
+	assert (d != NULL);
+	assert (pos < d->count);
+
+	const SpJsonNode *n = &d->tape[pos];
+	if (!n->integral) {
+		return n->as.number;
+	}
+	return n->negative ? (double)n->as.i64 : (double)n->as.u64;
+}
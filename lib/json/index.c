@@ -0,0 +1,572 @@
+#include "../cpu.h"
+#include "../../include/siphon/alloc.h"
+
+#include <errno.h>
+
+/**
+ * Stage one of the indexed mode classifies each 64 byte block into bit masks
+ * and reduces them to the positions of structural characters: brackets,
+ * colons and commas outside of strings, both quotes of every string, and the
+ * first byte of every other scalar. Stage two walks those positions rather
+ * than scanning the bytes between them.
+ */
+
+typedef struct {
+	uint64_t quote;      // '"'
+	uint64_t backslash;  // '\\'
+	uint64_t op;         // '{', '}', '[', ']', ':', ','
+	uint64_t ws;         // ' ', '\t', '\n', '\r'
+} IndexBlock;
+
+typedef struct {
+	uint64_t escaped;    // first byte of the next block is escaped
+	uint64_t in_string;  // all ones when the next block starts within a string
+	uint64_t scalar;     // last byte of the previous block continues a scalar
+} IndexState;
+
+typedef size_t (*IndexKernel) (IndexState *st, const uint8_t *buf, size_t len,
+		uint32_t *out);
+
+static inline uint64_t
+prefix_xor (uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/**
+ * Reduces the character masks for the block at `base` to structural
+ * positions. Runs of backslashes are resolved by the parity of their start
+ * so that only odd-length runs escape the next byte.
+ */
+static inline size_t
+index_block (IndexState *st, const IndexBlock *b, uint32_t base, uint32_t *out)
+{
+	static const uint64_t even = 0x5555555555555555ULL;
+
+	uint64_t bs = b->backslash & ~st->escaped;
+	uint64_t follows = (bs << 1) | st->escaped;
+	uint64_t odd_starts = bs & ~even & ~follows;
+	uint64_t even_seq = odd_starts + bs;
+	st->escaped = even_seq < bs;
+	uint64_t escaped = (even ^ (even_seq << 1)) & follows;
+
+	uint64_t quote = b->quote & ~escaped;
+	uint64_t in_string = prefix_xor (quote) ^ st->in_string;
+	st->in_string = (uint64_t)((int64_t)in_string >> 63);
+
+	uint64_t scalar = ~(b->op | b->ws);
+	uint64_t nonquote = scalar & ~quote;
+	uint64_t follows_scalar = (nonquote << 1) | st->scalar;
+	st->scalar = nonquote >> 63;
+
+	// string bodies are dropped but both of their quotes are kept
+	uint64_t mask = ((b->op | (scalar & ~follows_scalar)) & ~in_string) | quote;
+
+	size_t n = 0;
+	while (mask) {
+		out[n++] = base + (uint32_t)__builtin_ctzll (mask);
+		mask &= mask - 1;
+	}
+	return n;
+}
+
+// the final partial block is padded with whitespace
+#define INDEX_KERNEL(name, target, classify)                                  \
+target static size_t                                                          \
+name (IndexState *st, const uint8_t *buf, size_t len, uint32_t *out)          \
+{                                                                             \
+	IndexBlock b;                                                             \
+	size_t n = 0, off = 0;                                                    \
+	for (; len - off >= 64; off += 64) {                                      \
+		classify (buf + off, &b);                                             \
+		n += index_block (st, &b, (uint32_t)off, out + n);                    \
+	}                                                                         \
+	if (off < len) {                                                          \
+		uint8_t tail[64];                                                     \
+		memset (tail, ' ', sizeof tail);                                      \
+		memcpy (tail, buf + off, len - off);                                  \
+		classify (tail, &b);                                                  \
+		n += index_block (st, &b, (uint32_t)off, out + n);                    \
+	}                                                                         \
+	return n;                                                                 \
+}
+
+#if !SP_CPU_X86 || !defined (__SSE2__)
+
+enum {
+	CLS_QUOTE = 1,
+	CLS_BACKSLASH = 2,
+	CLS_OP = 4,
+	CLS_WS = 8
+};
+
+static const uint8_t index_class[256] = {
+	['"'] = CLS_QUOTE, ['\\'] = CLS_BACKSLASH,
+	['{'] = CLS_OP, ['}'] = CLS_OP, ['['] = CLS_OP, [']'] = CLS_OP,
+	[':'] = CLS_OP, [','] = CLS_OP,
+	[' '] = CLS_WS, ['\t'] = CLS_WS, ['\n'] = CLS_WS, ['\r'] = CLS_WS
+};
+
+static inline void
+classify_base (const uint8_t *s, IndexBlock *b)
+{
+	memset (b, 0, sizeof *b);
+	for (unsigned i = 0; i < 64; i++) {
+		uint64_t bit = 1ULL << i;
+		switch (index_class[s[i]]) {
+		case CLS_QUOTE:     b->quote |= bit; break;
+		case CLS_BACKSLASH: b->backslash |= bit; break;
+		case CLS_OP:        b->op |= bit; break;
+		case CLS_WS:        b->ws |= bit; break;
+		}
+	}
+}
+
+INDEX_KERNEL (index_base, , classify_base)
+
+#endif
+
+#if SP_CPU_X86
+
+#ifdef __SSE2__
+
+static inline void
+classify_sse2 (const uint8_t *s, IndexBlock *b)
+{
+	const __m128i quote = _mm_set1_epi8 ('"');
+	const __m128i bslash = _mm_set1_epi8 ('\\');
+	const __m128i lower = _mm_set1_epi8 (0x20);
+	const __m128i open = _mm_set1_epi8 ('{');
+	const __m128i close = _mm_set1_epi8 ('}');
+	const __m128i colon = _mm_set1_epi8 (':');
+	const __m128i comma = _mm_set1_epi8 (',');
+	const __m128i sp = _mm_set1_epi8 (' ');
+	const __m128i tab = _mm_set1_epi8 ('\t');
+	const __m128i nl = _mm_set1_epi8 ('\n');
+	const __m128i cr = _mm_set1_epi8 ('\r');
+
+	memset (b, 0, sizeof *b);
+	for (unsigned i = 0; i < 4; i++) {
+		__m128i v = _mm_loadu_si128 ((const __m128i *)(s + i*16));
+		// folding 0x20 maps '[' and ']' onto '{' and '}'
+		__m128i f = _mm_or_si128 (v, lower);
+		__m128i op = _mm_or_si128 (
+				_mm_or_si128 (_mm_cmpeq_epi8 (f, open), _mm_cmpeq_epi8 (f, close)),
+				_mm_or_si128 (_mm_cmpeq_epi8 (v, colon), _mm_cmpeq_epi8 (v, comma)));
+		__m128i ws = _mm_or_si128 (
+				_mm_or_si128 (_mm_cmpeq_epi8 (v, sp), _mm_cmpeq_epi8 (v, tab)),
+				_mm_or_si128 (_mm_cmpeq_epi8 (v, nl), _mm_cmpeq_epi8 (v, cr)));
+		unsigned sh = i * 16;
+		b->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, quote)) << sh;
+		b->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, bslash)) << sh;
+		b->op |= (uint64_t)(uint16_t)_mm_movemask_epi8 (op) << sh;
+		b->ws |= (uint64_t)(uint16_t)_mm_movemask_epi8 (ws) << sh;
+	}
+}
+
+INDEX_KERNEL (index_sse2, , classify_sse2)
+
+#endif
+
+SP_TARGET_AVX2 static inline void
+classify_avx2 (const uint8_t *s, IndexBlock *b)
+{
+	const __m256i quote = _mm256_set1_epi8 ('"');
+	const __m256i bslash = _mm256_set1_epi8 ('\\');
+	const __m256i lower = _mm256_set1_epi8 (0x20);
+	const __m256i open = _mm256_set1_epi8 ('{');
+	const __m256i close = _mm256_set1_epi8 ('}');
+	const __m256i colon = _mm256_set1_epi8 (':');
+	const __m256i comma = _mm256_set1_epi8 (',');
+	const __m256i sp = _mm256_set1_epi8 (' ');
+	const __m256i tab = _mm256_set1_epi8 ('\t');
+	const __m256i nl = _mm256_set1_epi8 ('\n');
+	const __m256i cr = _mm256_set1_epi8 ('\r');
+
+	memset (b, 0, sizeof *b);
+	for (unsigned i = 0; i < 2; i++) {
+		__m256i v = _mm256_loadu_si256 ((const __m256i *)(s + i*32));
+		__m256i f = _mm256_or_si256 (v, lower);
+		__m256i op = _mm256_or_si256 (
+				_mm256_or_si256 (_mm256_cmpeq_epi8 (f, open), _mm256_cmpeq_epi8 (f, close)),
+				_mm256_or_si256 (_mm256_cmpeq_epi8 (v, colon), _mm256_cmpeq_epi8 (v, comma)));
+		__m256i ws = _mm256_or_si256 (
+				_mm256_or_si256 (_mm256_cmpeq_epi8 (v, sp), _mm256_cmpeq_epi8 (v, tab)),
+				_mm256_or_si256 (_mm256_cmpeq_epi8 (v, nl), _mm256_cmpeq_epi8 (v, cr)));
+		unsigned sh = i * 32;
+		b->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, quote)) << sh;
+		b->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, bslash)) << sh;
+		b->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8 (op) << sh;
+		b->ws |= (uint64_t)(uint32_t)_mm256_movemask_epi8 (ws) << sh;
+	}
+}
+
+INDEX_KERNEL (index_avx2, SP_TARGET_AVX2, classify_avx2)
+
+SP_TARGET_AVX512 static inline void
+classify_avx512 (const uint8_t *s, IndexBlock *b)
+{
+	__m512i v = _mm512_loadu_si512 ((const void *)s);
+	__m512i f = _mm512_or_si512 (v, _mm512_set1_epi8 (0x20));
+
+	b->quote = _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('"'));
+	b->backslash = _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\\'));
+	b->op = _mm512_cmpeq_epi8_mask (f, _mm512_set1_epi8 ('{')) |
+		_mm512_cmpeq_epi8_mask (f, _mm512_set1_epi8 ('}')) |
+		_mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 (':')) |
+		_mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 (','));
+	b->ws = _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 (' ')) |
+		_mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\t')) |
+		_mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\n')) |
+		_mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\r'));
+}
+
+INDEX_KERNEL (index_avx512, SP_TARGET_AVX512, classify_avx512)
+
+#endif
+
+static size_t index_resolve (IndexState *st, const uint8_t *buf, size_t len,
+		uint32_t *pos);
+
+static IndexKernel index_kernel = index_resolve;
+
+// the first index selects the kernel and then runs through it
+static size_t
+index_resolve (IndexState *st, const uint8_t *buf, size_t len, uint32_t *pos)
+{
+	sp_cpu_init ();
+	return index_kernel (st, buf, len, pos);
+}
+
+void
+sp_json_select (unsigned features)
+{
+#if SP_CPU_X86
+# ifdef __SSE2__
+	index_kernel = index_sse2;
+# else
+	index_kernel = index_base;
+# endif
+	if (features & SP_CPU_AVX512BW) {
+		index_kernel = index_avx512;
+	}
+	else if (features & SP_CPU_AVX2) {
+		index_kernel = index_avx2;
+	}
+#else
+	(void)features;
+	index_kernel = index_base;
+#endif
+}
+
+int
+sp_json_index (SpJson *p, const void *buf, size_t len)
+{
+	assert (p != NULL);
+	assert (buf != NULL || len == 0);
+
+	if (len >= UINT32_MAX) {
+		return SP_JSON_ESIZE;
+	}
+
+	// every byte may be structural, plus one extra for the block tail
+	size_t cap = len + 1;
+	if (cap > p->index.cap) {
+		uint32_t *pos = sp_realloc (p->index.pos,
+				p->index.cap * sizeof *pos, cap * sizeof *pos);
+		if (pos == NULL) {
+			return SP_ESYSTEM (errno);
+		}
+		p->index.pos = pos;
+		p->index.cap = cap;
+	}
+
+	IndexState st = { 0, 0, 0 };
+	size_t n = index_kernel (&st, buf, len, p->index.pos);
+	if (st.in_string) {
+		p->index.count = 0;
+		return SP_JSON_ESYNTAX;
+	}
+
+	sp_utf8_reset (&p->utf8);
+	init_values (p);
+	p->index.base = buf;
+	p->index.len = len;
+	p->index.count = n;
+	p->index.cur = 0;
+	return 0;
+}
+
+static inline bool
+index_gap (const uint8_t *s, const uint8_t *e)
+{
+	for (; s < e; s++) {
+		if (*s != ' ' && *s != '\t' && *s != '\n' && *s != '\r') {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Yields the next token by walking the structural index.
+ */
+static ssize_t
+parse_indexed (SpJson *restrict p, const uint8_t *restrict m, size_t len)
+{
+	const uint8_t *base = p->index.base;
+	const uint32_t *pos = p->index.pos;
+	const uint8_t *end;
+
+	if (m < base || m + len > base + p->index.len) {
+		YIELD_ERROR (SP_JSON_ESTATE);
+	}
+
+again:
+	if (p->index.cur == p->index.count) {
+		YIELD_ERROR (SP_JSON_ESYNTAX);
+	}
+
+	end = base + pos[p->index.cur];
+
+	switch (p->cs) {
+	case KIND_ANY:
+		goto value;
+
+	case ARRAY_FIRST:
+		if (*end != ']') {
+			goto value;
+		}
+		// fallthrough
+	case ARRAY_NEXT:
+		if (*end == ']') {
+			p->index.cur++;
+			end++;
+			if (STACK_POP_ARR (p)) {
+				YIELD_STACK (SP_JSON_ARRAY_END);
+			}
+		}
+		else if (*end == ',' && p->cs == ARRAY_NEXT) {
+			p->index.cur++;
+			p->cs = KIND_ANY;
+			goto again;
+		}
+		break;
+
+	case OBJECT_FIRST:
+	case OBJECT_NEXT:
+		if (*end == '}') {
+			p->index.cur++;
+			end++;
+			if (STACK_POP_OBJ (p)) {
+				YIELD_STACK (SP_JSON_OBJECT_END);
+			}
+		}
+		else if (*end == ',' && p->cs == OBJECT_NEXT) {
+			p->index.cur++;
+			p->cs = OBJECT_KEY;
+			goto again;
+		}
+		else if (*end == '"' && p->cs == OBJECT_FIRST) {
+			p->cs = KIND_KEY;
+			goto value;
+		}
+		break;
+
+	case OBJECT_KEY:
+		if (*end == '"') {
+			p->cs = KIND_KEY;
+			goto value;
+		}
+		break;
+
+	case OBJECT_SEP:
+		if (*end == ':') {
+			p->index.cur++;
+			p->cs = KIND_ANY;
+			goto again;
+		}
+		break;
+	}
+	YIELD_ERROR (SP_JSON_ESYNTAX);
+
+value:
+	p->index.cur++;
+	switch (*end) {
+	case '{':
+		STACK_PUSH_OBJ (p);
+		end++;
+		YIELD (SP_JSON_OBJECT, OBJECT_FIRST);
+
+	case '[':
+		STACK_PUSH_ARR (p);
+		end++;
+		YIELD (SP_JSON_ARRAY, ARRAY_FIRST);
+
+	case '"': {
+		// stage one pairs every opening quote with its closing quote
+		const uint8_t *close = base + pos[p->index.cur++];
+		ssize_t rc;
+		if (p->lazy) {
+			sp_utf8_reset (&p->utf8);
+			p->raw.off = end + 1 - m;
+			p->raw.len = close - end - 1;
+			rc = string_check (end + 1, close, &p->escaped);
+		}
+		else {
+			rc = string_decode (p, end + 1, close);
+		}
+		if (rc < 0) {
+			YIELD_ERROR (rc);
+		}
+		end = close + 1;
+		YIELD (SP_JSON_STRING, p->cs == KIND_KEY ? OBJECT_SEP : YIELD_CS (p));
+	}
+	}
+
+	const uint8_t *doc_end = base + p->index.len;
+	const uint8_t *next = p->index.cur < p->index.count ?
+		base + pos[p->index.cur] : doc_end;
+	SpJsonType type;
+
+	switch (*end) {
+	case '-': case '.': case '0': case '1': case '2': case '3':
+	case '4': case '5': case '6': case '7': case '8': case '9': {
+		size_t n = doc_end - end;
+		ssize_t rc = number_convert (p, end, n > 512 ? 512 : n);
+		if (rc == 0) {
+			rc = n > 512 ? SP_JSON_ESIZE : SP_JSON_ESYNTAX;
+		}
+		if (rc < 0) {
+			YIELD_ERROR (rc);
+		}
+		end += rc;
+		type = SP_JSON_NUMBER;
+		break;
+	}
+	case 't':
+		if (doc_end - end < 4 || memcmp (end, "true", 4) != 0) {
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		}
+		end += 4;
+		type = SP_JSON_TRUE;
+		break;
+	case 'f':
+		if (doc_end - end < 5 || memcmp (end, "false", 5) != 0) {
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		}
+		end += 5;
+		type = SP_JSON_FALSE;
+		break;
+	case 'n':
+		if (doc_end - end < 4 || memcmp (end, "null", 4) != 0) {
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		}
+		end += 4;
+		type = SP_JSON_NULL;
+		break;
+	default:
+		YIELD_ERROR (SP_JSON_ESYNTAX);
+	}
+
+	// scalars must be followed by whitespace up to the next structural
+	if (end > next || !index_gap (end, next)) {
+		YIELD_ERROR (SP_JSON_ESYNTAX);
+	}
+	YIELD_STACK (type);
+}
+
+/**
+ * Skips a value using only the structural offsets. Strings occupy a pair of
+ * offsets so their contents are never visited.
+ */
+static ssize_t
+index_skip (SpJson *restrict p, const uint8_t *restrict m, size_t len)
+{
+	const uint8_t *base = p->index.base;
+	const uint32_t *pos = p->index.pos;
+	const uint8_t *end;
+	size_t cur = p->index.cur, count = p->index.count;
+	uint32_t depth = 0;
+	SpJsonType type;
+
+	if (m < base || m + len > base + p->index.len) {
+		YIELD_ERROR (SP_JSON_ESTATE);
+	}
+
+	bool value = p->cs != KIND_SKIP;
+	if (value) {
+		if (p->cs == KIND_SKIP_NEXT && cur < count && base[pos[cur]] == ']') {
+			if (!STACK_POP_ARR (p)) {
+				YIELD_ERROR (SP_JSON_ESYNTAX);
+			}
+			type = SP_JSON_ARRAY_END;
+			end = base + pos[cur++] + 1;
+			goto done;
+		}
+		if (p->cs != KIND_SKIP_ANY) {
+			uint8_t sep = p->cs == KIND_SKIP_SEP ? ':' : ',';
+			if (cur >= count || base[pos[cur]] != sep) {
+				YIELD_ERROR (SP_JSON_ESYNTAX);
+			}
+			cur++;
+		}
+		if (cur >= count) {
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		}
+		end = base + pos[cur++];
+		switch (*end) {
+		case '{': case '[':
+			depth = 1;
+			break;
+		case '"':
+			end = base + pos[cur++] + 1;
+			type = SP_JSON_STRING;
+			goto done;
+		case '}': case ']': case ',': case ':':
+			YIELD_ERROR (SP_JSON_ESYNTAX);
+		default:
+			type = *end == 't' ? SP_JSON_TRUE :
+				*end == 'f' ? SP_JSON_FALSE :
+				*end == 'n' ? SP_JSON_NULL : SP_JSON_NUMBER;
+			end = cur < count ? base + pos[cur] : base + p->index.len;
+			goto done;
+		}
+	}
+
+	for (; cur < count; cur++) {
+		uint8_t c = base[pos[cur]];
+		if (c == '"') {
+			cur++;
+		}
+		else if (c == '{' || c == '[') {
+			depth++;
+		}
+		else if (c == '}' || c == ']') {
+			if (depth == 0) {
+				if (c == '}' ? !STACK_POP_OBJ (p) : !STACK_POP_ARR (p)) {
+					YIELD_ERROR (SP_JSON_ESYNTAX);
+				}
+				type = c == '}' ? SP_JSON_OBJECT_END : SP_JSON_ARRAY_END;
+				end = base + pos[cur++] + 1;
+				goto done;
+			}
+			if (--depth == 0 && value) {
+				type = c == '}' ? SP_JSON_OBJECT : SP_JSON_ARRAY;
+				end = base + pos[cur++] + 1;
+				goto done;
+			}
+		}
+	}
+	YIELD_ERROR (SP_JSON_ESYNTAX);
+
+done:
+	p->index.cur = cur;
+	YIELD_STACK (type);
+}
@@ -0,0 +1,468 @@
+#include "../../include/siphon/error.h"
+#include "../../include/siphon/alloc.h"
+
+#include <errno.h>
+#include <string.h>
+
+/**
+ * Queries compile a set of paths into a trie of steps. While streaming, each
+ * tracked container keeps the trie nodes that reached it, and the members or
+ * elements of the container advance those nodes by one step. Values that no
+ * node can reach are handed to `sp_json_skip` so they are never tokenized.
+ * A value reached by the last step of a path is yielded along with every
+ * token within it.
+ */
+
+#define QUERY_KEY   1 // .name, ['name']
+#define QUERY_INDEX 2 // [n]
+#define QUERY_ANY   3 // .*, [*]
+
+typedef struct {
+	const char *key;
+	size_t keylen;
+	uint32_t index;
+	uint8_t kind;
+} QueryStep;
+
+static ssize_t
+query_parse (const char *path, size_t len, QueryStep *steps)
+{
+	const char *s = path, *e = path + len;
+	ssize_t n = 0;
+
+	if (s == e || *s != '$') {
+		return SP_JSON_EPATH;
+	}
+
+	for (s++; s < e; n++) {
+		if (n == SP_JSON_QUERY_DEPTH) {
+			return SP_JSON_EPATH;
+		}
+		QueryStep *st = &steps[n];
+		if (*s == '.') {
+			const char *start = ++s;
+			while (s < e && *s != '.' && *s != '[') {
+				s++;
+			}
+			if (s == start) {
+				return SP_JSON_EPATH;
+			}
+			if (s - start == 1 && *start == '*') {
+				st->kind = QUERY_ANY;
+			}
+			else {
+				st->kind = QUERY_KEY;
+				st->key = start;
+				st->keylen = s - start;
+			}
+		}
+		else if (*s == '[') {
+			if (++s == e) {
+				return SP_JSON_EPATH;
+			}
+			if (*s == '*') {
+				st->kind = QUERY_ANY;
+				s++;
+			}
+			else if (*s == '\'' || *s == '"') {
+				const char *start = ++s;
+				const char *end = memchr (start, start[-1], e - start);
+				if (end == NULL || memchr (start, '\\', end - start)) {
+					return SP_JSON_EPATH;
+				}
+				st->kind = QUERY_KEY;
+				st->key = start;
+				st->keylen = end - start;
+				s = end + 1;
+			}
+			else if (*s >= '0' && *s <= '9') {
+				uint64_t idx = 0;
+				for (; s < e && *s >= '0' && *s <= '9'; s++) {
+					idx = idx*10 + (*s - '0');
+					if (idx > UINT32_MAX) {
+						return SP_JSON_EPATH;
+					}
+				}
+				st->kind = QUERY_INDEX;
+				st->index = (uint32_t)idx;
+			}
+			else {
+				return SP_JSON_EPATH;
+			}
+			if (s == e || *s++ != ']') {
+				return SP_JSON_EPATH;
+			}
+		}
+		else {
+			return SP_JSON_EPATH;
+		}
+	}
+
+	return n;
+}
+
+static bool
+query_step_eq (const SpJsonQueryNode *node, const QueryStep *st)
+{
+	if (node->kind != st->kind) {
+		return false;
+	}
+	switch (st->kind) {
+	case QUERY_KEY:
+		return node->keylen == st->keylen &&
+			memcmp (node->key, st->key, st->keylen) == 0;
+	case QUERY_INDEX:
+		return node->index == st->index;
+	}
+	return true;
+}
+
+static int
+query_reserve (SpJsonQuery *q, size_t nodes)
+{
+	if (nodes > q->ncap) {
+		size_t cap = q->ncap ? q->ncap : 16;
+		while (cap < nodes) {
+			cap *= 2;
+		}
+		SpJsonQueryNode *n = sp_realloc (q->nodes,
+				q->ncap * sizeof *n, cap * sizeof *n);
+		if (n == NULL) {
+			return SP_ESYSTEM (errno);
+		}
+		q->nodes = n;
+		q->ncap = (uint16_t)cap;
+	}
+
+	// every tracked container holds at most one state per node, and the
+	// scratch space past the last frame needs the same, so streaming never
+	// has to allocate
+	size_t scap = nodes * (SP_JSON_QUERY_DEPTH + 1);
+	if (scap > q->scap) {
+		uint16_t *s = sp_realloc (q->states,
+				q->scap * sizeof *s, scap * sizeof *s);
+		if (s == NULL) {
+			return SP_ESYSTEM (errno);
+		}
+		q->states = s;
+		q->scap = scap;
+	}
+	return 0;
+}
+
+static uint16_t
+query_advance (SpJsonQuery *q, size_t first, uint16_t count,
+		const uint8_t *key, size_t keylen, uint32_t index, bool object)
+{
+	uint16_t *out = q->states + q->nstates;
+	uint16_t n = 0;
+
+	for (uint16_t i = 0; i < count; i++) {
+		for (uint16_t c = q->nodes[q->states[first + i]].child; c;
+				c = q->nodes[c].sibling) {
+			const SpJsonQueryNode *node = &q->nodes[c];
+			bool hit;
+			switch (node->kind) {
+			case QUERY_KEY:
+				hit = object && node->keylen == keylen &&
+					memcmp (node->key, key, keylen) == 0;
+				break;
+			case QUERY_INDEX:
+				hit = !object && node->index == index;
+				break;
+			default:
+				hit = true;
+				break;
+			}
+			if (hit) {
+				out[n++] = c;
+			}
+		}
+	}
+	return n;
+}
+
+static ssize_t
+query_key (SpJsonQuery *q, SpJson *p, const uint8_t *m)
+{
+	const uint8_t *key = p->utf8.buf;
+	size_t keylen = p->utf8.len;
+
+	if (p->lazy) {
+		if (p->escaped) {
+			ssize_t rc = sp_json_decode_string (p, m);
+			if (rc < 0) {
+				return rc;
+			}
+			key = p->utf8.buf;
+			keylen = p->utf8.len;
+		}
+		else {
+			key = m + p->raw.off;
+			keylen = p->raw.len;
+		}
+	}
+
+	const SpJsonQueryFrame *f = &q->frames[q->nframes - 1];
+	q->pending = query_advance (q, f->first, f->count, key, keylen, 0, true);
+	return 0;
+}
+
+static inline uint64_t
+query_emitting (const SpJsonQuery *q)
+{
+	return q->nemit ? q->emit_mask[q->nemit - 1] : 0;
+}
+
+/**
+ * Applies a yielded token to the query.
+ *
+ * @return  1 if the token is matched, 0 if not, or an error code
+ */
+static ssize_t
+query_token (SpJsonQuery *q, SpJson *p, const uint8_t *m)
+{
+	SpJsonQueryFrame *f = q->nframes ? &q->frames[q->nframes - 1] : NULL;
+
+	if (p->type == SP_JSON_OBJECT_END || p->type == SP_JSON_ARRAY_END) {
+		if (f != NULL && f->depth == p->depth + 1) {
+			q->nstates = f->first;
+			q->nframes--;
+		}
+		q->pending = 0;
+		q->match = query_emitting (q);
+		if (q->nemit && q->emit[q->nemit - 1] > p->depth) {
+			q->nemit--;
+		}
+		return q->match != 0;
+	}
+
+	if (p->type == SP_JSON_STRING && sp_json_is_key (p)) {
+		q->pending = 0;
+		if (f != NULL && f->depth == p->depth) {
+			ssize_t rc = query_key (q, p, m);
+			if (rc < 0) {
+				return rc;
+			}
+		}
+		if (q->nemit) {
+			q->match = query_emitting (q);
+			return 1;
+		}
+		if (q->pending == 0) {
+			q->skipping = true;
+		}
+		return 0;
+	}
+
+	bool container = p->type == SP_JSON_OBJECT || p->type == SP_JSON_ARRAY;
+	uint16_t parent = container ? p->depth - 1 : p->depth;
+	uint16_t n = 0;
+
+	if (parent == 0) {
+		q->states[q->nstates] = 0;
+		n = 1;
+	}
+	else if (f != NULL && f->depth == parent) {
+		if (f->object) {
+			n = q->pending;
+			q->pending = 0;
+		}
+		else {
+			n = query_advance (q, f->first, f->count, NULL, 0, f->index++, false);
+		}
+	}
+
+	uint64_t mask = 0;
+	bool children = false;
+	for (uint16_t i = 0; i < n; i++) {
+		const SpJsonQueryNode *node = &q->nodes[q->states[q->nstates + i]];
+		mask |= node->mask;
+		children |= node->child != 0;
+	}
+
+	q->match = mask | query_emitting (q);
+	if (container) {
+		if (children) {
+			assert (q->nframes < SP_JSON_QUERY_DEPTH);
+			f = &q->frames[q->nframes++];
+			f->first = q->nstates;
+			f->count = n;
+			f->depth = p->depth;
+			f->index = 0;
+			f->object = p->type == SP_JSON_OBJECT;
+			q->nstates += n;
+		}
+		else if (q->match == 0) {
+			q->skipping = true;
+			return 0;
+		}
+		// nested matches keep the paths of every matched ancestor
+		if (mask) {
+			assert (q->nemit <= SP_JSON_QUERY_DEPTH);
+			q->emit[q->nemit] = p->depth;
+			q->emit_mask[q->nemit] = q->match;
+			q->nemit++;
+		}
+	}
+	return q->match != 0;
+}
+
+void
+sp_json_query_init (SpJsonQuery *q)
+{
+	assert (q != NULL);
+
+	q->nodes = NULL;
+	q->nnodes = 0;
+	q->ncap = 0;
+	q->states = NULL;
+	q->nstates = 0;
+	q->scap = 0;
+	q->paths = 0;
+	sp_json_query_reset (q);
+}
+
+void
+sp_json_query_reset (SpJsonQuery *q)
+{
+	assert (q != NULL);
+
+	q->nstates = 0;
+	q->nframes = 0;
+	q->pending = 0;
+	q->nemit = 0;
+	q->skipping = false;
+	q->match = 0;
+}
+
+void
+sp_json_query_final (SpJsonQuery *q)
+{
+	assert (q != NULL);
+
+	for (uint16_t i = 0; i < q->nnodes; i++) {
+		if (q->nodes[i].key != NULL) {
+			sp_free (q->nodes[i].key, q->nodes[i].keylen + 1);
+		}
+	}
+	if (q->nodes != NULL) {
+		sp_free (q->nodes, q->ncap * sizeof *q->nodes);
+	}
+	if (q->states != NULL) {
+		sp_free (q->states, q->scap * sizeof *q->states);
+	}
+	sp_json_query_init (q);
+}
+
+int
+sp_json_query_add (SpJsonQuery *q, const char *path, size_t len)
+{
+	assert (q != NULL);
+	assert (path != NULL);
+	assert (q->nframes == 0);
+
+	if (q->paths == SP_JSON_QUERY_MAX) {
+		return SP_JSON_EPATH;
+	}
+
+	QueryStep steps[SP_JSON_QUERY_DEPTH];
+	ssize_t n = query_parse (path, len, steps);
+	if (n < 0) {
+		return (int)n;
+	}
+
+	int rc = query_reserve (q, q->nnodes + n + (q->nnodes == 0));
+	if (rc < 0) {
+		return rc;
+	}
+	if (q->nnodes == 0) {
+		memset (&q->nodes[0], 0, sizeof q->nodes[0]);
+		q->nnodes = 1;
+	}
+
+	uint16_t cur = 0;
+	for (ssize_t i = 0; i < n; i++) {
+		uint16_t c = q->nodes[cur].child, last = 0;
+		for (; c && !query_step_eq (&q->nodes[c], &steps[i]);
+				last = c, c = q->nodes[c].sibling) {}
+		if (c == 0) {
+			c = q->nnodes;
+			SpJsonQueryNode *node = &q->nodes[c];
+			memset (node, 0, sizeof *node);
+			node->kind = steps[i].kind;
+			node->index = steps[i].index;
+			if (node->kind == QUERY_KEY) {
+				node->key = sp_malloc (steps[i].keylen + 1);
+				if (node->key == NULL) {
+					return SP_ESYSTEM (errno);
+				}
+				memcpy (node->key, steps[i].key, steps[i].keylen);
+				node->key[steps[i].keylen] = '\0';
+				node->keylen = (uint32_t)steps[i].keylen;
+			}
+			// appending keeps sibling order stable for the matched states
+			if (last) {
+				q->nodes[last].sibling = c;
+			}
+			else {
+				q->nodes[cur].child = c;
+			}
+			q->nnodes++;
+		}
+		cur = c;
+	}
+
+	q->nodes[cur].mask |= UINT64_C(1) << q->paths;
+	return (int)q->paths++;
+}
+
+ssize_t
+sp_json_query_next (SpJsonQuery *q, SpJson *p,
+		const void *restrict buf, size_t len, bool eof)
+{
+	assert (q != NULL);
+	assert (p != NULL);
+
+	const uint8_t *m = buf;
+	size_t off = 0;
+
+	q->match = 0;
+	if (q->nnodes == 0) {
+		return SP_JSON_ESTATE;
+	}
+
+	while (!sp_json_is_done (p)) {
+		ssize_t rc = q->skipping ?
+			sp_json_skip (p, m + off, len - off, eof) :
+			sp_json_next (p, m + off, len - off, eof);
+		if (rc <= 0) {
+			if (rc < 0) {
+				return rc;
+			}
+			break;
+		}
+
+		size_t start = off;
+		off += rc;
+		if (p->type == SP_JSON_NONE) {
+			continue;
+		}
+		if (q->skipping) {
+			q->skipping = false;
+			continue;
+		}
+
+		rc = query_token (q, p, m + start);
+		if (rc < 0) {
+			return rc;
+		}
+		if (rc > 0) {
+			// make string ranges relative to the caller's buffer
+			p->raw.off += (uint32_t)start;
+			return off;
+		}
+	}
+
+	return off;
+}
@@ -0,0 +1,548 @@
+#include "../../include/siphon/transcode.h"
+#include "../../include/siphon/error.h"
+#include "../../include/siphon/alloc.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+/**
+ * Container counts are not known until a json container closes, so each
+ * container reserves a 5 byte header in the output. When it closes, the
+ * smallest header is written and the body is shifted down over the unused
+ * bytes. The shift is bounded by SP_TRANSCODE_PATCH_MAX: larger bodies keep
+ * the 32-bit header, which is still valid msgpack, so the cost of closing a
+ * container never grows with the size of the document.
+ */
+
+#define TRANSCODE_HDR 5
+
+#define TRANSCODE_ARR32 0xdd
+#define TRANSCODE_MAP32 0xdf
+
+static int
+to_msgpack_push (SpJsonToMsgpack *t, bool map)
+{
+	if (t->nopen == t->cap) {
+		if (t->cap == UINT16_MAX) {
+			return SP_JSON_ESTACK;
+		}
+		size_t cap = t->cap ? t->cap * 2 : 16;
+		if (cap > UINT16_MAX) {
+			cap = UINT16_MAX;
+		}
+		SpTranscodeFrame *open = sp_realloc (t->open,
+				t->cap * sizeof *open, cap * sizeof *open);
+		if (open == NULL) {
+			return SP_ESYSTEM (errno);
+		}
+		t->open = open;
+		t->cap = (uint16_t)cap;
+	}
+
+	int rc = sp_utf8_ensure (&t->out, TRANSCODE_HDR);
+	if (rc < 0) {
+		return rc;
+	}
+	SpTranscodeFrame *f = &t->open[t->nopen++];
+	f->off = t->out.len;
+	f->count = 0;
+	f->map = map;
+	t->out.len += TRANSCODE_HDR;
+	return 0;
+}
+
+static void
+to_msgpack_pop (SpJsonToMsgpack *t)
+{
+	SpTranscodeFrame *f = &t->open[--t->nopen];
+	uint8_t *hdr = t->out.buf + f->off;
+	size_t body = t->out.len - f->off - TRANSCODE_HDR;
+
+	if (body <= SP_TRANSCODE_PATCH_MAX) {
+		size_t n = f->map ?
+			sp_msgpack_enc_map (hdr, f->count) :
+			sp_msgpack_enc_array (hdr, f->count);
+		if (n < TRANSCODE_HDR) {
+			memmove (hdr + n, hdr + TRANSCODE_HDR, body);
+			t->out.len -= TRANSCODE_HDR - n;
+		}
+	}
+	else {
+		uint32_t be = sp_htobe32 (f->count);
+		hdr[0] = f->map ? TRANSCODE_MAP32 : TRANSCODE_ARR32;
+		memcpy (hdr + 1, &be, sizeof be);
+	}
+}
+
+static int
+to_msgpack_string (SpJsonToMsgpack *t, const uint8_t *m)
+{
+	SpJson *p = &t->json;
+	const void *str = m + p->raw.off;
+	size_t len = p->raw.len;
+
+	if (p->escaped) {
+		ssize_t rc = sp_json_decode_string (p, m);
+		if (rc < 0) {
+			return (int)rc;
+		}
+		str = p->utf8.buf;
+		len = (size_t)rc;
+	}
+	if (len > UINT32_MAX) {
+		return SP_JSON_ESIZE;
+	}
+
+	int rc = sp_utf8_ensure (&t->out, SP_MSGPACK_TAG_MAX + len);
+	if (rc < 0) {
+		return rc;
+	}
+	uint8_t *out = t->out.buf + t->out.len;
+	size_t n = sp_msgpack_enc_string (out, (uint32_t)len);
+	memcpy (out + n, str, len);
+	t->out.len += n + len;
+	return 0;
+}
+
+static int
+to_msgpack_scalar (SpJsonToMsgpack *t)
+{
+	SpJson *p = &t->json;
+
+	int rc = sp_utf8_ensure (&t->out, SP_MSGPACK_TAG_MAX);
+	if (rc < 0) {
+		return rc;
+	}
+	uint8_t *out = t->out.buf + t->out.len;
+	size_t n = 0;
+
+	switch (p->type) {
+	case SP_JSON_NUMBER:
+		// -0 is kept as a double to preserve the sign
+		if (!p->integral || (p->integer.u64 == 0 && signbit (p->number))) {
+			n = sp_msgpack_enc_double (out, p->number);
+		}
+		else if (p->number < 0) {
+			n = sp_msgpack_enc_signed (out, p->integer.i64);
+		}
+		else {
+			n = sp_msgpack_enc_unsigned (out, p->integer.u64);
+		}
+		break;
+	case SP_JSON_TRUE:  n = sp_msgpack_enc_true (out); break;
+	case SP_JSON_FALSE: n = sp_msgpack_enc_false (out); break;
+	case SP_JSON_NULL:  n = sp_msgpack_enc_nil (out); break;
+	default:
+		return SP_JSON_ESTATE;
+	}
+	t->out.len += n;
+	return 0;
+}
+
+static int
+to_msgpack_token (SpJsonToMsgpack *t, const uint8_t *m)
+{
+	SpJson *p = &t->json;
+
+	switch (p->type) {
+	case SP_JSON_OBJECT_END:
+	case SP_JSON_ARRAY_END:
+		to_msgpack_pop (t);
+		return 0;
+	default:
+		break;
+	}
+
+	// elements and keys are counted, object values are not
+	if (t->nopen > 0) {
+		SpTranscodeFrame *f = &t->open[t->nopen-1];
+		if (!f->map || sp_json_is_key (p)) {
+			f->count++;
+		}
+	}
+
+	switch (p->type) {
+	case SP_JSON_OBJECT: return to_msgpack_push (t, true);
+	case SP_JSON_ARRAY:  return to_msgpack_push (t, false);
+	case SP_JSON_STRING: return to_msgpack_string (t, m);
+	default:             return to_msgpack_scalar (t);
+	}
+}
+
+void
+sp_json_to_msgpack_init (SpJsonToMsgpack *t)
+{
+	assert (t != NULL);
+
+	sp_json_init (&t->json);
+	sp_json_use_lazy_strings (&t->json, true);
+	sp_utf8_init (&t->out);
+	t->open = NULL;
+	t->nopen = 0;
+	t->cap = 0;
+}
+
+void
+sp_json_to_msgpack_reset (SpJsonToMsgpack *t)
+{
+	assert (t != NULL);
+
+	sp_json_reset (&t->json);
+	sp_utf8_reset (&t->out);
+	t->nopen = 0;
+}
+
+void
+sp_json_to_msgpack_final (SpJsonToMsgpack *t)
+{
+	assert (t != NULL);
+
+	sp_json_final (&t->json);
+	sp_utf8_final (&t->out);
+	if (t->open != NULL) {
+		sp_free (t->open, t->cap * sizeof *t->open);
+		t->open = NULL;
+	}
+	t->nopen = 0;
+	t->cap = 0;
+}
+
+ssize_t
+sp_json_to_msgpack (SpJsonToMsgpack *t,
+		const void *restrict buf, size_t len, bool eof)
+{
+	assert (t != NULL);
+	assert (buf != NULL || len == 0);
+
+	SpJson *p = &t->json;
+	const uint8_t *m = buf;
+	size_t off = 0;
+
+	while (!sp_json_is_done (p)) {
+		ssize_t rc = sp_json_next (p, m + off, len - off, eof);
+		if (rc <= 0) {
+			if (rc < 0) {
+				return rc;
+			}
+			break;
+		}
+		size_t start = off;
+		off += rc;
+		if (p->type == SP_JSON_NONE) {
+			continue;
+		}
+		int err = to_msgpack_token (t, m + start);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	return off;
+}
+
+size_t
+sp_json_to_msgpack_ready (const SpJsonToMsgpack *t)
+{
+	assert (t != NULL);
+
+	// bytes from the first open header onward may still be rewritten
+	return t->nopen > 0 ? t->open[0].off : t->out.len;
+}
+
+void
+sp_json_to_msgpack_consume (SpJsonToMsgpack *t, size_t len)
+{
+	assert (t != NULL);
+	assert (len <= sp_json_to_msgpack_ready (t));
+
+	if (len == 0) {
+		return;
+	}
+	memmove (t->out.buf, t->out.buf + len, t->out.len - len);
+	t->out.len -= len;
+	for (uint16_t i = 0; i < t->nopen; i++) {
+		t->open[i].off -= len;
+	}
+}
+
+bool
+sp_json_to_msgpack_is_done (const SpJsonToMsgpack *t)
+{
+	assert (t != NULL);
+
+	return sp_json_is_done (&t->json);
+}
+
+static const char base64_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Writes binary data as a padded base64 json string.
+ */
+static ssize_t
+to_json_base64 (SpJsonWriter *w, const uint8_t *s, size_t len)
+{
+	size_t start = w->out.len;
+	int rc = writer_begin (w, false);
+	if (rc == 0) {
+		rc = sp_utf8_ensure (&w->out, (len + 2) / 3 * 4 + 2);
+	}
+	if (rc < 0) {
+		return writer_rollback (w, start, rc);
+	}
+
+	uint8_t *out = w->out.buf + w->out.len;
+	*out++ = '"';
+	for (; len >= 3; s += 3, len -= 3) {
+		uint32_t v = (uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2];
+		*out++ = base64_chars[v >> 18];
+		*out++ = base64_chars[(v >> 12) & 0x3f];
+		*out++ = base64_chars[(v >> 6) & 0x3f];
+		*out++ = base64_chars[v & 0x3f];
+	}
+	if (len > 0) {
+		uint32_t v = (uint32_t)s[0] << 16 | (len > 1 ? (uint32_t)s[1] << 8 : 0);
+		*out++ = base64_chars[v >> 18];
+		*out++ = base64_chars[(v >> 12) & 0x3f];
+		*out++ = len > 1 ? base64_chars[(v >> 6) & 0x3f] : '=';
+		*out++ = '=';
+	}
+	*out++ = '"';
+	*out = '\0';
+	w->out.len = out - w->out.buf;
+	writer_end (w);
+	return w->out.len - start;
+}
+
+/**
+ * Writes a scalar map key. Json only allows string keys, so other scalars
+ * use their json text as the key.
+ */
+static ssize_t
+to_json_key (SpJsonWriter *w, const SpMsgpack *p, const uint8_t *payload)
+{
+	char buf[SP_JSON_DOUBLE_MAX];
+	const void *key = buf;
+	size_t len;
+
+	switch (p->type) {
+	case SP_MSGPACK_STRING:
+		key = payload;
+		len = p->tag.count;
+		break;
+	case SP_MSGPACK_UNSIGNED:
+		len = u64_length (p->tag.u64);
+		u64_digits (buf, p->tag.u64, len);
+		break;
+	case SP_MSGPACK_SIGNED: {
+		uint64_t u = p->tag.i64 < 0 ? -(uint64_t)p->tag.i64 : (uint64_t)p->tag.i64;
+		len = u64_length (u);
+		buf[0] = '-';
+		u64_digits (buf + (p->tag.i64 < 0), u, len);
+		len += p->tag.i64 < 0;
+		break;
+	}
+	case SP_MSGPACK_FLOAT:
+		len = sp_json_format_double ((double)p->tag.f32, buf);
+		break;
+	case SP_MSGPACK_DOUBLE:
+		len = sp_json_format_double (p->tag.f64, buf);
+		break;
+	case SP_MSGPACK_NIL:   key = "null"; len = 4; break;
+	case SP_MSGPACK_TRUE:  key = "true"; len = 4; break;
+	case SP_MSGPACK_FALSE: key = "false"; len = 5; break;
+	default:
+		return SP_MSGPACK_EKEY;
+	}
+	return sp_json_write_key (w, key, len);
+}
+
+static ssize_t
+to_json_value (SpJsonWriter *w, const SpMsgpack *p, const uint8_t *payload)
+{
+	ssize_t rc;
+
+	switch (p->type) {
+	case SP_MSGPACK_MAP:       return sp_json_write_object (w);
+	case SP_MSGPACK_ARRAY:     return sp_json_write_array (w);
+	case SP_MSGPACK_MAP_END:   return sp_json_write_object_end (w);
+	case SP_MSGPACK_ARRAY_END: return sp_json_write_array_end (w);
+	case SP_MSGPACK_NIL:       return sp_json_write_null (w);
+	case SP_MSGPACK_TRUE:      return sp_json_write_bool (w, true);
+	case SP_MSGPACK_FALSE:     return sp_json_write_bool (w, false);
+	case SP_MSGPACK_SIGNED:    return sp_json_write_int (w, p->tag.i64);
+	case SP_MSGPACK_UNSIGNED:  return sp_json_write_uint (w, p->tag.u64);
+	case SP_MSGPACK_FLOAT:     return sp_json_write_double (w, (double)p->tag.f32);
+	case SP_MSGPACK_DOUBLE:    return sp_json_write_double (w, p->tag.f64);
+	case SP_MSGPACK_STRING:    return sp_json_write_string (w, payload, p->tag.count);
+	case SP_MSGPACK_BINARY:    return to_json_base64 (w, payload, p->tag.count);
+	case SP_MSGPACK_EXT: {
+		// extensions become a [type, "base64"] pair
+		size_t start = w->out.len;
+		SpJsonWriter save = *w;
+		if ((rc = sp_json_write_array (w)) < 0 ||
+				(rc = sp_json_write_int (w, p->tag.ext.type)) < 0 ||
+				(rc = to_json_base64 (w, payload, p->tag.ext.len)) < 0 ||
+				(rc = sp_json_write_array_end (w)) < 0) {
+			save.out = w->out;
+			*w = save;
+			return writer_rollback (w, start, rc);
+		}
+		return w->out.len - start;
+	}
+	default:
+		return SP_MSGPACK_ESYNTAX;
+	}
+}
+
+static inline size_t
+to_json_payload (const SpMsgpack *p)
+{
+	switch (p->type) {
+	case SP_MSGPACK_STRING:
+	case SP_MSGPACK_BINARY:
+		return p->tag.count;
+	case SP_MSGPACK_EXT:
+		return p->tag.ext.len;
+	default:
+		return 0;
+	}
+}
+
+void
+sp_msgpack_to_json_init (SpMsgpackToJson *t)
+{
+	assert (t != NULL);
+
+	sp_msgpack_init (&t->msgpack);
+	sp_json_writer_init (&t->writer);
+	sp_utf8_init (&t->payload);
+	t->need = 0;
+	t->key = false;
+}
+
+void
+sp_msgpack_to_json_reset (SpMsgpackToJson *t)
+{
+	assert (t != NULL);
+
+	sp_msgpack_reset (&t->msgpack);
+	sp_json_writer_reset (&t->writer);
+	sp_utf8_reset (&t->payload);
+	t->need = 0;
+	t->key = false;
+}
+
+void
+sp_msgpack_to_json_final (SpMsgpackToJson *t)
+{
+	assert (t != NULL);
+
+	sp_msgpack_final (&t->msgpack);
+	sp_json_writer_final (&t->writer);
+	sp_utf8_final (&t->payload);
+	t->need = 0;
+	t->key = false;
+}
+
+ssize_t
+sp_msgpack_to_json (SpMsgpackToJson *t,
+		const void *restrict buf, size_t len, bool eof)
+{
+	assert (t != NULL);
+	assert (buf != NULL || len == 0);
+
+	SpMsgpack *p = &t->msgpack;
+	SpJsonWriter *w = &t->writer;
+	const uint8_t *m = buf;
+	size_t off = 0;
+
+	// the parser needs a buffer, and an empty one cannot finish the document
+	if (len == 0) {
+		return eof && !w->done ? SP_MSGPACK_ESYNTAX : 0;
+	}
+
+	while (!w->done) {
+		const uint8_t *payload = m + off;
+		size_t plen = 0;
+
+		if (t->need > 0) {
+			// keep collecting a payload split across inputs
+			size_t n = len - off < t->need ? len - off : t->need;
+			int rc = sp_utf8_ensure (&t->payload, n);
+			if (rc < 0) {
+				return rc;
+			}
+			memcpy (t->payload.buf + t->payload.len, m + off, n);
+			t->payload.len += n;
+			t->need -= n;
+			off += n;
+			if (t->need > 0) {
+				if (eof) {
+					return SP_MSGPACK_ESYNTAX;
+				}
+				break;
+			}
+			payload = t->payload.buf;
+		}
+		else {
+			// the key position must be known before the count is consumed
+			bool key = sp_msgpack_in_map (p) && !sp_msgpack_is_key (p);
+			ssize_t rc = sp_msgpack_next (p, m + off, len - off, eof);
+			if (rc < 0) {
+				return rc;
+			}
+			if (p->type == SP_MSGPACK_NONE) {
+				break;
+			}
+			off += rc;
+			t->key = key &&
+				p->type != SP_MSGPACK_MAP_END && p->type != SP_MSGPACK_ARRAY_END;
+
+			plen = to_json_payload (p);
+			if (plen > len - off) {
+				if (eof) {
+					return SP_MSGPACK_ESYNTAX;
+				}
+				t->payload.len = 0;
+				t->need = (uint32_t)plen;
+				continue;
+			}
+			payload = m + off;
+		}
+
+		ssize_t rc = t->key ?
+			to_json_key (w, p, payload) :
+			to_json_value (w, p, payload);
+		if (rc < 0) {
+			return rc;
+		}
+		off += plen;
+	}
+
+	return off;
+}
+
+void
+sp_msgpack_to_json_consume (SpMsgpackToJson *t, size_t len)
+{
+	assert (t != NULL);
+	assert (len <= t->writer.out.len);
+
+	if (len == 0) {
+		return;
+	}
+	SpUtf8 *out = &t->writer.out;
+	memmove (out->buf, out->buf + len, out->len - len + 1);
+	out->len -= len;
+}
+
+bool
+sp_msgpack_to_json_is_done (const SpMsgpackToJson *t)
+{
+	assert (t != NULL);
+
+	return t->writer.done;
+}
+
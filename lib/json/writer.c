@@ -0,0 +1,706 @@
+#include "../dtoa.h"
+#include "../../include/siphon/error.h"
+
+#include <string.h>
+
+/**
+ * The writer appends tokens to an `SpUtf8` buffer, inserting the commas and
+ * colons implied by the current nesting. A failed write, such as running out
+ * of room in a fixed buffer, leaves both the output and the nesting state as
+ * they were before the call.
+ */
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static inline unsigned
+u64_length (uint64_t v)
+{
+	unsigned n = 1;
+	for (; v >= 10000; v /= 10000) {
+		n += 4;
+	}
+	return n + (v >= 10) + (v >= 100) + (v >= 1000);
+}
+
+/**
+ * Writes the decimal digits of `v` as exactly `n` characters.
+ */
+static inline void
+u64_digits (char *buf, uint64_t v, unsigned n)
+{
+	char *p = buf + n;
+	while (v >= 100) {
+		unsigned r = (unsigned)(v % 100);
+		v /= 100;
+		p -= 2;
+		memcpy (p, digit_pairs + r*2, 2);
+	}
+	if (v >= 10) {
+		p -= 2;
+		memcpy (p, digit_pairs + v*2, 2);
+	}
+	else if (p > buf) {
+		*--p = (char)('0' + v);
+	}
+}
+
+static inline int32_t
+dtoa_pow5bits (int32_t e)
+{
+	return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+static inline uint32_t
+dtoa_log10_pow2 (int32_t e)
+{
+	return ((uint32_t)e * 78913) >> 18;
+}
+
+static inline uint32_t
+dtoa_log10_pow5 (int32_t e)
+{
+	return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline bool
+dtoa_pow5_factor (uint64_t v, uint32_t p)
+{
+	uint32_t n = 0;
+	for (; v % 5 == 0; v /= 5) {
+		if (++n >= p) {
+			return true;
+		}
+	}
+	return n >= p;
+}
+
+static inline bool
+dtoa_pow2_factor (uint64_t v, uint32_t p)
+{
+	return (v & ((UINT64_C(1) << p) - 1)) == 0;
+}
+
+/**
+ * Computes (m * mul) >> j for a 128-bit multiplier and a shift of 64 to 127.
+ */
+static inline uint64_t
+dtoa_mul_shift (uint64_t m, const uint64_t *mul, int32_t j)
+{
+	uint64_t hi0, lo0, hi1, lo1;
+	mul128 (m, mul[0], &hi0, &lo0);
+	mul128 (m, mul[1], &hi1, &lo1);
+	(void)lo0;
+	lo1 += hi0;
+	hi1 += lo1 < hi0;
+	int32_t s = j - 64;
+	return (hi1 << (64 - s)) | (lo1 >> s);
+}
+
+/**
+ * Ryu shortest round-trip conversion of a finite, non-zero double into a
+ * decimal significand and exponent.
+ */
+static uint64_t
+dtoa_shortest (uint64_t mant, uint32_t exp, int32_t *e10_out)
+{
+	int32_t e2;
+	uint64_t m2;
+	if (exp == 0) {
+		e2 = 1 - 1023 - 52 - 2;
+		m2 = mant;
+	}
+	else {
+		e2 = (int32_t)exp - 1023 - 52 - 2;
+		m2 = (UINT64_C(1) << 52) | mant;
+
+		// small integers are exact, so only their trailing zeros are removed
+		int32_t ie = (int32_t)exp - 1023 - 52;
+		if (ie <= 0 && ie >= -52 && (m2 & ((UINT64_C(1) << -ie) - 1)) == 0) {
+			uint64_t v = m2 >> -ie;
+			int32_t e10 = 0;
+			for (; v % 10 == 0; v /= 10) {
+				e10++;
+			}
+			*e10_out = e10;
+			return v;
+		}
+	}
+
+	bool accept = (m2 & 1) == 0;
+	uint64_t mv = 4 * m2;
+	uint32_t mm_shift = mant != 0 || exp <= 1;
+
+	uint64_t vr, vp, vm;
+	int32_t e10;
+	bool vm_zeros = false, vr_zeros = false;
+
+	if (e2 >= 0) {
+		uint32_t q = dtoa_log10_pow2 (e2) - (e2 > 3);
+		e10 = (int32_t)q;
+		int32_t k = DTOA_POW5_INV_BITCOUNT + dtoa_pow5bits ((int32_t)q) - 1;
+		int32_t i = -e2 + (int32_t)q + k;
+		vr = dtoa_mul_shift (4 * m2, dtoa_pow5_inv[q], i);
+		vp = dtoa_mul_shift (4 * m2 + 2, dtoa_pow5_inv[q], i);
+		vm = dtoa_mul_shift (4 * m2 - 1 - mm_shift, dtoa_pow5_inv[q], i);
+		if (q <= 21) {
+			if (mv % 5 == 0) {
+				vr_zeros = dtoa_pow5_factor (mv, q);
+			}
+			else if (accept) {
+				vm_zeros = dtoa_pow5_factor (mv - 1 - mm_shift, q);
+			}
+			else {
+				vp -= dtoa_pow5_factor (mv + 2, q);
+			}
+		}
+	}
+	else {
+		uint32_t q = dtoa_log10_pow5 (-e2) - (-e2 > 1);
+		e10 = (int32_t)q + e2;
+		int32_t i = -e2 - (int32_t)q;
+		int32_t k = dtoa_pow5bits (i) - DTOA_POW5_BITCOUNT;
+		int32_t j = (int32_t)q - k;
+		vr = dtoa_mul_shift (4 * m2, dtoa_pow5[i], j);
+		vp = dtoa_mul_shift (4 * m2 + 2, dtoa_pow5[i], j);
+		vm = dtoa_mul_shift (4 * m2 - 1 - mm_shift, dtoa_pow5[i], j);
+		if (q <= 1) {
+			vr_zeros = true;
+			if (accept) {
+				vm_zeros = mm_shift == 1;
+			}
+			else {
+				vp--;
+			}
+		}
+		else if (q < 63) {
+			vr_zeros = dtoa_pow2_factor (mv, q);
+		}
+	}
+
+	int32_t removed = 0;
+	uint8_t last = 0;
+	uint64_t out;
+
+	if (vm_zeros || vr_zeros) {
+		// the rare general case tracks whether the removed digits were zeros
+		for (; vp / 10 > vm / 10; removed++) {
+			vm_zeros &= vm % 10 == 0;
+			vr_zeros &= last == 0;
+			last = (uint8_t)(vr % 10);
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+		}
+		if (vm_zeros) {
+			for (; vm % 10 == 0; removed++) {
+				vr_zeros &= last == 0;
+				last = (uint8_t)(vr % 10);
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+			}
+		}
+		if (vr_zeros && last == 5 && vr % 2 == 0) {
+			// round half to even when the exact value is ...50..0
+			last = 4;
+		}
+		out = vr + ((vr == vm && (!accept || !vm_zeros)) || last >= 5);
+	}
+	else {
+		bool up = false;
+		for (; vp / 100 > vm / 100; removed += 2) {
+			up = vr % 100 >= 50;
+			vr /= 100;
+			vp /= 100;
+			vm /= 100;
+		}
+		for (; vp / 10 > vm / 10; removed++) {
+			up = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+		}
+		out = vr + (vr == vm || up);
+	}
+
+	*e10_out = e10 + removed;
+	return out;
+}
+
+size_t
+sp_json_format_double (double val, char *buf)
+{
+	assert (buf != NULL);
+
+	uint64_t bits;
+	memcpy (&bits, &val, sizeof bits);
+	uint64_t mant = bits & ((UINT64_C(1) << 52) - 1);
+	uint32_t exp = (uint32_t)(bits >> 52) & 0x7FF;
+	char *p = buf;
+
+	// json has no representation for infinities or nan
+	if (exp == 0x7FF) {
+		memcpy (buf, "null", 4);
+		return 4;
+	}
+
+	if (bits >> 63) {
+		*p++ = '-';
+	}
+	if (exp == 0 && mant == 0) {
+		*p++ = '0';
+		return p - buf;
+	}
+
+	int32_t e10;
+	uint64_t digits = dtoa_shortest (mant, exp, &e10);
+	int32_t n = (int32_t)u64_length (digits);
+	int32_t point = e10 + n;
+
+	// use the same layout as javascript so common values stay short
+	if (point > 0 && point <= 21) {
+		if (n <= point) {
+			u64_digits (p, digits, n);
+			memset (p + n, '0', point - n);
+			p += point;
+		}
+		else {
+			char tmp[20];
+			u64_digits (tmp, digits, n);
+			memcpy (p, tmp, point);
+			p[point] = '.';
+			memcpy (p + point + 1, tmp + point, n - point);
+			p += n + 1;
+		}
+	}
+	else if (point > -6 && point <= 0) {
+		*p++ = '0';
+		*p++ = '.';
+		memset (p, '0', -point);
+		p += -point;
+		u64_digits (p, digits, n);
+		p += n;
+	}
+	else {
+		char tmp[20];
+		u64_digits (tmp, digits, n);
+		*p++ = tmp[0];
+		if (n > 1) {
+			*p++ = '.';
+			memcpy (p, tmp + 1, n - 1);
+			p += n - 1;
+		}
+		int32_t e = point - 1;
+		*p++ = 'e';
+		*p++ = e < 0 ? '-' : '+';
+		e = e < 0 ? -e : e;
+		unsigned elen = u64_length ((uint64_t)e);
+		u64_digits (p, (uint64_t)e, elen);
+		p += elen;
+	}
+	return p - buf;
+}
+
+/**
+ * Finds the first byte that cannot be copied into a json string as is: a
+ * quote, a backslash, a control character or the start of a multibyte
+ * character, which is validated separately.
+ */
+static inline const uint8_t *
+escape_run (const uint8_t *s, const uint8_t *e)
+{
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8 ('"');
+	const __m128i bslash = _mm_set1_epi8 ('\\');
+	const __m128i space = _mm_set1_epi8 (0x20);
+	for (; e - s >= 16; s += 16) {
+		__m128i v = _mm_loadu_si128 ((const __m128i *)s);
+		// the signed compare also catches bytes with the high bit set
+		__m128i hit = _mm_or_si128 (_mm_cmplt_epi8 (v, space),
+			_mm_or_si128 (_mm_cmpeq_epi8 (v, quote), _mm_cmpeq_epi8 (v, bslash)));
+		int mask = _mm_movemask_epi8 (hit);
+		if (mask) {
+			return s + __builtin_ctz (mask);
+		}
+	}
+#endif
+	static const uint64_t ones = 0x0101010101010101ULL;
+	static const uint64_t high = 0x8080808080808080ULL;
+	for (; e - s >= 8; s += 8) {
+		uint64_t v;
+		memcpy (&v, s, sizeof v);
+		uint64_t q = v ^ (ones * '"');
+		uint64_t b = v ^ (ones * '\\');
+		uint64_t hit = (((v - ones * 0x20) & ~v) | ((q - ones) & ~q) |
+			((b - ones) & ~b) | v) & high;
+		if (hit) {
+			break;
+		}
+	}
+	for (; s < e; s++) {
+		if (*s < 0x20 || *s == '"' || *s == '\\' || *s >= 0x80) {
+			return s;
+		}
+	}
+	return e;
+}
+
+static ssize_t
+escape_string (SpUtf8 *out, const uint8_t *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const uint8_t *e = s + len;
+	size_t start = out->len;
+	int rc;
+
+	if ((rc = sp_utf8_ensure (out, 1)) < 0) {
+		return rc;
+	}
+	out->buf[out->len++] = '"';
+
+	while (s < e) {
+		const uint8_t *run = escape_run (s, e);
+		size_t n = run - s;
+		char esc[6];
+		size_t elen = 0;
+
+		if (run < e) {
+			uint8_t c = *run;
+			if (c >= 0x80) {
+				ssize_t clen = sp_utf8_charlen (run, e - run);
+				if (clen <= 0) {
+					rc = SP_UTF8_EENCODING;
+					goto error;
+				}
+				n += clen;
+			}
+			else {
+				esc[0] = '\\';
+				elen = 2;
+				switch (c) {
+				case '"':  esc[1] = '"'; break;
+				case '\\': esc[1] = '\\'; break;
+				case '\b': esc[1] = 'b'; break;
+				case '\f': esc[1] = 'f'; break;
+				case '\n': esc[1] = 'n'; break;
+				case '\r': esc[1] = 'r'; break;
+				case '\t': esc[1] = 't'; break;
+				default:
+					memcpy (esc + 1, "u00", 3);
+					esc[4] = hex[c >> 4];
+					esc[5] = hex[c & 0xF];
+					elen = 6;
+					break;
+				}
+			}
+		}
+
+		if ((rc = sp_utf8_ensure (out, n + elen)) < 0) {
+			goto error;
+		}
+		memcpy (out->buf + out->len, s, n);
+		memcpy (out->buf + out->len + n, esc, elen);
+		out->len += n + elen;
+		s += n + (elen > 0);
+	}
+
+	if ((rc = sp_utf8_ensure (out, 1)) < 0) {
+		goto error;
+	}
+	out->buf[out->len++] = '"';
+	out->buf[out->len] = '\0';
+	return out->len - start;
+
+error:
+	out->len = start;
+	if (out->buf != NULL) {
+		out->buf[start] = '\0';
+	}
+	return rc;
+}
+
+#define WRITER_IN_OBJ(w) \
+	((w)->depth > 0 && ((w)->stack[((w)->depth-1)/8] >> (((w)->depth-1)%8) & 1))
+
+/**
+ * Checks that a value may be written and adds the separator before it.
+ */
+static int
+writer_begin (SpJsonWriter *w, bool key)
+{
+	if (w->done) {
+		return SP_JSON_ESTATE;
+	}
+	if (key != (WRITER_IN_OBJ (w) && !w->key)) {
+		return SP_JSON_ESTATE;
+	}
+	if (w->comma && !w->key) {
+		int rc = sp_utf8_ensure (&w->out, 1);
+		if (rc < 0) {
+			return rc;
+		}
+		w->out.buf[w->out.len++] = ',';
+	}
+	return 0;
+}
+
+static ssize_t
+writer_rollback (SpJsonWriter *w, size_t start, ssize_t rc)
+{
+	w->out.len = start;
+	if (w->out.buf != NULL) {
+		w->out.buf[start] = '\0';
+	}
+	return rc;
+}
+
+static void
+writer_end (SpJsonWriter *w)
+{
+	w->key = false;
+	w->comma = true;
+	w->done = w->depth == 0;
+}
+
+static ssize_t
+writer_raw (SpJsonWriter *w, const void *val, size_t len)
+{
+	size_t start = w->out.len;
+	int rc = writer_begin (w, false);
+	if (rc == 0) {
+		rc = sp_utf8_ensure (&w->out, len);
+	}
+	if (rc < 0) {
+		return writer_rollback (w, start, rc);
+	}
+	memcpy (w->out.buf + w->out.len, val, len);
+	w->out.len += len;
+	w->out.buf[w->out.len] = '\0';
+	writer_end (w);
+	return w->out.len - start;
+}
+
+static ssize_t
+writer_open (SpJsonWriter *w, bool obj)
+{
+	if (w->depth == sizeof w->stack * 8) {
+		return SP_JSON_ESTACK;
+	}
+	ssize_t rc = writer_raw (w, obj ? "{" : "[", 1);
+	if (rc < 0) {
+		return rc;
+	}
+	if (obj) {
+		w->stack[w->depth/8] |= 1 << (w->depth%8);
+	}
+	else {
+		w->stack[w->depth/8] &= ~(1 << (w->depth%8));
+	}
+	w->depth++;
+	w->done = false;
+	w->comma = false;
+	return rc;
+}
+
+static ssize_t
+writer_close (SpJsonWriter *w, bool obj)
+{
+	if (w->depth == 0 || WRITER_IN_OBJ (w) != obj || w->key) {
+		return SP_JSON_ESTATE;
+	}
+	int rc = sp_utf8_ensure (&w->out, 1);
+	if (rc < 0) {
+		return rc;
+	}
+	w->out.buf[w->out.len++] = obj ? '}' : ']';
+	w->out.buf[w->out.len] = '\0';
+	w->depth--;
+	writer_end (w);
+	return 1;
+}
+
+static void
+writer_init (SpJsonWriter *w)
+{
+	w->depth = 0;
+	w->comma = false;
+	w->key = false;
+	w->done = false;
+}
+
+void
+sp_json_writer_init (SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	sp_utf8_init (&w->out);
+	writer_init (w);
+}
+
+void
+sp_json_writer_init_fixed (SpJsonWriter *w, void *buf, size_t len)
+{
+	assert (w != NULL);
+	assert (buf != NULL);
+
+	sp_utf8_init_fixed (&w->out, buf, len);
+	writer_init (w);
+}
+
+void
+sp_json_writer_reset (SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	sp_utf8_reset (&w->out);
+	writer_init (w);
+}
+
+void
+sp_json_writer_final (SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	sp_utf8_final (&w->out);
+	writer_init (w);
+}
+
+bool
+sp_json_writer_is_done (const SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	return w->done;
+}
+
+ssize_t
+sp_json_write_object (SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	return writer_open (w, true);
+}
+
+ssize_t
+sp_json_write_object_end (SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	return writer_close (w, true);
+}
+
+ssize_t
+sp_json_write_array (SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	return writer_open (w, false);
+}
+
+ssize_t
+sp_json_write_array_end (SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	return writer_close (w, false);
+}
+
+ssize_t
+sp_json_write_key (SpJsonWriter *w, const void *key, size_t len)
+{
+	assert (w != NULL);
+	assert (key != NULL || len == 0);
+
+	size_t start = w->out.len;
+	ssize_t rc = writer_begin (w, true);
+	if (rc == 0) {
+		rc = escape_string (&w->out, key, len);
+	}
+	if (rc >= 0) {
+		rc = sp_utf8_ensure (&w->out, 1);
+	}
+	if (rc < 0) {
+		return writer_rollback (w, start, rc);
+	}
+	w->out.buf[w->out.len++] = ':';
+	w->out.buf[w->out.len] = '\0';
+	w->key = true;
+	return w->out.len - start;
+}
+
+ssize_t
+sp_json_write_string (SpJsonWriter *w, const void *str, size_t len)
+{
+	assert (w != NULL);
+	assert (str != NULL || len == 0);
+
+	size_t start = w->out.len;
+	ssize_t rc = writer_begin (w, false);
+	if (rc == 0) {
+		rc = escape_string (&w->out, str, len);
+	}
+	if (rc < 0) {
+		return writer_rollback (w, start, rc);
+	}
+	writer_end (w);
+	return w->out.len - start;
+}
+
+ssize_t
+sp_json_write_uint (SpJsonWriter *w, uint64_t val)
+{
+	assert (w != NULL);
+
+	char buf[20];
+	unsigned n = u64_length (val);
+	u64_digits (buf, val, n);
+	return writer_raw (w, buf, n);
+}
+
+ssize_t
+sp_json_write_int (SpJsonWriter *w, int64_t val)
+{
+	assert (w != NULL);
+
+	char buf[21];
+	uint64_t u = val < 0 ? -(uint64_t)val : (uint64_t)val;
+	unsigned n = u64_length (u);
+	buf[0] = '-';
+	u64_digits (buf + (val < 0), u, n);
+	return writer_raw (w, buf, n + (val < 0));
+}
+
+ssize_t
+sp_json_write_double (SpJsonWriter *w, double val)
+{
+	assert (w != NULL);
+
+	char buf[SP_JSON_DOUBLE_MAX];
+	return writer_raw (w, buf, sp_json_format_double (val, buf));
+}
+
+ssize_t
+sp_json_write_bool (SpJsonWriter *w, bool val)
+{
+	assert (w != NULL);
+
+	return val ? writer_raw (w, "true", 4) : writer_raw (w, "false", 5);
+}
+
+ssize_t
+sp_json_write_null (SpJsonWriter *w)
+{
+	assert (w != NULL);
+
+	return writer_raw (w, "null", 4);
+}
@@ -1,6 +1,6 @@
 #include "../include/siphon/map.h"
 #include "../include/siphon/error.h"
-#include "../include/siphon/alloc.h"
+#include "allocator.h"
 
 #include <unistd.h>
 #include <assert.h>
@@ -44,8 +44,11 @@ sp_map_final (SpMap *self)
 	self->bloom = NULL;
 
 	sp_map_clear (self);
-	sp_free (self->entries, self->size * sizeof *self->entries);
+	sp_afree (self->alloc, self->entries, self->size * sizeof *self->entries);
+
+	const SpAllocator *alloc = self->alloc;
 	*self = SP_MAP_MAKE (self->type);
+	self->alloc = alloc;
 }
 
 void
@@ -138,7 +141,7 @@ set_size (SpMap *self, size_t new_size)
 	SpMapEntry *const old_entries = self->entries;
 	const size_t old_size = self->size;
 
-	self->entries = sp_calloc (new_size, sizeof *self->entries);
+	self->entries = sp_acalloc (self->alloc, new_size, sizeof *self->entries);
 	if (self->entries == NULL) {
 		self->entries = old_entries;
 		return -1;
@@ -176,7 +179,7 @@ set_size (SpMap *self, size_t new_size)
 		}
 	}
 
-	sp_free (old_entries, sizeof *old_entries * old_size);
+	sp_afree (self->alloc, old_entries, sizeof *old_entries * old_size);
 
 	return 0;
 }
@@ -241,6 +244,31 @@ sp_map_use_bloom (SpMap *self, size_t hint, double fpp)
 	return 0;
 }
 
+int
+sp_map_use_allocator (SpMap *self, const SpAllocator *alloc)
+{
+	assert (self != NULL);
+
+	if (alloc == self->alloc) {
+		return 0;
+	}
+
+	SpMapEntry *entries = NULL;
+	size_t bytes = self->size * sizeof *self->entries;
+	if (self->entries != NULL) {
+		entries = sp_amalloc (alloc, bytes);
+		if (entries == NULL) {
+			return -errno;
+		}
+		memcpy (entries, self->entries, bytes);
+	}
+
+	sp_afree (self->alloc, self->entries, bytes);
+	self->entries = entries;
+	self->alloc = alloc;
+	return 0;
+}
+
 static bool
 definitely_no (const SpMap *self, uint64_t h)
 {
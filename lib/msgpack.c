@@ -1,8 +1,10 @@
 #include "../include/siphon/msgpack.h"
 #include "../include/siphon/error.h"
 #include "../include/siphon/endian.h"
+#include "cpu.h"
 
 #include <assert.h>
+#include <string.h>
 
 
 
@@ -74,6 +76,7 @@
 
 
 #define DONE 0xFFFFFFFFU
+#define SKIP 0x00000001U
 #define IS_DONE(cs) (((cs) & 0xF0000000U) != 0)
 
 #define YIELD_ERROR(err) do { \
@@ -212,7 +215,41 @@
 #define STACK_ARR 0
 #define STACK_MAP 1
 
-#define PUSH_COUNT(p, n) do { p->counts[p->depth-1] = (n); } while (0)
+#define COUNTS(p) \
+	(p->deep ? p->deep_counts : p->counts)
+
+#define PUSH_COUNT(p, n) do { COUNTS(p)[p->depth-1] = (n); } while (0)
+
+#define STACK_GROW(p) stack_grow (p)
+
+/**
+ * Doubles the external stack from the arena, starting from the inline one.
+ * The counts and bits share one allocation, so both halves are copied.
+ */
+static bool
+stack_grow (SpMsgpack *p)
+{
+	if (p->deep_arena == NULL || p->depth == SP_MSGPACK_DEPTH_MAX) {
+		return false;
+	}
+
+	size_t max = (size_t)STACK_MAX (p) * 2;
+	if (max > SP_MSGPACK_DEPTH_MAX) {
+		max = SP_MSGPACK_DEPTH_MAX;
+	}
+	uint32_t *counts = sp_arena_alloc (p->deep_arena, SP_MSGPACK_STACK_SIZE (max));
+	if (counts == NULL) {
+		return false;
+	}
+	uint8_t *bits = (uint8_t *)(counts + max);
+	memcpy (counts, COUNTS (p), p->depth * sizeof *counts);
+	memcpy (bits, STACK_BITS (p), (p->depth + 7) / 8);
+
+	p->deep_counts = counts;
+	p->deep = bits;
+	p->deep_max = (uint16_t)max;
+	return true;
+}
 
 /**
  * Pushes an array entry count onto the stack.
@@ -252,9 +289,122 @@ sp_msgpack_init (SpMsgpack *p)
 void
 sp_msgpack_reset (SpMsgpack *p)
 {
+	uint8_t *deep = p->deep;
+	uint32_t *deep_counts = p->deep_counts;
+	uint16_t deep_max = p->deep_max;
+	SpArena *deep_arena = p->deep_arena;
+	const SpMsgpackExtRegistry *ext = p->ext;
+
 	sp_msgpack_init (p);
+	p->ext = ext;
+
+	// a grown stack belongs to the arena and is rebuilt on demand
+	p->deep_arena = deep_arena;
+	if (deep_arena == NULL) {
+		p->deep = deep;
+		p->deep_counts = deep_counts;
+		p->deep_max = deep_max;
+	}
+}
+
+void
+sp_msgpack_final (SpMsgpack *p)
+{
+	sp_msgpack_init (p);
+}
+
+void
+sp_msgpack_use_stack (SpMsgpack *p, void *buf, size_t len)
+{
+	assert (p != NULL);
+	assert (p->depth == 0);
+	assert (buf != NULL || len == 0);
+	assert ((uintptr_t)buf % sizeof (uint32_t) == 0);
+
+	// largest depth where SP_MSGPACK_STACK_SIZE (max) <= len
+	size_t max = len > 0 ? (len*8 - 8) / 33 : 0;
+	while (SP_MSGPACK_STACK_SIZE (max + 1) <= len) {
+		max++;
+	}
+	if (max > SP_MSGPACK_DEPTH_MAX) {
+		max = SP_MSGPACK_DEPTH_MAX;
+	}
+	p->deep_counts = max > 0 ? buf : NULL;
+	p->deep = max > 0 ? (uint8_t *)((uint32_t *)buf + max) : NULL;
+	p->deep_max = (uint16_t)max;
+	p->deep_arena = NULL;
+}
+
+void
+sp_msgpack_use_stack_arena (SpMsgpack *p, SpArena *arena)
+{
+	assert (p != NULL);
+	assert (p->depth == 0);
+
+	p->deep_counts = NULL;
+	p->deep = NULL;
+	p->deep_max = 0;
+	p->deep_arena = arena;
+}
+
+void
+sp_msgpack_use_ext (SpMsgpack *p, const SpMsgpackExtRegistry *ext)
+{
+	assert (p != NULL);
+
+	p->ext = ext;
+}
+
+/**
+ * Hands a complete extension body to its registered decoder. The body is
+ * consumed along with the header so the caller never copies it out.
+ * @p: parser pointer
+ * @buf: the start of the extension header
+ * @off: length of the extension header
+ * @len: byte length available on stream
+ * @eof: if the byte length mark the end of input
+ */
+static ssize_t
+decode_ext (SpMsgpack *p, const uint8_t *restrict buf, size_t off, size_t len, bool eof)
+{
+	const SpMsgpackExtEntry *e = &p->ext->entry[(uint8_t)p->tag.ext.type];
+	uint32_t body = p->tag.ext.len;
+	EXPECT_SIZE (off + body, len, eof);
+
+	// the decoder may overwrite any part of the tag
+	int rc = e->fn (&p->tag, buf + off, body, e->data);
+	switch (rc) {
+	case SP_MSGPACK_NIL:
+	case SP_MSGPACK_TRUE:
+	case SP_MSGPACK_FALSE:
+	case SP_MSGPACK_SIGNED:
+	case SP_MSGPACK_UNSIGNED:
+	case SP_MSGPACK_FLOAT:
+	case SP_MSGPACK_DOUBLE:
+	case SP_MSGPACK_TIMESTAMP:
+	case SP_MSGPACK_EXT_VALUE:
+		p->type = (SpMsgpackType)rc;
+		return off + body;
+	default:
+		YIELD_ERROR (rc < 0 ? rc : SP_MSGPACK_ESYNTAX);
+	}
 }
 
+/**
+ * Verifies an extension payload, or decodes it when a decoder is registered.
+ * @p: parser pointer
+ * @buf: the start of the extension header
+ * @off: length of the extension header
+ * @len: byte length available on stream
+ * @eof: if the byte length mark the end of input
+ */
+#define VERIFY_EXT(p, buf, off, len, eof) do {                             \
+	if (p->ext != NULL && p->ext->entry[(uint8_t)p->tag.ext.type].fn) {    \
+		return decode_ext (p, buf, off, len, eof);                         \
+	}                                                                      \
+	VERIFY_LEN (off, p->tag.ext.len, len, eof);                            \
+} while (0)
+
 static inline ssize_t
 next (SpMsgpack *p, const uint8_t *restrict buf, size_t len, bool eof)
 {
@@ -326,7 +476,7 @@ next (SpMsgpack *p, const uint8_t *restrict buf, size_t len, bool eof)
 		READ_DINT (p->tag.ext.len, buf+1, blen);
 		p->tag.ext.type = buf[blen+1];
 		p->type = SP_MSGPACK_EXT;
-		VERIFY_LEN (blen + 2, p->tag.ext.len, len, eof);
+		VERIFY_EXT (p, buf, blen + 2, len, eof);
 
 	case B_FLOAT:
 		EXPECT_SIZE (5, len, eof);
@@ -373,13 +523,13 @@ next (SpMsgpack *p, const uint8_t *restrict buf, size_t len, bool eof)
 		p->tag.ext.type = buf[1];
 		p->tag.ext.len = 1 << ((unsigned)c & 0x03);
 		p->type = SP_MSGPACK_EXT;
-		VERIFY_LEN (2, p->tag.ext.len, len, eof);
+		VERIFY_EXT (p, buf, 2, len, eof);
 	case B_FEXT128:
 		EXPECT_SIZE (2, len, eof);
 		p->tag.ext.type = buf[1];
 		p->tag.ext.len = 16;
 		p->type = SP_MSGPACK_EXT;
-		VERIFY_LEN (2, p->tag.ext.len, len, eof);
+		VERIFY_EXT (p, buf, 2, len, eof);
 
 	case B_STR8:
 	case B_STR16:
@@ -421,7 +571,7 @@ sp_msgpack_next (SpMsgpack *p, const void *restrict buf, size_t len, bool eof)
 
 	ssize_t rc = 0;
 
-	if (p->depth > 0 && p->counts[p->depth-1] == 0) {
+	if (p->depth > 0 && COUNTS (p)[p->depth-1] == 0) {
 		if (STACK_IN_ARR (p)) {
 			p->type = SP_MSGPACK_ARRAY_END;
 		}
@@ -444,12 +594,100 @@ sp_msgpack_next (SpMsgpack *p, const void *restrict buf, size_t len, bool eof)
 	}
 
 	if (rc >= 0 && p->type > SP_MSGPACK_ARRAY && p->depth > 0) {
-		p->counts[p->depth-1]--;
+		COUNTS (p)[p->depth-1]--;
 	}
 
 	return rc;
 }
 
+/**
+ * Skips the next value without yielding its contents. Only headers are
+ * decoded: nested entries are tallied from the counts and payload lengths
+ * are passed over without reading the bytes. Each header is scanned with a
+ * scratch parser so nested containers never touch the stack.
+ */
+ssize_t
+sp_msgpack_skip (SpMsgpack *p, const void *restrict buf, size_t len, bool eof)
+{
+	assert (p != NULL);
+	assert (buf != NULL || len == 0);
+
+	const uint8_t *m = buf;
+	size_t off = 0;
+
+	if (p->cs != SKIP) {
+		if (IS_DONE (p->cs) || (p->depth > 0 && COUNTS (p)[p->depth-1] == 0)) {
+			return SP_MSGPACK_ESTATE;
+		}
+		p->cs = SKIP;
+		p->skip = 1;
+		p->skip_bytes = 0;
+		p->skip_type = SP_MSGPACK_NONE;
+	}
+	p->type = SP_MSGPACK_NONE;
+
+	while (p->skip > 0 || p->skip_bytes > 0) {
+		if (p->skip_bytes > 0) {
+			size_t n = len - off < p->skip_bytes ? len - off : p->skip_bytes;
+			p->skip_bytes -= (uint32_t)n;
+			off += n;
+			if (p->skip_bytes > 0) {
+				if (eof) {
+					YIELD_ERROR (SP_MSGPACK_ESYNTAX);
+				}
+				return off;
+			}
+			continue;
+		}
+
+		if (off == len) {
+			if (eof) {
+				YIELD_ERROR (SP_MSGPACK_ESYNTAX);
+			}
+			return off;
+		}
+
+		SpMsgpack h;
+		h.depth = 0;
+		h.deep = NULL;
+		h.deep_arena = NULL;
+		h.ext = NULL;
+		ssize_t rc = next (&h, m + off, len - off, eof);
+		if (rc <= 0) {
+			if (rc < 0) {
+				YIELD_ERROR (rc);
+			}
+			return off;
+		}
+		off += rc;
+
+		if (p->skip_type == SP_MSGPACK_NONE) {
+			p->skip_type = h.type;
+			p->tag = h.tag;
+		}
+		p->skip--;
+		switch (h.type) {
+		case SP_MSGPACK_MAP:    p->skip += (uint64_t)h.tag.count * 2; break;
+		case SP_MSGPACK_ARRAY:  p->skip += h.tag.count; break;
+		case SP_MSGPACK_STRING:
+		case SP_MSGPACK_BINARY: p->skip_bytes = h.tag.count; break;
+		case SP_MSGPACK_EXT:    p->skip_bytes = h.tag.ext.len; break;
+		default: break;
+		}
+	}
+
+	// the skipped value completes like any other
+	p->type = p->skip_type;
+	p->cs = 0;
+	if (p->depth > 0) {
+		COUNTS (p)[p->depth-1]--;
+	}
+	else if (p->type == SP_MSGPACK_MAP || p->type == SP_MSGPACK_ARRAY) {
+		p->cs = DONE;
+	}
+	return off;
+}
+
 bool
 sp_msgpack_in_map (const SpMsgpack *p)
 {
@@ -463,7 +701,7 @@ sp_msgpack_is_key (const SpMsgpack *p)
 {
 	assert (p != NULL);
 
-	return sp_msgpack_in_map (p) && p->counts[p->depth-1] % 2 == 1;
+	return sp_msgpack_in_map (p) && COUNTS (p)[p->depth-1] % 2 == 1;
 }
 
 bool
@@ -670,10 +908,6 @@ sp_msgpack_enc_map (void *buf, uint32_t count)
 size_t
 sp_msgpack_enc_ext (void *buf, int8_t type, uint32_t len)
 {
-	if (type < 0) {
-		return 0;
-	}
-
 	size_t off = 1;
 
 	if (len == 1)       { *(uint8_t *)buf = B_FEXT8; }
@@ -698,3 +932,9 @@ sp_msgpack_enc_ext (void *buf, int8_t type, uint32_t len)
 	return off + 1;
 }
 
+
+#include "msgpack/ext.c"
+
+#include "msgpack/index.c"
+
+#include "msgpack/writer.c"
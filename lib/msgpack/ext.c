@@ -0,0 +1,114 @@
+#include "../../include/siphon/error.h"
+#include "../../include/siphon/endian.h"
+
+#include <string.h>
+
+/**
+ * Timestamps use extension type -1 with three layouts: 32-bit unsigned
+ * seconds, 64-bit with 30 bits of nanoseconds above 34 bits of seconds, and
+ * 96-bit with 32-bit nanoseconds followed by signed 64-bit seconds.
+ */
+
+void
+sp_msgpack_ext_init (SpMsgpackExtRegistry *ext)
+{
+	assert (ext != NULL);
+
+	memset (ext, 0, sizeof *ext);
+	sp_msgpack_ext_register (ext, SP_MSGPACK_EXT_TIMESTAMP,
+			sp_msgpack_ext_timestamp, NULL);
+}
+
+void
+sp_msgpack_ext_register (SpMsgpackExtRegistry *ext, int8_t type,
+		SpMsgpackExtDecode fn, void *data)
+{
+	assert (ext != NULL);
+
+	ext->entry[(uint8_t)type] = (SpMsgpackExtEntry){ fn, data };
+}
+
+int
+sp_msgpack_ext_timestamp (SpMsgpackTag *tag,
+		const void *body, uint32_t len, void *data)
+{
+	assert (tag != NULL);
+
+	(void)data;
+
+	int rc = sp_msgpack_dec_timestamp (body, len, &tag->ts);
+	return rc < 0 ? rc : SP_MSGPACK_TIMESTAMP;
+}
+
+int
+sp_msgpack_dec_timestamp (const void *body, uint32_t len, SpClock *ts)
+{
+	assert (body != NULL || len == 0);
+	assert (ts != NULL);
+
+	const uint8_t *m = body;
+	uint64_t sec;
+	uint32_t nsec;
+
+	switch (len) {
+	case 4:
+		memcpy (&nsec, m, 4);
+		ts->tv_sec = sp_be32toh (nsec);
+		ts->tv_nsec = 0;
+		return 0;
+	case 8:
+		memcpy (&sec, m, 8);
+		sec = sp_be64toh (sec);
+		nsec = (uint32_t)(sec >> 34);
+		sec &= 0x3ffffffffULL;
+		break;
+	case 12:
+		memcpy (&nsec, m, 4);
+		memcpy (&sec, m+4, 8);
+		nsec = sp_be32toh (nsec);
+		sec = sp_be64toh (sec);
+		break;
+	default:
+		return SP_MSGPACK_ESYNTAX;
+	}
+
+	if (nsec >= SP_NSEC_PER_SEC) {
+		return SP_MSGPACK_ESYNTAX;
+	}
+	ts->tv_sec = (time_t)(int64_t)sec;
+	ts->tv_nsec = nsec;
+	return 0;
+}
+
+size_t
+sp_msgpack_enc_timestamp (void *buf, const SpClock *ts)
+{
+	assert (buf != NULL);
+	assert (ts != NULL);
+	assert (ts->tv_nsec >= 0 && ts->tv_nsec < SP_NSEC_PER_SEC);
+
+	uint8_t *m = buf;
+	uint64_t sec = (uint64_t)ts->tv_sec;
+	uint32_t nsec = (uint32_t)ts->tv_nsec;
+
+	if ((sec >> 34) == 0) {
+		if (nsec == 0 && sec <= UINT32_MAX) {
+			size_t off = sp_msgpack_enc_ext (m, SP_MSGPACK_EXT_TIMESTAMP, 4);
+			uint32_t val = sp_htobe32 ((uint32_t)sec);
+			memcpy (m+off, &val, 4);
+			return off + 4;
+		}
+		size_t off = sp_msgpack_enc_ext (m, SP_MSGPACK_EXT_TIMESTAMP, 8);
+		uint64_t val = sp_htobe64 (((uint64_t)nsec << 34) | sec);
+		memcpy (m+off, &val, 8);
+		return off + 8;
+	}
+
+	size_t off = sp_msgpack_enc_ext (m, SP_MSGPACK_EXT_TIMESTAMP, 12);
+	nsec = sp_htobe32 (nsec);
+	sec = sp_htobe64 (sec);
+	memcpy (m+off, &nsec, 4);
+	memcpy (m+off+4, &sec, 8);
+	return off + 12;
+}
+
@@ -0,0 +1,203 @@
+#include "../../include/siphon/alloc.h"
+#include "../../include/siphon/hash.h"
+#include "../../include/siphon/seed.h"
+
+#include <errno.h>
+
+/**
+ * The index makes one pass over the root container, recording where each
+ * entry starts and skipping its value by headers alone. Map entries take
+ * two offsets, the key followed by the value, and one trailing offset marks
+ * the end of the last entry so every value has a known length. String keys
+ * are also placed in an open addressing table holding entry numbers.
+ */
+
+static bool
+index_key (const SpMsgpackIndex *idx, uint32_t entry,
+		const uint8_t **key, uint32_t *len)
+{
+	uint32_t off = idx->pos[entry*2];
+	SpMsgpack h;
+	h.depth = 0;
+	h.deep = NULL;
+	h.deep_arena = NULL;
+	h.ext = NULL;
+	ssize_t rc = next (&h, idx->base + off, idx->len - off, true);
+	if (rc <= 0 || h.type != SP_MSGPACK_STRING) {
+		return false;
+	}
+	*key = idx->base + off + rc;
+	*len = h.tag.count;
+	return true;
+}
+
+static inline size_t
+index_slot (const void *key, size_t len)
+{
+	return (size_t)sp_metrohash64 (key, len, SP_SEED_RANDOM);
+}
+
+static int
+index_table (SpMsgpackIndex *idx)
+{
+	size_t size = sp_power_of_2 ((size_t)idx->count * 2);
+	if (size > idx->ntable) {
+		uint32_t *table = sp_realloc (idx->table,
+				idx->ntable * sizeof *table, size * sizeof *table);
+		if (table == NULL) {
+			return SP_ESYSTEM (errno);
+		}
+		idx->table = table;
+		idx->ntable = size;
+	}
+	memset (idx->table, 0, size * sizeof *idx->table);
+
+	// entries are inserted in document order so lookups find the first duplicate
+	for (uint32_t i = 0; i < idx->count; i++) {
+		const uint8_t *key;
+		uint32_t len;
+		if (!index_key (idx, i, &key, &len)) {
+			continue;
+		}
+		size_t s = index_slot (key, len) & (size - 1);
+		while (idx->table[s]) {
+			s = (s + 1) & (size - 1);
+		}
+		idx->table[s] = i + 1;
+	}
+	return 0;
+}
+
+void
+sp_msgpack_index_init (SpMsgpackIndex *idx)
+{
+	assert (idx != NULL);
+
+	idx->base = NULL;
+	idx->len = 0;
+	idx->count = 0;
+	idx->type = SP_MSGPACK_NONE;
+	idx->pos = NULL;
+	idx->npos = 0;
+	idx->table = NULL;
+	idx->ntable = 0;
+}
+
+void
+sp_msgpack_index_final (SpMsgpackIndex *idx)
+{
+	assert (idx != NULL);
+
+	if (idx->pos != NULL) {
+		sp_free (idx->pos, idx->npos * sizeof *idx->pos);
+	}
+	if (idx->table != NULL) {
+		sp_free (idx->table, idx->ntable * sizeof *idx->table);
+	}
+	sp_msgpack_index_init (idx);
+}
+
+int
+sp_msgpack_index_parse (SpMsgpackIndex *idx, const void *buf, size_t len)
+{
+	assert (idx != NULL);
+	assert (buf != NULL || len == 0);
+
+	if (len > UINT32_MAX) {
+		return SP_MSGPACK_ESIZE;
+	}
+
+	const uint8_t *m = buf;
+	idx->base = m;
+	idx->len = (uint32_t)len;
+	idx->count = 0;
+	idx->type = SP_MSGPACK_NONE;
+
+	SpMsgpack p;
+	sp_msgpack_init (&p);
+	ssize_t rc = sp_msgpack_next (&p, m, len, true);
+	if (rc < 0) {
+		return (int)rc;
+	}
+	idx->type = p.type;
+	if (p.type != SP_MSGPACK_MAP && p.type != SP_MSGPACK_ARRAY) {
+		return 0;
+	}
+
+	// every entry takes at least one byte, which bounds the allocation
+	size_t off = rc;
+	size_t entries = p.type == SP_MSGPACK_MAP ?
+		(size_t)p.tag.count * 2 : (size_t)p.tag.count;
+	if (entries > len - off) {
+		return SP_MSGPACK_ESYNTAX;
+	}
+	if (entries + 1 > idx->npos) {
+		uint32_t *pos = sp_realloc (idx->pos,
+				idx->npos * sizeof *pos, (entries + 1) * sizeof *pos);
+		if (pos == NULL) {
+			return SP_ESYSTEM (errno);
+		}
+		idx->pos = pos;
+		idx->npos = entries + 1;
+	}
+
+	for (size_t i = 0; i < entries; i++) {
+		idx->pos[i] = (uint32_t)off;
+		rc = sp_msgpack_skip (&p, m + off, len - off, true);
+		if (rc < 0) {
+			return (int)rc;
+		}
+		off += rc;
+	}
+	idx->pos[entries] = (uint32_t)off;
+	idx->count = idx->type == SP_MSGPACK_MAP ? (uint32_t)(entries / 2) : (uint32_t)entries;
+
+	if (idx->type == SP_MSGPACK_MAP && idx->count > 0) {
+		int err = index_table (idx);
+		if (err < 0) {
+			idx->count = 0;
+			return err;
+		}
+	}
+	return 0;
+}
+
+bool
+sp_msgpack_index_at (const SpMsgpackIndex *idx, uint32_t n, SpRange32 *val)
+{
+	assert (idx != NULL);
+	assert (val != NULL);
+
+	if (n >= idx->count) {
+		return false;
+	}
+	size_t i = idx->type == SP_MSGPACK_MAP ? (size_t)n*2 + 1 : n;
+	val->off = idx->pos[i];
+	val->len = idx->pos[i+1] - idx->pos[i];
+	return true;
+}
+
+bool
+sp_msgpack_index_get (const SpMsgpackIndex *idx,
+		const void *key, size_t len, SpRange32 *val)
+{
+	assert (idx != NULL);
+	assert (key != NULL || len == 0);
+	assert (val != NULL);
+
+	if (idx->type != SP_MSGPACK_MAP || idx->count == 0) {
+		return false;
+	}
+
+	size_t mask = sp_power_of_2 ((size_t)idx->count * 2) - 1;
+	for (size_t s = index_slot (key, len) & mask; idx->table[s]; s = (s + 1) & mask) {
+		uint32_t entry = idx->table[s] - 1;
+		const uint8_t *k;
+		uint32_t klen;
+		if (index_key (idx, entry, &k, &klen) &&
+				klen == len && memcmp (k, key, len) == 0) {
+			return sp_msgpack_index_at (idx, entry, val);
+		}
+	}
+	return false;
+}
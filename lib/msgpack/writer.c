@@ -0,0 +1,510 @@
+#include "../../include/siphon/error.h"
+
+#include <string.h>
+
+/**
+ * Bulk arrays are written with one encoding for every element, chosen from
+ * the range of the whole array. Fixed width elements let the values be
+ * byte-swapped and interleaved with their tags in straight loops, with a
+ * shuffle kernel doing several elements per store where the cpu allows it.
+ */
+
+typedef size_t (*PackKernel) (uint8_t *out, const uint8_t *limit,
+		const uint8_t *src, size_t n, unsigned size, unsigned width, uint8_t tag);
+
+static size_t
+pack_base (uint8_t *out, const uint8_t *limit,
+		const uint8_t *src, size_t n, unsigned size, unsigned width, uint8_t tag)
+{
+	(void)out; (void)limit; (void)src; (void)n; (void)size; (void)width; (void)tag;
+	return 0;
+}
+
+#if SP_CPU_X86
+
+/**
+ * Shuffles the low `width` bytes of each little-endian source element into
+ * big-endian order behind its tag. Every 16 byte load yields as many whole
+ * elements as fit in one 16 byte store; the remainder is left to the caller.
+ */
+SP_TARGET_SSE42 static size_t
+pack_ssse3 (uint8_t *out, const uint8_t *limit,
+		const uint8_t *src, size_t n, unsigned size, unsigned width, uint8_t tag)
+{
+	unsigned stride = 1 + width;
+	unsigned per = 16 / size;
+	if (per * stride > 16) {
+		per = 16 / stride;
+	}
+
+	uint8_t shuf[16], tags[16];
+	memset (shuf, 0x80, sizeof shuf);
+	memset (tags, 0, sizeof tags);
+	for (unsigned j = 0; j < per; j++) {
+		tags[j*stride] = tag;
+		for (unsigned b = 0; b < width; b++) {
+			shuf[j*stride + 1 + b] = (uint8_t)(j*size + width - 1 - b);
+		}
+	}
+	__m128i m = _mm_loadu_si128 ((const __m128i *)shuf);
+	__m128i t = _mm_loadu_si128 ((const __m128i *)tags);
+
+	size_t i = 0;
+	for (; i + 16/size <= n && out + 16 <= limit; i += per, out += per*stride) {
+		__m128i v = _mm_loadu_si128 ((const __m128i *)(src + i*size));
+		_mm_storeu_si128 ((__m128i *)out, _mm_or_si128 (_mm_shuffle_epi8 (v, m), t));
+	}
+	return i;
+}
+
+#endif
+
+static size_t pack_resolve (uint8_t *out, const uint8_t *limit,
+		const uint8_t *src, size_t n, unsigned size, unsigned width, uint8_t tag);
+
+static PackKernel pack_kernel = pack_resolve;
+
+// the first pack selects the kernel and then runs through it
+static size_t
+pack_resolve (uint8_t *out, const uint8_t *limit,
+		const uint8_t *src, size_t n, unsigned size, unsigned width, uint8_t tag)
+{
+	sp_cpu_init ();
+	return pack_kernel (out, limit, src, n, size, width, tag);
+}
+
+void
+sp_msgpack_select (unsigned features)
+{
+	pack_kernel = pack_base;
+#if SP_CPU_X86
+	if (features & SP_CPU_SSE42) {
+		pack_kernel = pack_ssse3;
+	}
+#else
+	(void)features;
+#endif
+}
+
+#define PACK_BE8(v) (v)
+#define PACK_BE16(v) sp_htobe16 (v)
+#define PACK_BE32(v) sp_htobe32 (v)
+#define PACK_BE64(v) sp_htobe64 (v)
+
+/**
+ * Writes the elements left over by the kernel one at a time.
+ */
+#define PACK_LOOP(out, src, i, n, tag, bits) do {                   \
+	for (; i < n; i++, out += 1 + bits/8) {                         \
+		uint##bits##_t be = PACK_BE##bits ((uint##bits##_t)src[i]); \
+		out[0] = (tag);                                             \
+		memcpy (out + 1, &be, sizeof be);                           \
+	}                                                               \
+} while (0)
+
+#define PACK(out, limit, src, n, tag, width) do {                   \
+	size_t _i = pack_kernel (out, limit, (const uint8_t *)(src),    \
+			n, sizeof *(src), width, tag);                          \
+	out += _i * (1 + width);                                        \
+	switch (width) {                                                \
+	case 1: PACK_LOOP (out, src, _i, n, tag, 8); break;             \
+	case 2: PACK_LOOP (out, src, _i, n, tag, 16); break;            \
+	case 4: PACK_LOOP (out, src, _i, n, tag, 32); break;            \
+	default: PACK_LOOP (out, src, _i, n, tag, 64); break;           \
+	}                                                               \
+} while (0)
+
+/**
+ * Reserves space for an array header and `n` elements of `stride` bytes,
+ * and writes the header.
+ */
+static ssize_t
+writer_array (SpMsgpackWriter *w, size_t n, size_t stride, uint8_t **out)
+{
+	if (n > UINT32_MAX) {
+		return SP_MSGPACK_ESIZE;
+	}
+	uint8_t hdr[5];
+	size_t len = sp_msgpack_enc_array (hdr, (uint32_t)n);
+	int rc = sp_utf8_ensure (&w->out, len + n*stride);
+	if (rc < 0) {
+		return rc;
+	}
+	*out = w->out.buf + w->out.len;
+	memcpy (*out, hdr, len);
+	return len;
+}
+
+static inline void
+writer_int_encoding (int64_t min, int64_t max, uint8_t *tag, unsigned *width)
+{
+	if (min >= 0) {
+		if (max <= UINT8_MAX)       { *tag = B_UINT8;  *width = 1; }
+		else if (max <= UINT16_MAX) { *tag = B_UINT16; *width = 2; }
+		else if (max <= UINT32_MAX) { *tag = B_UINT32; *width = 4; }
+		else                        { *tag = B_UINT64; *width = 8; }
+	}
+	else {
+		if (min >= INT8_MIN && max <= INT8_MAX)        { *tag = B_INT8;  *width = 1; }
+		else if (min >= INT16_MIN && max <= INT16_MAX) { *tag = B_INT16; *width = 2; }
+		else if (min >= INT32_MIN && max <= INT32_MAX) { *tag = B_INT32; *width = 4; }
+		else                                           { *tag = B_INT64; *width = 8; }
+	}
+}
+
+static ssize_t
+writer_scalar (SpMsgpackWriter *w, size_t (*enc) (void *, uint64_t), uint64_t val)
+{
+	uint8_t tag[SP_MSGPACK_TAG_MAX];
+	size_t n = enc (tag, val);
+	int rc = sp_utf8_ensure (&w->out, n);
+	if (rc < 0) {
+		return rc;
+	}
+	memcpy (w->out.buf + w->out.len, tag, n);
+	w->out.len += n;
+	return n;
+}
+
+static size_t
+enc_nil (void *buf, uint64_t val)
+{
+	(void)val;
+	return sp_msgpack_enc_nil (buf);
+}
+
+static size_t
+enc_bool (void *buf, uint64_t val)
+{
+	return val ? sp_msgpack_enc_true (buf) : sp_msgpack_enc_false (buf);
+}
+
+static size_t
+enc_int (void *buf, uint64_t val)
+{
+	return sp_msgpack_enc_signed (buf, (int64_t)val);
+}
+
+static size_t
+enc_uint (void *buf, uint64_t val)
+{
+	return sp_msgpack_enc_unsigned (buf, val);
+}
+
+static size_t
+enc_array (void *buf, uint64_t val)
+{
+	return sp_msgpack_enc_array (buf, (uint32_t)val);
+}
+
+static size_t
+enc_map (void *buf, uint64_t val)
+{
+	return sp_msgpack_enc_map (buf, (uint32_t)val);
+}
+
+static ssize_t
+writer_bytes (SpMsgpackWriter *w, size_t (*enc) (void *, uint32_t),
+		const void *val, size_t len)
+{
+	if (len > UINT32_MAX) {
+		return SP_MSGPACK_ESIZE;
+	}
+	uint8_t tag[SP_MSGPACK_TAG_MAX];
+	size_t n = enc (tag, (uint32_t)len);
+	int rc = sp_utf8_ensure (&w->out, n + len);
+	if (rc < 0) {
+		return rc;
+	}
+	uint8_t *out = w->out.buf + w->out.len;
+	memcpy (out, tag, n);
+	memcpy (out + n, val, len);
+	w->out.len += n + len;
+	return n + len;
+}
+
+void
+sp_msgpack_writer_init (SpMsgpackWriter *w)
+{
+	assert (w != NULL);
+
+	sp_utf8_init (&w->out);
+}
+
+void
+sp_msgpack_writer_init_fixed (SpMsgpackWriter *w, void *buf, size_t len)
+{
+	assert (w != NULL);
+	assert (buf != NULL);
+
+	sp_utf8_init_fixed (&w->out, buf, len);
+}
+
+void
+sp_msgpack_writer_reset (SpMsgpackWriter *w)
+{
+	assert (w != NULL);
+
+	sp_utf8_reset (&w->out);
+}
+
+void
+sp_msgpack_writer_final (SpMsgpackWriter *w)
+{
+	assert (w != NULL);
+
+	sp_utf8_final (&w->out);
+}
+
+ssize_t
+sp_msgpack_write_nil (SpMsgpackWriter *w)
+{
+	assert (w != NULL);
+
+	return writer_scalar (w, enc_nil, 0);
+}
+
+ssize_t
+sp_msgpack_write_bool (SpMsgpackWriter *w, bool val)
+{
+	assert (w != NULL);
+
+	return writer_scalar (w, enc_bool, val);
+}
+
+ssize_t
+sp_msgpack_write_int (SpMsgpackWriter *w, int64_t val)
+{
+	assert (w != NULL);
+
+	return writer_scalar (w, enc_int, (uint64_t)val);
+}
+
+ssize_t
+sp_msgpack_write_uint (SpMsgpackWriter *w, uint64_t val)
+{
+	assert (w != NULL);
+
+	return writer_scalar (w, enc_uint, val);
+}
+
+ssize_t
+sp_msgpack_write_float (SpMsgpackWriter *w, float val)
+{
+	assert (w != NULL);
+
+	int rc = sp_utf8_ensure (&w->out, 5);
+	if (rc < 0) {
+		return rc;
+	}
+	w->out.len += sp_msgpack_enc_float (w->out.buf + w->out.len, val);
+	return 5;
+}
+
+ssize_t
+sp_msgpack_write_double (SpMsgpackWriter *w, double val)
+{
+	assert (w != NULL);
+
+	int rc = sp_utf8_ensure (&w->out, 9);
+	if (rc < 0) {
+		return rc;
+	}
+	w->out.len += sp_msgpack_enc_double (w->out.buf + w->out.len, val);
+	return 9;
+}
+
+ssize_t
+sp_msgpack_write_string (SpMsgpackWriter *w, const void *str, size_t len)
+{
+	assert (w != NULL);
+	assert (str != NULL || len == 0);
+
+	return writer_bytes (w, sp_msgpack_enc_string, str, len);
+}
+
+ssize_t
+sp_msgpack_write_binary (SpMsgpackWriter *w, const void *bin, size_t len)
+{
+	assert (w != NULL);
+	assert (bin != NULL || len == 0);
+
+	return writer_bytes (w, sp_msgpack_enc_binary, bin, len);
+}
+
+ssize_t
+sp_msgpack_write_ext (SpMsgpackWriter *w, int8_t type,
+		const void *body, size_t len)
+{
+	assert (w != NULL);
+	assert (body != NULL || len == 0);
+
+	if (len > UINT32_MAX) {
+		return SP_MSGPACK_ESIZE;
+	}
+	uint8_t tag[SP_MSGPACK_TAG_MAX];
+	size_t n = sp_msgpack_enc_ext (tag, type, (uint32_t)len);
+	int rc = sp_utf8_ensure (&w->out, n + len);
+	if (rc < 0) {
+		return rc;
+	}
+	uint8_t *out = w->out.buf + w->out.len;
+	memcpy (out, tag, n);
+	memcpy (out + n, body, len);
+	w->out.len += n + len;
+	return n + len;
+}
+
+ssize_t
+sp_msgpack_write_timestamp (SpMsgpackWriter *w, const SpClock *ts)
+{
+	assert (w != NULL);
+	assert (ts != NULL);
+
+	uint8_t tag[SP_MSGPACK_TIMESTAMP_MAX];
+	size_t n = sp_msgpack_enc_timestamp (tag, ts);
+	int rc = sp_utf8_ensure (&w->out, n);
+	if (rc < 0) {
+		return rc;
+	}
+	memcpy (w->out.buf + w->out.len, tag, n);
+	w->out.len += n;
+	return n;
+}
+
+ssize_t
+sp_msgpack_write_array (SpMsgpackWriter *w, uint32_t count)
+{
+	assert (w != NULL);
+
+	return writer_scalar (w, enc_array, count);
+}
+
+ssize_t
+sp_msgpack_write_map (SpMsgpackWriter *w, uint32_t count)
+{
+	assert (w != NULL);
+
+	return writer_scalar (w, enc_map, count);
+}
+
+ssize_t
+sp_msgpack_write_int_array (SpMsgpackWriter *w, const int64_t *vals, size_t n)
+{
+	assert (w != NULL);
+	assert (vals != NULL || n == 0);
+
+	int64_t min = 0, max = 0;
+	for (size_t i = 0; i < n; i++) {
+		min = vals[i] < min ? vals[i] : min;
+		max = vals[i] > max ? vals[i] : max;
+	}
+
+	uint8_t *out;
+	if (min >= B_FINT_MIN && max <= B_FUINT_MAX) {
+		// every value is its own tag
+		ssize_t hdr = writer_array (w, n, 1, &out);
+		if (hdr < 0) {
+			return hdr;
+		}
+		out += hdr;
+		for (size_t i = 0; i < n; i++) {
+			out[i] = (uint8_t)vals[i];
+		}
+		w->out.len += hdr + n;
+		return hdr + n;
+	}
+
+	uint8_t tag;
+	unsigned width;
+	writer_int_encoding (min, max, &tag, &width);
+
+	ssize_t hdr = writer_array (w, n, 1 + width, &out);
+	if (hdr < 0) {
+		return hdr;
+	}
+	out += hdr;
+	PACK (out, w->out.buf + w->out.cap, vals, n, tag, width);
+	w->out.len += hdr + n*(1 + width);
+	return hdr + n*(1 + width);
+}
+
+ssize_t
+sp_msgpack_write_uint32_array (SpMsgpackWriter *w, const uint32_t *vals, size_t n)
+{
+	assert (w != NULL);
+	assert (vals != NULL || n == 0);
+
+	uint32_t max = 0;
+	for (size_t i = 0; i < n; i++) {
+		max = vals[i] > max ? vals[i] : max;
+	}
+
+	uint8_t *out;
+	if (max <= B_FUINT_MAX) {
+		ssize_t hdr = writer_array (w, n, 1, &out);
+		if (hdr < 0) {
+			return hdr;
+		}
+		out += hdr;
+		for (size_t i = 0; i < n; i++) {
+			out[i] = (uint8_t)vals[i];
+		}
+		w->out.len += hdr + n;
+		return hdr + n;
+	}
+
+	uint8_t tag;
+	unsigned width;
+	writer_int_encoding (0, max, &tag, &width);
+
+	ssize_t hdr = writer_array (w, n, 1 + width, &out);
+	if (hdr < 0) {
+		return hdr;
+	}
+	out += hdr;
+	PACK (out, w->out.buf + w->out.cap, vals, n, tag, width);
+	w->out.len += hdr + n*(1 + width);
+	return hdr + n*(1 + width);
+}
+
+ssize_t
+sp_msgpack_write_double_array (SpMsgpackWriter *w, const double *vals, size_t n)
+{
+	assert (w != NULL);
+	assert (vals != NULL || n == 0);
+
+	// floats are used when every value survives the narrowing exactly
+	bool narrow = true;
+	for (size_t i = 0; i < n && narrow; i++) {
+		narrow = (double)(float)vals[i] == vals[i];
+	}
+
+	uint8_t *out;
+	ssize_t hdr = writer_array (w, n, narrow ? 5 : 9, &out);
+	if (hdr < 0) {
+		return hdr;
+	}
+	out += hdr;
+
+	if (narrow) {
+		for (size_t i = 0; i < n; i++, out += 5) {
+			union { float f; uint32_t i; } v = { .f = (float)vals[i] };
+			uint32_t be = sp_htobe32 (v.i);
+			out[0] = B_FLOAT;
+			memcpy (out + 1, &be, sizeof be);
+		}
+	}
+	else {
+		for (size_t i = 0; i < n; i++, out += 9) {
+			union { double f; uint64_t i; } v = { .f = vals[i] };
+			uint64_t be = sp_htobe64 (v.i);
+			out[0] = B_DOUBLE;
+			memcpy (out + 1, &be, sizeof be);
+		}
+	}
+
+	size_t len = hdr + n*(narrow ? 5 : 9);
+	w->out.len += len;
+	return len;
+}
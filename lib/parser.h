@@ -1,17 +1,34 @@
 #include "../include/siphon/error.h"
 
-#include "pcmp/eq16.h"
-#include "pcmp/leq.h"
-#include "pcmp/leq16.h"
-#include "pcmp/set16.h"
-#include "pcmp/range16.h"
-
+#include "pcmp/common.h"
+#include "scan.h"
+
+#include <string.h>
+
+/**
+ * Compares a mixed case string to a lower case literal.
+ *
+ * The literals matched by the parsers are only a few bytes long, so a
+ * scalar compare is cheaper than setting up a vector one. Unlike the pcmp
+ * versions, this never reads past either string and needs no locale.
+ */
+static inline int
+sp_leq (const uint8_t *restrict s1, const uint8_t *restrict s2, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		uint8_t c = s1[i];
+		if ((unsigned)(c - 'A') < 26) {
+			c |= 0x20;
+		}
+		if (c != s2[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
 
 #define LEQ(cmp, off, len) \
-	(len == sizeof cmp - 1 && pcmp_leq (off, (uint8_t *)cmp, sizeof cmp - 1))
-
-#define LEQ16(cmp, off, len) \
-	(len == sizeof cmp - 1 && pcmp_leq16 (off, (uint8_t *)cmp, sizeof cmp - 1))
+	(len == sizeof cmp - 1 && sp_leq (off, (uint8_t *)cmp, sizeof cmp - 1))
 
 
 #define DONE 0xFFFFFFFFU
@@ -66,21 +83,21 @@
 } while (0)
 
 #define EXPECT_RANGE(rng, max, done, esyn, esize) do {         \
-	end = pcmp_range16 (end, REMAIN, rng, sizeof rng - 1);     \
+	end = sp_scan_range (end, REMAIN, rng, sizeof rng - 1);    \
 	VERIFY_END (max, done, esyn, esize);                       \
 	CAPTURE_OFFSET ();                                         \
 	EXPECT_MAX_OFFSET (max, esize);                            \
 } while (0)
 
 #define EXPECT_SET(set, max, done, esyn, esize) do {           \
-	end = pcmp_set16 (end, REMAIN, set, sizeof set - 1);       \
+	end = sp_scan_set (end, REMAIN, set, sizeof set - 1);      \
 	VERIFY_END (max, done, esyn, esize);                       \
 	CAPTURE_OFFSET ();                                         \
 	EXPECT_MAX_OFFSET (max, esize);                            \
 } while (0)
 
 #define EXPECT_RANGE_THEN_CHAR(rng, ch, max, done, esyn, esize) do { \
-	end = pcmp_range16 (end, REMAIN, rng, sizeof rng - 1);           \
+	end = sp_scan_range (end, REMAIN, rng, sizeof rng - 1);          \
 	VERIFY_END (max, done, esyn, esize);                             \
 	if (pcmp_unlikely (*end != ch)) {                                \
 		YIELD_ERROR (esyn);                                          \
@@ -115,7 +132,7 @@
 		}                                                      \
 		return SCAN;                                           \
 	}                                                          \
-	if (!pcmp_eq16 (end, pre, sizeof pre - 1)) {               \
+	if (memcmp (end, pre, sizeof pre - 1) != 0) {              \
 		YIELD_ERROR (esyn);                                    \
 	}                                                          \
 	end = m + p->off + SCAN + sizeof pre - 1;                  \
@@ -123,7 +140,7 @@
 } while (0)
 
 #define EXPECT_CRLF(max, done, esyn, esize) do {               \
-	end = pcmp_set16 (end, REMAIN, (uint8_t *)"\r", 1);        \
+	end = sp_scan_set (end, REMAIN, (uint8_t *)"\r", 1);       \
 	VERIFY_END (max, done, esyn, esize);                       \
 	if (pcmp_unlikely ((size_t)(end - m) == len - 1)) {        \
 		p->off = len - 1 - SCAN;                               \
@@ -1,5 +1,5 @@
 #include "../include/siphon/ring.h"
-#include "../include/siphon/alloc.h"
+#include "allocator.h"
 #include "../include/siphon/hash.h"
 #include "../include/siphon/vec.h"
 #include "../include/siphon/fmt.h"
@@ -18,7 +18,7 @@ static void
 node_free (void *val)
 {
 	SpRingNode *node = val;
-	sp_free (node, sizeof *node + node->keylen);
+	sp_afree (node->ring->nodes.alloc, node, sizeof *node + node->keylen);
 }
 
 static const SpType map_type = {
@@ -53,10 +53,25 @@ sp_ring_final (SpRing *self)
 	}
 }
 
+int
+sp_ring_use_allocator (SpRing *self, const SpAllocator *alloc)
+{
+	assert (self != NULL);
+
+	// nodes free themselves through the ring so they must not outlive it
+	if (sp_map_count (&self->nodes) > 0) {
+		return -EBUSY;
+	}
+
+	int rc = sp_map_use_allocator (&self->nodes, alloc);
+	if (rc < 0) { return rc; }
+	return sp_vec_use_allocator (self->replicas, alloc) < 0 ? -errno : 0;
+}
+
 static SpRingNode *
 create_node (SpRing *self, const void *restrict key, size_t len, int avail)
 {
-	SpRingNode *node = sp_malloc (sizeof *node + len);
+	SpRingNode *node = sp_amalloc (self->nodes.alloc, sizeof *node + len);
 	if (node == NULL) return NULL;
 
 	node->ring = self;
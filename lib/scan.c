@@ -0,0 +1,300 @@
+#include "scan.h"
+#include "cpu.h"
+#include "pcmp/range16.h"
+#include "pcmp/set16.h"
+
+// maximum number of range pairs and set characters
+#define MAX_RANGE 8
+#define MAX_SET 16
+
+static const uint8_t *
+range_base (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict rng, int rlen)
+{
+	return pcmp_range16 (cmp, clen, rng, rlen);
+}
+
+static const uint8_t *
+set_base (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict set, int slen)
+{
+	return pcmp_set16 (cmp, clen, set, slen);
+}
+
+// the first scan selects the kernels and then runs through them
+static const uint8_t *
+range_resolve (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict rng, int rlen)
+{
+	sp_cpu_init ();
+	return sp_scan_range_kernel (cmp, clen, rng, rlen);
+}
+
+static const uint8_t *
+set_resolve (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict set, int slen)
+{
+	sp_cpu_init ();
+	return sp_scan_set_kernel (cmp, clen, set, slen);
+}
+
+SpScan sp_scan_range_kernel = range_resolve;
+SpScan sp_scan_set_kernel = set_resolve;
+
+#if SP_CPU_X86
+
+SP_TARGET_SSE42 static const uint8_t *
+range_sse42 (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict rng, int rlen)
+{
+	// copy the range so the load never reads past the caller's string
+	uint8_t pairs[16] = { 0 };
+	int n = rlen/2 < MAX_RANGE ? rlen/2 : MAX_RANGE;
+	memcpy (pairs, rng, n*2);
+
+	const __m128i s1 = _mm_loadu_si128 ((const __m128i *)pairs);
+
+	for (; clen >= 16; cmp += 16, clen -= 16) {
+		__m128i s2 = _mm_loadu_si128 ((const __m128i *)cmp);
+		int c = _mm_cmpestri (s1, n*2, s2, 16, _SIDD_CMP_RANGES);
+		if (c != 16) {
+			return cmp + c;
+		}
+	}
+
+	if (clen > 0) {
+		// copy the remainder so the load never reads past the input
+		uint8_t rem[16] = { 0 };
+		memcpy (rem, cmp, clen);
+		__m128i s2 = _mm_loadu_si128 ((const __m128i *)rem);
+		int c = _mm_cmpestri (s1, n*2, s2, clen, _SIDD_CMP_RANGES);
+		if (c != 16) {
+			return cmp + c;
+		}
+	}
+
+	return NULL;
+}
+
+SP_TARGET_SSE42 static const uint8_t *
+set_sse42 (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict set, int slen)
+{
+	uint8_t chars[16] = { 0 };
+	int n = slen < MAX_SET ? slen : MAX_SET;
+	memcpy (chars, set, n);
+
+	const __m128i s1 = _mm_loadu_si128 ((const __m128i *)chars);
+
+	for (; clen >= 16; cmp += 16, clen -= 16) {
+		__m128i s2 = _mm_loadu_si128 ((const __m128i *)cmp);
+		int c = _mm_cmpestri (s1, n, s2, 16, _SIDD_CMP_EQUAL_ANY);
+		if (c != 16) {
+			return cmp + c;
+		}
+	}
+
+	if (clen > 0) {
+		uint8_t rem[16] = { 0 };
+		memcpy (rem, cmp, clen);
+		__m128i s2 = _mm_loadu_si128 ((const __m128i *)rem);
+		int c = _mm_cmpestri (s1, n, s2, clen, _SIDD_CMP_EQUAL_ANY);
+		if (c != 16) {
+			return cmp + c;
+		}
+	}
+
+	return NULL;
+}
+
+SP_TARGET_AVX2 static inline uint32_t
+range_mask32 (__m256i s, const __m256i *lo, const __m256i *hi, int n)
+{
+	__m256i acc = _mm256_setzero_si256 ();
+	for (int i = 0; i < n; i++) {
+		// unsigned lo <= s <= hi using min/max since there is no unsigned compare
+		__m256i ge = _mm256_cmpeq_epi8 (_mm256_max_epu8 (s, lo[i]), s);
+		__m256i le = _mm256_cmpeq_epi8 (_mm256_min_epu8 (s, hi[i]), s);
+		acc = _mm256_or_si256 (acc, _mm256_and_si256 (ge, le));
+	}
+	return (uint32_t)_mm256_movemask_epi8 (acc);
+}
+
+SP_TARGET_AVX2 static const uint8_t *
+range_avx2 (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict rng, int rlen)
+{
+	if (clen < 32) {
+		// most tokens are short, and every avx2 cpu also has sse4.2
+		return range_sse42 (cmp, clen, rng, rlen);
+	}
+
+	__m256i lo[MAX_RANGE], hi[MAX_RANGE];
+	int n = rlen/2 < MAX_RANGE ? rlen/2 : MAX_RANGE;
+	for (int i = 0; i < n; i++) {
+		lo[i] = _mm256_set1_epi8 ((char)rng[i*2]);
+		hi[i] = _mm256_set1_epi8 ((char)rng[i*2+1]);
+	}
+
+	for (; clen >= 32; cmp += 32, clen -= 32) {
+		__m256i s = _mm256_loadu_si256 ((const __m256i *)cmp);
+		uint32_t mask = range_mask32 (s, lo, hi, n);
+		if (mask) {
+			return cmp + __builtin_ctz (mask);
+		}
+	}
+
+	if (clen > 0) {
+		// rescan the final 32 bytes and drop the bits already checked
+		__m256i s = _mm256_loadu_si256 ((const __m256i *)(cmp + clen - 32));
+		uint32_t mask = range_mask32 (s, lo, hi, n) >> (32 - clen);
+		if (mask) {
+			return cmp + __builtin_ctz (mask);
+		}
+	}
+
+	return NULL;
+}
+
+SP_TARGET_AVX2 static inline uint32_t
+set_mask32 (__m256i s, const __m256i *ch, int n)
+{
+	__m256i acc = _mm256_setzero_si256 ();
+	for (int i = 0; i < n; i++) {
+		acc = _mm256_or_si256 (acc, _mm256_cmpeq_epi8 (s, ch[i]));
+	}
+	return (uint32_t)_mm256_movemask_epi8 (acc);
+}
+
+SP_TARGET_AVX2 static const uint8_t *
+set_avx2 (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict set, int slen)
+{
+	if (clen < 32) {
+		return set_sse42 (cmp, clen, set, slen);
+	}
+
+	__m256i ch[MAX_SET];
+	int n = slen < MAX_SET ? slen : MAX_SET;
+	for (int i = 0; i < n; i++) {
+		ch[i] = _mm256_set1_epi8 ((char)set[i]);
+	}
+
+	for (; clen >= 32; cmp += 32, clen -= 32) {
+		__m256i s = _mm256_loadu_si256 ((const __m256i *)cmp);
+		uint32_t mask = set_mask32 (s, ch, n);
+		if (mask) {
+			return cmp + __builtin_ctz (mask);
+		}
+	}
+
+	if (clen > 0) {
+		__m256i s = _mm256_loadu_si256 ((const __m256i *)(cmp + clen - 32));
+		uint32_t mask = set_mask32 (s, ch, n) >> (32 - clen);
+		if (mask) {
+			return cmp + __builtin_ctz (mask);
+		}
+	}
+
+	return NULL;
+}
+
+SP_TARGET_AVX512 static inline __m512i
+load64 (const uint8_t *cmp, int clen, __mmask64 *live)
+{
+	if (clen >= 64) {
+		*live = ~(__mmask64)0;
+		return _mm512_loadu_si512 ((const void *)cmp);
+	}
+	// masked loads suppress faults so the tail never reads past the input
+	*live = ((__mmask64)1 << clen) - 1;
+	return _mm512_maskz_loadu_epi8 (*live, cmp);
+}
+
+SP_TARGET_AVX512 static const uint8_t *
+range_avx512 (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict rng, int rlen)
+{
+	if (clen < 64) {
+		// a single masked block does not pay for the broadcasts
+		return range_sse42 (cmp, clen, rng, rlen);
+	}
+
+	__m512i lo[MAX_RANGE], hi[MAX_RANGE];
+	int n = rlen/2 < MAX_RANGE ? rlen/2 : MAX_RANGE;
+	for (int i = 0; i < n; i++) {
+		lo[i] = _mm512_set1_epi8 ((char)rng[i*2]);
+		hi[i] = _mm512_set1_epi8 ((char)rng[i*2+1]);
+	}
+
+	for (; clen > 0; cmp += 64, clen -= 64) {
+		__mmask64 live, mask = 0;
+		__m512i s = load64 (cmp, clen, &live);
+		for (int i = 0; i < n; i++) {
+			mask |= _mm512_cmpge_epu8_mask (s, lo[i]) &
+				_mm512_cmple_epu8_mask (s, hi[i]);
+		}
+		mask &= live;
+		if (mask) {
+			return cmp + __builtin_ctzll (mask);
+		}
+	}
+
+	return NULL;
+}
+
+SP_TARGET_AVX512 static const uint8_t *
+set_avx512 (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict set, int slen)
+{
+	if (clen < 64) {
+		return set_sse42 (cmp, clen, set, slen);
+	}
+
+	__m512i ch[MAX_SET];
+	int n = slen < MAX_SET ? slen : MAX_SET;
+	for (int i = 0; i < n; i++) {
+		ch[i] = _mm512_set1_epi8 ((char)set[i]);
+	}
+
+	for (; clen > 0; cmp += 64, clen -= 64) {
+		__mmask64 live, mask = 0;
+		__m512i s = load64 (cmp, clen, &live);
+		for (int i = 0; i < n; i++) {
+			mask |= _mm512_cmpeq_epi8_mask (s, ch[i]);
+		}
+		mask &= live;
+		if (mask) {
+			return cmp + __builtin_ctzll (mask);
+		}
+	}
+
+	return NULL;
+}
+
+#endif
+
+void
+sp_scan_select (unsigned features)
+{
+	sp_scan_range_kernel = range_base;
+	sp_scan_set_kernel = set_base;
+
+#if SP_CPU_X86
+	if (features & SP_CPU_AVX512BW) {
+		sp_scan_range_kernel = range_avx512;
+		sp_scan_set_kernel = set_avx512;
+	}
+	else if (features & SP_CPU_AVX2) {
+		sp_scan_range_kernel = range_avx2;
+		sp_scan_set_kernel = set_avx2;
+	}
+	else if (features & SP_CPU_SSE42) {
+		sp_scan_range_kernel = range_sse42;
+		sp_scan_set_kernel = set_sse42;
+	}
+#else
+	(void)features;
+#endif
+}
+
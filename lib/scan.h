@@ -0,0 +1,50 @@
+#ifndef SIPHON_SCAN_H
+#define SIPHON_SCAN_H
+
+#include "../include/siphon/common.h"
+
+typedef const uint8_t *(*SpScan) (
+		const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict rng, int rlen);
+
+// scanners for the host cpu, selected at load time
+SP_LOCAL extern SpScan sp_scan_range_kernel;
+SP_LOCAL extern SpScan sp_scan_set_kernel;
+
+/**
+ * Finds the first character matching the range string.
+ *
+ * The whole string goes through the selected kernel so short tokens get
+ * the host's vector compare even when the build targets a baseline cpu.
+ *
+ * @param  cmp   string to search
+ * @param  clen  length of search string
+ * @param  rng   range string limited to 8 range pairs
+ * @param  rlen  length of range string
+ * @return  pointer to match or NULL
+ */
+static inline const uint8_t *
+sp_scan_range (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict rng, int rlen)
+{
+	return sp_scan_range_kernel (cmp, clen, rng, rlen);
+}
+
+/**
+ * Finds the first character matching any character in the set string.
+ *
+ * @param  cmp   string to search
+ * @param  clen  length of search string
+ * @param  set   set string limited to 16 characters
+ * @param  slen  length of set string
+ * @return  pointer to match or NULL
+ */
+static inline const uint8_t *
+sp_scan_set (const uint8_t *restrict cmp, int clen,
+		const uint8_t *restrict set, int slen)
+{
+	return sp_scan_set_kernel (cmp, clen, set, slen);
+}
+
+#endif
+
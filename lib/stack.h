@@ -1,20 +1,35 @@
+/**
+ * Bit stack shared by the json and msgpack parsers. Entries live in the
+ * inline `stack` array until an external stack is attached with `deep`,
+ * which also raises the depth limit to `deep_max`. When the limit is hit,
+ * STACK_GROW gets a chance to enlarge the external stack before the push
+ * fails. It must be defined by the parser before the push macros are used.
+ */
+
+#define STACK_BITS(p) \
+	(p->deep ? p->deep : p->stack)
+
 #define STACK_MAX(p) \
-	(sizeof (p->stack)*8 - 1)
+	(p->deep ? p->deep_max : sizeof (p->stack)*8 - 1)
 
-#define STACK_PUSH_FALSE(p, e) do {                 \
-	if (p->depth == STACK_MAX (p)) YIELD_ERROR (e); \
-	p->stack[p->depth/8] &= ~(1 << (p->depth%8));   \
-	p->depth++;                                     \
+#define STACK_PUSH_FALSE(p, e) do {                             \
+	if (p->depth == STACK_MAX (p) && !STACK_GROW (p)) {         \
+		YIELD_ERROR (e);                                        \
+	}                                                           \
+	STACK_BITS(p)[p->depth/8] &= ~(1 << (p->depth%8));          \
+	p->depth++;                                                 \
 } while (0)
 
-#define STACK_PUSH_TRUE(p, e) do {                  \
-	if (p->depth == STACK_MAX (p)) YIELD_ERROR (e); \
-	p->stack[p->depth/8] |= 1 << (p->depth%8);      \
-	p->depth++;                                     \
+#define STACK_PUSH_TRUE(p, e) do {                              \
+	if (p->depth == STACK_MAX (p) && !STACK_GROW (p)) {         \
+		YIELD_ERROR (e);                                        \
+	}                                                           \
+	STACK_BITS(p)[p->depth/8] |= 1 << (p->depth%8);             \
+	p->depth++;                                                 \
 } while (0)
 
 #define STACK_TOP(p) \
-	(!!(p->stack[(p->depth-1)/8] & (1 << ((p->depth-1)%8))))
+	(!!(STACK_BITS(p)[(p->depth-1)/8] & (1 << ((p->depth-1)%8))))
 
 #define STACK_POP(p, c) \
 	(p->depth > 0 && STACK_TOP(p) == (c) ? (--p->depth, 1) : 0)
@@ -1,6 +1,6 @@
 #include "../include/siphon/trie.h"
 #include "../include/siphon/fmt.h"
-#include "../include/siphon/alloc.h"
+#include "allocator.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -107,7 +107,23 @@ sp_trie_final (SpTrie *self)
 	assert (self != NULL);
 
 	sp_trie_clear (self);
+
+	const SpAllocator *alloc = self->alloc;
 	*self = SP_TRIE_MAKE (self->type);
+	self->alloc = alloc;
+}
+
+int
+sp_trie_use_allocator (SpTrie *self, const SpAllocator *alloc)
+{
+	assert (self != NULL);
+
+	// nodes are not moved so the allocator may only change while empty
+	if (self->root != NULL) {
+		return -EBUSY;
+	}
+	self->alloc = alloc;
+	return 0;
 }
 
 size_t
@@ -119,21 +135,21 @@ sp_trie_count (const SpTrie *self)
 }
 
 static void
-free_leaf (SpTrieLeaf *l)
+free_leaf (const SpAllocator *a, SpTrieLeaf *l)
 {
 	assert (IS_LEAF ((SpTrieNode *)l));
-	sp_free (l, sizeof *l + l->key_len);
+	sp_afree (a, l, sizeof *l + l->key_len);
 }
 
 static void
-free_branch (SpTrieBranch *b)
+free_branch (const SpAllocator *a, SpTrieBranch *b)
 {
 	assert (IS_BRANCH ((SpTrieNode *)b));
-	sp_free (b, sizeof *b + CAPACITY (b) * sizeof b->children[0]);
+	sp_afree (a, b, sizeof *b + CAPACITY (b) * sizeof b->children[0]);
 }
 
 static void
-clear (SpTrieNode *n, SpFree func)
+clear (const SpAllocator *a, SpTrieNode *n, SpFree func)
 {
 	if (n == NULL) {
 		return;
@@ -144,15 +160,15 @@ clear (SpTrieNode *n, SpFree func)
 		if (func) {
 			func (l->value);
 		}
-		free_leaf (l);
+		free_leaf (a, l);
 	}
 	else {
 		SpTrieBranch *b = BRANCH (n);
-		clear (&b->leaf->node, func);
+		clear (a, &b->leaf->node, func);
 		for (int i = 0; i < CAPACITY (b); i++) {
-			clear (b->children[i], func);
+			clear (a, b->children[i], func);
 		}
-		free_branch (b);
+		free_branch (a, b);
 	}
 }
 
@@ -161,7 +177,7 @@ sp_trie_clear (SpTrie *self)
 {
 	assert (self != NULL);
 
-	clear (self->root, self->type->free);
+	clear (self->alloc, self->root, self->type->free);
 	self->root = NULL;
 	self->count = 0;
 }
@@ -351,7 +367,7 @@ sp_trie_put (SpTrie *self, const void *restrict key, size_t len, void *val)
  * Return the node position for 'c', resizing the branch if necessary
  */
 static SpTrieNode **
-reserve (SpTrieBranch **ref, uint8_t c)
+reserve (const SpAllocator *a, SpTrieBranch **ref, uint8_t c)
 {
 	assert (ref != NULL);
 	assert (*ref != NULL);
@@ -385,7 +401,7 @@ reserve (SpTrieBranch **ref, uint8_t c)
 		assert (cap > 1);
 		assert (off <= c);
 
-		b = sp_realloc (b,
+		b = sp_arealloc (a, b,
 				sizeof *b + CAPACITY (b) * sizeof b->children[0],
 				sizeof *b + cap * sizeof b->children[0]);
 		if (b == NULL) return NULL;
@@ -409,7 +425,7 @@ reserve (SpTrieBranch **ref, uint8_t c)
 }
 
 static SpTrieBranch *
-branch_create (uint8_t c1, uint8_t c2, const void *key, size_t len)
+branch_create (const SpAllocator *a, uint8_t c1, uint8_t c2, const void *key, size_t len)
 {
 	assert (len <= PREFIX_MAX);
 
@@ -423,7 +439,7 @@ branch_create (uint8_t c1, uint8_t c2, const void *key, size_t len)
 		off = min (c1, c2);
 	}
 
-	SpTrieBranch *b = sp_malloc (sizeof *b + cap * sizeof b->children[0]);
+	SpTrieBranch *b = sp_amalloc (a, sizeof *b + cap * sizeof b->children[0]);
 	if (b == NULL) return NULL;
 
 	SET_CAPACITY (b, cap);
@@ -473,12 +489,13 @@ sp_trie_reserve (SpTrie *self, const void *restrict key, size_t len, bool *isnew
 				c2 = end == l->key_len ? c1 : l->key[end];
 			}
 
-			SpTrieBranch *b = branch_create (c1, c2, (uint8_t *)key + offset, end - offset);
+			SpTrieBranch *b = branch_create (self->alloc, c1, c2,
+					(uint8_t *)key + offset, end - offset);
 			if (b == NULL) return NULL;
 
 			if (end == len) {
 				// set old leaf as child
-				SpTrieNode **n = reserve (&b, c2);
+				SpTrieNode **n = reserve (self->alloc, &b, c2);
 				if (n == NULL) return NULL;
 				*n = &l->node;
 
@@ -494,14 +511,14 @@ sp_trie_reserve (SpTrie *self, const void *restrict key, size_t len, bool *isnew
 				}
 				else {
 					// set old leaf as child
-					SpTrieNode **n = reserve (&b, c2);
+					SpTrieNode **n = reserve (self->alloc, &b, c2);
 					if (n == NULL) return NULL;
 					*n = &l->node;
 				}
 
 				// set new branch as parent
 				*par = &b->node;
-				par = reserve ((SpTrieBranch **)par, c1);
+				par = reserve (self->alloc, (SpTrieBranch **)par, c1);
 			}
 
 			// if offset reaches end of key then stop, else keep branching
@@ -522,7 +539,7 @@ sp_trie_reserve (SpTrie *self, const void *restrict key, size_t len, bool *isnew
 					uint8_t c = b->prefix[tail];
 
 					// create new branch by splitting the prefix
-					SpTrieBranch *nb = branch_create (c, c, b->prefix, tail);
+					SpTrieBranch *nb = branch_create (self->alloc, c, c, b->prefix, tail);
 					if (nb == NULL) return NULL;
 
 					// shorten old branch
@@ -530,7 +547,7 @@ sp_trie_reserve (SpTrie *self, const void *restrict key, size_t len, bool *isnew
 					b->prefix_len = b->prefix_len - tail - 1;
 
 					// set old branch as child of new branch
-					SpTrieNode **n = reserve (&nb, c);
+					SpTrieNode **n = reserve (self->alloc, &nb, c);
 					if (n == NULL) return NULL;
 					*n = (SpTrieNode *)b;
 
@@ -548,13 +565,13 @@ sp_trie_reserve (SpTrie *self, const void *restrict key, size_t len, bool *isnew
 			}
 
 			// move parent to the child position in the branch
-			par = reserve ((SpTrieBranch **)par, ((uint8_t *)key)[end]);
+			par = reserve (self->alloc, (SpTrieBranch **)par, ((uint8_t *)key)[end]);
 			if (par == NULL) return NULL;
 			offset = end + 1;
 		}
 	}
 
-	SpTrieLeaf *leaf = sp_malloc (sizeof *leaf + len);
+	SpTrieLeaf *leaf = sp_amalloc (self->alloc, sizeof *leaf + len);
 	if (leaf == NULL) return NULL;
 
 	SET_LEAF (leaf);
@@ -571,7 +588,7 @@ sp_trie_reserve (SpTrie *self, const void *restrict key, size_t len, bool *isnew
 }
 
 static bool
-compact (SpTrieBranch **b)
+compact (const SpAllocator *a, SpTrieBranch **b)
 {
 	// find the only child node otherwise we can't compact
 	SpTrieNode **child = (*b)->leaf == NULL ? NULL : (SpTrieNode **)&(*b)->leaf;
@@ -613,12 +630,12 @@ compact (SpTrieBranch **b)
 		// move child into branch position
 		SpTrieNode *tmp = *child;
 		*child = NULL;
-		free_branch (*b);
+		free_branch (a, *b);
 		*(SpTrieNode **)b = tmp;
 	}
 	// if the branch is empty just free and clear it
 	else {
-		free_branch (*b);
+		free_branch (a, *b);
 		*b = NULL;
 	}
 
@@ -659,10 +676,10 @@ sp_trie_steal (SpTrie *self, const void *restrict key, size_t len)
 		*par = NULL; // remove leaf from its position
 
 		// compact each path item bottom up
-		for (size_t i = depth; i > 0 && compact (path[i-1]); i--);
+		for (size_t i = depth; i > 0 && compact (self->alloc, path[i-1]); i--);
 
 		value = l->value;
-		free_leaf (l);
+		free_leaf (self->alloc, l);
 		self->count--;
 	}
 	return value;
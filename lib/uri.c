@@ -4,7 +4,7 @@
 #include "../include/siphon/error.h"
 #include "../include/siphon/fmt.h"
 
-#include "pcmp/set16.h"
+#include "scan.h"
 
 #include <stdlib.h>
 #include <assert.h>
@@ -477,7 +477,7 @@ sp_uri_query_next (const void *restrict buf, size_t len,
 	sp_utf8_init_fixed (&u, key, iklen);
 
 	while (1) {
-		m = pcmp_set16 (p, len, keyset, sizeof keyset - 1);
+		m = sp_scan_set (p, len, keyset, sizeof keyset - 1);
 		if (m == NULL) {
 			UPDATE (sp_utf8_add_raw (&u, p, len));
 			*klen = u.len;
@@ -506,7 +506,7 @@ read_val:
 	sp_utf8_init_fixed (&u, val, ivlen);
 
 	while (1) {
-		m = pcmp_set16 (p, len, valset, sizeof valset - 1);
+		m = sp_scan_set (p, len, valset, sizeof valset - 1);
 		if (m == NULL) {
 			UPDATE (sp_utf8_add_raw (&u, p, len));
 			*vlen = u.len;
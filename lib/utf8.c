@@ -1,6 +1,6 @@
 #include "../include/siphon/utf8.h"
 #include "../include/siphon/error.h"
-#include "../include/siphon/alloc.h"
+#include "allocator.h"
 #include "parser.h"
 
 #include "pcmp/range.h"
@@ -227,6 +227,29 @@ sp_utf8_init_fixed (SpUtf8 *u, void *buf, size_t len)
 	*u = SP_UTF8_MAKE_FIXED (buf, len);
 }
 
+int
+sp_utf8_use_allocator (SpUtf8 *u, const SpAllocator *alloc)
+{
+	assert (u != NULL);
+
+	if (alloc == u->alloc) {
+		return 0;
+	}
+
+	if (!u->fixed && u->buf != NULL) {
+		uint8_t *buf = sp_amalloc (alloc, u->cap);
+		if (buf == NULL) {
+			return SP_ESYSTEM (errno);
+		}
+		memcpy (buf, u->buf, u->len);
+		buf[u->len] = '\0';
+		sp_afree (u->alloc, u->buf, u->cap);
+		u->buf = buf;
+	}
+	u->alloc = alloc;
+	return 0;
+}
+
 void
 sp_utf8_reset (SpUtf8 *u)
 {
@@ -244,9 +267,12 @@ sp_utf8_final (SpUtf8 *u)
 	assert (u != NULL);
 
 	if (!u->fixed) {
-		sp_free (u->buf, u->cap);
+		sp_afree (u->alloc, u->buf, u->cap);
 	}
+
+	const SpAllocator *alloc = u->alloc;
 	*u = SP_UTF8_MAKE ();
+	u->alloc = alloc;
 }
 
 uint8_t *
@@ -257,7 +283,10 @@ sp_utf8_steal (SpUtf8 *u, size_t *len, size_t *cap)
 	uint8_t *buf = u->buf;
 	if (len) *len = u->len;
 	if (cap) *cap = u->cap;
+
+	const SpAllocator *alloc = u->alloc;
 	*u = SP_UTF8_MAKE ();
+	u->alloc = alloc;
 	return buf;
 }
 
@@ -310,7 +339,7 @@ sp_utf8_ensure (SpUtf8 *u, size_t len)
 		cap = sp_next_quantum (cap, MAX_POWER_OF_2);
 	}
 
-	uint8_t *buf = sp_realloc (u->buf, u->cap, cap);
+	uint8_t *buf = sp_arealloc (u->alloc, u->buf, u->cap, cap);
 	if (buf == NULL) {
 		return SP_ESYSTEM(errno);
 	}
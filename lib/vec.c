@@ -1,5 +1,5 @@
 #include "../include/siphon/vec.h"
-#include "../include/siphon/alloc.h"
+#include "allocator.h"
 
 #include <string.h>
 #include <assert.h>
@@ -9,8 +9,18 @@ typedef struct {
 	uintptr_t count, capacity;
 } SpVec;
 
+// vectors using an allocator store it in a prefix ahead of the header
+typedef struct {
+	const SpAllocator *alloc;
+	uintptr_t pad;
+} SpVecPrefix;
+
 static SpVec NIL = { 0, 0 };
 
+#define HAS_ALLOC (~(UINTPTR_MAX >> 1))
+#define CAP(v) ((v)->capacity & ~HAS_ALLOC)
+#define ALLOC(v) ((v)->capacity & HAS_ALLOC ? ((SpVecPrefix *)(v) - 1)->alloc : NULL)
+
 #define POS(v, s, n) ((uint8_t *)(v+1)+s*n)
 #define HEAD(v) POS(v, 0, 0)
 #define TAIL(v, s) POS(v, s, v->count)
@@ -45,7 +55,8 @@ static SpVec NIL = { 0, 0 };
 } while (0)
 
 static inline SpVec *
-resize (SpVec *v, void **vec, size_t size, size_t cap, size_t count)
+resize (SpVec *v, void **vec, size_t size, size_t cap, size_t count,
+		const SpAllocator *alloc)
 {
 	size_t total = sizeof *v + size*cap;
 	total = total < 16276 ?
@@ -53,12 +64,20 @@ resize (SpVec *v, void **vec, size_t size, size_t cap, size_t count)
 		sp_next_quantum (total, 4096);
 	cap = (total - sizeof *v) / size;
 
-	v = sp_malloc (total);
-	if (v == NULL) { return NULL; }
+	if (alloc != NULL) {
+		SpVecPrefix *pre = sp_amalloc (alloc, sizeof *pre + total);
+		if (pre == NULL) { return NULL; }
+		pre->alloc = alloc;
+		v = (SpVec *)(pre + 1);
+	}
+	else {
+		v = sp_malloc (total);
+		if (v == NULL) { return NULL; }
+	}
 
 	memcpy (HEAD (v), *vec, size*count);
 	v->count = count;
-	v->capacity = cap;
+	v->capacity = alloc ? cap | HAS_ALLOC : cap;
 	sp_vecp_free (vec, size);
 	*vec = v + 1;
 
@@ -69,8 +88,8 @@ static inline SpVec *
 ensure (SpVec *v, void **vec, size_t size, size_t nitems)
 {
 	size_t count = v->count, cap = count + nitems;
-	if (cap <= v->capacity) { return v; }
-	return resize (v, vec, size, cap, count);
+	if (cap <= CAP (v)) { return v; }
+	return resize (v, vec, size, cap, count, ALLOC (v));
 }
 
 size_t
@@ -82,7 +101,7 @@ sp_vecp_count (void **vec)
 size_t
 sp_vecp_capacity (void **vec)
 {
-	return VEC (vec)->capacity;
+	return CAP (VEC (vec));
 }
 
 void
@@ -97,11 +116,27 @@ sp_vecp_free (void **vec, size_t size)
 {
 	SpVec *v = VEC (vec);
 	if (v != &NIL) {
-		sp_free (v, sizeof *v + v->capacity * size);
+		const SpAllocator *alloc = ALLOC (v);
+		if (alloc != NULL) {
+			SpVecPrefix *pre = (SpVecPrefix *)v - 1;
+			sp_afree (alloc, pre, sizeof *pre + sizeof *v + CAP (v) * size);
+		}
+		else {
+			sp_free (v, sizeof *v + v->capacity * size);
+		}
 		*vec = NULL;
 	}
 }
 
+int
+sp_vecp_use_allocator (void **vec, size_t size, const SpAllocator *alloc)
+{
+	SpVec *v = VEC (vec);
+	if (ALLOC (v) == alloc) { return 0; }
+
+	return resize (v, vec, size, v->count, v->count, alloc) ? 0 : -1;
+}
+
 int
 sp_vecp_ensure (void **vec, size_t size, size_t nitems)
 {
@@ -165,8 +200,8 @@ sp_vecp_splice (void **vec, size_t size, ssize_t start, ssize_t end, void *el, s
 	}
 
 	ssize_t new = (ssize_t)v->count + nitems - (end - start);
-	if ((ssize_t)v->capacity < new) {
-		v = resize (v, vec, size, new, v->count);
+	if ((ssize_t)CAP (v) < new) {
+		v = resize (v, vec, size, new, v->count, ALLOC (v));
 		if (v == NULL) { return -1; }
 	}
 
@@ -0,0 +1,159 @@
+#include "../include/siphon/arena.h"
+#include "../include/siphon/alloc.h"
+#include "mu.h"
+
+static void
+test_alloc (void)
+{
+	SpArena a;
+	sp_arena_init (&a, 1024);
+
+	uint8_t *p1 = sp_arena_alloc (&a, 3);
+	uint8_t *p2 = sp_arena_alloc (&a, 20);
+	mu_fassert_ptr_ne (p1, NULL);
+	mu_fassert_ptr_ne (p2, NULL);
+	mu_assert_uint_eq ((uintptr_t)p1 % SP_ARENA_ALIGN, 0);
+	mu_assert_uint_eq ((uintptr_t)p2 % SP_ARENA_ALIGN, 0);
+	mu_assert_ptr_eq (p2, p1 + SP_ARENA_ALIGN);
+	mu_assert_uint_eq (a.used, 48);
+
+	memset (p1, 1, 3);
+	memset (p2, 2, 20);
+
+	// fill past the first block
+	for (int i = 0; i < 100; i++) {
+		uint8_t *p = sp_arena_alloc (&a, 64);
+		mu_fassert_ptr_ne (p, NULL);
+		memset (p, 3, 64);
+	}
+	mu_assert_uint_eq (p1[2], 1);
+	mu_assert_uint_eq (p2[19], 2);
+
+	sp_arena_final (&a);
+}
+
+static void
+test_realloc (void)
+{
+	SpArena a;
+	sp_arena_init (&a, 1024);
+
+	char *p = sp_arena_alloc (&a, 16);
+	memcpy (p, "0123456789abcdef", 16);
+
+	// the last allocation grows in place
+	char *g = sp_arena_realloc (&a, p, 16, 100);
+	mu_assert_ptr_eq (g, p);
+	mu_assert_uint_eq (a.used, 112);
+
+	char *q = sp_arena_alloc (&a, 8);
+	mu_assert_ptr_ne (q, NULL);
+
+	// older allocations are copied
+	char *r = sp_arena_realloc (&a, g, 100, 200);
+	mu_fassert_ptr_ne (r, NULL);
+	mu_assert_ptr_ne (r, g);
+	mu_assert_int_eq (memcmp (r, "0123456789abcdef", 16), 0);
+
+	// shrinking never moves
+	mu_assert_ptr_eq (sp_arena_realloc (&a, q, 8, 4), q);
+
+	sp_arena_final (&a);
+}
+
+static void
+test_free (void)
+{
+	SpArena a;
+	sp_arena_init (&a, 1024);
+
+	void *p1 = sp_arena_alloc (&a, 32);
+	void *p2 = sp_arena_alloc (&a, 32);
+	mu_assert_uint_eq (a.used, 64);
+
+	// only the last allocation is reclaimed
+	sp_arena_free (&a, p1, 32);
+	mu_assert_uint_eq (a.used, 64);
+	sp_arena_free (&a, p2, 32);
+	mu_assert_uint_eq (a.used, 32);
+	mu_assert_ptr_eq (sp_arena_alloc (&a, 32), p2);
+
+	sp_arena_final (&a);
+}
+
+static void
+test_large (void)
+{
+	SpArena a;
+	sp_arena_init (&a, 1024);
+
+	void *small = sp_arena_alloc (&a, 16);
+	uint8_t *big = sp_arena_alloc (&a, 4000);
+	mu_fassert_ptr_ne (big, NULL);
+	memset (big, 0xff, 4000);
+
+	// the bump block is still used after a large allocation
+	mu_assert_ptr_eq (sp_arena_alloc (&a, 16), (uint8_t *)small + 16);
+
+	sp_arena_final (&a);
+}
+
+static void
+test_reset (void)
+{
+	SpArena a;
+	sp_arena_init (&a, 1024);
+
+	void *first = NULL;
+	for (int round = 0; round < 3; round++) {
+		void *p = sp_arena_alloc (&a, 100);
+		if (first == NULL) {
+			first = p;
+		}
+		for (int i = 0; i < 50; i++) {
+			sp_arena_alloc (&a, 100);
+		}
+		sp_arena_alloc (&a, 5000);
+		sp_arena_reset (&a);
+		mu_assert_uint_eq (a.used, 0);
+		mu_assert_ptr_ne (a.head, NULL);
+	}
+
+	sp_arena_final (&a);
+	mu_assert_ptr_eq (a.head, NULL);
+}
+
+static void
+test_allocator (void)
+{
+	SpArena a;
+	sp_arena_init (&a, 0);
+
+	const SpAllocator *alloc = sp_arena_allocator (&a);
+	char *p = alloc->alloc (alloc->ctx, 10);
+	mu_fassert_ptr_ne (p, NULL);
+	memcpy (p, "abcdefghij", 10);
+	p = alloc->realloc (alloc->ctx, p, 10, 20);
+	mu_fassert_ptr_ne (p, NULL);
+	mu_assert_int_eq (memcmp (p, "abcdefghij", 10), 0);
+	alloc->free (alloc->ctx, p, 20);
+	mu_assert_uint_eq (a.used, 0);
+
+	sp_arena_final (&a);
+}
+
+int
+main (void)
+{
+	mu_init ("arena");
+
+	test_alloc ();
+	test_realloc ();
+	test_free ();
+	test_large ();
+	test_reset ();
+	test_allocator ();
+
+	mu_assert (sp_alloc_summary ());
+}
+
@@ -1,4 +1,5 @@
 #include "../include/siphon/crc.h"
+#include "../include/siphon/cpu.h"
 #include "../include/siphon/alloc.h"
 #include "mu.h"
 
@@ -1077,13 +1078,113 @@ test_crc32c (void)
 	}
 }
 
+static uint8_t large[8195];
+
+static void
+test_large (uint32_t (*fn) (uint32_t, const void *, size_t))
+{
+	static uint32_t expect[sizeof large];
+
+	for (size_t i = 0; i < sizeof large; i++) {
+		large[i] = (uint8_t)(i * 2654435761U >> 13);
+	}
+
+	// compute the reference values using only the portable kernels
+	unsigned active = sp_cpu_active ();
+	sp_cpu_restrict (0);
+	for (size_t i = 0; i < sizeof large; i += 7) {
+		expect[i] = fn (0, large + (i % 8), sizeof large - i);
+	}
+	sp_cpu_restrict (active);
+
+	for (size_t i = 0; i < sizeof large; i += 7) {
+		uint32_t crc = fn (0, large + (i % 8), sizeof large - i);
+		mu_assert_uint_eq (crc, expect[i]);
+	}
+}
+
+static void
+test_crc32_incremental (void)
+{
+	uint32_t expect = sp_crc32 (0, large, sizeof large);
+
+	// feed uneven pieces so each kernel sees odd lengths and offsets
+	for (size_t step = 1; step < 1500; step += 61) {
+		uint32_t crc = 0;
+		for (size_t off = 0; off < sizeof large; off += step) {
+			size_t n = sizeof large - off < step ? sizeof large - off : step;
+			crc = sp_crc32 (crc, large + off, n);
+		}
+		mu_assert_uint_eq (crc, expect);
+	}
+}
+
+static void
+test_combine (void)
+{
+	for (size_t split = 0; split <= sizeof large; split += 97) {
+		uint32_t a, b;
+
+		a = sp_crc32 (0, large, split);
+		b = sp_crc32 (0, large + split, sizeof large - split);
+		mu_assert_uint_eq (sp_crc32_combine (a, b, sizeof large - split),
+				sp_crc32 (0, large, sizeof large));
+
+		a = sp_crc32c (0, large, split);
+		b = sp_crc32c (0, large + split, sizeof large - split);
+		mu_assert_uint_eq (sp_crc32c_combine (a, b, sizeof large - split),
+				sp_crc32c (0, large, sizeof large));
+	}
+}
+
+static void
+test_parallel (void)
+{
+	// large enough to split into several of the 1 MiB parts
+	size_t size = 4*1024*1024 + 13;
+	uint8_t *buf = malloc (size);
+	mu_fassert_ptr_ne (buf, NULL);
+
+	for (size_t i = 0; i < size; i++) {
+		buf[i] = (uint8_t)(i * 2654435761U >> 17);
+	}
+
+	for (size_t len = 0; len <= size; len += len < 4096 ? 1021 : 524287) {
+		uint32_t crc = sp_crc32 (7, buf, len);
+		uint32_t crcc = sp_crc32c (7, buf, len);
+		for (unsigned n = 0; n <= 9; n++) {
+			mu_assert_uint_eq (sp_crc32_parallel (7, buf, len, n), crc);
+			mu_assert_uint_eq (sp_crc32c_parallel (7, buf, len, n), crcc);
+		}
+	}
+
+	free (buf);
+}
+
 int
 main (void)
 {
 	mu_init ("crc");
 
-	test_crc32 ();
-	test_crc32c ();
+	// run the vectors against every kernel tier the host supports
+	unsigned features = sp_cpu_features ();
+	unsigned tiers[] = {
+		0,
+		SP_CPU_SSE42,
+		SP_CPU_SSE42|SP_CPU_PCLMUL,
+		features
+	};
+	for (size_t i = 0; i < sp_len (tiers); i++) {
+		mu_assert_uint_eq (sp_cpu_restrict (tiers[i]), tiers[i] & features);
+		test_crc32 ();
+		test_crc32c ();
+		test_large (sp_crc32);
+		test_large (sp_crc32c);
+		test_crc32_incremental ();
+		test_combine ();
+	}
+
+	test_parallel ();
 
 	mu_assert (sp_alloc_summary ());
 }
@@ -1,11 +1,15 @@
 #include "../include/siphon/http.h"
 #include "../include/siphon/alloc.h"
+#include "../include/siphon/arena.h"
 #include "../include/siphon/error.h"
 #include "../include/siphon/fmt.h"
 #include "mu.h"
 
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
+
+#define count(a) (sizeof (a) / sizeof ((a)[0]))
 
 typedef struct {
 	union {
@@ -28,6 +32,45 @@ typedef struct {
 	char body[256];
 } Message;
 
+static void
+capture (Message *msg, SpHttpType type, const SpHttpValue *as,
+		const uint8_t *buf, size_t *body)
+{
+	if (type == SP_HTTP_REQUEST) {
+		strncat (msg->as.request.method,
+				(char *)buf + as->request.method.off,
+				as->request.method.len);
+		strncat (msg->as.request.uri,
+				(char *)buf + as->request.uri.off,
+				as->request.uri.len);
+		msg->as.request.version = as->request.version;
+	}
+	else if (type == SP_HTTP_RESPONSE) {
+		msg->as.response.version = as->response.version;
+		msg->as.response.status = as->response.status;
+		strncat (msg->as.response.reason,
+				(char *)buf + as->response.reason.off,
+				as->response.reason.len);
+	}
+	else if (type == SP_HTTP_FIELD) {
+		strncat (msg->fields[msg->field_count].name,
+				(char *)buf + as->field.name.off,
+				as->field.name.len);
+		strncat (msg->fields[msg->field_count].value,
+				(char *)buf + as->field.value.off,
+				as->field.value.len);
+		msg->field_count++;
+	}
+	else if (type == SP_HTTP_BODY_START) {
+		if (!as->body_start.chunked) {
+			*body = as->body_start.content_length;
+		}
+	}
+	else if (type == SP_HTTP_BODY_CHUNK) {
+		*body = as->body_chunk.length;
+	}
+}
+
 static bool
 parse (SpHttp *p, Message *msg, const uint8_t *in, size_t inlen, ssize_t speed)
 {
@@ -76,39 +119,79 @@ parse (SpHttp *p, Message *msg, const uint8_t *in, size_t inlen, ssize_t speed)
 				goto out;
 			}
 
-			if (p->type == SP_HTTP_REQUEST) {
-				strncat (msg->as.request.method,
-						(char *)buf + p->as.request.method.off,
-						p->as.request.method.len);
-				strncat (msg->as.request.uri,
-						(char *)buf + p->as.request.uri.off,
-						p->as.request.uri.len);
-				msg->as.request.version = p->as.request.version;
-			}
-			else if (p->type == SP_HTTP_RESPONSE) {
-				msg->as.response.version = p->as.response.version;
-				msg->as.response.status = p->as.response.status;
-				strncat (msg->as.response.reason,
-						(char *)buf + p->as.response.reason.off,
-						p->as.response.reason.len);
+			capture (msg, p->type, &p->as, buf, &body);
+		}
+
+		// trim the buffer
+		buf += rc;
+		trim += rc;
+
+		if (speed > 0) {
+			len += speed;
+			if (len > inlen) {
+				len = inlen;
 			}
-			else if (p->type == SP_HTTP_FIELD) {
-				strncat (msg->fields[msg->field_count].name,
-						(char *)buf + p->as.field.name.off,
-						p->as.field.name.len);
-				strncat (msg->fields[msg->field_count].value,
-						(char *)buf + p->as.field.value.off,
-						p->as.field.value.len);
-				msg->field_count++;
+		}
+	}
+
+out:
+	return ok;
+}
+
+static bool
+parse_batch (SpHttp *p, Message *msg, const uint8_t *in, size_t inlen,
+		ssize_t speed, size_t max)
+{
+	memset (msg, 0, sizeof *msg);
+
+	SpHttpToken tok[8];
+	const uint8_t *buf = in;
+	size_t len, trim = 0;
+	size_t body = 0;
+	ssize_t rc;
+	bool ok = true;
+
+	mu_fassert_uint_le (max, sp_len (tok));
+
+	if (speed > 0) {
+		len = speed;
+	}
+	else {
+		len = inlen;
+	}
+
+	while (body > 0 || !sp_http_is_done (p)) {
+		mu_assert_uint_ge (len, trim);
+		if (len < trim) {
+			ok = false;
+			goto out;
+		}
+
+		if (body > 0) {
+			rc = len - trim;
+			if (body < (size_t)rc) {
+				rc = body;
 			}
-			else if (p->type == SP_HTTP_BODY_START) {
-				if (!p->as.body_start.chunked) {
-					body = p->as.body_start.content_length;
-				}
+			strncat (msg->body, (char *)buf, rc);
+			body -= rc;
+		}
+		else {
+			rc = sp_http_next_batch (p, buf, len - trim, tok, max);
+
+			mu_assert_int_ge (rc, 0);
+			if (rc < 0) {
+				ok = false;
+				goto out;
 			}
-			else if (p->type == SP_HTTP_BODY_CHUNK) {
-				body = p->as.body_chunk.length;
+
+			size_t used = 0;
+			for (ssize_t i = 0; i < rc; i++) {
+				mu_assert_uint_eq (tok[i].off, used);
+				capture (msg, tok[i].type, &tok[i].as, buf + tok[i].off, &body);
+				used += tok[i].len;
 			}
+			mu_assert_uint_le (used, len - trim);
+			rc = (ssize_t)used;
 		}
 
 		// trim the buffer
@@ -242,6 +325,141 @@ test_request_capture (ssize_t speed)
 	sp_http_final (&p);
 }
 
+static void
+test_request_index (ssize_t speed)
+{
+	SpHttp p;
+	SpHttpIndex idx;
+	sp_http_init_request (&p, false);
+	sp_http_use_index (&p, &idx);
+
+	static const uint8_t request[] = 
+		"GET /some/path HTTP/1.1\r\n"
+		"Empty:\r\n"
+		"Space: value\r\n"
+		"Content-Length: 12\r\n"
+		"Test: value 1\r\n"
+		"TEST: value 2\r\n"
+		"test: value 3\r\n"
+		"\r\n"
+		"Hello World!"
+		;
+
+	// the index references the input so use a copy that can be recycled
+	uint8_t copy[sizeof request];
+	memcpy (copy, request, sizeof request);
+
+	Message msg;
+	mu_fassert (parse (&p, &msg, copy, sizeof copy - 1, speed));
+
+	mu_assert_str_eq ("GET", msg.as.request.method);
+	mu_assert_uint_eq (0, msg.field_count);
+	mu_assert_str_eq ("Hello World!", msg.body);
+	mu_assert_uint_eq (idx.count, 6);
+
+	sp_http_index_rebase (&idx, copy);
+
+	const SpHttpIndexField *f = sp_http_index_get (&idx, "content-length", 14);
+	mu_fassert_ptr_ne (f, NULL);
+	mu_assert (SP_RANGE_EQ_STR (f->name, idx.base, "Content-Length"));
+	mu_assert (SP_RANGE_EQ_STR (f->value, idx.base, "12"));
+
+	f = sp_http_index_get (&idx, "empty", 5);
+	mu_fassert_ptr_ne (f, NULL);
+	mu_assert_uint_eq (f->value.len, 0);
+
+	mu_assert_ptr_eq (sp_http_index_get (&idx, "missing", 7), NULL);
+
+	for (int i = 0; i < 2; i++) {
+		f = sp_http_index_get (&idx, "TeSt", 4);
+		mu_fassert_ptr_ne (f, NULL);
+		mu_assert (SP_RANGE_EQ_STR (f->name, idx.base, "Test"));
+		mu_assert (SP_RANGE_EQ_STR (f->value, idx.base, "value 1"));
+		f = sp_http_index_next (&idx, f);
+		mu_fassert_ptr_ne (f, NULL);
+		mu_assert (SP_RANGE_EQ_STR (f->value, idx.base, "value 2"));
+		f = sp_http_index_next (&idx, f);
+		mu_fassert_ptr_ne (f, NULL);
+		mu_assert (SP_RANGE_EQ_STR (f->value, idx.base, "value 3"));
+		mu_assert_ptr_eq (sp_http_index_next (&idx, f), NULL);
+
+		// after owning the fields the receive buffer may be reused
+		mu_fassert_int_eq (sp_http_index_own (&idx), 0);
+		memset (copy, 0, sizeof copy);
+	}
+
+	sp_http_reset (&p);
+	mu_assert_uint_eq (idx.count, 0);
+	mu_assert_ptr_eq (p.index, &idx);
+
+	sp_http_final (&p);
+	sp_http_index_final (&idx);
+}
+
+static void
+test_index_limit (void)
+{
+	char request[8192] = "GET / HTTP/1.1\r\n";
+	size_t len = strlen (request);
+	for (int i = 0; i <= SP_HTTP_INDEX_MAX; i++) {
+		len += snprintf (request + len, sizeof request - len, "X-%d: %d\r\n", i, i);
+	}
+	len += snprintf (request + len, sizeof request - len, "\r\n");
+
+	SpHttp p;
+	SpHttpIndex idx;
+	ssize_t rc;
+
+	sp_http_init_request (&p, false);
+	sp_http_use_index (&p, &idx);
+	rc = sp_http_next (&p, request, len);
+	mu_fassert_int_eq (rc, 16);
+	rc = sp_http_next (&p, request + rc, len - rc);
+	mu_assert_int_eq (rc, SP_HTTP_ESIZE);
+	mu_assert_uint_eq (idx.count, SP_HTTP_INDEX_MAX);
+
+	sp_http_final (&p);
+	sp_http_index_final (&idx);
+}
+
+static void
+test_index_range (void)
+{
+	static const uint8_t buf[] = "Host: example.com";
+
+	SpHttpIndex idx;
+	sp_http_index_init (&idx);
+
+	SpRange16 name = { 0, 4 }, value = { 6, 11 };
+	mu_assert_int_eq (sp_http_index_add (&idx, buf, name, value), 0);
+	mu_assert_uint_eq (idx.count, 1);
+
+	// a range ending past the 16-bit offsets is rejected
+	SpRange16 far = { UINT16_MAX - 3, 4 };
+	mu_assert_int_eq (sp_http_index_add (&idx, buf, name, far), SP_HTTP_ESIZE);
+	far.off = UINT16_MAX - 2;
+	mu_assert_int_eq (sp_http_index_add (&idx, buf, far, value), SP_HTTP_ESIZE);
+	mu_assert_uint_eq (idx.count, 1);
+
+	sp_http_index_final (&idx);
+
+	// overlapping ranges cannot be packed into 16-bit offsets
+	static uint8_t big[30010];
+	memcpy (big, "Big: ", 5);
+	memset (big + 5, 'x', sizeof big - 5);
+	sp_http_index_init (&idx);
+	name = (SpRange16){ 0, 3 };
+	value = (SpRange16){ 5, 30000 };
+	for (int i = 0; i < 4; i++) {
+		mu_fassert_int_eq (sp_http_index_add (&idx, big, name, value), 0);
+	}
+	sp_http_index_rebase (&idx, big);
+	mu_assert_int_eq (sp_http_index_own (&idx), SP_HTTP_ESIZE);
+	mu_assert_ptr_eq (idx.base, big);
+	mu_assert_uint_eq (idx.count, 4);
+	sp_http_index_final (&idx);
+}
+
 static void
 test_chunked_request (ssize_t speed)
 {
@@ -471,6 +689,1043 @@ test_chunked_response (ssize_t speed)
 	sp_http_final (&p);
 }
 
+static void
+test_batch_request (ssize_t speed)
+{
+	static const uint8_t request[] = 
+		"GET /some/path HTTP/1.1\r\n"
+		"Empty:\r\n"
+		"Space: value\r\n"
+		"Spaces: value with spaces\r\n"
+		"Content-Length: 12\r\n"
+		"\r\n"
+		"Hello World!"
+		;
+
+	for (size_t max = 1; max <= 8; max++) {
+		SpHttp p;
+		sp_http_init_request (&p, false);
+
+		Message msg;
+		mu_fassert (parse_batch (&p, &msg, request, sizeof request - 1, speed, max));
+
+		mu_assert_str_eq ("GET", msg.as.request.method);
+		mu_assert_str_eq ("/some/path", msg.as.request.uri);
+		mu_assert_uint_eq (1, msg.as.request.version);
+		mu_assert_uint_eq (4, msg.field_count);
+		mu_assert_str_eq ("Empty", msg.fields[0].name);
+		mu_assert_str_eq ("", msg.fields[0].value);
+		mu_assert_str_eq ("Space", msg.fields[1].name);
+		mu_assert_str_eq ("value", msg.fields[1].value);
+		mu_assert_str_eq ("Spaces", msg.fields[2].name);
+		mu_assert_str_eq ("value with spaces", msg.fields[2].value);
+		mu_assert_str_eq ("Content-Length", msg.fields[3].name);
+		mu_assert_str_eq ("12", msg.fields[3].value);
+		mu_assert_str_eq ("Hello World!", msg.body);
+
+		sp_http_final (&p);
+	}
+}
+
+static void
+test_batch_chunked_request (ssize_t speed)
+{
+	static const uint8_t request[] = 
+		"GET /some/path HTTP/1.1\r\n"
+		"Space: value\r\n"
+		"Transfer-Encoding: chunked\r\n"
+		"\r\n"
+		"5\r\n"
+		"Hello\r\n"
+		"7\r\n"
+		" World!\r\n"
+		"0\r\n"
+		"Trailer: trailer value\r\n"
+		"\r\n"
+		;
+
+	for (size_t max = 1; max <= 8; max++) {
+		SpHttp p;
+		sp_http_init_request (&p, false);
+
+		Message msg;
+		mu_fassert (parse_batch (&p, &msg, request, sizeof request - 1, speed, max));
+
+		mu_assert_uint_eq (3, msg.field_count);
+		mu_assert_str_eq ("Space", msg.fields[0].name);
+		mu_assert_str_eq ("value", msg.fields[0].value);
+		mu_assert_str_eq ("Transfer-Encoding", msg.fields[1].name);
+		mu_assert_str_eq ("chunked", msg.fields[1].value);
+		mu_assert_str_eq ("Trailer", msg.fields[2].name);
+		mu_assert_str_eq ("trailer value", msg.fields[2].value);
+		mu_assert_str_eq ("Hello World!", msg.body);
+
+		sp_http_final (&p);
+	}
+}
+
+#define PIPELINE_REQ1 \
+	"GET /a HTTP/1.1\r\n" \
+	"Host: example.com\r\n" \
+	"\r\n"
+#define PIPELINE_REQ2 \
+	"POST /b HTTP/1.1\r\n" \
+	"Content-Length: 5\r\n" \
+	"\r\n" \
+	"hello"
+#define PIPELINE_REQ3 \
+	"POST /c HTTP/1.1\r\n" \
+	"Transfer-Encoding: chunked\r\n" \
+	"\r\n" \
+	"3\r\nabc\r\n" \
+	"2\r\nde\r\n" \
+	"0\r\n" \
+	"Trailer: x\r\n" \
+	"\r\n"
+
+static const uint8_t pipeline_input[] =
+	PIPELINE_REQ1 PIPELINE_REQ2 PIPELINE_REQ3;
+
+static const size_t pipeline_sizes[] = {
+	sizeof PIPELINE_REQ1 - 1,
+	sizeof PIPELINE_REQ2 - 1,
+	sizeof PIPELINE_REQ3 - 1,
+};
+
+static const char *pipeline_uris[] = { "/a", "/b", "/c" };
+static const char *pipeline_bodies[] = { "", "hello", "abcde" };
+
+static void
+test_pipeline (ssize_t speed)
+{
+	const size_t inlen = sizeof pipeline_input - 1;
+	size_t len = speed > 0 ? (size_t)speed : inlen;
+	size_t trim = 0, start = 0, n = 0;
+	char uri[3][8] = { "" }, body[3][8] = { "" };
+
+	SpHttp p;
+	sp_http_init_request (&p, false);
+	sp_http_use_pipeline (&p, true);
+
+	while (n < count (pipeline_sizes)) {
+		ssize_t rc = sp_http_next (&p, pipeline_input + trim, len - trim);
+		mu_fassert_int_ge (rc, 0);
+
+		const char *tok = (const char *)pipeline_input + trim;
+		switch (p.type) {
+		case SP_HTTP_REQUEST:
+			strncat (uri[n], tok + p.as.request.uri.off, p.as.request.uri.len);
+			break;
+		case SP_HTTP_BODY:
+			mu_fassert_uint_eq (p.as.body.length, rc);
+			strncat (body[n], tok, p.as.body.length);
+			break;
+		case SP_HTTP_MESSAGE_END:
+			mu_fassert_int_eq (rc, 0);
+			mu_assert_uint_eq (p.as.message.length, pipeline_sizes[n]);
+			mu_assert_uint_eq (trim - p.as.message.length, start);
+			mu_assert_str_eq (uri[n], pipeline_uris[n]);
+			mu_assert_str_eq (body[n], pipeline_bodies[n]);
+			start = trim;
+			n++;
+			break;
+		default:
+			break;
+		}
+		mu_assert (!sp_http_is_done (&p));
+
+		trim += rc;
+		if (speed > 0) {
+			len += speed;
+			if (len > inlen) {
+				len = inlen;
+			}
+		}
+	}
+
+	mu_assert_uint_eq (trim, inlen);
+	mu_assert_int_eq (sp_http_next (&p, pipeline_input + trim, 0), 0);
+	mu_assert_int_eq (p.type, SP_HTTP_NONE);
+	sp_http_final (&p);
+}
+
+static void
+test_pipeline_batch (void)
+{
+	static const SpHttpType types[] = {
+		SP_HTTP_REQUEST, SP_HTTP_FIELD, SP_HTTP_BODY_START, SP_HTTP_MESSAGE_END,
+		SP_HTTP_REQUEST, SP_HTTP_FIELD, SP_HTTP_BODY_START, SP_HTTP_BODY,
+		SP_HTTP_MESSAGE_END,
+		SP_HTTP_REQUEST, SP_HTTP_FIELD, SP_HTTP_BODY_START,
+		SP_HTTP_BODY_CHUNK, SP_HTTP_BODY, SP_HTTP_BODY_CHUNK, SP_HTTP_BODY,
+		SP_HTTP_BODY_END, SP_HTTP_FIELD, SP_HTTP_TRAILER_END, SP_HTTP_MESSAGE_END,
+	};
+
+	SpHttpToken tok[32];
+	SpHttp p;
+	sp_http_init_request (&p, false);
+	sp_http_use_pipeline (&p, true);
+
+	ssize_t rc = sp_http_next_batch (&p, pipeline_input, sizeof pipeline_input - 1,
+			tok, count (tok));
+	mu_fassert_int_eq (rc, count (types));
+
+	size_t start = 0, n = 0;
+	for (size_t i = 0; i < count (types); i++) {
+		mu_assert_int_eq (tok[i].type, types[i]);
+		if (tok[i].type == SP_HTTP_MESSAGE_END) {
+			mu_assert_uint_eq (tok[i].len, 0);
+			mu_assert_uint_eq (tok[i].as.message.length, pipeline_sizes[n]);
+			mu_assert_uint_eq (tok[i].off - tok[i].as.message.length, start);
+			start = tok[i].off;
+			n++;
+		}
+	}
+	mu_assert_uint_eq (start, sizeof pipeline_input - 1);
+	sp_http_final (&p);
+
+	// an index only holds one message, so the batch stops at each end
+	SpHttpIndex idx;
+	sp_http_index_init (&idx);
+	sp_http_init_request (&p, false);
+	sp_http_use_pipeline (&p, true);
+	sp_http_use_index (&p, &idx);
+
+	size_t off = 0;
+	for (n = 0; n < count (pipeline_sizes); n++) {
+		rc = sp_http_next_batch (&p, pipeline_input + off,
+				sizeof pipeline_input - 1 - off, tok, count (tok));
+		mu_fassert_int_gt (rc, 0);
+		mu_fassert_int_eq (tok[rc-1].type, SP_HTTP_MESSAGE_END);
+		mu_assert_uint_eq (tok[rc-1].off, pipeline_sizes[n]);
+		mu_assert_uint_eq (idx.count, 1);
+		off += tok[rc-1].off;
+	}
+	mu_assert_uint_eq (off, sizeof pipeline_input - 1);
+
+	sp_http_final (&p);
+	sp_http_index_final (&idx);
+}
+
+static const uint8_t chunked_body[] =
+	"5;name=value\r\n"
+	"Hello\r\n"
+	"7 ; ext\r\n"
+	" World!\r\n"
+	"0\r\n"
+	"Trailer: trailer value\r\n"
+	"Other:  spaced \r\n"
+	"\r\n"
+	;
+
+static void
+test_chunked_decode (ssize_t speed)
+{
+	const size_t inlen = sizeof chunked_body - 1;
+	uint8_t rx[sizeof chunked_body];
+	char body[32] = "";
+	size_t have = 0, in = 0;
+
+	SpHttpMap *trailers = sp_http_map_new ();
+	SpHttpChunked c;
+	sp_http_chunked_init (&c);
+	sp_http_chunked_use_trailers (&c, trailers);
+
+	while (!sp_http_chunked_is_done (&c)) {
+		size_t n = speed > 0 ? (size_t)speed : inlen;
+		if (n > inlen - in) {
+			n = inlen - in;
+		}
+		mu_fassert (n > 0 || have > 0);
+		memcpy (rx + have, chunked_body + in, n);
+		have += n;
+		in += n;
+
+		size_t out;
+		ssize_t rc = sp_http_chunked_decode (&c, rx, have, &out);
+		mu_fassert_int_ge (rc, 0);
+		mu_fassert_uint_le (out, (size_t)rc);
+		strncat (body, (char *)rx, out);
+		memmove (rx, rx + rc, have - rc);
+		have -= rc;
+	}
+
+	mu_assert_uint_eq (in, inlen);
+	mu_assert_uint_eq (have, 0);
+	mu_assert_uint_eq (c.total, 12);
+	mu_assert_str_eq (body, "Hello World!");
+
+	struct iovec iov;
+	const SpHttpEntry *e = sp_http_map_get (trailers, "trailer", 7);
+	mu_fassert_ptr_ne (e, NULL);
+	mu_fassert (sp_http_entry_value (e, 0, &iov));
+	mu_assert_int_eq (iov.iov_len, 13);
+	mu_assert (memcmp (iov.iov_base, "trailer value", 13) == 0);
+	e = sp_http_map_get (trailers, "Other", 5);
+	mu_fassert_ptr_ne (e, NULL);
+	mu_fassert (sp_http_entry_value (e, 0, &iov));
+	mu_assert_int_eq (iov.iov_len, 6);
+	mu_assert (memcmp (iov.iov_base, "spaced", 6) == 0);
+
+	sp_http_map_free (trailers);
+}
+
+static void
+test_chunked_scatter (void)
+{
+	const size_t inlen = sizeof chunked_body - 1;
+	struct iovec iov[2];
+	char body[32] = "";
+	size_t off = 0;
+
+	SpHttpChunked c;
+	sp_http_chunked_init (&c);
+
+	// a single iovec forces a return at each chunk
+	while (!sp_http_chunked_is_done (&c)) {
+		size_t cnt = 1;
+		ssize_t rc = sp_http_chunked_scatter (&c, chunked_body + off, inlen - off, iov, &cnt);
+		mu_fassert_int_gt (rc, 0);
+		mu_fassert_uint_le (cnt, 1);
+		if (cnt == 1) {
+			strncat (body, iov[0].iov_base, iov[0].iov_len);
+		}
+		off += rc;
+	}
+	mu_assert_uint_eq (off, inlen);
+	mu_assert_str_eq (body, "Hello World!");
+
+	static const char *invalid[] = {
+		"zz\r\n",
+		"5\r\nHelloX\r\n",
+		"5\n",
+		"5 x\r\n",
+		"10000000000000000\r\n",
+		"0\r\nNoColon\r\n",
+	};
+
+	for (size_t i = 0; i < count (invalid); i++) {
+		size_t cnt = count (iov);
+		sp_http_chunked_init (&c);
+		ssize_t rc = sp_http_chunked_scatter (&c, invalid[i], strlen (invalid[i]), iov, &cnt);
+		mu_assert_int_lt (rc, 0);
+		mu_assert (!sp_http_chunked_is_done (&c));
+		cnt = count (iov);
+		mu_assert_int_eq (sp_http_chunked_scatter (&c, chunked_body, inlen, iov, &cnt),
+				SP_HTTP_ESTATE);
+		size_t out;
+		mu_assert_int_eq (sp_http_chunked_decode (&c, body, 0, &out), SP_HTTP_ESTATE);
+	}
+
+	uint8_t line[SP_HTTP_MAX_VALUE + 8];
+	memset (line, '0', sizeof line);
+	size_t cnt = count (iov);
+	sp_http_chunked_init (&c);
+	mu_assert_int_eq (sp_http_chunked_scatter (&c, line, sizeof line, iov, &cnt),
+			SP_HTTP_ESIZE);
+}
+
+static size_t
+flatten (const struct iovec *iov, size_t cnt, char *out)
+{
+	size_t len = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		memcpy (out + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	out[len] = '\0';
+	return len;
+}
+
+static void
+test_writer_response (void)
+{
+	static const char body[] = "Hello World!";
+	struct iovec iov[16];
+	char out[256];
+
+	SpHttpWriter w;
+	sp_http_writer_init (&w, iov, count (iov));
+
+	mu_assert_int_eq (sp_http_writer_response (&w, 1, 200, NULL, 0), 0);
+	mu_assert_uint_eq (sp_http_writer_count (&w), 1);
+	mu_assert_int_eq (sp_http_writer_header (&w, SP_HTTP_HEADER_CONTENT_TYPE, "text/plain", 10), 0);
+	mu_assert_int_eq (sp_http_writer_content_length (&w, sizeof body - 1), 0);
+	mu_assert_int_eq (sp_http_writer_end_headers (&w), 0);
+	mu_assert_int_eq (sp_http_writer_body (&w, body, sizeof body - 1), 0);
+
+	size_t len = flatten (iov, sp_http_writer_count (&w), out);
+	mu_assert_uint_eq (len, sp_http_writer_length (&w));
+	mu_assert_str_eq (out,
+		"HTTP/1.1 200 OK\r\n"
+		"content-type: text/plain\r\n"
+		"content-length: 12\r\n"
+		"\r\n"
+		"Hello World!");
+
+	// the body is referenced rather than copied
+	mu_assert_ptr_eq (iov[sp_http_writer_count (&w) - 1].iov_base, body);
+
+	SpHttp p;
+	mu_assert_int_eq (sp_http_init_response (&p, false), 0);
+	mu_assert_int_eq (sp_http_next (&p, out, len), 17);
+	mu_assert_int_eq (p.type, SP_HTTP_RESPONSE);
+	mu_assert_uint_eq (p.as.response.status, 200);
+	sp_http_final (&p);
+
+	// other versions and unknown codes are formatted into the scratch space
+	static const struct {
+		uint8_t version;
+		uint16_t status;
+		const char *reason;
+		const char *expect;
+	} lines[] = {
+		{ 0, 404, NULL, "HTTP/1.0 404 Not Found\r\n" },
+		{ 1, 200, "Fine", "HTTP/1.1 200 Fine\r\n" },
+		{ 1, 599, "", "HTTP/1.1 599 \r\n" },
+		{ 1, 599, NULL, "HTTP/1.1 599 \r\n" },
+	};
+
+	for (size_t i = 0; i < count (lines); i++) {
+		sp_http_writer_reset (&w);
+		mu_assert_int_eq (sp_http_writer_response (&w, lines[i].version, lines[i].status,
+				lines[i].reason, lines[i].reason ? strlen (lines[i].reason) : 0), 0);
+		flatten (iov, sp_http_writer_count (&w), out);
+		mu_assert_str_eq (out, lines[i].expect);
+	}
+
+	// entries are checked before anything is added
+	sp_http_writer_init (&w, iov, 3);
+	mu_assert_int_eq (sp_http_writer_request (&w, "GET", 3, "/", 1, 1), SP_HTTP_ESIZE);
+	mu_assert_uint_eq (sp_http_writer_count (&w), 0);
+	mu_assert_int_eq (sp_http_writer_header (&w, SP_HTTP_HEADER_NONE, "", 0), SP_HTTP_ESYNTAX);
+}
+
+static void
+test_writer_chunked (void)
+{
+	struct iovec iov[32];
+	char out[512];
+
+	SpHttpMap *headers = sp_http_map_new ();
+	SpHttpMap *trailers = sp_http_map_new ();
+	mu_assert_int_eq (sp_http_map_put (headers, "Host", 4, "example.com", 11), 0);
+	mu_assert_int_eq (sp_http_map_put (trailers, "Expires", 7, "never", 5), 0);
+
+	SpHttpWriter w;
+	sp_http_writer_init (&w, iov, count (iov));
+
+	mu_assert_int_eq (sp_http_writer_request (&w, "POST", 4, "/upload", 7, 1), 0);
+	mu_assert_int_eq (sp_http_writer_map (&w, headers), 0);
+	mu_assert_int_eq (sp_http_writer_chunked (&w), 0);
+	mu_assert_int_eq (sp_http_writer_end_headers (&w), 0);
+	mu_assert_int_eq (sp_http_writer_chunk (&w, "Hello", 5), 0);
+	mu_assert_int_eq (sp_http_writer_chunk (&w, "", 0), 0);
+	mu_assert_int_eq (sp_http_writer_chunk (&w, " World! 0123456789", 18), 0);
+	mu_assert_int_eq (sp_http_writer_chunk_end (&w, trailers), 0);
+
+	size_t len = flatten (iov, sp_http_writer_count (&w), out);
+	mu_assert_uint_eq (len, sp_http_writer_length (&w));
+	mu_assert_str_eq (out,
+		"POST /upload HTTP/1.1\r\n"
+		"Host: example.com\r\n"
+		"transfer-encoding: chunked\r\n"
+		"\r\n"
+		"5\r\nHello\r\n"
+		"12\r\n World! 0123456789\r\n"
+		"0\r\n"
+		"Expires: never\r\n"
+		"\r\n");
+
+	// the output decodes back to the original body and trailers
+	const char *start = strstr (out, "\r\n\r\n") + 4;
+	size_t blen = len - (start - out), dlen;
+	SpHttpMap *decoded = sp_http_map_new ();
+	SpHttpChunked c;
+	sp_http_chunked_init (&c);
+	sp_http_chunked_use_trailers (&c, decoded);
+	mu_assert_int_eq (sp_http_chunked_decode (&c, (char *)start, blen, &dlen), blen);
+	mu_assert (sp_http_chunked_is_done (&c));
+	mu_assert_uint_eq (dlen, 23);
+	mu_assert_int_eq (strncmp (start, "Hello World! 0123456789", 23), 0);
+	mu_assert_ptr_ne (sp_http_map_get (decoded, "expires", 7), NULL);
+	sp_http_map_free (decoded);
+
+	sp_http_writer_reset (&w);
+	mu_assert_int_eq (sp_http_writer_chunk_end (&w, NULL), 0);
+	flatten (iov, sp_http_writer_count (&w), out);
+	mu_assert_str_eq (out, "0\r\n\r\n");
+
+	// the scratch space limits the chunks per batch until a reset
+	sp_http_writer_reset (&w);
+	int rc = 0;
+	size_t n = 0;
+	while (rc == 0 && n < 100) {
+		rc = sp_http_writer_chunk (&w, out, 1);
+		n++;
+	}
+	mu_assert_int_eq (rc, SP_HTTP_ESIZE);
+	mu_assert_uint_eq (n, count (iov) / 3 + 1);
+	sp_http_writer_reset (&w);
+	mu_assert_int_eq (sp_http_writer_chunk (&w, out, 1), 0);
+
+	sp_http_map_free (headers);
+	sp_http_map_free (trailers);
+}
+
+static size_t
+unhex (const char *hex, uint8_t *out)
+{
+	size_t n = 0;
+	for (; hex[0] && hex[1]; hex += 2) {
+		unsigned b;
+		sscanf (hex, "%2x", &b);
+		out[n++] = (uint8_t)b;
+	}
+	return n;
+}
+
+typedef struct {
+	const char *hex;
+	size_t table_size;
+	const char *fields[6][2];
+} HpackBlock;
+
+// RFC 7541 C.4 requests and C.6 responses, huffman encoded
+static const HpackBlock hpack_requests[] = {
+	{ "828684418cf1e3c2e5f23a6ba0ab90f4ff", 57, {
+		{ ":method", "GET" },
+		{ ":scheme", "http" },
+		{ ":path", "/" },
+		{ ":authority", "www.example.com" },
+	} },
+	{ "828684be5886a8eb10649cbf", 110, {
+		{ ":method", "GET" },
+		{ ":scheme", "http" },
+		{ ":path", "/" },
+		{ ":authority", "www.example.com" },
+		{ "cache-control", "no-cache" },
+	} },
+	{ "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf", 164, {
+		{ ":method", "GET" },
+		{ ":scheme", "https" },
+		{ ":path", "/index.html" },
+		{ ":authority", "www.example.com" },
+		{ "custom-key", "custom-value" },
+	} },
+};
+
+static const HpackBlock hpack_responses[] = {
+	{ "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff"
+	  "6e919d29ad171863c78f0b97c8e9ae82ae43d3", 222, {
+		{ ":status", "302" },
+		{ "cache-control", "private" },
+		{ "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+		{ "location", "https://www.example.com" },
+	} },
+	{ "4883640effc1c0bf", 222, {
+		{ ":status", "307" },
+		{ "cache-control", "private" },
+		{ "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+		{ "location", "https://www.example.com" },
+	} },
+	{ "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94"
+	  "e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c0"
+	  "03ed4ee5b1063d5007", 215, {
+		{ ":status", "200" },
+		{ "cache-control", "private" },
+		{ "date", "Mon, 21 Oct 2013 20:13:22 GMT" },
+		{ "location", "https://www.example.com" },
+		{ "content-encoding", "gzip" },
+		{ "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" },
+	} },
+};
+
+static size_t
+hpack_count (const HpackBlock *b)
+{
+	size_t n = 0;
+	while (n < count (b->fields) && b->fields[n][0] != NULL) {
+		n++;
+	}
+	return n;
+}
+
+static void
+test_hpack_blocks (const HpackBlock *blocks, size_t n, size_t limit)
+{
+	SpHpackDecoder d;
+	SpHpackEncoder e;
+	SpUtf8 out = SP_UTF8_MAKE ();
+	mu_assert_int_eq (sp_hpack_decoder_init (&d, limit), 0);
+	mu_assert_int_eq (sp_hpack_encoder_init (&e, limit), 0);
+
+	for (size_t i = 0; i < n; i++) {
+		uint8_t block[256];
+		size_t len = unhex (blocks[i].hex, block), off = 0, nfields = 0;
+
+		while (off < len) {
+			SpHpackField f;
+			ssize_t rc = sp_hpack_decode_next (&d, block + off, len - off, &f);
+			mu_fassert_int_gt (rc, 0);
+			mu_fassert_uint_lt (nfields, count (blocks[i].fields));
+			const char *name = blocks[i].fields[nfields][0];
+			const char *value = blocks[i].fields[nfields][1];
+			mu_assert_int_eq (f.nlen, strlen (name));
+			mu_assert_int_eq (strncmp ((const char *)f.name, name, f.nlen), 0);
+			mu_assert_int_eq (f.vlen, strlen (value));
+			mu_assert_int_eq (strncmp ((const char *)f.value, value, f.vlen), 0);
+
+			mu_assert_int_eq (sp_hpack_encode_field (&e, &out,
+					name, strlen (name), value, strlen (value),
+					SP_HPACK_LITERAL_INDEXED), 0);
+
+			off += rc;
+			nfields++;
+		}
+		mu_assert_uint_eq (nfields, hpack_count (&blocks[i]));
+		mu_assert_uint_eq (d.table.size, blocks[i].table_size);
+		mu_assert_uint_eq (e.table.size, blocks[i].table_size);
+
+		// the encoder makes the same choices as the examples
+		mu_assert_uint_eq (out.len, len);
+		mu_assert_int_eq (memcmp (out.buf, block, len), 0);
+		sp_utf8_reset (&out);
+	}
+
+	sp_utf8_final (&out);
+	sp_hpack_encoder_final (&e);
+	sp_hpack_decoder_final (&d);
+}
+
+static void
+test_hpack_examples (void)
+{
+	test_hpack_blocks (hpack_requests, count (hpack_requests), SP_HPACK_TABLE_SIZE);
+	test_hpack_blocks (hpack_responses, count (hpack_responses), 256);
+}
+
+static const uint8_t *
+hpack_entry_name (const SpHpackTable *t, size_t i, size_t *len)
+{
+	const SpHpackEntry *e = &t->entries[(t->head - 1 - i) & t->mask];
+	*len = e->nlen;
+	return t->bytes + e->off;
+}
+
+static void
+test_hpack_map (void)
+{
+	SpHpackDecoder d;
+	SpHpackEncoder e;
+	SpUtf8 out = SP_UTF8_MAKE ();
+	mu_assert_int_eq (sp_hpack_decoder_init (&d, 256), 0);
+	mu_assert_int_eq (sp_hpack_encoder_init (&e, 256), 0);
+
+	SpHttpMap *m = sp_http_map_new ();
+	mu_assert_int_eq (sp_http_map_put (m, "Host", 4, "example.com", 11), 0);
+	mu_assert_int_eq (sp_http_map_put (m, ":path", 5, "/", 1), 0);
+	mu_assert_int_eq (sp_http_map_put (m, "Connection", 10, "keep-alive", 10), 0);
+	mu_assert_int_eq (sp_http_map_put (m, "Authorization", 13, "Basic c2VjcmV0", 14), 0);
+	mu_assert_int_eq (sp_http_map_put (m, "Accept", 6, "text/html", 9), 0);
+	mu_assert_int_eq (sp_http_map_put (m, "Accept", 6, "*/*", 3), 0);
+
+	// the second block is mostly indexed from the dynamic table
+	size_t first = 0;
+	for (int i = 0; i < 2; i++) {
+		sp_utf8_reset (&out);
+		mu_assert_int_eq (sp_hpack_encode_map (&e, &out, m), 0);
+		if (i == 0) {
+			first = out.len;
+		}
+		else {
+			mu_assert_uint_lt (out.len, first);
+		}
+
+		// pseudo-header fields come first
+		SpHpackField f;
+		ssize_t n = sp_hpack_decode_next (&d, out.buf, out.len, &f);
+		mu_assert_int_gt (n, 0);
+		mu_assert_int_eq (f.nlen, 5);
+		mu_assert_int_eq (strncmp ((const char *)f.name, ":path", 5), 0);
+
+		SpHttpMap *dm = sp_http_map_new ();
+		mu_assert_int_eq (sp_hpack_decode_map (&d, out.buf + n, out.len - n, dm), out.len - n);
+		mu_assert_ptr_ne (sp_http_map_get (dm, "host", 4), NULL);
+		mu_assert_ptr_ne (sp_http_map_get (dm, "authorization", 13), NULL);
+		mu_assert_ptr_eq (sp_http_map_get (dm, "connection", 10), NULL);
+		const SpHttpEntry *ent = sp_http_map_get (dm, "accept", 6);
+		mu_assert_ptr_ne (ent, NULL);
+		mu_assert_uint_eq (sp_http_entry_count (ent), 2);
+		sp_http_map_free (dm);
+	}
+
+	// authorization is never indexed, so it never enters the table
+	mu_assert_uint_eq (d.table.count, 3);
+	for (size_t i = 0; i < d.table.count; i++) {
+		size_t len;
+		const uint8_t *name = hpack_entry_name (&d.table, i, &len);
+		mu_assert (len != 13 || memcmp (name, "authorization", 13) != 0);
+	}
+
+	sp_http_map_free (m);
+	sp_utf8_final (&out);
+	sp_hpack_encoder_final (&e);
+	sp_hpack_decoder_final (&d);
+}
+
+static void
+test_hpack_size (void)
+{
+	SpHpackDecoder d;
+	SpHpackEncoder e;
+	SpUtf8 out = SP_UTF8_MAKE ();
+	mu_assert_int_eq (sp_hpack_decoder_init (&d, 256), 0);
+	mu_assert_int_eq (sp_hpack_encoder_init (&e, 256), 0);
+
+	char value[300];
+	memset (value, 'x', sizeof value);
+
+	// each entry is 32 + 1 + 60 bytes, so only two fit and older ones are evicted
+	for (int i = 0; i < 5; i++) {
+		char name = (char)('a' + i);
+		mu_assert_int_eq (sp_hpack_encode_field (&e, &out, &name, 1, value, 60,
+				SP_HPACK_LITERAL_INDEXED), 0);
+	}
+	SpHttpMap *m = sp_http_map_new ();
+	mu_assert_int_eq (sp_hpack_decode_map (&d, out.buf, out.len, m), out.len);
+	sp_http_map_free (m);
+	mu_assert_uint_eq (d.table.count, 2);
+	mu_assert_uint_eq (d.table.size, 2 * 93);
+
+	size_t len;
+	mu_assert_int_eq (hpack_entry_name (&d.table, 0, &len)[0], 'e');
+	mu_assert_int_eq (hpack_entry_name (&d.table, 1, &len)[0], 'd');
+
+	// indexes beyond the dynamic table are rejected
+	SpHpackField f;
+	mu_assert_int_eq (sp_hpack_decode_next (&d, "\xbf", 1, &f), 1);
+	mu_assert_int_eq (sp_hpack_decode_next (&d, "\xc0", 1, &f), SP_HTTP_ESYNTAX);
+
+	// an entry larger than the table empties it
+	sp_utf8_reset (&out);
+	mu_assert_int_eq (sp_hpack_encode_field (&e, &out, "big", 3, value, sizeof value,
+			SP_HPACK_LITERAL_INDEXED), 0);
+	mu_assert_int_eq (sp_hpack_encoder_set_size (&e, 100), 0);
+	mu_assert_int_eq (sp_hpack_encoder_set_size (&e, 200), 0);
+	mu_assert_int_eq (sp_hpack_encoder_set_size (&e, 257), SP_HTTP_ESIZE);
+	mu_assert_uint_eq (e.table.count, 0);
+
+	// a reduction then increase is signalled as both sizes
+	mu_assert_int_eq (sp_hpack_encode_field (&e, &out, "a", 1, "b", 1,
+			SP_HPACK_LITERAL_INDEXED), 0);
+	ssize_t off = 0, rc;
+	mu_assert_int_gt ((rc = sp_hpack_decode_next (&d, out.buf, out.len, &f)), 0);
+	off += rc;
+	mu_assert_uint_eq (d.table.count, 0);
+	mu_assert_int_gt ((rc = sp_hpack_decode_next (&d, out.buf + off, out.len - off, &f)), 0);
+	off += rc;
+	mu_assert_int_eq (f.type, SP_HPACK_SIZE_UPDATE);
+	mu_assert_uint_eq (f.size, 100);
+	mu_assert_int_gt ((rc = sp_hpack_decode_next (&d, out.buf + off, out.len - off, &f)), 0);
+	off += rc;
+	mu_assert_int_eq (f.type, SP_HPACK_SIZE_UPDATE);
+	mu_assert_uint_eq (f.size, 200);
+	mu_assert_int_gt ((rc = sp_hpack_decode_next (&d, out.buf + off, out.len - off, &f)), 0);
+	off += rc;
+	mu_assert_int_eq (f.type, SP_HPACK_LITERAL_INDEXED);
+	mu_assert_uint_eq (off, out.len);
+	mu_assert_uint_eq (d.table.max, 200);
+
+	sp_utf8_final (&out);
+	sp_hpack_encoder_final (&e);
+	sp_hpack_decoder_final (&d);
+}
+
+static void
+test_hpack_long (void)
+{
+	SpHpackDecoder d;
+	SpHpackEncoder e;
+	SpUtf8 out = SP_UTF8_MAKE ();
+	mu_assert_int_eq (sp_hpack_decoder_init (&d, SP_HPACK_TABLE_SIZE), 0);
+	mu_assert_int_eq (sp_hpack_encoder_init (&e, SP_HPACK_TABLE_SIZE), 0);
+
+	static char value[SP_HPACK_MAX_VALUE + 1];
+	for (size_t i = 0; i < sizeof value; i++) {
+		value[i] = "abcdefghijklmnopqrstuvwxyz0123456789/"[i % 37];
+	}
+
+	// values beyond the http/1 limits round trip, raw and huffman encoded
+	static const size_t lens[] = { 1500, 3000, SP_HPACK_MAX_VALUE };
+	for (int huff = 0; huff < 2; huff++) {
+		sp_hpack_encoder_use_huffman (&e, huff);
+		for (size_t i = 0; i < count (lens); i++) {
+			sp_utf8_reset (&out);
+			mu_assert_int_eq (sp_hpack_encode_field (&e, &out, ":path", 5, value, lens[i],
+					SP_HPACK_LITERAL_INDEXED), 0);
+			mu_assert_int_eq (sp_hpack_encode_field (&e, &out, ":path", 5, value, lens[i],
+					SP_HPACK_LITERAL_INDEXED), 0);
+
+			size_t off = 0;
+			for (int n = 0; n < 2; n++) {
+				SpHpackField f;
+				ssize_t rc = sp_hpack_decode_next (&d, out.buf + off, out.len - off, &f);
+				mu_fassert_int_gt (rc, 0);
+				mu_assert_uint_eq (f.vlen, lens[i]);
+				mu_assert_int_eq (memcmp (f.value, value, lens[i]), 0);
+				off += rc;
+			}
+			mu_assert_uint_eq (off, out.len);
+		}
+	}
+
+	// the encoder refuses what the decoder would reject
+	sp_utf8_reset (&out);
+	mu_assert_int_eq (sp_hpack_encode_field (&e, &out, "cookie", 6, value, sizeof value,
+			SP_HPACK_LITERAL_INDEXED), SP_HTTP_ESIZE);
+	mu_assert_uint_eq (out.len, 0);
+
+	sp_utf8_final (&out);
+	sp_hpack_encoder_final (&e);
+	sp_hpack_decoder_final (&d);
+}
+
+static void
+test_hpack_invalid (void)
+{
+	static const struct {
+		const char *hex;
+		ssize_t rc;
+	} blocks[] = {
+		{ "80", SP_HTTP_ESYNTAX },                  // index zero
+		{ "be", SP_HTTP_ESYNTAX },                  // empty dynamic table
+		{ "3fe201", SP_HTTP_ESIZE },                // size update above the limit
+		{ "82208286", SP_HTTP_ESYNTAX },            // size update after a field
+		{ "4082", SP_HTTP_ESYNTAX },                // truncated name
+		{ "000161" "82ff", SP_HTTP_ESYNTAX },       // truncated huffman value
+		{ "000161" "81ff", SP_HTTP_ESYNTAX },       // padding longer than 7 bits
+		{ "000161" "84ffffffff", SP_HTTP_ESYNTAX }, // encoded EOS
+		{ "000161" "8100", SP_HTTP_ESYNTAX },       // padding not all ones
+		{ "ff80808080808001", SP_HTTP_ESIZE },      // integer overflow
+	};
+
+	for (size_t i = 0; i < count (blocks); i++) {
+		SpHpackDecoder d;
+		uint8_t block[32];
+		size_t len = unhex (blocks[i].hex, block);
+		SpHttpMap *m = sp_http_map_new ();
+		mu_assert_int_eq (sp_hpack_decoder_init (&d, 256), 0);
+		mu_assert_int_eq (sp_hpack_decode_map (&d, block, len, m), blocks[i].rc);
+		sp_hpack_decoder_final (&d);
+		sp_http_map_free (m);
+	}
+
+	// incomplete representations ask for more input
+	SpHpackDecoder d;
+	SpHpackField f;
+	mu_assert_int_eq (sp_hpack_decoder_init (&d, 256), 0);
+	mu_assert_int_eq (sp_hpack_decode_next (&d, "\x40\x82", 2, &f), 0);
+	mu_assert_int_eq (sp_hpack_decode_next (&d, "\x7f", 1, &f), 0);
+	mu_assert_int_eq (sp_hpack_decode_next (&d, "\x00\x01" "a", 3, &f), 0);
+	sp_hpack_decoder_final (&d);
+}
+
+static void
+test_batch_capture (void)
+{
+	static const uint8_t request[] = 
+		"GET /some/path HTTP/1.1\r\n"
+		"Test: value 1\r\n"
+		"TEST: value 2\r\n"
+		"\r\n"
+		;
+
+	SpHttp p;
+	SpHttpToken tok[4];
+	ssize_t rc;
+
+	sp_http_init_request (&p, true);
+	rc = sp_http_next_batch (&p, request, sizeof request - 1, tok, sp_len (tok));
+	mu_fassert_int_eq (rc, 2);
+	mu_assert_int_eq (tok[0].type, SP_HTTP_REQUEST);
+	mu_assert_uint_eq (tok[0].off, 0);
+	mu_assert_uint_eq (tok[0].len, 25);
+	mu_assert_int_eq (tok[1].type, SP_HTTP_BODY_START);
+	mu_assert_uint_eq (tok[1].off, 25);
+	mu_assert_uint_eq (tok[1].len, sizeof request - 1 - 25);
+	mu_assert (sp_http_is_done (&p));
+
+	const SpHttpEntry *e = sp_http_map_get (p.headers, "test", 4);
+	mu_fassert_ptr_ne (e, NULL);
+	mu_assert_uint_eq (sp_http_entry_count (e), 2);
+
+	sp_http_final (&p);
+}
+
+static void
+test_batch_error (void)
+{
+	static const uint8_t request[] = 
+		"GET /some/path HTTP/1.1\r\n"
+		"Test: value 1\r\n"
+		"Bad Field: value 2\r\n"
+		"\r\n"
+		;
+
+	SpHttp p;
+	SpHttpToken tok[8];
+	ssize_t rc;
+
+	sp_http_init_request (&p, false);
+
+	// the tokens before the error are still returned
+	rc = sp_http_next_batch (&p, request, sizeof request - 1, tok, sp_len (tok));
+	mu_fassert_int_eq (rc, 2);
+	mu_assert_int_eq (tok[0].type, SP_HTTP_REQUEST);
+	mu_assert_int_eq (tok[1].type, SP_HTTP_FIELD);
+	mu_assert_uint_eq (tok[1].off, 25);
+	mu_assert_uint_eq (tok[1].len, 15);
+
+	// then the error is reported once
+	size_t off = tok[1].off + tok[1].len;
+	rc = sp_http_next_batch (&p, request + off, sizeof request - 1 - off,
+			tok, sp_len (tok));
+	mu_assert_int_eq (rc, SP_HTTP_ESYNTAX);
+	mu_assert (sp_http_is_done (&p));
+
+	rc = sp_http_next_batch (&p, request + off, sizeof request - 1 - off,
+			tok, sp_len (tok));
+	mu_assert_int_eq (rc, 0);
+
+	// the held error is also reported when switching to sp_http_next
+	sp_http_reset (&p);
+	rc = sp_http_next_batch (&p, request, sizeof request - 1, tok, sp_len (tok));
+	mu_fassert_int_eq (rc, 2);
+	rc = sp_http_next (&p, request + off, sizeof request - 1 - off);
+	mu_assert_int_eq (rc, SP_HTTP_ESYNTAX);
+	mu_assert (sp_http_is_done (&p));
+
+	sp_http_final (&p);
+}
+
+static void
+test_capture_arena (void)
+{
+	static const uint8_t request[] = 
+		"GET /some/path HTTP/1.1\r\n"
+		"Test: value 1\r\n"
+		"Content-Length: 12\r\n"
+		"TEST: value 2\r\n"
+		"\r\n"
+		"Hello World!"
+		;
+
+	SpArena arena;
+	sp_arena_init (&arena, 0);
+
+	SpHttp p;
+	sp_http_init_request (&p, true);
+	mu_fassert_int_eq (sp_http_map_use_allocator (p.headers, sp_arena_allocator (&arena)), 0);
+
+	for (int i = 0; i < 3; i++) {
+		Message msg;
+		mu_fassert (parse (&p, &msg, request, sizeof request - 1, 0));
+		mu_assert_str_eq ("Hello World!", msg.body);
+		mu_assert_uint_gt (arena.used, 0);
+
+		const SpHttpEntry *e = sp_http_map_get (p.headers, "test", 4);
+		mu_fassert_ptr_ne (e, NULL);
+		mu_assert_uint_eq (sp_http_entry_count (e), 2);
+
+		// the allocator cannot change once headers are captured
+		mu_assert_int_eq (sp_http_map_use_allocator (p.headers, NULL), SP_ESYSTEM (EBUSY));
+
+		// drop the captured headers and recycle the arena per request
+		sp_http_reset (&p);
+		sp_arena_reset (&arena);
+	}
+
+	sp_http_final (&p);
+	sp_arena_final (&arena);
+}
+
+static void
+test_header_id (void)
+{
+	static const char *names[] = {
+#define XX(id, name) name,
+		SP_HTTP_HEADERS(XX)
+#undef XX
+	};
+
+	mu_assert_int_eq (count (names), SP_HTTP_HEADER_COUNT - 1);
+
+	for (size_t i = 0; i < count (names); i++) {
+		char upper[64];
+		size_t len = strlen (names[i]);
+		for (size_t j = 0; j <= len; j++) {
+			upper[j] = toupper (names[i][j]);
+		}
+		mu_assert_int_eq (sp_http_header_id (names[i], len), i + 1);
+		mu_assert_int_eq (sp_http_header_id (upper, len), i + 1);
+		mu_assert_str_eq (sp_http_header_name (i + 1), names[i]);
+		mu_assert_int_eq (sp_http_header_id (names[i], len - 1), SP_HTTP_HEADER_NONE);
+
+		// an exact allocation catches any read past the name
+		char *exact = malloc (len);
+		mu_fassert_ptr_ne (exact, NULL);
+		memcpy (exact, upper, len);
+		mu_assert_int_eq (sp_http_header_id (exact, len), i + 1);
+		free (exact);
+	}
+
+	static const char *unknown[] = {
+		"", "a", "x-custom", "content-lengths", "hots", "cookie2",
+		"access-control-allow-headerz", "x-forwarded-fox",
+		"this-is-a-very-long-header-name-that-is-not-known",
+		"content\rlength", "x-request\x8d" "id", "user\x01" "agent",
+	};
+	for (size_t i = 0; i < count (unknown); i++) {
+		mu_assert_int_eq (sp_http_header_id (unknown[i], strlen (unknown[i])),
+				SP_HTTP_HEADER_NONE);
+	}
+
+	mu_assert_ptr_eq (sp_http_header_name (SP_HTTP_HEADER_NONE), NULL);
+	mu_assert_ptr_eq (sp_http_header_name (SP_HTTP_HEADER_COUNT), NULL);
+
+	static const uint8_t request[] = 
+		"GET /some/path HTTP/1.1\r\n"
+		"Host: example.com\r\n"
+		"X-Custom: 1\r\n"
+		"CONTENT-LENGTH: 0\r\n"
+		"\r\n"
+		;
+
+	static const SpHttpHeader ids[] = {
+		SP_HTTP_HEADER_HOST,
+		SP_HTTP_HEADER_NONE,
+		SP_HTTP_HEADER_CONTENT_LENGTH,
+	};
+
+	SpHttp p;
+	sp_http_init_request (&p, false);
+	size_t off = 0, n = 0;
+	while (!sp_http_is_done (&p)) {
+		ssize_t rc = sp_http_next (&p, request + off, sizeof request - 1 - off);
+		mu_fassert_int_gt (rc, 0);
+		if (p.type == SP_HTTP_FIELD) {
+			mu_fassert_uint_lt (n, count (ids));
+			mu_assert_int_eq (p.as.field.id, ids[n]);
+			n++;
+		}
+		off += rc;
+	}
+	mu_assert_uint_eq (n, count (ids));
+	mu_assert_uint_eq (off, sizeof request - 1);
+	sp_http_final (&p);
+}
+
 static void
 test_invalid_header (void)
 {
@@ -933,12 +2188,34 @@ main (void)
 		test_request (i);
 		test_chunked_request (i);
 		test_request_capture (i);
+		test_request_index (i);
 		test_chunked_request_capture (i);
 		test_response (i);
 		test_chunked_response (i);
+		test_batch_request (i);
+		test_batch_chunked_request (i);
+		test_pipeline (i);
+		test_chunked_decode (i);
 	}
 
+	test_chunked_scatter ();
+	test_pipeline_batch ();
+	test_writer_response ();
+	test_writer_chunked ();
+	test_hpack_examples ();
+	test_hpack_map ();
+	test_hpack_size ();
+	test_hpack_long ();
+	test_hpack_invalid ();
+
+	test_batch_capture ();
+	test_batch_error ();
+	test_index_limit ();
+	test_index_range ();
+	test_capture_arena ();
+
 	test_invalid_header ();
+	test_header_id ();
 
 	test_limit_method_size ();
 	test_exceed_method_size ();
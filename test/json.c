@@ -1,6 +1,8 @@
 #include "../include/siphon/json.h"
+#include "../include/siphon/transcode.h"
 #include "../include/siphon/alloc.h"
 #include "../include/siphon/error.h"
+#include "../include/siphon/cpu.h"
 #include "mu.h"
 
 #include <stdlib.h>
@@ -11,8 +13,10 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <inttypes.h>
+#include <math.h>
 
 static bool debug = false;
+static bool indexed = false;
 
 typedef struct {
 	struct {
@@ -227,6 +231,196 @@ test_parse (ssize_t speed)
 	sp_json_final (&p);
 }
 
+static ssize_t
+parse_number (const char *str, SpJson *p)
+{
+	// a bare number needs a delimiter to be complete
+	char buf[128];
+	int len = snprintf (buf, sizeof buf, "%s ", str);
+
+	sp_json_init (p);
+	ssize_t rc = sp_json_next (p, buf, len, true);
+	if (rc >= 0 && p->type != SP_JSON_NUMBER) {
+		rc = SP_JSON_ESYNTAX;
+	}
+	sp_json_final (p);
+	return rc;
+}
+
+static void
+test_integer (void)
+{
+	SpJson p;
+
+	mu_assert_int_eq (parse_number ("0", &p), 1);
+	mu_assert (p.integral);
+	mu_assert_uint_eq (p.integer.u64, 0);
+
+	mu_assert_int_eq (parse_number ("-0", &p), 2);
+	mu_assert (p.integral);
+	mu_assert_int_eq (p.integer.i64, 0);
+	mu_assert (signbit (p.number));
+
+	mu_assert_int_eq (parse_number ("9007199254740993", &p), 16);
+	mu_assert (p.integral);
+	mu_assert_uint_eq (p.integer.u64, 9007199254740993ULL);
+
+	mu_assert_int_eq (parse_number ("9223372036854775807", &p), 19);
+	mu_assert (p.integral);
+	mu_assert_int_eq (p.integer.i64, INT64_MAX);
+
+	mu_assert_int_eq (parse_number ("-9223372036854775808", &p), 20);
+	mu_assert (p.integral);
+	mu_assert_int_eq (p.integer.i64, INT64_MIN);
+
+	mu_assert_int_eq (parse_number ("18446744073709551615", &p), 20);
+	mu_assert (p.integral);
+	mu_assert_uint_eq (p.integer.u64, UINT64_MAX);
+	mu_assert (p.number == 18446744073709551615.0);
+
+	mu_assert_int_eq (parse_number ("-9223372036854775809", &p), 20);
+	mu_assert (!p.integral);
+	mu_assert (p.number == -9223372036854775809.0);
+
+	mu_assert_int_eq (parse_number ("18446744073709551616", &p), 20);
+	mu_assert (!p.integral);
+	mu_assert (p.number == 18446744073709551616.0);
+
+	mu_assert_int_eq (parse_number ("1.0", &p), 3);
+	mu_assert (!p.integral);
+	mu_assert (p.number == 1.0);
+
+	mu_assert_int_eq (parse_number ("1e2", &p), 3);
+	mu_assert (!p.integral);
+	mu_assert (p.number == 100.0);
+}
+
+static void
+test_float (void)
+{
+	static const char *values[] = {
+		"0.1", "0.3", "1e23", "8.98846567431158e307", "1.7976931348623157e308",
+		"1.7976931348623158e308", "1.8e308", "2.2250738585072014e-308",
+		"2.2250738585072011e-308", "4.9406564584124654e-324",
+		"2.4703282292062327e-324", "2.4703282292062328e-324", "1e-400",
+		"9007199254740993", "9007199254740993.0", "9007199254740992.5",
+		"7.3177701707893310e+15", "1.00000000000000011102230246251565404236316680908203125",
+		"1.00000000000000011102230246251565404236316680908203124",
+		"1.00000000000000011102230246251565404236316680908203126",
+		"3.14159265358979323846264338327950288419716939937510",
+		"-123456789.123456789e-5", "0.000000000000000000000000000000000001",
+		"123456789012345678901234567890", "2.718281828459045", "1E-7",
+		"6.02214076E+23", "-0.0", "5e-324", "1e308", "1e309", "00012.5",
+	};
+
+	for (size_t i = 0; i < sizeof values / sizeof values[0]; i++) {
+		SpJson p;
+		mu_assert_int_eq (parse_number (values[i], &p), (ssize_t)strlen (values[i]));
+		double d = strtod (values[i], NULL);
+		mu_assert_msg (memcmp (&d, &p.number, sizeof d) == 0,
+				"%s: %.17g != %.17g", values[i], p.number, d);
+	}
+
+	// randomized round trips through the shortest and long representations
+	srand (1234);
+	for (int i = 0; i < 100000; i++) {
+		uint64_t bits = ((uint64_t)rand () << 42) ^ ((uint64_t)rand () << 21) ^ (uint64_t)rand ();
+		bits &= ~(1ULL << 63);
+		double d;
+		memcpy (&d, &bits, sizeof d);
+		if (isnan (d) || isinf (d)) {
+			continue;
+		}
+
+		char buf[64];
+		snprintf (buf, sizeof buf, i % 2 ? "%.17g" : "%.25e", d);
+		SpJson p;
+		mu_assert_int_eq (parse_number (buf, &p), (ssize_t)strlen (buf));
+		double exp = strtod (buf, NULL);
+		mu_assert_msg (memcmp (&exp, &p.number, sizeof d) == 0,
+				"%s: %.17g != %.17g", buf, p.number, exp);
+	}
+
+	SpJson p;
+	mu_assert_int_eq (parse_number ("1e", &p), SP_JSON_ESYNTAX);
+	mu_assert_int_eq (parse_number ("1e+", &p), SP_JSON_ESYNTAX);
+	mu_assert_int_eq (parse_number ("-", &p), SP_JSON_ESYNTAX);
+	mu_assert_int_eq (parse_number ("-.", &p), SP_JSON_ESYNTAX);
+	mu_assert_int_eq (parse_number ("1-2", &p), SP_JSON_ESYNTAX);
+	mu_assert_int_eq (parse_number ("1.2.3", &p), SP_JSON_ESYNTAX);
+}
+
+static void
+test_number_stream (ssize_t speed)
+{
+	static const char doc[] =
+		"[1234567890123456789,12345678901234567890123,-0.00001234567890123456789e-3,"
+		"1611241800000,1.5E+2,-7]";
+	static const double exp[] = {
+		1234567890123456789.0, 12345678901234567890123.0,
+		-0.00001234567890123456789e-3, 1611241800000.0, 1.5E+2, -7.0
+	};
+
+	SpJson p;
+	sp_json_init (&p);
+
+	const char *m = doc;
+	size_t len = sizeof doc - 1, off = 0, trim = 0, count = 0;
+	if (speed < 1) {
+		speed = len;
+	}
+
+	while (!sp_json_is_done (&p)) {
+		size_t avail = off + trim + speed;
+		if (avail > len) {
+			avail = len;
+		}
+		ssize_t rc = sp_json_next (&p, m + off, avail - off, avail == len);
+		mu_fassert (rc >= 0);
+		if (rc == 0) {
+			trim += speed;
+			continue;
+		}
+		off += rc;
+		trim = 0;
+		if (p.type == SP_JSON_NUMBER) {
+			mu_fassert (count < sizeof exp / sizeof exp[0]);
+			mu_assert_msg (p.number == exp[count], "%.17g != %.17g",
+					p.number, exp[count]);
+			count++;
+		}
+	}
+	mu_assert_uint_eq (count, sizeof exp / sizeof exp[0]);
+
+	sp_json_final (&p);
+}
+
+static void
+test_number_size (void)
+{
+	char buf[1024];
+	buf[0] = '[';
+	memset (buf + 1, '1', 600);
+	buf[601] = ']';
+
+	SpJson p;
+	sp_json_init (&p);
+	mu_assert_int_eq (sp_json_next (&p, buf, 602, true), 1);
+	mu_assert_int_eq (sp_json_next (&p, buf + 1, 601, true), SP_JSON_ESIZE);
+	sp_json_final (&p);
+
+	// long numbers within the limit still convert exactly
+	memset (buf + 1, '1', 400);
+	buf[401] = ']';
+	sp_json_init (&p);
+	mu_assert_int_eq (sp_json_next (&p, buf, 402, true), 1);
+	mu_assert_int_eq (sp_json_next (&p, buf + 1, 401, true), 400);
+	mu_assert (!p.integral);
+	buf[401] = '\0';
+	mu_assert (p.number == strtod (buf + 1, NULL));
+	sp_json_final (&p);
+}
+
 static ssize_t
 parse_value (const uint8_t *m, ssize_t len, uint16_t depth)
 {
@@ -240,6 +434,14 @@ parse_value (const uint8_t *m, ssize_t len, uint16_t depth)
 		printf ("LEN: %zu\n", len);
 	}
 
+	if (indexed) {
+		int rc = sp_json_index (&p, m, len);
+		if (rc < 0) {
+			values = rc;
+			goto out;
+		}
+	}
+
 	do {
 		ssize_t n = sp_json_next (&p, m, len - off, true);
 		if (n < 0) {
@@ -313,17 +515,1007 @@ out:
 	return rc;
 }
 
-int
-main (void)
+static void
+test_index_stream (void)
 {
-	mu_init ("json");
+	static const char body[] =
+		"{\"a\\\\\\\"b\":[1,-2.5e3,true,false,null,\"x\\\\\"],"
+		"\"esc\\\\\\\\\":\"\\u00e9\\n\\\"{[,:]}\\\"\",\"nest\":{\"k\":[[],{}]},"
+		"\"sp\" : [ 12 , \"\" ] }";
 
-	test_parse (-1);
-	test_parse (1);
+	for (size_t pad = 0; pad < 70; pad++) {
+		char doc[256];
+		memset (doc, ' ', pad);
+		memcpy (doc + pad, body, sizeof body);
+		size_t len = pad + sizeof body - 1;
 
-	test_parse (2);
-	test_parse (11);
+		SpJson a, b;
+		sp_json_init (&a);
+		sp_json_init (&b);
+		mu_assert_int_eq (sp_json_index (&b, doc, len), 0);
+
+		size_t aoff = 0, boff = 0;
+		while (!sp_json_is_done (&a)) {
+			ssize_t rc = sp_json_next (&a, doc + aoff, len - aoff, true);
+			mu_fassert (rc >= 0);
+			aoff += rc;
+			if (a.type == SP_JSON_NONE) {
+				continue;
+			}
+
+			rc = sp_json_next (&b, doc + boff, len - boff, true);
+			mu_fassert (rc >= 0);
+			boff += rc;
+			mu_assert_int_eq (a.type, b.type);
+			mu_assert_uint_eq (aoff, boff);
+			mu_assert_int_eq (sp_json_is_key (&a), sp_json_is_key (&b));
+			if (a.type == SP_JSON_STRING) {
+				mu_assert_uint_eq (a.utf8.len, b.utf8.len);
+				mu_assert (memcmp (a.utf8.buf, b.utf8.buf, a.utf8.len) == 0);
+			}
+			else if (a.type == SP_JSON_NUMBER) {
+				mu_assert (a.number == b.number);
+			}
+		}
+		mu_assert (sp_json_is_done (&b));
+
+		sp_json_final (&a);
+		sp_json_final (&b);
+	}
+
+	SpJson p;
+	sp_json_init (&p);
+	mu_assert_int_eq (sp_json_index (&p, "[\"abc\\\"]", 8), SP_JSON_ESYNTAX);
+	const char *doc = "[1x]";
+	mu_assert_int_eq (sp_json_index (&p, doc, 4), 0);
+	mu_assert_int_eq (sp_json_next (&p, doc, 4, true), 1);
+	mu_assert_int_eq (sp_json_next (&p, doc + 1, 3, true), SP_JSON_ESYNTAX);
+	sp_json_reset (&p);
+	doc = "[\"a\"\"b\"]";
+	mu_assert_int_eq (sp_json_index (&p, doc, 8), 0);
+	mu_assert_int_eq (sp_json_next (&p, doc, 8, true), 1);
+	mu_assert_int_eq (sp_json_next (&p, doc + 1, 7, true), 3);
+	mu_assert_int_eq (sp_json_next (&p, doc + 4, 4, true), SP_JSON_ESYNTAX);
+	sp_json_reset (&p);
+	mu_assert_int_eq (sp_json_index (&p, doc, 8), 0);
+	mu_assert_int_eq (sp_json_next (&p, "[", 1, true), SP_JSON_ESTATE);
+	sp_json_final (&p);
+}
+
+typedef struct {
+	bool skip;
+	SpJsonType type;
+} SkipOp;
+
+static void
+check_skip (const char *doc, size_t len, const SkipOp *ops, size_t nops,
+		ssize_t speed, bool index)
+{
+	SpJson p;
+	sp_json_init (&p);
+
+	size_t off = 0, trim = 0, op = 0;
+	if (index) {
+		mu_assert_int_eq (sp_json_index (&p, doc, len), 0);
+	}
+	if (speed < 1) {
+		speed = len;
+	}
+
+	while (!sp_json_is_done (&p)) {
+		mu_fassert (op < nops);
+		size_t avail = off + trim + speed;
+		if (avail > len) {
+			avail = len;
+		}
+		ssize_t rc = ops[op].skip ?
+			sp_json_skip (&p, doc + off, avail - off, avail == len) :
+			sp_json_next (&p, doc + off, avail - off, avail == len);
+		mu_fassert_msg (rc >= 0, "op %zu (%zd, %d): %s", op, speed, index, sp_strerror (rc));
+		if (rc == 0) {
+			trim += speed;
+			continue;
+		}
+		off += rc;
+		trim = 0;
+		if (p.type != SP_JSON_NONE) {
+			mu_assert_int_eq (p.type, ops[op].type);
+			if (ops[op].type == SP_JSON_NUMBER && !ops[op].skip) {
+				mu_assert (p.number == 1);
+			}
+			op++;
+		}
+	}
+	mu_assert_uint_eq (op, nops);
+	mu_assert_int_eq (p.depth, 0);
+
+	sp_json_final (&p);
+}
+
+static void
+test_skip (ssize_t speed, bool index)
+{
+	static const char doc[] =
+		"{\"skip\":{\"a\":[1,\"x\\\"]}\",{\"b\":\"\\\\\"}]},\"keep\":1,"
+		"\"s2\" : \"str\\\"ing\" ,\"n2\":-12.5e3,\"arr\":[1,[2,3],\"]\"],"
+		"\"t\":true,\"last\":{\"x\":{}}} ";
+	static const SkipOp ops[] = {
+		{ false, SP_JSON_OBJECT },
+		{ false, SP_JSON_STRING }, { true, SP_JSON_OBJECT },
+		{ false, SP_JSON_STRING }, { false, SP_JSON_NUMBER },
+		{ false, SP_JSON_STRING }, { true, SP_JSON_STRING },
+		{ false, SP_JSON_STRING }, { true, SP_JSON_NUMBER },
+		{ false, SP_JSON_STRING }, { false, SP_JSON_ARRAY },
+		{ true, SP_JSON_ARRAY_END },
+		{ false, SP_JSON_STRING }, { true, SP_JSON_TRUE },
+		{ false, SP_JSON_STRING }, { false, SP_JSON_OBJECT },
+		{ true, SP_JSON_OBJECT_END },
+		{ false, SP_JSON_OBJECT_END },
+	};
+
+	check_skip (doc, sizeof doc - 1, ops, sizeof ops / sizeof ops[0], speed, index);
+}
+
+static void
+test_skip_elements (ssize_t speed, bool index)
+{
+	// each skip after the first element consumes the comma before the next
+	static const char doc[] =
+		"[1,{\"a\":[2]},\"s\\\"\" , [1,\"]\"],true,null,-2.5e1 ,1,[]]";
+	static const SkipOp ops[] = {
+		{ false, SP_JSON_ARRAY },
+		{ false, SP_JSON_NUMBER }, { true, SP_JSON_OBJECT },
+		{ true, SP_JSON_STRING }, { true, SP_JSON_ARRAY },
+		{ true, SP_JSON_TRUE }, { true, SP_JSON_NULL },
+		{ true, SP_JSON_NUMBER }, { false, SP_JSON_NUMBER },
+		{ true, SP_JSON_ARRAY }, { true, SP_JSON_ARRAY_END },
+	};
+
+	check_skip (doc, sizeof doc - 1, ops, sizeof ops / sizeof ops[0], speed, index);
+}
+
+static void
+test_skip_root (ssize_t speed, bool index)
+{
+	static const struct {
+		const char *doc;
+		SpJsonType type;
+	} tests[] = {
+		{ "42", SP_JSON_NUMBER },
+		{ " -1.5e3 ", SP_JSON_NUMBER },
+		{ "true", SP_JSON_TRUE },
+		{ "null ", SP_JSON_NULL },
+		{ "\"st\\\"r\"", SP_JSON_STRING },
+		{ "[1,[2],{\"a\":\"]\"}]", SP_JSON_ARRAY },
+		{ " {\"a\":{}} ", SP_JSON_OBJECT },
+	};
+
+	for (size_t i = 0; i < sizeof tests / sizeof tests[0]; i++) {
+		SkipOp op = { true, tests[i].type };
+		check_skip (tests[i].doc, strlen (tests[i].doc), &op, 1, speed, index);
+	}
+}
+
+static void
+test_lazy (ssize_t speed, bool index)
+{
+	static const char doc[] =
+		"{\"plain\":\"value\",\"esc\\\\aped\":[\"a\\nb\",\"\\u00e9\\\"\",\"\"],"
+		"\"long\":\"0123456789abcdefghijklmnopqrstuvwxyz0123456789\",\"n\":1,"
+		"\"tail\\\\\":\"\\\\\"}";
+	static const struct {
+		const char *str;
+		bool escaped;
+	} exp[] = {
+		{ "plain", false }, { "value", false }, { "esc\\aped", true },
+		{ "a\nb", true }, { "\xc3\xa9\"", true }, { "", false },
+		{ "long", false }, { "0123456789abcdefghijklmnopqrstuvwxyz0123456789", false },
+		{ "n", false }, { "tail\\", true }, { "\\", true },
+	};
+
+	SpJson p;
+	sp_json_init (&p);
+	sp_json_use_lazy_strings (&p, true);
+
+	size_t len = sizeof doc - 1, off = 0, trim = 0, count = 0;
+	if (index) {
+		mu_assert_int_eq (sp_json_index (&p, doc, len), 0);
+	}
+	if (speed < 1) {
+		speed = len;
+	}
+
+	while (!sp_json_is_done (&p)) {
+		size_t avail = off + trim + speed;
+		if (avail > len) {
+			avail = len;
+		}
+		ssize_t rc = sp_json_next (&p, doc + off, avail - off, avail == len);
+		mu_fassert_msg (rc >= 0, "%s", sp_strerror (rc));
+		if (rc == 0) {
+			trim += speed;
+			continue;
+		}
+		if (p.type == SP_JSON_STRING) {
+			mu_fassert (count < sizeof exp / sizeof exp[0]);
+			mu_assert_int_eq (p.escaped, exp[count].escaped);
+			mu_assert_uint_eq (p.utf8.len, 0);
+			ssize_t n = sp_json_decode_string (&p, doc + off);
+			mu_assert_int_eq (n, (ssize_t)strlen (exp[count].str));
+			mu_assert_str_eq ((char *)p.utf8.buf, exp[count].str);
+			count++;
+		}
+		off += rc;
+		trim = 0;
+	}
+	mu_assert_uint_eq (count, sizeof exp / sizeof exp[0]);
+
+	static const char *bad[] = { "\"bad\x01\" ", "\"bad\x1F\" ", "\"bad\x7F\" " };
+	for (size_t i = 0; i < sizeof bad / sizeof bad[0]; i++) {
+		sp_json_reset (&p);
+		if (index) {
+			mu_assert_int_eq (sp_json_index (&p, bad[i], 7), 0);
+		}
+		mu_assert_int_eq (sp_json_next (&p, bad[i], 7, true), SP_JSON_EBYTE);
+	}
+
+	sp_json_final (&p);
+}
+
+static void
+test_query (ssize_t speed, bool index, bool lazy)
+{
+	static const char doc[] =
+		"{\"store\":{\"book\":[{\"title\":\"A\",\"price\":8.95},"
+		"{\"title\":\"B\",\"price\":12.99,\"tags\":[\"x\",\"y\"]}],"
+		"\"bicycle\":{\"color\":\"red\",\"price\":19.95}},"
+		"\"skip\":[1,2,{\"deep\":[3,\"]\"]}],\"esc\\u0061pe\":true}";
+	static const char *paths[] = {
+		"$.store.book[*].title",
+		"$.store.bicycle",
+		"$.store.book[1].tags[0]",
+		"$.escape",
+		"$['store'].bicycle.price",
+	};
+	static const struct {
+		SpJsonType type;
+		uint64_t match;
+		const char *str;
+	} exp[] = {
+		{ SP_JSON_STRING, 0x01, "A" },
+		{ SP_JSON_STRING, 0x01, "B" },
+		{ SP_JSON_STRING, 0x04, "x" },
+		{ SP_JSON_OBJECT, 0x02, NULL },
+		{ SP_JSON_STRING, 0x02, "color" },
+		{ SP_JSON_STRING, 0x02, "red" },
+		{ SP_JSON_STRING, 0x02, "price" },
+		{ SP_JSON_NUMBER, 0x12, NULL },
+		{ SP_JSON_OBJECT_END, 0x02, NULL },
+		{ SP_JSON_TRUE, 0x08, NULL },
+	};
+
+	SpJsonQuery q;
+	sp_json_query_init (&q);
+	for (size_t i = 0; i < sizeof paths / sizeof paths[0]; i++) {
+		mu_assert_int_eq (sp_json_query_add (&q, paths[i], strlen (paths[i])), (int)i);
+	}
+
+	SpJson p;
+	sp_json_init (&p);
+	sp_json_use_lazy_strings (&p, lazy);
+
+	size_t len = sizeof doc - 1, off = 0, trim = 0, count = 0;
+	if (index) {
+		mu_assert_int_eq (sp_json_index (&p, doc, len), 0);
+	}
+	if (speed < 1) {
+		speed = len;
+	}
+
+	while (!sp_json_is_done (&p)) {
+		size_t avail = off + trim + speed;
+		if (avail > len) {
+			avail = len;
+		}
+		ssize_t rc = sp_json_query_next (&q, &p, doc + off, avail - off, avail == len);
+		mu_fassert_msg (rc >= 0, "(%zd, %d, %d): %s", speed, index, lazy, sp_strerror (rc));
+		if (rc == 0) {
+			trim += speed;
+			continue;
+		}
+		if (q.match) {
+			mu_fassert (count < sizeof exp / sizeof exp[0]);
+			mu_assert_int_eq (p.type, exp[count].type);
+			mu_assert_uint_eq (q.match, exp[count].match);
+			if (exp[count].str != NULL) {
+				if (lazy) {
+					mu_fassert (sp_json_decode_string (&p, doc + off) >= 0);
+				}
+				mu_assert_str_eq ((char *)p.utf8.buf, exp[count].str);
+			}
+			else if (p.type == SP_JSON_NUMBER) {
+				mu_assert (p.number == 19.95);
+			}
+			count++;
+		}
+		off += rc;
+		trim = 0;
+	}
+	mu_assert_uint_eq (count, sizeof exp / sizeof exp[0]);
+	mu_assert_uint_eq (off, len);
+	mu_assert_uint_eq (q.nframes, 0);
+
+	sp_json_final (&p);
+	sp_json_query_final (&q);
+}
+
+static void
+test_query_nested (void)
+{
+	static const struct {
+		const char *doc;
+		const char *paths[2];
+		SpJsonType type[8];
+		uint64_t match[8];
+	} tests[] = {
+		{ "{\"a\":{\"b\":{\"c\":1}}}", { "$.a", "$.a.b" },
+			{ SP_JSON_OBJECT, SP_JSON_STRING, SP_JSON_OBJECT, SP_JSON_STRING,
+			  SP_JSON_NUMBER, SP_JSON_OBJECT_END, SP_JSON_OBJECT_END },
+			{ 1, 1, 3, 3, 3, 3, 1 } },
+		{ "{\"a\":[[2]]}", { "$.a[0]", "$.a" },
+			{ SP_JSON_ARRAY, SP_JSON_ARRAY, SP_JSON_NUMBER, SP_JSON_ARRAY_END,
+			  SP_JSON_ARRAY_END },
+			{ 2, 3, 3, 3, 2 } },
+		{ "{\"a\":{}}", { "$", "$.a" },
+			{ SP_JSON_OBJECT, SP_JSON_STRING, SP_JSON_OBJECT, SP_JSON_OBJECT_END,
+			  SP_JSON_OBJECT_END },
+			{ 1, 1, 3, 3, 1 } },
+	};
+
+	for (size_t t = 0; t < sizeof tests / sizeof tests[0]; t++) {
+		SpJsonQuery q;
+		sp_json_query_init (&q);
+		for (int i = 0; i < 2; i++) {
+			const char *path = tests[t].paths[i];
+			mu_assert_int_eq (sp_json_query_add (&q, path, strlen (path)), i);
+		}
+
+		SpJson p;
+		sp_json_init (&p);
+
+		const char *doc = tests[t].doc;
+		size_t len = strlen (doc), off = 0, n = 0;
+		while (!sp_json_is_done (&p)) {
+			ssize_t rc = sp_json_query_next (&q, &p, doc + off, len - off, true);
+			mu_fassert_int_gt (rc, 0);
+			off += rc;
+			if (q.match) {
+				mu_fassert_uint_lt (n, 8);
+				mu_assert_int_eq (p.type, tests[t].type[n]);
+				mu_assert_uint_eq (q.match, tests[t].match[n]);
+				n++;
+			}
+		}
+		mu_assert_uint_eq (n, t == 0 ? 7 : 5);
+		mu_assert_uint_eq (q.nemit, 0);
+
+		sp_json_final (&p);
+		sp_json_query_final (&q);
+	}
+}
+
+static void
+test_query_paths (void)
+{
+	static const char *bad[] = {
+		"", "store", "$.", "$..a", "$[", "$[1", "$[x]", "$['a]", "$[\"a\\\"\"]",
+		"$[4294967296]", "$.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q",
+	};
+
+	SpJsonQuery q;
+	sp_json_query_init (&q);
+	for (size_t i = 0; i < sizeof bad / sizeof bad[0]; i++) {
+		mu_assert_int_eq (sp_json_query_add (&q, bad[i], strlen (bad[i])), SP_JSON_EPATH);
+	}
+
+	SpJson p;
+	sp_json_init (&p);
+	mu_assert_int_eq (sp_json_query_next (&q, &p, "[]", 2, true), SP_JSON_ESTATE);
+
+	// repeated paths share their steps but keep distinct ids
+	char path[32];
+	for (int i = 0; i < SP_JSON_QUERY_MAX; i++) {
+		int n = snprintf (path, sizeof path, "$[%d].a[*]", i % 4);
+		mu_assert_int_eq (sp_json_query_add (&q, path, n), i);
+	}
+	mu_assert_int_eq (sp_json_query_add (&q, "$", 1), SP_JSON_EPATH);
+	mu_assert_uint_eq (q.nnodes, 13);
 
+	const char *doc = "[{\"a\":[1]},{\"a\":{\"b\":2}},3] ";
+	uint64_t even = 0;
+	for (int i = 0; i < SP_JSON_QUERY_MAX; i += 4) {
+		even |= UINT64_C(1) << i;
+	}
+	size_t len = strlen (doc), off = 0;
+	ssize_t rc = sp_json_query_next (&q, &p, doc, len, true);
+	mu_assert_int_eq (rc, 8);
+	mu_assert_int_eq (p.type, SP_JSON_NUMBER);
+	mu_assert_uint_eq (q.match, even);
+	off += rc;
+	rc = sp_json_query_next (&q, &p, doc + off, len - off, true);
+	mu_assert_int_eq (rc, 14);
+	mu_assert_int_eq (p.type, SP_JSON_NUMBER);
+	mu_assert_uint_eq (q.match, even << 1);
+	off += rc;
+	rc = sp_json_query_next (&q, &p, doc + off, len - off, true);
+	mu_assert_int_eq (rc, 5);
+	mu_assert_uint_eq (q.match, 0);
+	mu_assert (sp_json_is_done (&p));
+
+	sp_json_final (&p);
+	sp_json_query_final (&q);
+}
+
+static void
+test_dom (void)
+{
+	static const char doc[] =
+		"{\"name\":\"plain\",\"esc\":\"a\\nb\\u00e9\",\"list\":[1,-2,[true,false],null,0.5,-0],"
+		"\"empty\":{},\"big\":{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,"
+		"\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,"
+		"\"k13\":13,\"k14\":14,\"k15\":15,\"k16\":{\"x\":[]},\"k1\":99},"
+		"\"huge\":18446744073709551615}";
+
+	SpJsonDom d;
+	sp_json_dom_init (&d);
+	mu_assert_int_eq (sp_json_dom_parse (&d, doc, sizeof doc - 1), 0);
+
+	mu_assert_uint_eq (d.count, 59);
+	mu_assert_int_eq (d.tape[0].type, SP_JSON_OBJECT);
+	mu_assert_uint_eq (d.tape[0].len, 6);
+	mu_assert_uint_eq (d.tape[0].next, d.count);
+	mu_assert_ptr_eq (d.tape[0].as.table, NULL);
+
+	uint32_t pos = sp_json_dom_get (&d, 0, "name", 4);
+	mu_assert_int_eq (d.tape[pos].type, SP_JSON_STRING);
+	mu_assert_uint_eq (d.tape[pos].len, 5);
+	mu_assert_ptr_eq (d.tape[pos].as.str, (const uint8_t *)doc + 9);
+
+	pos = sp_json_dom_get (&d, 0, "esc", 3);
+	mu_assert_uint_eq (d.tape[pos].len, 5);
+	mu_assert (memcmp (d.tape[pos].as.str, "a\nb\xc3\xa9", 5) == 0);
+
+	uint32_t list = sp_json_dom_get (&d, 0, "list", 4);
+	mu_assert_int_eq (d.tape[list].type, SP_JSON_ARRAY);
+	mu_assert_uint_eq (d.tape[list].len, 6);
+	mu_assert (sp_json_dom_number (&d, sp_json_dom_at (&d, list, 0)) == 1);
+	pos = sp_json_dom_at (&d, list, 1);
+	mu_assert (d.tape[pos].integral && d.tape[pos].negative);
+	mu_assert_int_eq (d.tape[pos].as.i64, -2);
+	pos = sp_json_dom_at (&d, list, 2);
+	mu_assert_uint_eq (d.tape[pos].len, 2);
+	mu_assert_int_eq (d.tape[pos + 2].type, SP_JSON_FALSE);
+	mu_assert_int_eq (d.tape[d.tape[pos].next].type, SP_JSON_NULL);
+	mu_assert (sp_json_dom_number (&d, sp_json_dom_at (&d, list, 4)) == 0.5);
+	pos = sp_json_dom_at (&d, list, 5);
+	mu_assert (!d.tape[pos].integral);
+	mu_assert (signbit (sp_json_dom_number (&d, pos)));
+	mu_assert_uint_eq (sp_json_dom_at (&d, list, 6), 0);
+	mu_assert_uint_eq (sp_json_dom_get (&d, list, "a", 1), 0);
+
+	pos = sp_json_dom_get (&d, 0, "empty", 5);
+	mu_assert_uint_eq (d.tape[pos].len, 0);
+	mu_assert_uint_eq (d.tape[pos].next, pos + 1);
+	mu_assert_uint_eq (sp_json_dom_get (&d, pos, "a", 1), 0);
+
+	// the large object is searched through its table and keeps the first duplicate
+	uint32_t big = sp_json_dom_get (&d, 0, "big", 3);
+	mu_assert_uint_eq (d.tape[big].len, 18);
+	mu_assert_ptr_ne (d.tape[big].as.table, NULL);
+	char key[8];
+	for (int i = 0; i < 16; i++) {
+		int n = snprintf (key, sizeof key, "k%d", i);
+		pos = sp_json_dom_get (&d, big, key, n);
+		mu_fassert_uint_ne (pos, 0);
+		mu_assert (sp_json_dom_number (&d, pos) == i);
+	}
+	pos = sp_json_dom_get (&d, big, "k16", 3);
+	mu_assert_int_eq (d.tape[pos].type, SP_JSON_OBJECT);
+	mu_assert_int_eq (d.tape[sp_json_dom_get (&d, pos, "x", 1)].type, SP_JSON_ARRAY);
+	mu_assert_uint_eq (sp_json_dom_get (&d, big, "k17", 3), 0);
+
+	pos = sp_json_dom_get (&d, 0, "huge", 4);
+	mu_assert (d.tape[pos].integral && !d.tape[pos].negative);
+	mu_assert_uint_eq (d.tape[pos].as.u64, UINT64_MAX);
+
+	// the tape and arena are reused for the next document
+	mu_assert_int_eq (sp_json_dom_parse (&d, "[\"\\\"\"]", 6), 0);
+	mu_assert_uint_eq (d.count, 2);
+	mu_assert_uint_eq (d.tape[1].len, 1);
+	mu_assert_int_eq (d.tape[1].as.str[0], '"');
+	mu_assert_int_eq (sp_json_dom_parse (&d, "{\"a\":[}", 7), SP_JSON_ESYNTAX);
+
+	// only whitespace may follow the root value
+	mu_assert_int_eq (sp_json_dom_parse (&d, "{} \r\n", 5), 0);
+	mu_assert_int_eq (sp_json_dom_parse (&d, "{} x", 4), SP_JSON_ESYNTAX);
+	mu_assert_int_eq (sp_json_dom_parse (&d, "[1] [2]", 7), SP_JSON_ESYNTAX);
+	mu_assert_int_eq (sp_json_dom_parse (&d, "{\"a\":1}}", 8), SP_JSON_ESYNTAX);
+
+	// large arrays index their elements directly
+	static const char arr[] = "[0,[1],2,{\"a\":3},4,5,6,7,8,\"9\",10,11]";
+	mu_assert_int_eq (sp_json_dom_parse (&d, arr, sizeof arr - 1), 0);
+	mu_assert_ptr_ne (d.tape[0].as.table, NULL);
+	for (uint32_t i = 0; i < 12; i++) {
+		pos = sp_json_dom_at (&d, 0, i);
+		mu_fassert_uint_ne (pos, 0);
+		if (i == 1) {
+			mu_assert_int_eq (d.tape[pos].type, SP_JSON_ARRAY);
+		}
+		else if (i == 3) {
+			mu_assert_int_eq (d.tape[pos].type, SP_JSON_OBJECT);
+		}
+		else if (i == 9) {
+			mu_assert_int_eq (d.tape[pos].type, SP_JSON_STRING);
+		}
+		else {
+			mu_assert (sp_json_dom_number (&d, pos) == i);
+		}
+	}
+	mu_assert_uint_eq (sp_json_dom_at (&d, 0, 12), 0);
+
+	sp_json_dom_final (&d);
+}
+
+static void
+test_format_double (void)
+{
+	static const struct {
+		double val;
+		const char *str;
+	} fixed[] = {
+		{ 0.0, "0" }, { -0.0, "-0" }, { 1.0, "1" }, { -2.5, "-2.5" },
+		{ 0.1, "0.1" }, { 0.3, "0.3" }, { 123.456, "123.456" },
+		{ 1e20, "100000000000000000000" }, { 1e21, "1e+21" },
+		{ 0.000001, "0.000001" }, { 1.5e-7, "1.5e-7" },
+		{ 9007199254740993.0, "9007199254740992" },
+		{ 5e-324, "5e-324" }, { 1.7976931348623157e308, "1.7976931348623157e+308" },
+		{ 2.2250738585072014e-308, "2.2250738585072014e-308" },
+		{ NAN, "null" }, { -INFINITY, "null" },
+	};
+
+	char buf[SP_JSON_DOUBLE_MAX];
+	for (size_t i = 0; i < sizeof fixed / sizeof fixed[0]; i++) {
+		size_t n = sp_json_format_double (fixed[i].val, buf);
+		buf[n] = '\0';
+		mu_assert_str_eq (buf, fixed[i].str);
+	}
+
+	// every output must parse back to the same bits with the fewest digits
+	srand (7);
+	for (int i = 0; i < 100000; i++) {
+		uint64_t bits = 0;
+		for (int j = 0; j < 4; j++) {
+			bits = (bits << 16) | (rand () & 0xFFFF);
+		}
+		double val;
+		memcpy (&val, &bits, sizeof val);
+		if (!isfinite (val)) {
+			continue;
+		}
+		size_t n = sp_json_format_double (val, buf);
+		mu_fassert_uint_lt (n, SP_JSON_DOUBLE_MAX);
+		buf[n] = '\0';
+		double back = strtod (buf, NULL);
+		mu_fassert_msg (memcmp (&back, &val, sizeof val) == 0, "%.17g -> %s", val, buf);
+
+		int digits = 0, lead = 1;
+		for (const char *p = buf; *p && *p != 'e'; p++) {
+			if (*p >= '1' && *p <= '9') {
+				lead = 0;
+			}
+			if (*p >= '0' && *p <= '9' && !lead) {
+				digits++;
+			}
+		}
+		// trailing zeros of integers are not significant
+		if (strchr (buf, '.') == NULL && strchr (buf, 'e') == NULL) {
+			for (const char *p = buf + n - 1; p > buf && *p == '0'; p--) {
+				digits--;
+			}
+		}
+		char tmp[32];
+		int shortest = 1;
+		for (; shortest < 17; shortest++) {
+			snprintf (tmp, sizeof tmp, "%.*g", shortest, val);
+			if (strtod (tmp, NULL) == val) {
+				break;
+			}
+		}
+		mu_fassert_msg (digits == shortest, "%.17g -> %s (%d)", val, buf, shortest);
+	}
+}
+
+static void
+test_writer (void)
+{
+	SpJsonWriter w;
+	sp_json_writer_init (&w);
+
+	mu_assert_int_eq (sp_json_write_key (&w, "a", 1), SP_JSON_ESTATE);
+	mu_assert_int_eq (sp_json_write_object_end (&w), SP_JSON_ESTATE);
+	mu_assert_int_eq (sp_json_write_object (&w), 1);
+	mu_assert_int_eq (sp_json_write_null (&w), SP_JSON_ESTATE);
+	mu_assert_int_eq (sp_json_write_key (&w, "str", 3), 6);
+	mu_assert_int_eq (sp_json_write_object_end (&w), SP_JSON_ESTATE);
+	mu_assert_int_eq (sp_json_write_key (&w, "str", 3), SP_JSON_ESTATE);
+	mu_assert_int_eq (sp_json_write_string (&w,
+			"quote\" back\\ tab\t ctl\x01 caf\xc3\xa9 and a longer tail\n", 47), 58);
+	mu_assert_int_eq (sp_json_write_key (&w, "list", 4), 8);
+	mu_assert_int_eq (sp_json_write_array (&w), 1);
+	mu_assert_int_eq (sp_json_write_int (&w, INT64_MIN), 20);
+	mu_assert_int_eq (sp_json_write_uint (&w, UINT64_MAX), 21);
+	mu_assert_int_eq (sp_json_write_int (&w, 0), 2);
+	mu_assert_int_eq (sp_json_write_double (&w, 0.25), 5);
+	mu_assert_int_eq (sp_json_write_bool (&w, true), 5);
+	mu_assert_int_eq (sp_json_write_object (&w), 2);
+	mu_assert_int_eq (sp_json_write_object_end (&w), 1);
+	mu_assert_int_eq (sp_json_write_array (&w), 2);
+	mu_assert_int_eq (sp_json_write_object_end (&w), SP_JSON_ESTATE);
+	mu_assert_int_eq (sp_json_write_array_end (&w), 1);
+	mu_assert_int_eq (sp_json_write_array_end (&w), 1);
+	mu_assert_int_eq (sp_json_write_key (&w, "bad", 3), 7);
+	mu_assert_int_eq (sp_json_write_string (&w, "\xc3", 1), SP_UTF8_EENCODING);
+	mu_assert_int_eq (sp_json_write_bool (&w, false), 5);
+	mu_assert (!sp_json_writer_is_done (&w));
+	mu_assert_int_eq (sp_json_write_object_end (&w), 1);
+	mu_assert (sp_json_writer_is_done (&w));
+	mu_assert_int_eq (sp_json_write_null (&w), SP_JSON_ESTATE);
+
+	mu_assert_str_eq ((char *)w.out.buf,
+		"{\"str\":\"quote\\\" back\\\\ tab\\t ctl\\u0001 caf\xc3\xa9 and a longer tail\\n\","
+		"\"list\":[-9223372036854775808,18446744073709551615,0,0.25,true,{},[]],"
+		"\"bad\":false}");
+
+	// the output parses back to the written values
+	SpJsonDom d;
+	sp_json_dom_init (&d);
+	mu_assert_int_eq (sp_json_dom_parse (&d, w.out.buf, w.out.len), 0);
+	uint32_t pos = sp_json_dom_get (&d, 0, "str", 3);
+	mu_assert_uint_eq (d.tape[pos].len, 47);
+	mu_assert (memcmp (d.tape[pos].as.str,
+			"quote\" back\\ tab\t ctl\x01 caf\xc3\xa9 and a longer tail\n", 47) == 0);
+	sp_json_dom_final (&d);
+
+	sp_json_writer_reset (&w);
+	mu_assert_uint_eq (w.out.len, 0);
+	mu_assert_int_eq (sp_json_write_double (&w, 1e300), 6);
+	mu_assert_str_eq ((char *)w.out.buf, "1e+300");
+	sp_json_writer_final (&w);
+
+	// a full fixed buffer leaves the output and state untouched
+	char buf[16];
+	sp_json_writer_init_fixed (&w, buf, sizeof buf);
+	mu_assert_int_eq (sp_json_write_array (&w), 1);
+	mu_assert_int_eq (sp_json_write_string (&w, "0123456789", 10), 12);
+	mu_assert_int_eq (sp_json_write_string (&w, "x", 1), SP_UTF8_EBUFS);
+	mu_assert_int_eq (sp_json_write_array_end (&w), 1);
+	mu_assert_str_eq (buf, "[\"0123456789\"]");
+	sp_json_writer_final (&w);
+}
+
+static ssize_t
+parse_deep (SpJson *p, const char *in, size_t len, unsigned depth, bool index)
+{
+	size_t off = 0;
+	unsigned opened = 0, closed = 0;
+
+	if (index) {
+		int rc = sp_json_index (p, in, len);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+	while (!sp_json_is_done (p)) {
+		ssize_t rc = sp_json_next (p, in + off, len - off, true);
+		if (rc < 0) {
+			return rc;
+		}
+		off += rc;
+		switch (p->type) {
+		case SP_JSON_OBJECT:
+		case SP_JSON_ARRAY:
+			// even levels are arrays and odd levels are objects
+			mu_fassert_int_eq (p->type, (opened % 2 ? SP_JSON_OBJECT : SP_JSON_ARRAY));
+			opened++;
+			break;
+		case SP_JSON_OBJECT_END:
+		case SP_JSON_ARRAY_END:
+			closed++;
+			mu_fassert_int_eq (p->type,
+					((depth - closed) % 2 ? SP_JSON_OBJECT_END : SP_JSON_ARRAY_END));
+			break;
+		default:
+			break;
+		}
+	}
+	mu_assert_uint_eq (opened, depth);
+	mu_assert_uint_eq (closed, depth);
+	return off;
+}
+
+static void
+test_deep (bool index)
+{
+	// [{"k":[{"k":[... 1 ...]}]}]
+	enum { DEPTH = 3000 };
+	static char input[DEPTH * 6 + 2];
+	size_t len = 0;
+	for (unsigned i = 0; i < DEPTH; i++) {
+		if (i % 2) {
+			memcpy (input + len, "{\"k\":", 5);
+			len += 5;
+		}
+		else {
+			input[len++] = '[';
+		}
+	}
+	input[len++] = '1';
+	for (unsigned i = DEPTH; i > 0; i--) {
+		input[len++] = (i - 1) % 2 ? '}' : ']';
+	}
+
+	SpJson p;
+	sp_json_init (&p);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH, index), SP_JSON_ESTACK);
+	sp_json_final (&p);
+
+	// the arena grows the stack as needed and is released on reset
+	SpArena arena;
+	sp_arena_init (&arena, 0);
+	sp_json_init (&p);
+	sp_json_use_stack_arena (&p, &arena);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH, index), len);
+	sp_json_reset (&p);
+	mu_assert (p.deep == NULL);
+	sp_arena_reset (&arena);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH, index), len);
+	sp_json_final (&p);
+	sp_arena_final (&arena);
+
+	// a caller supplied stack sets the limit and survives a reset
+	static uint8_t stack[SP_JSON_STACK_SIZE (DEPTH)];
+	sp_json_init (&p);
+	sp_json_use_stack (&p, stack, sizeof stack);
+	mu_assert_uint_eq (p.deep_max, sizeof stack * 8 - 1);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH, index), len);
+	sp_json_reset (&p);
+	mu_assert (p.deep == stack);
+	sp_json_use_stack (&p, stack, 64);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH, index), SP_JSON_ESTACK);
+	sp_json_final (&p);
+}
+
+static ssize_t
+transcode_json (const char *in, size_t len, ssize_t speed,
+		uint8_t *out, size_t cap)
+{
+	SpJsonToMsgpack t;
+	sp_json_to_msgpack_init (&t);
+
+	size_t off = 0, avail = 0, olen = 0;
+	ssize_t rc = 0;
+	if (speed < 1) {
+		speed = len;
+	}
+
+	while (!sp_json_to_msgpack_is_done (&t)) {
+		avail += speed;
+		if (off + avail > len) {
+			avail = len - off;
+		}
+		rc = sp_json_to_msgpack (&t, in + off, avail, off + avail == len);
+		if (rc < 0) {
+			goto out;
+		}
+		off += rc;
+		avail -= rc;
+
+		// flush the finished prefix as it becomes available
+		size_t ready = sp_json_to_msgpack_ready (&t);
+		if (olen + ready > cap) {
+			rc = SP_UTF8_EBUFS;
+			goto out;
+		}
+		memcpy (out + olen, t.out.buf, ready);
+		olen += ready;
+		sp_json_to_msgpack_consume (&t, ready);
+
+		if (rc == 0 && off + avail == len) {
+			rc = SP_JSON_ESYNTAX;
+			goto out;
+		}
+	}
+	rc = olen;
+
+out:
+	sp_json_to_msgpack_final (&t);
+	return rc;
+}
+
+static ssize_t
+transcode_msgpack (const uint8_t *in, size_t len, ssize_t speed,
+		char *out, size_t cap)
+{
+	SpMsgpackToJson t;
+	sp_msgpack_to_json_init (&t);
+
+	size_t off = 0, avail = 0, olen = 0;
+	ssize_t rc = 0;
+	if (speed < 1) {
+		speed = len;
+	}
+
+	while (!sp_msgpack_to_json_is_done (&t)) {
+		avail += speed;
+		if (off + avail > len) {
+			avail = len - off;
+		}
+		rc = sp_msgpack_to_json (&t, in + off, avail, off + avail == len);
+		if (rc < 0) {
+			goto out;
+		}
+		off += rc;
+		avail -= rc;
+
+		if (olen + t.writer.out.len >= cap) {
+			rc = SP_UTF8_EBUFS;
+			goto out;
+		}
+		memcpy (out + olen, t.writer.out.buf, t.writer.out.len);
+		olen += t.writer.out.len;
+		sp_msgpack_to_json_consume (&t, t.writer.out.len);
+
+		if (rc == 0 && off + avail == len && !sp_msgpack_to_json_is_done (&t)) {
+			rc = SP_MSGPACK_ESYNTAX;
+			goto out;
+		}
+	}
+	out[olen] = '\0';
+	rc = olen;
+
+out:
+	sp_msgpack_to_json_final (&t);
+	return rc;
+}
+
+static void
+test_transcode (ssize_t speed)
+{
+	static const char json[] =
+		"{ \"a\": [1, -2, 3.5, true, false, null, -0.0],"
+		"  \"s\": \"esc\\\"aped \\u00e9\","
+		"  \"big\": 18446744073709551615, \"neg\": -9223372036854775808,"
+		"  \"o\": {\"k\": {}, \"l\": [[]]}, \"e\": \"\" }";
+	static const char expect[] =
+		"{\"a\":[1,-2,3.5,true,false,null,-0],"
+		"\"s\":\"esc\\\"aped \xc3\xa9\","
+		"\"big\":18446744073709551615,\"neg\":-9223372036854775808,"
+		"\"o\":{\"k\":{},\"l\":[[]]},\"e\":\"\"}";
+
+	uint8_t mp[256];
+	char back[256];
+
+	ssize_t n = transcode_json (json, sizeof json - 1, speed, mp, sizeof mp);
+	mu_fassert_msg (n > 0, "speed %zd: %s", speed, sp_strerror (n));
+	mu_assert_uint_eq (mp[0], 0x86);
+
+	// every msgpack chunk size decodes to the same document
+	ssize_t m = transcode_msgpack (mp, n, speed, back, sizeof back);
+	mu_fassert_msg (m > 0, "speed %zd: %s", speed, sp_strerror (m));
+	mu_assert_str_eq (back, expect);
+}
+
+static void
+test_transcode_patch (void)
+{
+	static char json[16384];
+	static uint8_t mp[16384];
+
+	// 20 elements need a 16-bit header, shifted down from the reservation
+	size_t len = 0;
+	json[len++] = '[';
+	for (int i = 0; i < 20; i++) {
+		len += snprintf (json + len, sizeof json - len, "%s%d", i ? "," : "", i);
+	}
+	json[len++] = ']';
+	mu_assert_int_eq (transcode_json (json, len, -1, mp, sizeof mp), 23);
+	mu_assert (memcmp (mp, "\xdc\x00\x14\x00\x01", 5) == 0);
+	mu_assert_uint_eq (mp[22], 19);
+
+	// small maps get a fix header
+	mu_assert_int_eq (transcode_json ("{\"a\":[1,\"x\"]}", 13, 1, mp, sizeof mp), 7);
+	mu_assert (memcmp (mp, "\x81\xa1\x61\x92\x01\xa1\x78", 7) == 0);
+
+	// bodies past the patch limit keep the reserved 32-bit header
+	len = 0;
+	json[len++] = '[';
+	for (int i = 0; i < SP_TRANSCODE_PATCH_MAX + 1; i++) {
+		json[len++] = '0';
+		json[len++] = ',';
+	}
+	json[len-1] = ']';
+	ssize_t n = transcode_json (json, len, -1, mp, sizeof mp);
+	mu_assert_int_eq (n, SP_TRANSCODE_PATCH_MAX + 6);
+	mu_assert (memcmp (mp, "\xdd\x00\x00\x10\x01", 5) == 0);
+
+	// the 32-bit header round trips
+	char *back = malloc (len + 1);
+	mu_assert_int_eq (transcode_msgpack (mp, n, 7, back, len + 1), len);
+	mu_assert (memcmp (back, json, len) == 0);
+	free (back);
+}
+
+static void
+test_transcode_msgpack (void)
+{
+	char out[256];
+
+	// scalar keys are stringified
+	static const uint8_t keys[] = {
+		0x85,
+		0x01, 0xc0,
+		0xff, 0xc3,
+		0xcb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0, 0xc2,
+		0xc3, 0xca, 0x3e, 0x80, 0, 0,
+		0xa2, 'h', 'i', 0x90,
+	};
+	for (ssize_t speed = 1; speed < 8; speed++) {
+		mu_assert_int_eq (transcode_msgpack (keys, sizeof keys, speed, out, sizeof out), 52);
+		mu_assert_str_eq (out, "{\"1\":null,\"-1\":true,\"1.5\":false,\"true\":0.25,\"hi\":[]}");
+	}
+
+	// binary becomes base64 and extensions a [type, data] pair
+	static const uint8_t bin[] = {
+		0x94,
+		0xc4, 0x03, 0x01, 0x02, 0x03,
+		0xc4, 0x01, 0xff,
+		0xd4, 0x05, 0xfb,
+		0xc7, 0x02, 0x07, 'h', 'i',
+	};
+	for (ssize_t speed = 1; speed < 8; speed++) {
+		mu_assert_int_eq (transcode_msgpack (bin, sizeof bin, speed, out, sizeof out), 37);
+		mu_assert_str_eq (out, "[\"AQID\",\"/w==\",[5,\"+w==\"],[7,\"aGk=\"]]");
+	}
+
+	// containers and binary cannot be keys
+	static const uint8_t key_arr[] = { 0x81, 0x90, 0xc0 };
+	mu_assert_int_eq (transcode_msgpack (key_arr, sizeof key_arr, -1, out, sizeof out),
+			SP_MSGPACK_EKEY);
+	static const uint8_t key_bin[] = { 0x81, 0xc4, 0x01, 0x00, 0xc0 };
+	mu_assert_int_eq (transcode_msgpack (key_bin, sizeof key_bin, 2, out, sizeof out),
+			SP_MSGPACK_EKEY);
+
+	// a truncated payload is an error at eof
+	static const uint8_t trunc[] = { 0x91, 0xa5, 'h', 'e' };
+	mu_assert_int_eq (transcode_msgpack (trunc, sizeof trunc, 1, out, sizeof out),
+			SP_MSGPACK_ESYNTAX);
+
+	// a root scalar completes on its own
+	static const uint8_t root[] = { 0xcd, 0x01, 0x00 };
+	mu_assert_int_eq (transcode_msgpack (root, sizeof root, 1, out, sizeof out), 3);
+	mu_assert_str_eq (out, "256");
+
+	// empty input needs no buffer
+	SpMsgpackToJson t;
+	sp_msgpack_to_json_init (&t);
+	mu_assert_int_eq (sp_msgpack_to_json (&t, NULL, 0, false), 0);
+	mu_assert_int_eq (sp_msgpack_to_json (&t, NULL, 0, true), SP_MSGPACK_ESYNTAX);
+	sp_msgpack_to_json_final (&t);
+}
+
+static void
+test_files (void)
+{
 	// XXX: allowing bare values
 	//mu_assert_int_eq (SP_JSON_ESYNTAX, parse_file ("fail1.json", 20));
 	mu_assert_int_eq (SP_JSON_ESYNTAX, parse_file ("fail2.json", 20));
@@ -370,6 +1562,70 @@ main (void)
 	mu_assert_int_eq (1, parse_file ("pass6.json", 20));
 	mu_assert_int_eq (1, parse_file ("pass7.json", 20));
 	mu_assert_int_eq (1, parse_file ("pass8.json", 20));
+}
+
+int
+main (void)
+{
+	mu_init ("json");
+
+	test_parse (-1);
+	test_parse (1);
+
+	test_parse (2);
+	test_parse (11);
+
+	test_integer ();
+	test_float ();
+	for (ssize_t i = 0; i < 20; i++) {
+		test_number_stream (i);
+	}
+	test_number_size ();
+	for (ssize_t i = 0; i < 20; i++) {
+		test_skip (i, false);
+		test_skip_elements (i, false);
+		test_skip_root (i, false);
+	}
+	test_skip (-1, true);
+	test_skip_elements (-1, true);
+	test_skip_root (-1, true);
+	for (ssize_t i = 0; i < 20; i++) {
+		test_lazy (i, false);
+	}
+	test_lazy (-1, true);
+	for (ssize_t i = 0; i < 20; i++) {
+		test_query (i, false, false);
+		test_query (i, false, true);
+	}
+	test_query (-1, true, false);
+	test_query (-1, true, true);
+	test_query_paths ();
+	test_query_nested ();
+	test_dom ();
+	test_format_double ();
+	test_writer ();
+	test_deep (false);
+	test_deep (true);
+	for (ssize_t i = 0; i < 20; i++) {
+		test_transcode (i);
+	}
+	test_transcode_patch ();
+	test_transcode_msgpack ();
+
+	test_files ();
+
+	// the indexed mode must agree with the streaming parser on every kernel
+	indexed = true;
+	unsigned features = sp_cpu_features ();
+	test_files ();
+	sp_cpu_restrict (features & ~SP_CPU_AVX512BW);
+	test_files ();
+	sp_cpu_restrict (0);
+	test_files ();
+	sp_cpu_restrict (features);
+	indexed = false;
+
+	test_index_stream ();
 
 	mu_assert (sp_alloc_summary ());
 }
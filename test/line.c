@@ -1,4 +1,5 @@
 #include "../include/siphon/line.h"
+#include "../include/siphon/cpu.h"
 #include "../include/siphon/alloc.h"
 #include "mu.h"
 
@@ -99,6 +100,30 @@ test_parse (ssize_t speed)
 	mu_assert_str_eq (cmp, "line 3\n");
 }
 
+static void
+test_long_lines (void)
+{
+	// exercise each block boundary of the wide scanners
+	for (size_t n = 0; n <= 200; n++) {
+		uint8_t data[256];
+		memset (data, 'x', n);
+		data[n] = '\n';
+		memset (data + n + 1, '\n', sizeof data - n - 1);
+
+		SpLine p;
+		sp_line_init (&p);
+
+		ssize_t rc = sp_line_next (&p, data, sizeof data, true);
+		mu_assert_int_eq (rc, n + 1);
+		mu_assert_int_eq (p.type, SP_LINE_VALUE);
+
+		sp_line_init (&p);
+		rc = sp_line_next (&p, data, n, false);
+		mu_assert_int_eq (rc, 0);
+		mu_assert_int_eq (p.type, SP_LINE_NONE);
+	}
+}
+
 int
 main (void)
 {
@@ -110,6 +135,13 @@ main (void)
 	test_parse (2);
 	test_parse (11);
 
+	unsigned features = sp_cpu_features ();
+	unsigned tiers[] = { 0, SP_CPU_SSE42, SP_CPU_SSE42|SP_CPU_AVX2, features };
+	for (size_t i = 0; i < sp_len (tiers); i++) {
+		sp_cpu_restrict (tiers[i]);
+		test_long_lines ();
+	}
+
 	sp_alloc_summary ();
 }
 
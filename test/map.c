@@ -1,5 +1,6 @@
 #include "../include/siphon/map.h"
 #include "../include/siphon/alloc.h"
+#include "../include/siphon/arena.h"
 #include "mu.h"
 
 /*
@@ -460,6 +461,35 @@ test_reserve (void)
 	sp_map_final (&map);
 }
 
+static void
+test_allocator (void)
+{
+	SpArena arena;
+	sp_arena_init (&arena, 0);
+
+	SpMap map;
+	sp_map_init (&map, 0, 0, &good_type);
+	TEST_ADD_NEW (&map, "a", 1);
+
+	// entries are moved into the arena
+	mu_fassert_int_eq (sp_map_use_allocator (&map, sp_arena_allocator (&arena)), 0);
+	mu_assert_uint_gt (arena.used, 0);
+	mu_assert_str_eq (sp_map_get (&map, "a", 1), "a");
+
+	static char *keys[] = {
+		"b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n"
+	};
+	for (size_t i = 0; i < sp_len (keys); i++) {
+		TEST_ADD_NEW (&map, keys[i], i + 2);
+	}
+	for (size_t i = 0; i < sp_len (keys); i++) {
+		mu_assert_str_eq (sp_map_get (&map, keys[i], 1), keys[i]);
+	}
+
+	sp_map_final (&map);
+	sp_arena_final (&arena);
+}
+
 int
 main (void)
 {
@@ -479,6 +509,7 @@ main (void)
 	test_each ();
 	test_bloom ();
 	test_reserve ();
+	test_allocator ();
 
 	mu_assert (sp_alloc_summary ());
 }
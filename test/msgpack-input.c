@@ -44,8 +44,12 @@ main (int argc, char **argv)
 	uint8_t *buf = val;
 	size_t freelen = len;
 
+	SpMsgpackExtRegistry ext;
+	sp_msgpack_ext_init (&ext);
+
 	SpMsgpack p;
 	sp_msgpack_init (&p);
+	sp_msgpack_use_ext (&p, &ext);
 
 	while (!sp_msgpack_is_done (&p)) {
 		ssize_t rc = sp_msgpack_next (&p, buf, len, true);
@@ -108,6 +112,13 @@ main (int argc, char **argv)
 			buf += p.tag.ext.len;
 			len -= p.tag.ext.len;
 			break;
+		case SP_MSGPACK_TIMESTAMP:
+			printf ("timestamp: %" PRIi64 ".%09ld\n",
+					(int64_t)p.tag.ts.tv_sec, p.tag.ts.tv_nsec);
+			break;
+		case SP_MSGPACK_EXT_VALUE:
+			printf ("ext value: type=%d\n", p.tag.ext.type);
+			break;
 		}
 	}
 	sp_free (val, freelen);
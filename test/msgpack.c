@@ -1,8 +1,12 @@
 #include "../include/siphon/msgpack.h"
 #include "../include/siphon/alloc.h"
 #include "../include/siphon/fmt.h"
+#include "../include/siphon/error.h"
+#include "../include/siphon/cpu.h"
 #include "mu.h"
 
+#include <math.h>
+
 #define count(a) (sizeof (a) / sizeof ((a)[0]))
 
 #define DEBUG 0
@@ -112,6 +116,13 @@ parse (Message *msg, const uint8_t *in, size_t inlen, ssize_t speed)
 			case SP_MSGPACK_EXT:
 				printf ("<ext: type=%d, length=%u>", p.tag.ext.type, p.tag.ext.len);
 				break;
+			case SP_MSGPACK_TIMESTAMP:
+				printf ("<timestamp: %" PRIi64 ".%09ld>",
+						(int64_t)p.tag.ts.tv_sec, p.tag.ts.tv_nsec);
+				break;
+			case SP_MSGPACK_EXT_VALUE:
+				printf ("<ext value: type=%d>", p.tag.ext.type);
+				break;
 			}
 			if (p.type > SP_MSGPACK_ARRAY) {
 				if (sp_msgpack_is_key (&p)) {
@@ -145,6 +156,8 @@ parse (Message *msg, const uint8_t *in, size_t inlen, ssize_t speed)
 		case SP_MSGPACK_MAP:
 		case SP_MSGPACK_MAP_END:
 		case SP_MSGPACK_EXT:
+		case SP_MSGPACK_TIMESTAMP:
+		case SP_MSGPACK_EXT_VALUE:
 			msg->fields[msg->field_count].tag = p.tag;
 			msg->fields[msg->field_count].type = p.type;
 			msg->field_count++;
@@ -689,6 +702,429 @@ test_decode (ssize_t speed)
 	test_decode_map_key_end (speed);
 }
 
+static ssize_t
+parse_deep (SpMsgpack *p, const uint8_t *in, size_t len, unsigned depth)
+{
+	size_t off = 0;
+	unsigned opened = 0, closed = 0;
+
+	while (!sp_msgpack_is_done (p)) {
+		ssize_t rc = sp_msgpack_next (p, in + off, len - off, true);
+		if (rc < 0) {
+			return rc;
+		}
+		off += rc;
+		switch (p->type) {
+		case SP_MSGPACK_MAP:
+		case SP_MSGPACK_ARRAY:
+			// even levels are maps and odd levels are arrays
+			mu_fassert_int_eq (p->type, (opened % 2 ? SP_MSGPACK_ARRAY : SP_MSGPACK_MAP));
+			opened++;
+			break;
+		case SP_MSGPACK_MAP_END:
+		case SP_MSGPACK_ARRAY_END:
+			closed++;
+			mu_fassert_int_eq (p->type,
+					((depth - closed) % 2 ? SP_MSGPACK_ARRAY_END : SP_MSGPACK_MAP_END));
+			break;
+		case SP_MSGPACK_STRING:
+			off += p->tag.count;
+			break;
+		default:
+			break;
+		}
+	}
+	mu_assert_uint_eq (opened, depth);
+	mu_assert_uint_eq (closed, depth);
+	return off;
+}
+
+static void
+test_decode_deep (void)
+{
+	// {"k"=>[{"k"=>[... 1 ...]}]}
+	enum { DEPTH = 3000 };
+	static uint8_t input[DEPTH * 3 + 1];
+	size_t len = 0;
+	for (unsigned i = 0; i < DEPTH; i++) {
+		if (i % 2) {
+			input[len++] = 0x91;
+		}
+		else {
+			input[len++] = 0x81;
+			input[len++] = 0xa1;
+			input[len++] = 'k';
+		}
+	}
+	input[len++] = 0x01;
+
+	SpMsgpack p;
+	sp_msgpack_init (&p);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH), SP_MSGPACK_ESTACK);
+
+	// the arena grows the stack as needed and is released on reset
+	SpArena arena;
+	sp_arena_init (&arena, 0);
+	sp_msgpack_init (&p);
+	sp_msgpack_use_stack_arena (&p, &arena);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH), len);
+	sp_msgpack_reset (&p);
+	mu_assert (p.deep == NULL);
+	sp_arena_reset (&arena);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH), len);
+	sp_msgpack_final (&p);
+	sp_arena_final (&arena);
+
+	// a caller supplied stack sets an exact limit and survives a reset
+	static uint32_t stack[(SP_MSGPACK_STACK_SIZE (DEPTH) + 3) / 4];
+	sp_msgpack_init (&p);
+	sp_msgpack_use_stack (&p, stack, SP_MSGPACK_STACK_SIZE (DEPTH));
+	mu_assert_uint_eq (p.deep_max, DEPTH);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH), len);
+	sp_msgpack_reset (&p);
+	mu_assert (p.deep_counts == stack);
+	sp_msgpack_use_stack (&p, stack, SP_MSGPACK_STACK_SIZE (DEPTH - 1));
+	mu_assert_uint_eq (p.deep_max, DEPTH - 1);
+	mu_assert_int_eq (parse_deep (&p, input, len, DEPTH), SP_MSGPACK_ESTACK);
+	sp_msgpack_final (&p);
+}
+
+static void
+test_skip (ssize_t speed)
+{
+	// {"a"=>[1, 2, {"x"=>bin(300)}], "b"=>"str", "c"=>ext(7, "abcd"), "d"=>5}
+	static uint8_t input[400];
+	size_t len = 0;
+	memcpy (input + len, "\x84\xa1" "a" "\x93\x01\x02\x81\xa1" "x" "\xc5\x01\x2c", 12);
+	len += 12;
+	for (int i = 0; i < 300; i++) {
+		input[len++] = 0xc0;
+	}
+	memcpy (input + len, "\xa1" "b" "\xa3" "str" "\xa1" "c" "\xd6\x07" "abcd" "\xa1" "d" "\x05", 17);
+	len += 17;
+
+	static const struct {
+		bool skip;
+		SpMsgpackType type;
+	} ops[] = {
+		{ false, SP_MSGPACK_MAP },
+		{ false, SP_MSGPACK_STRING },
+		{ true,  SP_MSGPACK_ARRAY },
+		{ false, SP_MSGPACK_STRING },
+		{ true,  SP_MSGPACK_STRING },
+		{ true,  SP_MSGPACK_STRING },
+		{ true,  SP_MSGPACK_EXT },
+		{ false, SP_MSGPACK_STRING },
+		{ false, SP_MSGPACK_UNSIGNED },
+		{ false, SP_MSGPACK_MAP_END },
+	};
+
+	SpMsgpack p;
+	sp_msgpack_init (&p);
+
+	size_t off = 0, avail = 0, op = 0;
+	if (speed < 1) {
+		speed = len;
+	}
+
+	while (!sp_msgpack_is_done (&p)) {
+		mu_fassert_uint_lt (op, count (ops));
+		if (avail == 0 || off + avail < len) {
+			avail += speed;
+			if (off + avail > len) {
+				avail = len - off;
+			}
+		}
+		bool eof = off + avail == len;
+		ssize_t rc = ops[op].skip ?
+			sp_msgpack_skip (&p, input + off, avail, eof) :
+			sp_msgpack_next (&p, input + off, avail, eof);
+		mu_fassert_msg (rc >= 0, "op %zu (%zd): %s", op, speed, sp_strerror (rc));
+		off += rc;
+		avail -= rc;
+		if (p.type == SP_MSGPACK_NONE) {
+			continue;
+		}
+		mu_assert_int_eq (p.type, ops[op].type);
+		// string keys carry their payload which next leaves to the caller
+		if (!ops[op].skip && p.type == SP_MSGPACK_STRING) {
+			while (avail < p.tag.count) {
+				avail += speed;
+			}
+			off += p.tag.count;
+			avail -= p.tag.count;
+		}
+		op++;
+	}
+	mu_assert_uint_eq (op, count (ops));
+	mu_assert_uint_eq (off, len);
+
+	// skipping the root value completes the document
+	sp_msgpack_reset (&p);
+	mu_assert_int_eq (sp_msgpack_skip (&p, input, len, true), len);
+	mu_assert_int_eq (p.type, SP_MSGPACK_MAP);
+	mu_assert_uint_eq (p.tag.count, 4);
+	mu_assert (sp_msgpack_is_done (&p));
+
+	// nothing follows the last entry of a container
+	sp_msgpack_reset (&p);
+	mu_assert_int_eq (sp_msgpack_next (&p, "\x91\x01", 2, true), 1);
+	mu_assert_int_eq (sp_msgpack_skip (&p, "\x01", 1, true), 1);
+	mu_assert_int_eq (sp_msgpack_skip (&p, "", 0, true), SP_MSGPACK_ESTATE);
+
+	// truncated payloads are reported at eof
+	sp_msgpack_reset (&p);
+	mu_assert_int_eq (sp_msgpack_skip (&p, "\xa3" "ab", 3, true), SP_MSGPACK_ESYNTAX);
+}
+
+static void
+test_index (void)
+{
+	// {"id"=>7, "name"=>"siphon", 1=>nil, "list"=>[1, [2, 3], {"k"=>"v"}], "id"=>8}
+	static const uint8_t input[] =
+		"\x85"
+		"\xa2" "id" "\x07"
+		"\xa4" "name" "\xa6" "siphon"
+		"\x01" "\xc0"
+		"\xa4" "list" "\x93\x01\x92\x02\x03\x81\xa1" "k" "\xa1" "v"
+		"\xa2" "id" "\x08";
+
+	SpMsgpackIndex idx;
+	sp_msgpack_index_init (&idx);
+	mu_assert_int_eq (sp_msgpack_index_parse (&idx, input, sizeof input - 1), 0);
+	mu_assert_int_eq (idx.type, SP_MSGPACK_MAP);
+	mu_assert_uint_eq (idx.count, 5);
+
+	SpRange32 r;
+	mu_assert (sp_msgpack_index_get (&idx, "name", 4, &r));
+	mu_assert_uint_eq (r.len, 7);
+	mu_assert (memcmp (input + r.off, "\xa6" "siphon", 7) == 0);
+
+	// duplicate keys resolve to the first entry
+	mu_assert (sp_msgpack_index_get (&idx, "id", 2, &r));
+	mu_assert_uint_eq (r.len, 1);
+	mu_assert_uint_eq (input[r.off], 7);
+
+	mu_assert (sp_msgpack_index_get (&idx, "list", 4, &r));
+	mu_assert_uint_eq (r.len, 10);
+	mu_assert (!sp_msgpack_index_get (&idx, "nope", 4, &r));
+	mu_assert (!sp_msgpack_index_get (&idx, "", 0, &r));
+
+	// a nested value can be indexed in turn from its range
+	SpMsgpackIndex sub;
+	sp_msgpack_index_init (&sub);
+	mu_assert_int_eq (sp_msgpack_index_parse (&sub, input + r.off, r.len), 0);
+	mu_assert_int_eq (sub.type, SP_MSGPACK_ARRAY);
+	mu_assert_uint_eq (sub.count, 3);
+	mu_assert (sp_msgpack_index_at (&sub, 1, &r));
+	mu_assert_uint_eq (r.len, 3);
+	mu_assert (sp_msgpack_index_at (&sub, 2, &r));
+	mu_assert_uint_eq (r.len, 5);
+	mu_assert (!sp_msgpack_index_at (&sub, 3, &r));
+	mu_assert (!sp_msgpack_index_get (&sub, "k", 1, &r));
+
+	// entries are also reachable by position
+	mu_assert (sp_msgpack_index_at (&idx, 2, &r));
+	mu_assert_uint_eq (r.len, 1);
+	mu_assert_uint_eq (input[r.off], 0xc0);
+	mu_assert (sp_msgpack_index_at (&idx, 4, &r));
+	mu_assert_uint_eq (input[r.off], 8);
+
+	// a large map is reused and looked up through the table
+	static uint8_t big[4 + 2000 * 8];
+	size_t len = 0;
+	big[len++] = 0xde;
+	big[len++] = 2000 >> 8;
+	big[len++] = 2000 & 0xff;
+	for (int i = 0; i < 2000; i++) {
+		len += sprintf ((char *)big + len, "\xa4%04d", i);
+		big[len++] = 0xcd;
+		big[len++] = i >> 8;
+		big[len++] = i & 0xff;
+	}
+	mu_assert_int_eq (sp_msgpack_index_parse (&idx, big, len), 0);
+	mu_assert_uint_eq (idx.count, 2000);
+	for (int i = 0; i < 2000; i++) {
+		char key[8];
+		snprintf (key, sizeof key, "%04d", i);
+		mu_fassert (sp_msgpack_index_get (&idx, key, 4, &r));
+		mu_fassert_uint_eq (r.len, 3);
+		mu_fassert_uint_eq ((unsigned)big[r.off+1] << 8 | big[r.off+2], i);
+	}
+
+	// counts that cannot fit in the input are rejected before allocating
+	mu_assert_int_eq (sp_msgpack_index_parse (&sub, "\xdd\xff\xff\xff\xff\x01", 6),
+			SP_MSGPACK_ESYNTAX);
+	mu_assert_int_eq (sp_msgpack_index_parse (&sub, "\x92\x01", 2), SP_MSGPACK_ESYNTAX);
+
+	sp_msgpack_index_final (&sub);
+	sp_msgpack_index_final (&idx);
+}
+
+static void
+check_int_array (const uint8_t *buf, size_t len, const int64_t *vals, size_t n, uint8_t tag)
+{
+	SpMsgpack p;
+	sp_msgpack_init (&p);
+	size_t off = 0;
+
+	ssize_t rc = sp_msgpack_next (&p, buf, len, true);
+	mu_fassert_int_gt (rc, 0);
+	mu_fassert_int_eq (p.type, SP_MSGPACK_ARRAY);
+	mu_fassert_uint_eq (p.tag.count, n);
+	off += rc;
+	for (size_t i = 0; i < n; i++) {
+		if (tag) {
+			mu_fassert_uint_eq (buf[off], tag);
+		}
+		rc = sp_msgpack_next (&p, buf + off, len - off, true);
+		mu_fassert_int_gt (rc, 0);
+		off += rc;
+		if (p.type == SP_MSGPACK_SIGNED) {
+			mu_fassert_int_eq (p.tag.i64, vals[i]);
+		}
+		else {
+			mu_fassert_int_eq (p.type, SP_MSGPACK_UNSIGNED);
+			mu_fassert_uint_eq (p.tag.u64, (uint64_t)vals[i]);
+		}
+	}
+	mu_assert_uint_eq (off, len);
+}
+
+static void
+test_writer (void)
+{
+	SpMsgpackWriter w;
+	sp_msgpack_writer_init (&w);
+
+	mu_assert_int_eq (sp_msgpack_write_map (&w, 2), 1);
+	mu_assert_int_eq (sp_msgpack_write_string (&w, "a", 1), 2);
+	mu_assert_int_eq (sp_msgpack_write_array (&w, 20), 3);
+	mu_assert_int_eq (sp_msgpack_write_string (&w, "b", 1), 2);
+	mu_assert_int_eq (sp_msgpack_write_binary (&w, "\x00\x01", 2), 4);
+	mu_assert_int_eq (sp_msgpack_write_nil (&w), 1);
+	mu_assert_int_eq (sp_msgpack_write_bool (&w, true), 1);
+	mu_assert_int_eq (sp_msgpack_write_int (&w, -200), 3);
+	mu_assert_int_eq (sp_msgpack_write_uint (&w, 70000), 5);
+	mu_assert_int_eq (sp_msgpack_write_float (&w, 1.5f), 5);
+	mu_assert_int_eq (sp_msgpack_write_double (&w, 0.1), 9);
+	mu_assert_uint_eq (w.out.len, 36);
+	mu_assert (memcmp (w.out.buf,
+			"\x82\xa1" "a" "\xdc\x00\x14\xa1" "b" "\xc4\x02\x00\x01\xc0\xc3"
+			"\xd1\xff\x38\xce\x00\x01\x11\x70\xca\x3f\xc0\x00\x00", 27) == 0);
+	sp_msgpack_writer_final (&w);
+
+	// a full fixed buffer reports the error without writing
+	uint8_t fixed[8];
+	sp_msgpack_writer_init_fixed (&w, fixed, sizeof fixed);
+	mu_assert_int_eq (sp_msgpack_write_string (&w, "abc", 3), 4);
+	mu_assert_int_eq (sp_msgpack_write_string (&w, "abcd", 4), SP_UTF8_EBUFS);
+	mu_assert_int_eq (sp_msgpack_write_double (&w, 1.0), SP_UTF8_EBUFS);
+	mu_assert_int_eq (sp_msgpack_write_int (&w, 1), 1);
+	mu_assert_uint_eq (w.out.len, 5);
+	sp_msgpack_writer_final (&w);
+}
+
+static void
+test_writer_arrays (void)
+{
+	static const struct {
+		int64_t min, max;
+		uint8_t tag;
+		unsigned width;
+	} ranges[] = {
+		{ -31, 127, 0, 0 },
+		{ 0, 255, 0xcc, 1 },
+		{ 0, 65535, 0xcd, 2 },
+		{ 0, UINT32_MAX, 0xce, 4 },
+		{ 0, INT64_MAX, 0xcf, 8 },
+		{ -128, 127, 0xd0, 1 },
+		{ -32768, 32767, 0xd1, 2 },
+		{ INT32_MIN, INT32_MAX, 0xd2, 4 },
+		{ INT64_MIN, INT64_MAX, 0xd3, 8 },
+	};
+
+	static int64_t vals[1003];
+	static uint32_t vals32[1003];
+	unsigned features = sp_cpu_features ();
+	SpMsgpackWriter w, base;
+	sp_msgpack_writer_init (&w);
+	sp_msgpack_writer_init (&base);
+
+	for (size_t r = 0; r < count (ranges); r++) {
+		for (size_t n = 0; n < count (vals); n += n < 40 ? 1 : 321) {
+			uint64_t span = (uint64_t)ranges[r].max - (uint64_t)ranges[r].min;
+			for (size_t i = 0; i < n; i++) {
+				uint64_t x = ((uint64_t)rand () << 33) ^ ((uint64_t)rand () << 11) ^ rand ();
+				vals[i] = (int64_t)((uint64_t)ranges[r].min + (span == UINT64_MAX ? x : x % (span + 1)));
+			}
+			// pin the extremes so the encoding is fixed
+			if (n >= 2) {
+				vals[0] = ranges[r].min;
+				vals[n-1] = ranges[r].max;
+			}
+
+			sp_msgpack_writer_reset (&w);
+			sp_msgpack_writer_reset (&base);
+			sp_cpu_restrict (features);
+			ssize_t rc = sp_msgpack_write_int_array (&w, vals, n);
+			sp_cpu_restrict (0);
+			mu_fassert_int_eq (sp_msgpack_write_int_array (&base, vals, n), rc);
+			sp_cpu_restrict (features);
+
+			if (n >= 2) {
+				size_t hdr = n <= 15 ? 1 : 3;
+				mu_fassert_uint_eq (rc, hdr + n * (1 + ranges[r].width));
+			}
+			mu_fassert (memcmp (w.out.buf, base.out.buf, rc) == 0);
+			check_int_array (w.out.buf, rc, vals, n, n >= 2 ? ranges[r].tag : 0);
+
+			// unsigned 32-bit inputs take the same encodings
+			if (ranges[r].min == 0 && ranges[r].max <= UINT32_MAX) {
+				for (size_t i = 0; i < n; i++) {
+					vals32[i] = (uint32_t)vals[i];
+				}
+				sp_msgpack_writer_reset (&base);
+				mu_fassert_int_eq (sp_msgpack_write_uint32_array (&base, vals32, n), rc);
+				mu_fassert (memcmp (w.out.buf, base.out.buf, rc) == 0);
+			}
+		}
+	}
+
+	// doubles narrow to floats only when every value is exact
+	double dvals[] = { 0.5, -0.0, 1099511627776.0, 3.0, INFINITY };
+	sp_msgpack_writer_reset (&w);
+	mu_assert_int_eq (sp_msgpack_write_double_array (&w, dvals, 5), 26);
+	mu_assert (memcmp (w.out.buf, "\x95\xca\x3f\x00\x00\x00\xca\x80\x00\x00\x00", 11) == 0);
+	dvals[3] = 0.1;
+	sp_msgpack_writer_reset (&w);
+	mu_assert_int_eq (sp_msgpack_write_double_array (&w, dvals, 5), 46);
+
+	SpMsgpack p;
+	sp_msgpack_init (&p);
+	size_t off = sp_msgpack_next (&p, w.out.buf, w.out.len, true);
+	for (size_t i = 0; i < 5; i++) {
+		off += sp_msgpack_next (&p, w.out.buf + off, w.out.len - off, true);
+		mu_assert_int_eq (p.type, SP_MSGPACK_DOUBLE);
+		mu_assert (memcmp (&p.tag.f64, &dvals[i], sizeof (double)) == 0);
+	}
+
+	// a fixed buffer just large enough still takes the vector path
+	uint8_t fixed[3 + 20*5];
+	for (size_t i = 0; i < 20; i++) {
+		vals[i] = 100000 + i;
+	}
+	SpMsgpackWriter f;
+	sp_msgpack_writer_init_fixed (&f, fixed, sizeof fixed + 1);
+	mu_assert_int_eq (sp_msgpack_write_int_array (&f, vals, 20), sizeof fixed);
+	check_int_array (fixed, sizeof fixed, vals, 20, 0xce);
+	sp_msgpack_writer_init_fixed (&f, fixed, sizeof fixed);
+	mu_assert_int_eq (sp_msgpack_write_int_array (&f, vals, 20), SP_UTF8_EBUFS);
+
+	sp_msgpack_writer_final (&w);
+	sp_msgpack_writer_final (&base);
+}
+
 static void
 test_encode_nil (void)
 {
@@ -1004,7 +1440,7 @@ test_encode_ext ()
 
 	m = buf;
 	for (size_t i = 0; i < count (lengths); i++) {
-		rc = sp_msgpack_enc_ext (m, (int8_t)i, lengths[i]);
+		rc = sp_msgpack_enc_ext (m, (int8_t)i - 5, lengths[i]);
 		mu_fassert_int_ge (rc, 2);
 		m += rc;
 		memset (m, 0xff, lengths[i]);
@@ -1019,7 +1455,7 @@ test_encode_ext ()
 		rc = sp_msgpack_next (&p, m, sizeof buf - (m - buf), true);
 		mu_fassert_int_ge (rc, 2);
 		mu_assert_int_eq (p.type, SP_MSGPACK_EXT);
-		mu_assert_int_eq (p.tag.ext.type, (int8_t)i);
+		mu_assert_int_eq (p.tag.ext.type, (int8_t)i - 5);
 		mu_assert_int_eq (p.tag.ext.len, lengths[i]);
 		m += rc + p.tag.ext.len;
 		if (m > buf + sizeof buf) {
@@ -1029,6 +1465,151 @@ test_encode_ext ()
 	}
 }
 
+static int
+decode_sum (SpMsgpackTag *tag, const void *body, uint32_t len, void *data)
+{
+	(void)data;
+	const uint8_t *m = body;
+	tag->u64 = 0;
+	for (uint32_t i = 0; i < len; i++) {
+		tag->u64 += m[i];
+	}
+	return SP_MSGPACK_UNSIGNED;
+}
+
+static int
+decode_copy (SpMsgpackTag *tag, const void *body, uint32_t len, void *data)
+{
+	if (len != 3) {
+		return SP_MSGPACK_ESYNTAX;
+	}
+	(void)tag;
+	memcpy (data, body, len);
+	return SP_MSGPACK_EXT_VALUE;
+}
+
+static void
+test_timestamp (void)
+{
+	static const struct {
+		SpClock ts;
+		size_t len;
+	} values[] = {
+		{ { 0, 0 }, 6 },
+		{ { UINT32_MAX, 0 }, 6 },
+		{ { 1, 1 }, 10 },
+		{ { 0x3ffffffffLL, 999999999 }, 10 },
+		{ { 0x400000000LL, 0 }, 15 },
+		{ { -1, 500 }, 15 },
+		{ { INT64_MIN, 999999999 }, 15 },
+	};
+
+	SpMsgpackExtRegistry ext;
+	sp_msgpack_ext_init (&ext);
+
+	for (size_t i = 0; i < count (values); i++) {
+		uint8_t buf[SP_MSGPACK_TIMESTAMP_MAX];
+		size_t len = sp_msgpack_enc_timestamp (buf, &values[i].ts);
+		mu_assert_uint_eq (len, values[i].len);
+
+		SpClock ts;
+		mu_assert_int_eq (sp_msgpack_dec_timestamp (buf, 5, &ts), SP_MSGPACK_ESYNTAX);
+
+		SpMsgpack p;
+		sp_msgpack_init (&p);
+		ssize_t rc = sp_msgpack_next (&p, buf, len, true);
+		mu_assert_int_eq (p.type, SP_MSGPACK_EXT);
+		mu_assert_int_eq (p.tag.ext.type, SP_MSGPACK_EXT_TIMESTAMP);
+		mu_assert_int_eq (rc + p.tag.ext.len, len);
+		mu_assert_int_eq (sp_msgpack_dec_timestamp (buf + rc, p.tag.ext.len, &ts), 0);
+		mu_assert_int_eq (ts.tv_sec, values[i].ts.tv_sec);
+		mu_assert_int_eq (ts.tv_nsec, values[i].ts.tv_nsec);
+
+		// with a registry the body is decoded in place, waiting for all of it
+		sp_msgpack_init (&p);
+		sp_msgpack_use_ext (&p, &ext);
+		for (size_t n = 0; n < len; n++) {
+			mu_assert_int_eq (sp_msgpack_next (&p, buf, n, false), 0);
+		}
+		mu_assert_int_eq (sp_msgpack_next (&p, buf, len, false), len);
+		mu_assert_int_eq (p.type, SP_MSGPACK_TIMESTAMP);
+		mu_assert_int_eq (p.tag.ts.tv_sec, values[i].ts.tv_sec);
+		mu_assert_int_eq (p.tag.ts.tv_nsec, values[i].ts.tv_nsec);
+
+		sp_msgpack_reset (&p);
+		mu_assert_int_eq (sp_msgpack_next (&p, buf, len - 1, true), SP_MSGPACK_ESYNTAX);
+	}
+
+	// nanoseconds beyond a second are rejected
+	uint8_t bad[] = { 0xd7, 0xff, 0xee, 0x6b, 0x28, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	SpMsgpack p;
+	sp_msgpack_init (&p);
+	sp_msgpack_use_ext (&p, &ext);
+	mu_assert_int_eq (sp_msgpack_next (&p, bad, sizeof bad, true), SP_MSGPACK_ESYNTAX);
+
+	// user decoders within a container
+	uint8_t copy[3] = { 0 };
+	sp_msgpack_ext_register (&ext, 5, decode_sum, NULL);
+	sp_msgpack_ext_register (&ext, -5, decode_copy, copy);
+
+	SpMsgpackWriter w;
+	sp_msgpack_writer_init (&w);
+	SpClock now = { 1500000000, 123456789 };
+	mu_assert_int_eq (sp_msgpack_write_array (&w, 4), 1);
+	mu_assert_int_eq (sp_msgpack_write_ext (&w, 5, "\x01\x02\x03\x04\x05", 5), 8);
+	mu_assert_int_eq (sp_msgpack_write_ext (&w, -5, "abc", 3), 6);
+	mu_assert_int_eq (sp_msgpack_write_timestamp (&w, &now), 10);
+	mu_assert_int_eq (sp_msgpack_write_ext (&w, 6, "xy", 2), 4);
+
+	static const SpMsgpackType types[] = {
+		SP_MSGPACK_ARRAY,
+		SP_MSGPACK_UNSIGNED,
+		SP_MSGPACK_EXT_VALUE,
+		SP_MSGPACK_TIMESTAMP,
+		SP_MSGPACK_EXT,
+		SP_MSGPACK_ARRAY_END,
+	};
+
+	sp_msgpack_init (&p);
+	sp_msgpack_use_ext (&p, &ext);
+	size_t off = 0;
+	for (size_t i = 0; i < count (types); i++) {
+		ssize_t rc = sp_msgpack_next (&p, w.out.buf + off, w.out.len - off, true);
+		mu_fassert_int_ge (rc, 0);
+		mu_fassert_int_eq (p.type, types[i]);
+		off += rc;
+		switch (p.type) {
+		case SP_MSGPACK_UNSIGNED:
+			mu_assert_uint_eq (p.tag.u64, 15);
+			break;
+		case SP_MSGPACK_EXT_VALUE:
+			mu_assert_int_eq (p.tag.ext.type, -5);
+			mu_assert (memcmp (copy, "abc", 3) == 0);
+			break;
+		case SP_MSGPACK_TIMESTAMP:
+			mu_assert_int_eq (p.tag.ts.tv_sec, now.tv_sec);
+			mu_assert_int_eq (p.tag.ts.tv_nsec, now.tv_nsec);
+			break;
+		case SP_MSGPACK_EXT:
+			off += p.tag.ext.len;
+			break;
+		default:
+			break;
+		}
+	}
+	mu_assert_uint_eq (off, w.out.len);
+	mu_assert (sp_msgpack_is_done (&p));
+
+	// decoder errors stop the parser
+	sp_msgpack_writer_reset (&w);
+	sp_msgpack_write_ext (&w, -5, "abcd", 4);
+	sp_msgpack_init (&p);
+	sp_msgpack_use_ext (&p, &ext);
+	mu_assert_int_eq (sp_msgpack_next (&p, w.out.buf, w.out.len, true), SP_MSGPACK_ESYNTAX);
+
+	sp_msgpack_writer_final (&w);
+}
+
 int
 main (void)
 {
@@ -1038,6 +1619,11 @@ main (void)
 	test_decode (1);
 	test_decode (2);
 	test_decode (11);
+	test_decode_deep ();
+	for (ssize_t i = 0; i < 20; i++) {
+		test_skip (i);
+	}
+	test_index ();
 
 	test_encode_nil ();
 	test_encode_true ();
@@ -1052,6 +1638,10 @@ main (void)
 	test_encode_map ();
 	test_encode_ext ();
 
+	test_writer ();
+	test_timestamp ();
+	test_writer_arrays ();
+
 	mu_assert (sp_alloc_summary ());
 }
 
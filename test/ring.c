@@ -1,8 +1,11 @@
 #include "../include/siphon/ring.h"
 #include "../include/siphon/alloc.h"
 #include "../include/siphon/vec.h"
+#include "../include/siphon/arena.h"
 #include "mu.h"
 
+#include <errno.h>
+
 #define FIND(r, s) sp_ring_find ((r), (s), sizeof (s) - 1)
 #define RESERVE(r, s) sp_ring_reserve ((r), FIND (r, s))
 
@@ -248,6 +251,32 @@ test_exhausted (void)
 	sp_ring_final (&ring);
 }
 
+static void
+test_allocator (void)
+{
+	SpArena arena;
+	sp_arena_init (&arena, 0);
+
+	SpRing ring;
+	sp_ring_init (&ring, sp_siphash);
+	mu_fassert_int_eq (sp_ring_use_allocator (&ring, sp_arena_allocator (&arena)), 0);
+
+	sp_ring_put (&ring, "test1", 5, 3, 2);
+	sp_ring_put (&ring, "test2", 5, 3, 2);
+	sp_ring_put (&ring, "test3", 5, 3, 2);
+	mu_assert_uint_gt (arena.used, 0);
+
+	const SpRingReplica *r = FIND (&ring, "/some/path");
+	mu_fassert_ptr_ne (r, NULL);
+	mu_assert_str_eq (r->node->key, "test2");
+
+	mu_assert (sp_ring_del (&ring, "test2", 5));
+	mu_assert_int_eq (sp_ring_use_allocator (&ring, NULL), -EBUSY);
+
+	sp_ring_final (&ring);
+	sp_arena_final (&arena);
+}
+
 int
 main (void)
 {
@@ -260,6 +289,7 @@ main (void)
 	test_del ();
 	test_del_add ();
 	test_empty ();
+	test_allocator ();
 	test_exhausted ();
 
 	mu_assert (sp_alloc_summary ());
@@ -1,7 +1,10 @@
 #include "../include/siphon/trie.h"
 #include "../include/siphon/alloc.h"
+#include "../include/siphon/arena.h"
 #include "mu.h"
 
+#include <errno.h>
+
 static const SpType type = {
 	.print = sp_print_str
 };
@@ -665,6 +668,36 @@ test_match (void)
 }
 
 
+static void
+test_allocator (void)
+{
+	SpArena arena;
+	sp_arena_init (&arena, 0);
+
+	SpTrie trie = SP_TRIE_MAKE (&type);
+	mu_fassert_int_eq (sp_trie_use_allocator (&trie, sp_arena_allocator (&arena)), 0);
+
+	sp_trie_put (&trie, "abc", 3, "first");
+	sp_trie_put (&trie, "abcd", 4, "second");
+	sp_trie_put (&trie, "abcd1", 5, "third");
+	sp_trie_put (&trie, "b", 1, "fourth");
+	mu_assert_uint_gt (arena.used, 0);
+
+	// the allocator cannot change once nodes exist
+	mu_assert_int_eq (sp_trie_use_allocator (&trie, NULL), -EBUSY);
+
+	mu_assert_str_eq (sp_trie_get (&trie, "abc", 3), "first");
+	mu_assert_str_eq (sp_trie_get (&trie, "abcd", 4), "second");
+	mu_assert_str_eq (sp_trie_get (&trie, "abcd1", 5), "third");
+	mu_assert_str_eq (sp_trie_get (&trie, "b", 1), "fourth");
+	mu_assert (sp_trie_del (&trie, "abcd1", 5));
+	mu_assert_ptr_eq (sp_trie_get (&trie, "abcd1", 5), NULL);
+	mu_assert_str_eq (sp_trie_get (&trie, "abcd", 4), "second");
+
+	sp_trie_final (&trie);
+	sp_arena_final (&arena);
+}
+
 int
 main (void)
 {
@@ -692,6 +725,7 @@ main (void)
 	test_each_prefix_leaf ();
 	test_prefix ();
 	test_match ();
+	test_allocator ();
 
 	mu_assert (sp_alloc_summary ());
 }
@@ -1,5 +1,6 @@
 #include "../include/siphon/utf8.h"
 #include "../include/siphon/alloc.h"
+#include "../include/siphon/arena.h"
 #include "../include/siphon/error.h"
 #include "mu.h"
 
@@ -348,6 +349,28 @@ test_uri_encode_ascii_comp (void)
 	sp_utf8_final (&u);
 }
 
+static void
+test_allocator (void)
+{
+	SpArena arena;
+	sp_arena_init (&arena, 0);
+
+	SpUtf8 u = SP_UTF8_MAKE ();
+	sp_utf8_add_raw (&u, "test", 4);
+	mu_fassert_int_eq (sp_utf8_use_allocator (&u, sp_arena_allocator (&arena)), 0);
+	mu_assert_str_eq (u.buf, "test");
+	mu_assert_uint_gt (arena.used, 0);
+
+	for (int i = 0; i < 100; i++) {
+		sp_utf8_add_raw (&u, "0123456789", 10);
+	}
+	mu_assert_uint_eq (u.len, 1004);
+
+	sp_utf8_final (&u);
+	mu_assert_ptr_eq (u.alloc, sp_arena_allocator (&arena));
+	sp_arena_final (&arena);
+}
+
 int
 main (void)
 {
@@ -384,6 +407,7 @@ main (void)
 	test_uri_encode_ascii ();
 	test_uri_encode_ascii_space_plus ();
 	test_uri_encode_ascii_comp ();
+	test_allocator ();
 
 	mu_assert (sp_alloc_summary ());
 }
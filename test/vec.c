@@ -1,5 +1,6 @@
 #include "../include/siphon/vec.h"
 #include "../include/siphon/alloc.h"
+#include "../include/siphon/arena.h"
 #include "mu.h"
 
 #include <errno.h>
@@ -409,6 +410,35 @@ test_search (void)
 	sp_vec_free (vec);
 }
 
+static void
+test_allocator (void)
+{
+	SpArena arena;
+	sp_arena_init (&arena, 0);
+
+	int *vec = NULL;
+	for (int i = 0; i < 10; i++) {
+		sp_vec_push (vec, i);
+	}
+
+	// existing values are moved into the arena
+	mu_fassert_int_eq (sp_vec_use_allocator (vec, sp_arena_allocator (&arena)), 0);
+	mu_assert_uint_eq (sp_vec_count (vec), 10);
+	mu_assert_uint_gt (arena.used, 0);
+
+	for (int i = 10; i < 1000; i++) {
+		sp_vec_push (vec, i);
+	}
+	mu_assert_uint_eq (sp_vec_count (vec), 1000);
+	for (int i = 0; i < 1000; i++) {
+		mu_assert_int_eq (vec[i], i);
+	}
+
+	sp_vec_free (vec);
+	mu_assert_ptr_eq (vec, NULL);
+	sp_arena_final (&arena);
+}
+
 int
 main (void)
 {
@@ -431,6 +461,7 @@ main (void)
 	test_reverse ();
 	test_bsearch ();
 	test_search ();
+	test_allocator ();
 
 	mu_assert (sp_alloc_summary ());
 }